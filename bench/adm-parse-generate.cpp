@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "register.h"
+#include "XMLADMData.h"
+#include "RIFFChunk_Definitions.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct
+{
+  uint_t      objects;
+  uint_t      tracks;             // tracks (channels) per object
+  uint_t      blocks;             // audioBlockFormats per channel
+  uint_t      blockms;            // duration of each audioBlockFormat
+  uint_t      repeats;
+  std::string standarddefinitions;
+  const char  *xmlfile;           // file to save generated XML to (NULL for none)
+  const char  *results;           // JSON lines results file (NULL for none)
+} OPTIONS;
+
+static FILE *resultsfp = NULL;
+
+static double ElapsedMS(const Clock::time_point& t0, const Clock::time_point& t1)
+{
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count() * 1.0e-6;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return peak resident memory of the process in MB (0 if not available)
+ */
+/*--------------------------------------------------------------------------------*/
+static double GetPeakMemoryMB()
+{
+#ifndef _WIN32
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#ifdef __APPLE__
+    return (double)usage.ru_maxrss / (1024.0 * 1024.0);     // bytes
+#else
+    return (double)usage.ru_maxrss / 1024.0;                // KB
+#endif
+  }
+#endif
+
+  return 0.0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Print result and append it to the results file as a single line of JSON
+ */
+/*--------------------------------------------------------------------------------*/
+static void Result(const OPTIONS& opts, const char *test, const char *metric, double value, const char *unit)
+{
+  printf("  %-20s %-8s %12.3f %s\n", test, metric, value, unit);
+
+  if (resultsfp)
+  {
+    fprintf(resultsfp, "{\"test\":\"%s\",\"objects\":%u,\"tracks\":%u,\"blocks\":%s,\"metric\":\"%s\",\"value\":%.6f,\"unit\":\"%s\"}\n",
+            test, opts.objects, opts.tracks, StringFrom((uint64_t)opts.objects * opts.tracks * opts.blocks).c_str(),
+            metric, value, unit);
+    fflush(resultsfp);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append printf style formatted text to string
+ */
+/*--------------------------------------------------------------------------------*/
+static void Append(std::string& str, const char *fmt, ...)
+{
+  char buf[512];
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  str += buf;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Format time in ms as an ADM time (hh:mm:ss.fffff)
+ */
+/*--------------------------------------------------------------------------------*/
+static const char *FormatTime(char *buf, size_t size, uint64_t ms)
+{
+  snprintf(buf, size, "%02u:%02u:%02u.%05u",
+           (uint_t)(ms / 3600000), (uint_t)((ms / 60000) % 60), (uint_t)((ms / 1000) % 60), (uint_t)(ms % 1000) * 100);
+  return buf;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Generate axml with the shape of test/test1.xml and test/test2.xml scaled up
+ *
+ * Every object has its own pack of tracks, each track with its own channel, stream and
+ * track formats, audioTrackUID and the given number of audioBlockFormats
+ */
+/*--------------------------------------------------------------------------------*/
+static void GenerateAxml(const OPTIONS& opts, std::string& xml)
+{
+  char   start[32], duration[32];
+  uint_t i, j, k, ntracks = opts.objects * opts.tracks;
+
+  // rough size of each block to avoid repeated reallocation
+  xml.reserve((size_t)ntracks * opts.blocks * 700 + (size_t)ntracks * 1500 + 4096);
+
+  xml  = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+  xml += "<ebuCoreMain xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns=\"urn:ebu:metadata-schema:ebuCore_2014\" xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" schema=\"EBU_CORE_20140201.xsd\" xml:lang=\"en\">\n";
+  xml += "\t<coreMetadata>\n\t\t<format>\n\t\t\t<audioFormatExtended>\n";
+
+  xml += "\t\t\t\t<audioProgramme audioProgrammeID=\"APR_1001\" audioProgrammeName=\"Benchmark\" typeLabel=\"0000\">\n";
+  xml += "\t\t\t\t\t<audioContentIDRef>ACO_1001</audioContentIDRef>\n";
+  xml += "\t\t\t\t</audioProgramme>\n";
+
+  xml += "\t\t\t\t<audioContent audioContentID=\"ACO_1001\" audioContentName=\"Benchmark\" typeLabel=\"0000\">\n";
+  for (i = 0; i < opts.objects; i++) Append(xml, "\t\t\t\t\t<audioObjectIDRef>AO_%04x</audioObjectIDRef>\n", 0x1001 + i);
+  xml += "\t\t\t\t</audioContent>\n";
+
+  for (i = 0; i < opts.objects; i++)
+  {
+    Append(xml, "\t\t\t\t<audioObject audioObjectID=\"AO_%04x\" audioObjectName=\"Object %u\" typeLabel=\"0000\">\n", 0x1001 + i, i + 1);
+    Append(xml, "\t\t\t\t\t<audioPackFormatIDRef>AP_0003%04x</audioPackFormatIDRef>\n", 0x1001 + i);
+    for (j = 0; j < opts.tracks; j++) Append(xml, "\t\t\t\t\t<audioTrackUIDRef>ATU_%08x</audioTrackUIDRef>\n", 1 + i * opts.tracks + j);
+    xml += "\t\t\t\t</audioObject>\n";
+  }
+
+  for (i = 0; i < opts.objects; i++)
+  {
+    Append(xml, "\t\t\t\t<audioPackFormat audioPackFormatID=\"AP_0003%04x\" audioPackFormatName=\"Pack %u\" typeDefinition=\"Objects\" typeLabel=\"0003\">\n", 0x1001 + i, i + 1);
+    for (j = 0; j < opts.tracks; j++) Append(xml, "\t\t\t\t\t<audioChannelFormatIDRef>AC_0003%04x</audioChannelFormatIDRef>\n", 0x1001 + i * opts.tracks + j);
+    xml += "\t\t\t\t</audioPackFormat>\n";
+  }
+
+  for (i = 0; i < ntracks; i++)
+  {
+    Append(xml, "\t\t\t\t<audioChannelFormat audioChannelFormatID=\"AC_0003%04x\" audioChannelFormatName=\"Track %u\" typeDefinition=\"Objects\" typeLabel=\"0003\">\n", 0x1001 + i, i + 1);
+
+    for (k = 0; k < opts.blocks; k++)
+    {
+      Append(xml, "\t\t\t\t\t<audioBlockFormat audioBlockFormatID=\"AB_0003%04x_%08x\" duration=\"%s\" rtime=\"%s\">\n",
+             0x1001 + i, k + 1,
+             FormatTime(duration, sizeof(duration), opts.blockms),
+             FormatTime(start,    sizeof(start),    (uint64_t)k * opts.blockms));
+      xml += "\t\t\t\t\t\t<cartesian>0</cartesian>\n";
+      Append(xml, "\t\t\t\t\t\t<position coordinate=\"azimuth\">%0.6f</position>\n", (double)((i + k) % 36) * 10.0 - 180.0);
+      Append(xml, "\t\t\t\t\t\t<position coordinate=\"elevation\">%0.6f</position>\n", (double)(k % 9) * 10.0);
+      xml += "\t\t\t\t\t\t<position coordinate=\"distance\">1.000000</position>\n";
+      Append(xml, "\t\t\t\t\t\t<diffuse>%0.6f</diffuse>\n", (double)(k % 10) * .1);
+      xml += "\t\t\t\t\t\t<objectDivergence azimuthRange=\"45.000000\">0.300000</objectDivergence>\n";
+      xml += "\t\t\t\t\t\t<channelLock maxDistance=\"1.100000\">1</channelLock>\n";
+      xml += "\t\t\t\t\t\t<zoneExclusion>\n";
+      xml += "\t\t\t\t\t\t\t<zone maxX=\"1.000000\" maxY=\"1.000000\" maxZ=\"1.000000\" minX=\"-1.000000\" minY=\"-1.000000\" minZ=\"-1.000000\">Left wall</zone>\n";
+      xml += "\t\t\t\t\t\t</zoneExclusion>\n";
+      xml += "\t\t\t\t\t</audioBlockFormat>\n";
+    }
+
+    xml += "\t\t\t\t</audioChannelFormat>\n";
+  }
+
+  for (i = 0; i < ntracks; i++)
+  {
+    Append(xml, "\t\t\t\t<audioStreamFormat audioStreamFormatID=\"AS_0003%04x\" audioStreamFormatName=\"PCM_Track %u\" formatDefinition=\"PCM\" formatLabel=\"0001\" typeLabel=\"0000\">\n", 0x1001 + i, i + 1);
+    Append(xml, "\t\t\t\t\t<audioChannelFormatIDRef>AC_0003%04x</audioChannelFormatIDRef>\n", 0x1001 + i);
+    Append(xml, "\t\t\t\t\t<audioTrackFormatIDRef>AT_0003%04x_01</audioTrackFormatIDRef>\n", 0x1001 + i);
+    Append(xml, "\t\t\t\t\t<audioPackFormatIDRef>AP_0003%04x</audioPackFormatIDRef>\n", 0x1001 + i / opts.tracks);
+    xml += "\t\t\t\t</audioStreamFormat>\n";
+  }
+
+  for (i = 0; i < ntracks; i++)
+  {
+    Append(xml, "\t\t\t\t<audioTrackFormat audioTrackFormatID=\"AT_0003%04x_01\" audioTrackFormatName=\"PCM_Track %u\" formatDefinition=\"PCM\" formatLabel=\"0001\" typeLabel=\"0000\">\n", 0x1001 + i, i + 1);
+    Append(xml, "\t\t\t\t\t<audioStreamFormatIDRef>AS_0003%04x</audioStreamFormatIDRef>\n", 0x1001 + i);
+    xml += "\t\t\t\t</audioTrackFormat>\n";
+  }
+
+  for (i = 0; i < ntracks; i++)
+  {
+    Append(xml, "\t\t\t\t<audioTrackUID UID=\"ATU_%08x\" bitDepth=\"24\" sampleRate=\"48000\" typeLabel=\"0000\">\n", 1 + i);
+    Append(xml, "\t\t\t\t\t<audioTrackFormatIDRef>AT_0003%04x_01</audioTrackFormatIDRef>\n", 0x1001 + i);
+    Append(xml, "\t\t\t\t\t<audioPackFormatIDRef>AP_0003%04x</audioPackFormatIDRef>\n", 0x1001 + i / opts.tracks);
+    xml += "\t\t\t\t</audioTrackUID>\n";
+  }
+
+  xml += "\t\t\t</audioFormatExtended>\n\t\t</format>\n\t</coreMetadata>\n</ebuCoreMain>\n";
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Generate chna for the tracks of the generated axml (one UID per track)
+ */
+/*--------------------------------------------------------------------------------*/
+static void GenerateChna(const OPTIONS& opts, std::vector<uint8_t>& chna)
+{
+  uint_t i, ntracks = opts.objects * opts.tracks;
+
+  chna.resize(sizeof(CHNA_CHUNK) + ntracks * sizeof(((CHNA_CHUNK *)NULL)->UIDs[0]));
+
+  CHNA_CHUNK *p = (CHNA_CHUNK *)&chna[0];
+  p->TrackCount = (uint16_t)ntracks;
+  p->UIDCount   = (uint16_t)ntracks;
+
+  for (i = 0; i < ntracks; i++)
+  {
+    char buf[32];
+
+    p->UIDs[i].TrackNum = (uint16_t)(i + 1);
+    snprintf(buf, sizeof(buf), "ATU_%08x", 1 + i);
+    memcpy(p->UIDs[i].UID, buf, sizeof(p->UIDs[i].UID));
+    snprintf(buf, sizeof(buf), "AT_0003%04x_01", 0x1001 + i);
+    memcpy(p->UIDs[i].TrackRef, buf, sizeof(p->UIDs[i].TrackRef));
+    snprintf(buf, sizeof(buf), "AP_0003%04x", 0x1001 + i / opts.tracks);
+    memcpy(p->UIDs[i].PackRef, buf, sizeof(p->UIDs[i].PackRef));
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Time each stage of reading an ADM BWF's ADM (as ADMRIFFFile::Open() does) and generating
+ * it again (as ADMRIFFFile::Close() does)
+ */
+/*--------------------------------------------------------------------------------*/
+static bool Run(const OPTIONS& opts, const std::string& xml, const std::vector<uint8_t>& chna)
+{
+  XMLADMData *adm;
+  Clock::time_point t0, t1;
+  bool success = true;
+
+  // standard definitions are loaded by the constructor
+  t0 = Clock::now();
+  adm = XMLADMData::CreateADM(opts.standarddefinitions);
+  t1 = Clock::now();
+
+  if (!adm)
+  {
+    fprintf(stderr, "No XML ADM provider available\n");
+    return false;
+  }
+  Result(opts, "standarddefinitions", "time", ElapsedMS(t0, t1), "ms");
+
+  t0 = Clock::now();
+  success &= adm->SetChna(&chna[0], chna.size());
+  t1 = Clock::now();
+  Result(opts, "setchna", "time", ElapsedMS(t0, t1), "ms");
+
+  // parse (TranslateXML()) without finalising so that Finalise() can be timed separately
+  t0 = Clock::now();
+  success &= adm->SetAxml(xml, false);
+  t1 = Clock::now();
+  Result(opts, "setaxml", "time", ElapsedMS(t0, t1), "ms");
+  Result(opts, "setaxml", "rate", (double)xml.size() / (ElapsedMS(t0, t1) * 1.0e3), "MB/s");
+
+  t0 = Clock::now();
+  success &= adm->Finalise();
+  t1 = Clock::now();
+  Result(opts, "finalise", "time", ElapsedMS(t0, t1), "ms");
+
+  if (adm->GetErrorCount())
+  {
+    fprintf(stderr, "%u errors reading ADM, first: %s\n", adm->GetErrorCount(), adm->GetErrors()[0].c_str());
+  }
+
+  uint8_t  *chnadata;
+  uint64_t chnalen;
+  t0 = Clock::now();
+  chnadata = adm->GetChna(chnalen);
+  t1 = Clock::now();
+  Result(opts, "getchna", "time", ElapsedMS(t0, t1), "ms");
+  if (chnadata) free(chnadata);
+  else success = false;
+
+  // ADMRIFFFile::Close() sizes the axml chunk then fills it
+  uint64_t axmllen, axmllen1 = 0;
+  t0 = Clock::now();
+  axmllen = adm->GetAxmlBuffer(NULL, 0);
+  t1 = Clock::now();
+  Result(opts, "getaxmlbuffer-size", "time", ElapsedMS(t0, t1), "ms");
+
+  std::vector<uint8_t> axml(axmllen + 1);
+  t0 = Clock::now();
+  axmllen1 = adm->GetAxmlBuffer(&axml[0], axmllen);
+  t1 = Clock::now();
+  Result(opts, "getaxmlbuffer-fill", "time", ElapsedMS(t0, t1), "ms");
+  Result(opts, "getaxmlbuffer-fill", "size", (double)axmllen / (1024.0 * 1024.0), "MB");
+
+  if (axmllen1 != axmllen)
+  {
+    fprintf(stderr, "Generated axml size differs between passes (%s vs %s)\n", StringFrom(axmllen).c_str(), StringFrom(axmllen1).c_str());
+    success = false;
+  }
+
+  Result(opts, "peak", "memory", GetPeakMemoryMB(), "MB");
+
+  t0 = Clock::now();
+  delete adm;
+  t1 = Clock::now();
+  Result(opts, "delete", "time", ElapsedMS(t0, t1), "ms");
+
+  return success;
+}
+
+static void Usage()
+{
+  fprintf(stderr, "Usage: adm-parse-generate [options]\n");
+  fprintf(stderr, "  -o <objects>     number of audio objects (default 1000)\n");
+  fprintf(stderr, "  -t <tracks>      tracks per object (default 1)\n");
+  fprintf(stderr, "  -b <blocks>      audioBlockFormats per track (default 100)\n");
+  fprintf(stderr, "  -l <ms>          duration of each audioBlockFormat (default 100)\n");
+  fprintf(stderr, "  -r <repeats>     number of times to run (default 1)\n");
+  fprintf(stderr, "  -s <file>        standard definitions file (default: found as the library does)\n");
+  fprintf(stderr, "  -x <file>        save generated axml to file\n");
+  fprintf(stderr, "  -j <file>        write results as JSON lines to file (default adm-parse-generate.json, '-' for none)\n");
+  fprintf(stderr, "Objects x tracks must be no more than %u\n", 0xefff);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  OPTIONS opts;
+  int i;
+
+  opts.objects = 1000;
+  opts.tracks  = 1;
+  opts.blocks  = 100;
+  opts.blockms = 100;
+  opts.repeats = 1;
+  opts.xmlfile = NULL;
+  opts.results = "adm-parse-generate.json";
+
+  // ensure libraries are set up
+  bbcat_register_bbcat_fileio();
+
+  for (i = 1; i < argc; i++)
+  {
+    if ((argv[i][0] == '-') && argv[i][1] && !argv[i][2] && ((i + 1) < argc))
+    {
+      const char *arg = argv[++i];
+      uint_t     val  = (uint_t)atoi(arg);
+
+      switch (argv[i - 1][1])
+      {
+        case 'o': opts.objects = std::max(val, 1U); break;
+        case 't': opts.tracks  = std::max(val, 1U); break;
+        case 'b': opts.blocks  = std::max(val, 1U); break;
+        case 'l': opts.blockms = std::max(val, 1U); break;
+        case 'r': opts.repeats = std::max(val, 1U); break;
+        case 's': opts.standarddefinitions = arg; break;
+        case 'x': opts.xmlfile = arg; break;
+        case 'j': opts.results = (strcmp(arg, "-") == 0) ? NULL : arg; break;
+        default:  Usage(); break;
+      }
+    }
+    else Usage();
+  }
+
+  // IDs of channel, stream and track formats have 4 hex digits starting at 1001
+  if (((uint64_t)opts.objects * opts.tracks) > 0xefff) Usage();
+
+  if (opts.results && ((resultsfp = fopen(opts.results, "w")) == NULL))
+  {
+    fprintf(stderr, "Failed to create results file '%s'\n", opts.results);
+    exit(1);
+  }
+
+  std::string          xml;
+  std::vector<uint8_t> chna;
+  Clock::time_point    t0 = Clock::now();
+
+  GenerateAxml(opts, xml);
+  GenerateChna(opts, chna);
+
+  printf("%u objects, %u tracks per object, %s audioBlockFormats: %.1fMB axml generated in %.1fms\n",
+         opts.objects, opts.tracks, StringFrom((uint64_t)opts.objects * opts.tracks * opts.blocks).c_str(),
+         (double)xml.size() / (1024.0 * 1024.0), ElapsedMS(t0, Clock::now()));
+  Result(opts, "generated", "memory", GetPeakMemoryMB(), "MB");
+
+  if (opts.xmlfile)
+  {
+    FILE *fp;
+
+    if ((fp = fopen(opts.xmlfile, "w")) != NULL)
+    {
+      fwrite(xml.c_str(), 1, xml.size(), fp);
+      fclose(fp);
+    }
+    else fprintf(stderr, "Failed to create '%s'\n", opts.xmlfile);
+  }
+
+  uint_t j, failures = 0;
+  for (j = 0; j < opts.repeats; j++)
+  {
+    printf("\nRun %u:\n", j + 1);
+    if (!Run(opts, xml, chna)) failures++;
+  }
+
+  if (resultsfp) fclose(resultsfp);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include "register.h"
+#include "ADMRIFFFile.h"
+#include "LatencyHistogram.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct
+{
+  std::vector<SampleFormat_t> formats;
+  std::vector<uint_t>         channels;
+  uint_t                      samplerate;
+  uint_t                      seconds;
+  uint_t                      blocksize;
+  uint_t                      seeks;          // number of random seeks for latency
+  uint_t                      opens;          // number of opens for latency
+  uint_t                      sparsegb;       // size of sparse RF64 file (0 for none)
+  bool                        adm;            // include ADM BWF files
+  bool                        keep;           // keep test files
+  const char                  *dir;
+  const char                  *results;       // JSON lines results file (NULL for none)
+} OPTIONS;
+
+/*--------------------------------------------------------------------------------*/
+/** Description of the file a result was measured on
+ */
+/*--------------------------------------------------------------------------------*/
+typedef struct
+{
+  const char     *container;    // "wav", "adm-bwf" or "rf64-sparse"
+  SampleFormat_t format;
+  uint_t         channels;
+  uint64_t       frames;
+  bool           background;    // background writing
+} CONFIG;
+
+static FILE *resultsfp = NULL;
+
+static double ElapsedNS(const Clock::time_point& t0, const Clock::time_point& t1)
+{
+  return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+}
+
+static const char *GetFormatName(SampleFormat_t format)
+{
+  switch (format)
+  {
+    case SampleFormat_16bit: return "16";
+    case SampleFormat_24bit: return "24";
+    case SampleFormat_32bit: return "32";
+    case SampleFormat_Float: return "float";
+    default:                 return "unknown";
+  }
+}
+
+static uint64_t GetDataBytes(const CONFIG& cfg)
+{
+  return cfg.frames * cfg.channels * GetBytesPerSample(cfg.format);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Print result and append it to the results file as a single line of JSON
+ */
+/*--------------------------------------------------------------------------------*/
+static void Result(const char *test, const CONFIG& cfg, const char *metric, double value, const char *unit)
+{
+  printf("  %-8s %-11s %-5s %3u ch %s %-14s %12.3f %s\n",
+         test, cfg.container, GetFormatName(cfg.format), cfg.channels, cfg.background ? "bg" : "  ", metric, value, unit);
+
+  if (resultsfp)
+  {
+    fprintf(resultsfp, "{\"test\":\"%s\",\"container\":\"%s\",\"format\":\"%s\",\"channels\":%u,\"frames\":%s,\"bytes\":%s,\"background\":%s,\"metric\":\"%s\",\"value\":%.6f,\"unit\":\"%s\"}\n",
+            test, cfg.container, GetFormatName(cfg.format), cfg.channels,
+            StringFrom(cfg.frames).c_str(), StringFrom(GetDataBytes(cfg)).c_str(),
+            cfg.background ? "true" : "false",
+            metric, value, unit);
+    fflush(resultsfp);
+  }
+}
+
+static void Throughput(const char *test, const CONFIG& cfg, double ns)
+{
+  Result(test, cfg, "throughput", (ns > 0.0) ? ((double)GetDataBytes(cfg) * 1.0e3 / ns) : 0.0, "MB/s");
+}
+
+static void Latency(const char *test, const CONFIG& cfg, const LatencyHistogram& hist)
+{
+  Result(test, cfg, "mean",  (double)hist.GetMeanNS() * 1.0e-3, "us");
+  Result(test, cfg, "p50",   (double)hist.GetPercentileNS(50.0) * 1.0e-3, "us");
+  Result(test, cfg, "p99",   (double)hist.GetPercentileNS(99.0) * 1.0e-3, "us");
+  Result(test, cfg, "worst", (double)hist.GetMaxNS() * 1.0e-3, "us");
+}
+
+static std::string GetFilename(const OPTIONS& opts, const CONFIG& cfg)
+{
+  return std::string(opts.dir) + "/fileio-throughput-" + cfg.container + "-" + GetFormatName(cfg.format) + "-" + StringFrom(cfg.channels) + ".wav";
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create ADM objects for the tracks of a file (an object and pack for every 4 tracks)
+ */
+/*--------------------------------------------------------------------------------*/
+static void CreateObjects(ADMRIFFFile& file)
+{
+  ADMData *adm = file.GetADM();
+
+  if (adm)
+  {
+    const ADMData::TRACKLIST& tracklist = adm->GetTrackList();
+    ADMData::OBJECTNAMES names;
+    uint_t t;
+
+    names.programmeName = "Benchmark Programme";
+    names.contentName   = "Benchmark Content";
+
+    for (t = 0; t < tracklist.size(); t++)
+    {
+      std::string trackname;
+
+      Printf(trackname, "Track %u", t + 1);
+
+      names.trackNumber       = t;
+      names.channelFormatName = trackname;
+      names.streamFormatName  = "PCM_" + trackname;
+      names.trackFormatName   = "PCM_" + trackname;
+      names.objectName        = "";
+      Printf(names.objectName, "Object %u", 1 + (t / 4));
+      names.packFormatName    = "";
+      Printf(names.packFormatName, "Pack %u", 1 + (t / 4));
+      names.typeLabel         = ADMObject::TypeLabel_Objects;
+
+      adm->CreateObjects(names);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write a test file, measuring Create(), WriteSamples() and Close()
+ *
+ * ADM files get a new block of object parameters for every track each second so that
+ * Close() has a realistic axml chunk to generate
+ */
+/*--------------------------------------------------------------------------------*/
+static bool WriteTest(const OPTIONS& opts, const CONFIG& cfg)
+{
+  std::string filename = GetFilename(opts, cfg);
+  ADMRIFFFile file;
+  std::vector<float> buffer(opts.blocksize * cfg.channels);
+  Clock::time_point t0, t1, t2, t3;
+  uint64_t pos, nextparams = 0;
+  double   writens = 0.0;
+  uint_t   i;
+  bool     success = true;
+
+  // a different low level tone on each channel, the content does not affect the timing
+  for (i = 0; i < buffer.size(); i++) buffer[i] = (float)(.1 * sin(2.0 * M_PI * (double)(1 + (i % cfg.channels)) * (double)(i / cfg.channels) / (double)opts.blocksize));
+
+  if (cfg.background) file.EnableBackgroundWriting(true);
+  if (strcmp(cfg.container, "adm-bwf") == 0) file.CreateADM();
+
+  t0 = Clock::now();
+  if (file.Create(filename.c_str(), opts.samplerate, cfg.channels, cfg.format))
+  {
+    t1 = Clock::now();
+
+    if (file.GetADM()) CreateObjects(file);
+
+    for (pos = 0; success && (pos < cfg.frames); pos += opts.blocksize)
+    {
+      uint_t nframes = (uint_t)std::min((uint64_t)opts.blocksize, cfg.frames - pos);
+
+      if (file.GetADM() && (pos >= nextparams))
+      {
+        for (i = 0; i < cfg.channels; i++)
+        {
+          AudioObjectParameters params;
+          Position position;
+
+          position.polar  = true;
+          position.pos.az = (double)((pos / opts.samplerate + i) % 18) * 20.0;
+          position.pos.el = 0.0;
+          position.pos.d  = 1.0;
+          params.SetPosition(position);
+
+          file.SetObjectParameters(i, params);
+        }
+
+        nextparams += opts.samplerate;
+      }
+
+      t2 = Clock::now();
+      success = (file.WriteSamples(&buffer[0], 0, cfg.channels, nframes) == (sint_t)nframes);
+      writens += ElapsedNS(t2, Clock::now());
+    }
+
+    t2 = Clock::now();
+    file.Close();
+    t3 = Clock::now();
+
+    if (success)
+    {
+      Result("create", cfg, "time", ElapsedNS(t0, t1) * 1.0e-6, "ms");
+      Throughput("write", cfg, writens);
+      Result("close", cfg, "time", ElapsedNS(t2, t3) * 1.0e-6, "ms");
+    }
+    else fprintf(stderr, "Failed to write to '%s'\n", filename.c_str());
+  }
+  else
+  {
+    fprintf(stderr, "Failed to create '%s'\n", filename.c_str());
+    success = false;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Measure Open() and Close() of an existing file
+ */
+/*--------------------------------------------------------------------------------*/
+static void OpenTest(const OPTIONS& opts, const CONFIG& cfg)
+{
+  std::string filename = GetFilename(opts, cfg);
+  LatencyHistogram openhist, closehist;
+  uint_t i;
+
+  for (i = 0; i < opts.opens; i++)
+  {
+    ADMRIFFFile file;
+    Clock::time_point t0, t1, t2;
+
+    t0 = Clock::now();
+    if (!file.Open(filename.c_str()))
+    {
+      fprintf(stderr, "Failed to open '%s'\n", filename.c_str());
+      return;
+    }
+    t1 = Clock::now();
+    file.Close();
+    t2 = Clock::now();
+
+    openhist.Add((uint64_t)ElapsedNS(t0, t1));
+    closehist.Add((uint64_t)ElapsedNS(t1, t2));
+  }
+
+  Result("open",  cfg, "mean",          (double)openhist.GetMeanNS()  * 1.0e-6, "ms");
+  Result("open",  cfg, "worst",         (double)openhist.GetMaxNS()   * 1.0e-6, "ms");
+  Result("close", cfg, "readonly-mean", (double)closehist.GetMeanNS() * 1.0e-6, "ms");
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Measure sequential ReadSamples() throughput of (up to) the given number of frames from
+ * the given position and the latency of reading a block after random seeks
+ */
+/*--------------------------------------------------------------------------------*/
+static void ReadTest(const OPTIONS& opts, const CONFIG& cfg, uint64_t from, uint64_t frames)
+{
+  std::string filename = GetFilename(opts, cfg);
+  RIFFFile file;
+
+  if (file.Open(filename.c_str()))
+  {
+    std::vector<float> buffer(opts.blocksize * cfg.channels);
+    uint64_t length = file.GetSampleLength(), pos, total = 0;
+    Clock::time_point t0;
+    double   readns;
+    uint_t   i;
+
+    // sequential read
+    file.SetSamplePosition(from);
+    t0 = Clock::now();
+    for (pos = 0; pos < frames; pos += opts.blocksize)
+    {
+      sint_t n = file.ReadSamples(&buffer[0], 0, cfg.channels, (uint_t)std::min((uint64_t)opts.blocksize, frames - pos));
+
+      if (n <= 0) break;
+      total += n;
+    }
+    readns = ElapsedNS(t0, Clock::now());
+
+    CONFIG readcfg = cfg;
+    readcfg.frames = total;
+    Throughput("read", readcfg, readns);
+
+    // random seeks, each followed by a block read (the seek itself is deferred until the read)
+    if (opts.seeks && (length > opts.blocksize))
+    {
+      std::mt19937_64 rng(12345);
+      LatencyHistogram hist;
+
+      for (i = 0; i < opts.seeks; i++)
+      {
+        t0 = Clock::now();
+        file.SetSamplePosition(rng() % (length - opts.blocksize));
+        file.ReadSamples(&buffer[0], 0, cfg.channels, opts.blocksize);
+        hist.Add((uint64_t)ElapsedNS(t0, Clock::now()));
+      }
+
+      Latency("seek", cfg, hist);
+    }
+
+    file.Close();
+  }
+  else fprintf(stderr, "Failed to open '%s'\n", filename.c_str());
+}
+
+static void Put16(std::vector<uint8_t>& data, uint16_t val)
+{
+  data.push_back((uint8_t)val);
+  data.push_back((uint8_t)(val >> 8));
+}
+
+static void Put32(std::vector<uint8_t>& data, uint32_t val)
+{
+  Put16(data, (uint16_t)val);
+  Put16(data, (uint16_t)(val >> 16));
+}
+
+static void Put64(std::vector<uint8_t>& data, uint64_t val)
+{
+  Put32(data, (uint32_t)val);
+  Put32(data, (uint32_t)(val >> 32));
+}
+
+static void PutID(std::vector<uint8_t>& data, const char *id)
+{
+  data.insert(data.end(), id, id + 4);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create an RF64 file whose sample data is a hole (a sparse file on most filesystems) so
+ * that files larger than 4GB can be tested without writing them
+ */
+/*--------------------------------------------------------------------------------*/
+static bool CreateSparseFile(const OPTIONS& opts, const CONFIG& cfg)
+{
+  std::string filename = GetFilename(opts, cfg);
+  std::vector<uint8_t> header;
+  EnhancedFile file;
+  uint64_t datasize = GetDataBytes(cfg);
+  uint_t   bps = GetBytesPerSample(cfg.format);
+  bool     success = false;
+
+  PutID(header, "RF64"); Put32(header, ~0U); PutID(header, "WAVE");
+  PutID(header, "ds64"); Put32(header, 28);
+  Put64(header, 0);                 // RIFF size, filled in below
+  Put64(header, datasize);
+  Put64(header, cfg.frames);
+  Put32(header, 0);
+  PutID(header, "fmt "); Put32(header, 16);
+  Put16(header, (cfg.format == SampleFormat_Float) ? 3 : 1);
+  Put16(header, (uint16_t)cfg.channels);
+  Put32(header, opts.samplerate);
+  Put32(header, opts.samplerate * cfg.channels * bps);
+  Put16(header, (uint16_t)(cfg.channels * bps));
+  Put16(header, (uint16_t)(bps * 8));
+  PutID(header, "data"); Put32(header, ~0U);
+
+  uint64_t riffsize = header.size() - 8 + datasize;
+  for (uint_t i = 0; i < 8; i++) header[20 + i] = (uint8_t)(riffsize >> (8 * i));
+
+  if (file.fopen(filename.c_str(), "wb"))
+  {
+    uint8_t zero = 0;
+
+    // write the last byte of the sample data only, leaving a hole before it
+    success = ((file.fwrite(&header[0], 1, header.size()) == header.size()) &&
+               (file.fseek((off_t)(header.size() + datasize - 1), SEEK_SET) == 0) &&
+               (file.fwrite(&zero, 1, 1) == 1));
+    file.fclose();
+  }
+
+  if (!success) fprintf(stderr, "Failed to create sparse file '%s'\n", filename.c_str());
+
+  return success;
+}
+
+static void DeleteFile(const OPTIONS& opts, const CONFIG& cfg)
+{
+  if (!opts.keep) remove(GetFilename(opts, cfg).c_str());
+}
+
+static bool ParseFormats(const char *arg, std::vector<SampleFormat_t>& formats)
+{
+  std::vector<std::string> list;
+  uint_t i;
+
+  SplitString(arg, list, ',');
+
+  formats.clear();
+  for (i = 0; i < list.size(); i++)
+  {
+    if      (list[i] == "16")    formats.push_back(SampleFormat_16bit);
+    else if (list[i] == "24")    formats.push_back(SampleFormat_24bit);
+    else if (list[i] == "32")    formats.push_back(SampleFormat_32bit);
+    else if (list[i] == "float") formats.push_back(SampleFormat_Float);
+    else return false;
+  }
+
+  return !formats.empty();
+}
+
+static bool ParseChannels(const char *arg, std::vector<uint_t>& channels)
+{
+  std::vector<std::string> list;
+  uint_t i;
+
+  SplitString(arg, list, ',');
+
+  channels.clear();
+  for (i = 0; i < list.size(); i++)
+  {
+    uint_t n = (uint_t)atoi(list[i].c_str());
+
+    if ((n < 1) || (n > 256)) return false;
+    channels.push_back(n);
+  }
+
+  return !channels.empty();
+}
+
+static void Usage()
+{
+  fprintf(stderr, "Usage: fileio-throughput [options]\n");
+  fprintf(stderr, "  -f <formats>     comma separated sample formats from 16, 24, 32 and float (default all)\n");
+  fprintf(stderr, "  -c <channels>    comma separated channel counts, 1-256 (default 1,2,16,64,256)\n");
+  fprintf(stderr, "  -r <rate>        sample rate (default 48000)\n");
+  fprintf(stderr, "  -t <seconds>     length of written files (default 10)\n");
+  fprintf(stderr, "  -b <frames>      frames per read/write (default 1024)\n");
+  fprintf(stderr, "  -s <seeks>       random seeks for seek latency (default 1000)\n");
+  fprintf(stderr, "  -n <opens>       opens for open/close latency (default 10)\n");
+  fprintf(stderr, "  -g <GB>          also test sparse RF64 files of this size (default 5, 0 for none)\n");
+  fprintf(stderr, "  -A               skip ADM BWF files\n");
+  fprintf(stderr, "  -k               keep test files\n");
+  fprintf(stderr, "  -d <dir>         directory for test files (default /tmp)\n");
+  fprintf(stderr, "  -o <file>        write results as JSON lines to file ('-' for stdout only)\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  OPTIONS opts;
+  int i;
+
+  opts.samplerate = 48000;
+  opts.seconds    = 10;
+  opts.blocksize  = 1024;
+  opts.seeks      = 1000;
+  opts.opens      = 10;
+  opts.sparsegb   = 5;
+  opts.adm        = true;
+  opts.keep       = false;
+  opts.dir        = "/tmp";
+  opts.results    = "fileio-throughput.json";
+  ParseFormats("16,24,32,float", opts.formats);
+  ParseChannels("1,2,16,64,256", opts.channels);
+
+  // ensure libraries are set up
+  bbcat_register_bbcat_fileio();
+
+  for (i = 1; i < argc; i++)
+  {
+    if      (strcmp(argv[i], "-A") == 0) opts.adm  = false;
+    else if (strcmp(argv[i], "-k") == 0) opts.keep = true;
+    else if ((argv[i][0] == '-') && argv[i][1] && !argv[i][2] && ((i + 1) < argc))
+    {
+      const char *arg = argv[++i];
+      uint_t     val  = (uint_t)atoi(arg);
+
+      switch (argv[i - 1][1])
+      {
+        case 'f': if (!ParseFormats(arg, opts.formats))   Usage(); break;
+        case 'c': if (!ParseChannels(arg, opts.channels)) Usage(); break;
+        case 'r': opts.samplerate = std::max(val, 1U); break;
+        case 't': opts.seconds    = std::max(val, 1U); break;
+        case 'b': opts.blocksize  = std::max(val, 1U); break;
+        case 's': opts.seeks      = val; break;
+        case 'n': opts.opens      = std::max(val, 1U); break;
+        case 'g': opts.sparsegb   = val; break;
+        case 'd': opts.dir        = arg; break;
+        case 'o': opts.results    = (strcmp(arg, "-") == 0) ? NULL : arg; break;
+        default:  Usage(); break;
+      }
+    }
+    else Usage();
+  }
+
+  if (opts.results && ((resultsfp = fopen(opts.results, "w")) == NULL))
+  {
+    fprintf(stderr, "Failed to create results file '%s'\n", opts.results);
+    exit(1);
+  }
+
+  printf("%us files @ %uHz, %u frames per read/write, %u seeks, %u opens, sparse RF64 %uGB\n",
+         opts.seconds, opts.samplerate, opts.blocksize, opts.seeks, opts.opens, opts.sparsegb);
+  printf("Note: files are read back straight after being written so reads are likely to be from the page cache\n");
+
+  uint_t f, c, failures = 0;
+  for (f = 0; f < opts.formats.size(); f++)
+  {
+    for (c = 0; c < opts.channels.size(); c++)
+    {
+      CONFIG cfg;
+
+      cfg.format   = opts.formats[f];
+      cfg.channels = opts.channels[c];
+      cfg.frames   = (uint64_t)opts.seconds * opts.samplerate;
+
+      printf("\n%s, %u channels:\n", GetFormatName(cfg.format), cfg.channels);
+
+      // plain WAV and ADM BWF, with and without background writing
+      const char *containers[] = {"wav", "adm-bwf"};
+      uint_t j, k;
+      for (j = 0; j < (opts.adm ? 2U : 1U); j++)
+      {
+        cfg.container = containers[j];
+
+        for (k = 0; k < 2; k++)
+        {
+          cfg.background = (k != 0);
+          if (!WriteTest(opts, cfg)) failures++;
+        }
+
+        cfg.background = false;
+        OpenTest(opts, cfg);
+        ReadTest(opts, cfg, 0, cfg.frames);
+        DeleteFile(opts, cfg);
+      }
+
+      // files too large to write in a reasonable time
+      if (opts.sparsegb)
+      {
+        cfg.container  = "rf64-sparse";
+        cfg.background = false;
+        cfg.frames     = ((uint64_t)opts.sparsegb << 30) / (cfg.channels * GetBytesPerSample(cfg.format));
+
+        if (CreateSparseFile(opts, cfg))
+        {
+          uint64_t frames = std::min((uint64_t)opts.seconds * opts.samplerate, cfg.frames);
+
+          OpenTest(opts, cfg);
+          // read the end of the file (beyond 4GB if the file is that large)
+          ReadTest(opts, cfg, cfg.frames - frames, frames);
+        }
+        else failures++;
+
+        DeleteFile(opts, cfg);
+      }
+    }
+  }
+
+  if (resultsfp) fclose(resultsfp);
+
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,439 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <random>
+
+#include "register.h"
+#include "Playlist.h"
+#include "LatencyHistogram.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+typedef std::chrono::steady_clock Clock;
+
+typedef struct
+{
+  uint_t     channels;
+  uint_t     blocksize;
+  uint_t     samplerate;
+  uint_t     seconds;
+  uint_t     items;
+  uint_t     itemseconds;
+  uint_t     slowus;            // delay added to every file read
+  uint_t     spikeus;           // delay added to one in SpikeInterval file reads
+  uint_t     prefetch;          // number of prefetch workers
+  uint_t     prerollms;
+  uint_t     lazyopen;          // maximum open files (0 for all open)
+  uint_t     controlms;         // interval between injected controls (0 for none)
+  uint_t     pollhz;            // rate of UI polling (0 for none)
+  bool       crossfade;
+  const char *dir;
+} OPTIONS;
+
+typedef struct
+{
+  LatencyHistogram execution;   // time spent in ReadSamples()
+  LatencyHistogram response;    // time from start of period to end of ReadSamples()
+  uint64_t         misses;      // callbacks that completed after the end of their period
+  uint64_t         late;        // callbacks that started after the end of their period
+  uint64_t         shortreads;  // callbacks that returned fewer frames than requested
+  uint64_t         controls;
+  uint64_t         polls;
+} RESULTS;
+
+// one in this many reads of a slow file is delayed by the spike time
+static const uint_t SpikeInterval = 100;
+
+/*--------------------------------------------------------------------------------*/
+/** Sound file samples that take longer to read, to simulate slow or contended storage
+ */
+/*--------------------------------------------------------------------------------*/
+class SlowSoundFileSamples : public SoundFileSamples
+{
+public:
+  SlowSoundFileSamples(uint_t delayus, uint_t spikeus) : SoundFileSamples(),
+                                                         delayus(delayus),
+                                                         spikeus(spikeus),
+                                                         reads(0) {}
+  SlowSoundFileSamples(const SlowSoundFileSamples *obj) : SoundFileSamples(obj),
+                                                          delayus(obj->delayus),
+                                                          spikeus(obj->spikeus),
+                                                          reads(0) {}
+
+  virtual SoundFileSamples *Duplicate() const
+  {
+    SlowSoundFileSamples *obj;
+
+    if (((obj = new SlowSoundFileSamples(this)) != NULL) && !obj->ReopenFile())
+    {
+      delete obj;
+      obj = NULL;
+    }
+
+    return obj;
+  }
+
+  using SoundFileSamples::ReadSamples;
+
+  virtual uint_t ReadSamples(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0)
+  {
+    uint_t us = delayus + (((++reads % SpikeInterval) == 0) ? spikeus : 0);
+
+    if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+
+    return SoundFileSamples::ReadSamples(buffer, type, dstchannel, ndstchannels, frames, firstchannel, nchannels);
+  }
+
+protected:
+  uint_t delayus;
+  uint_t spikeus;
+  uint_t reads;
+};
+
+static std::string GetItemFilename(const OPTIONS& opts, uint_t index)
+{
+  return std::string(opts.dir) + "/playout-deadline-" + StringFrom(index) + ".raw";
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write raw float test files (a different tone on each channel)
+ */
+/*--------------------------------------------------------------------------------*/
+static bool CreateFiles(const OPTIONS& opts)
+{
+  std::vector<float> frame(opts.channels);
+  uint_t i, j, k, frames = opts.itemseconds * opts.samplerate;
+  bool   success = true;
+
+  for (i = 0; success && (i < opts.items); i++)
+  {
+    std::string filename = GetItemFilename(opts, i);
+    FILE *fp;
+
+    if ((fp = fopen(filename.c_str(), "wb")) != NULL)
+    {
+      for (j = 0; j < frames; j++)
+      {
+        for (k = 0; k < opts.channels; k++) frame[k] = (float)(.25 * sin(2.0 * M_PI * (double)(100 * (i + k + 1)) * (double)j / (double)opts.samplerate));
+
+        fwrite(&frame[0], sizeof(frame[0]), frame.size(), fp);
+      }
+
+      fclose(fp);
+    }
+    else
+    {
+      fprintf(stderr, "Failed to create '%s'\n", filename.c_str());
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+static void DeleteFiles(const OPTIONS& opts)
+{
+  uint_t i;
+
+  for (i = 0; i < opts.items; i++) remove(GetItemFilename(opts, i).c_str());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add test files to playlist
+ */
+/*--------------------------------------------------------------------------------*/
+static bool LoadPlaylist(Playlist& playlist, const SoundFormat *format, const OPTIONS& opts)
+{
+  uint64_t bytes = (uint64_t)opts.itemseconds * opts.samplerate * opts.channels * sizeof(float);
+  uint_t   i;
+  bool     success = true;
+
+  for (i = 0; success && (i < opts.items); i++)
+  {
+    std::string  filename = GetItemFilename(opts, i);
+    EnhancedFile *file    = new EnhancedFile;
+
+    if (file->fopen(filename.c_str(), "rb"))
+    {
+      SlowSoundFileSamples *samples = new SlowSoundFileSamples(opts.slowus, opts.spikeus);
+
+      samples->SetFormat(format);
+      samples->SetFile(RefCount<EnhancedFile>(file), 0, bytes);
+
+      playlist.AddFile(samples);
+    }
+    else
+    {
+      fprintf(stderr, "Failed to open '%s'\n", filename.c_str());
+      delete file;
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Simulate audio callbacks: ReadSamples() is called once per period and must return
+ * before the end of that period
+ */
+/*--------------------------------------------------------------------------------*/
+static void RunCallbacks(Playlist& playlist, const OPTIONS& opts, RESULTS& results)
+{
+  std::vector<Sample_t> buffer(opts.blocksize * opts.channels);
+  Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds((uint64_t)opts.blocksize * 1000000000ULL / opts.samplerate));
+  Clock::time_point start = Clock::now() + period;
+  uint64_t k, nblocks = (uint64_t)opts.seconds * opts.samplerate / opts.blocksize;
+
+  for (k = 0; k < nblocks; k++)
+  {
+    Clock::time_point tick = start + period * k, now = Clock::now(), t0, t1;
+
+    if (now < tick) std::this_thread::sleep_until(tick);
+    else if (now >= (tick + period)) results.late++;
+
+    t0 = Clock::now();
+    uint_t n = playlist.ReadSamples(&buffer[0], 0, opts.channels, opts.blocksize);
+    t1 = Clock::now();
+
+    results.execution.Add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    results.response.Add((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - tick).count());
+
+    if (t1 > (tick + period)) results.misses++;
+    if (n < opts.blocksize)   results.shortreads++;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Inject seeks, pauses and index changes as a user interface would
+ */
+/*--------------------------------------------------------------------------------*/
+static void RunControls(Playlist& playlist, const OPTIONS& opts, const std::atomic<bool>& running, RESULTS& results)
+{
+  std::mt19937 rng(12345);
+  bool paused = false;
+
+  while (running.load())
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(opts.controlms));
+
+    switch (rng() % 4)
+    {
+      case 0:
+        playlist.SetPlaybackPosition(rng() % std::max(playlist.GetPlaybackLength(), (uint64_t)1), false);
+        break;
+
+      case 1:
+        playlist.SetPlaybackIndex(rng() % opts.items, true, false);
+        break;
+
+      case 2:
+        playlist.Next();
+        break;
+
+      default:
+        playlist.PauseAudio(paused = !paused);
+        break;
+    }
+
+    results.controls++;
+  }
+
+  if (paused) playlist.PauseAudio(false);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Poll playback progress as a user interface would
+ */
+/*--------------------------------------------------------------------------------*/
+static void RunPolling(Playlist& playlist, const OPTIONS& opts, const std::atomic<bool>& running, RESULTS& results)
+{
+  std::chrono::microseconds interval(1000000 / opts.pollhz);
+  volatile uint64_t position = 0;
+
+  while (running.load())
+  {
+    Playlist::PLAYBACKPROGRESS progress = playlist.GetPlaybackProgress();
+
+    position = progress.absoluteposition + progress.fileindex;
+    results.polls++;
+
+    std::this_thread::sleep_for(interval);
+  }
+
+  UNUSED_PARAMETER(position);
+}
+
+static void PrintHistogram(const char *name, const LatencyHistogram& hist)
+{
+  printf("%s: mean %.1fus, 50%% <%.1fus, 99%% <%.1fus, 99.9%% <%.1fus, worst %.1fus\n",
+         name,
+         (double)hist.GetMeanNS() * 1.0e-3,
+         (double)hist.GetPercentileNS(50.0) * 1.0e-3,
+         (double)hist.GetPercentileNS(99.0) * 1.0e-3,
+         (double)hist.GetPercentileNS(99.9) * 1.0e-3,
+         (double)hist.GetMaxNS() * 1.0e-3);
+  printf("  %s\n", hist.ToString().c_str());
+}
+
+static void Usage()
+{
+  fprintf(stderr, "Usage: playout-deadline [options]\n");
+  fprintf(stderr, "  -c <channels>    channels per item and callback (default 16)\n");
+  fprintf(stderr, "  -b <frames>      callback block size (default 256)\n");
+  fprintf(stderr, "  -r <rate>        sample rate (default 48000)\n");
+  fprintf(stderr, "  -t <seconds>     duration of simulation (default 10)\n");
+  fprintf(stderr, "  -n <items>       number of playlist items (default 8)\n");
+  fprintf(stderr, "  -l <seconds>     length of each item (default 2)\n");
+  fprintf(stderr, "  -s <us>          delay added to every file read (default 0)\n");
+  fprintf(stderr, "  -S <us>          delay added to one in %u file reads (default 0)\n", SpikeInterval);
+  fprintf(stderr, "  -p <workers>     prefetch worker threads (default 0)\n");
+  fprintf(stderr, "  -P <ms>          pre-roll time (default 0)\n");
+  fprintf(stderr, "  -L <files>       open files lazily, keeping at most this many open (default 0, all open)\n");
+  fprintf(stderr, "  -i <ms>          interval between injected seeks/pauses/index changes (default 250, 0 for none)\n");
+  fprintf(stderr, "  -u <hz>          rate of UI progress polling (default 60, 0 for none)\n");
+  fprintf(stderr, "  -x               crossfade between items\n");
+  fprintf(stderr, "  -d <dir>         directory for test files (default /tmp)\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  OPTIONS opts =
+  {
+    16, 256, 48000, 10, 8, 2,
+    0, 0,
+    0, 0, 0,
+    250, 60,
+    false,
+    "/tmp",
+  };
+  int i;
+
+  // ensure libraries are set up
+  bbcat_register_bbcat_fileio();
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-x") == 0) opts.crossfade = true;
+    else if ((argv[i][0] == '-') && argv[i][1] && !argv[i][2] && ((i + 1) < argc))
+    {
+      const char *arg = argv[++i];
+      uint_t     val  = (uint_t)atoi(arg);
+
+      switch (argv[i - 1][1])
+      {
+        case 'c': opts.channels    = std::max(val, 1U); break;
+        case 'b': opts.blocksize   = std::max(val, 1U); break;
+        case 'r': opts.samplerate  = std::max(val, 1U); break;
+        case 't': opts.seconds     = val; break;
+        case 'n': opts.items       = std::max(val, 1U); break;
+        case 'l': opts.itemseconds = std::max(val, 1U); break;
+        case 's': opts.slowus      = val; break;
+        case 'S': opts.spikeus     = val; break;
+        case 'p': opts.prefetch    = val; break;
+        case 'P': opts.prerollms   = val; break;
+        case 'L': opts.lazyopen    = val; break;
+        case 'i': opts.controlms   = val; break;
+        case 'u': opts.pollhz      = val; break;
+        case 'd': opts.dir         = arg; break;
+        default:  Usage(); break;
+      }
+    }
+    else Usage();
+  }
+
+  printf("%u channels, %u frames @ %uHz (%.2fms period), %u x %us items, %us\n",
+         opts.channels, opts.blocksize, opts.samplerate, 1000.0 * (double)opts.blocksize / (double)opts.samplerate,
+         opts.items, opts.itemseconds, opts.seconds);
+  printf("File delay %uus (spikes %uus), prefetch workers %u, pre-roll %ums, lazy open %u, controls every %ums, polling %uHz, crossfade %s\n",
+         opts.slowus, opts.spikeus, opts.prefetch, opts.prerollms, opts.lazyopen, opts.controlms, opts.pollhz, opts.crossfade ? "on" : "off");
+
+  if (!CreateFiles(opts))
+  {
+    DeleteFiles(opts);
+    exit(1);
+  }
+
+  SoundFormat format;
+  format.SetSampleRate(opts.samplerate);
+  format.SetChannels(opts.channels);
+  format.SetSampleFormat(SampleFormat_Float);
+  format.SetSamplesBigEndian(MACHINE_IS_BIG_ENDIAN);
+
+  RESULTS results;
+  results.misses = results.late = results.shortreads = results.controls = results.polls = 0;
+
+  {
+    Playlist playlist;
+
+    if (opts.lazyopen) playlist.EnableLazyOpen(opts.lazyopen);
+
+    if (LoadPlaylist(playlist, &format, opts))
+    {
+      std::atomic<bool> running(true);
+      std::thread       controls, polling;
+      uint64_t          underruns = 0, underrunframes = 0;
+      uint_t            j;
+
+      playlist.EnableLoop(true);
+      playlist.EnableCrossfade(opts.crossfade);
+      if (opts.prerollms) playlist.SetPrerollTime(opts.prerollms);
+      if (opts.prefetch)  playlist.EnablePrefetch(opts.prefetch);
+
+      if (opts.controlms) controls = std::thread(RunControls, std::ref(playlist), std::cref(opts), std::cref(running), std::ref(results));
+      if (opts.pollhz)    polling  = std::thread(RunPolling,  std::ref(playlist), std::cref(opts), std::cref(running), std::ref(results));
+
+      RunCallbacks(playlist, opts, results);
+
+      running.store(false);
+      if (controls.joinable()) controls.join();
+      if (polling.joinable())  polling.join();
+
+      for (j = 0; j < playlist.GetCount(); j++)
+      {
+        Playlist::PREFETCHSTATS stats;
+
+        if (playlist.GetPrefetchStats(j, stats))
+        {
+          underruns      += stats.underruns;
+          underrunframes += stats.underrunframes;
+        }
+      }
+
+      printf("\n%s callbacks, %s deadline misses, %s late starts, %s short reads\n",
+             StringFrom(results.execution.GetCount()).c_str(),
+             StringFrom(results.misses).c_str(),
+             StringFrom(results.late).c_str(),
+             StringFrom(results.shortreads).c_str());
+      printf("%s controls injected, %s progress polls\n", StringFrom(results.controls).c_str(), StringFrom(results.polls).c_str());
+      if (opts.prefetch) printf("Prefetch underruns: %s (%s frames)\n", StringFrom(underruns).c_str(), StringFrom(underrunframes).c_str());
+
+      FileHandlePool::STATS handlestats;
+      if (playlist.GetFileHandleStats(handlestats))
+      {
+        printf("File handles: %u open, %s opens, %s not open when read, %s silent reads, %s evictions\n",
+               handlestats.open,
+               StringFrom(handlestats.opens).c_str(),
+               StringFrom(handlestats.misses).c_str(),
+               StringFrom(handlestats.silentreads).c_str(),
+               StringFrom(handlestats.evictions).c_str());
+      }
+
+      printf("\n");
+      PrintHistogram("ReadSamples() time", results.execution);
+      PrintHistogram("Callback response ", results.response);
+    }
+  }
+
+  DeleteFiles(opts);
+
+  return results.misses ? 2 : 0;
+}
@@ -6,7 +6,9 @@
 BBC_AUDIOTOOLBOX_START
 
 ADMAudioFileSamples::ADMAudioFileSamples(const ADMRIFFFile& file) : SoundFileSamples(file.GetSamples()),
-                                                                    adm(file.GetADM())
+                                                                    adm(file.GetADM()),
+                                                                    sparse(false),
+                                                                    anyactivity(false)
 {
   uint_t i, n = GetChannels();
   
@@ -18,10 +20,14 @@ ADMAudioFileSamples::ADMAudioFileSamples(const ADMRIFFFile& file) : SoundFileSam
   {
     cursors.push_back(new ADMTrackCursor(GetStartChannel() + i));
   }
+
+  activity.resize(n);
 }
 
 ADMAudioFileSamples::ADMAudioFileSamples(const SoundFileSamples *isamples, const ADMData *_adm) : SoundFileSamples(isamples),
-                                                                                                  adm(_adm)
+                                                                                                  adm(_adm),
+                                                                                                  sparse(false),
+                                                                                                  anyactivity(false)
 {
   uint_t i, n = GetChannels();
   
@@ -33,10 +39,15 @@ ADMAudioFileSamples::ADMAudioFileSamples(const SoundFileSamples *isamples, const
   {
     cursors.push_back(new ADMTrackCursor(GetStartChannel() + i));
   }
+
+  activity.resize(n);
 }
 
 ADMAudioFileSamples::ADMAudioFileSamples(const ADMAudioFileSamples *isamples) : SoundFileSamples(isamples),
-                                                                                adm(isamples->adm)
+                                                                                adm(isamples->adm),
+                                                                                activity(isamples->activity),
+                                                                                sparse(isamples->sparse),
+                                                                                anyactivity(isamples->anyactivity)
 {
   uint_t i;
 
@@ -114,6 +125,9 @@ bool ADMAudioFileSamples::Add(const ADMAudioObject *obj)
 
       SetClip(clip);
 
+      // record when the object makes this track active (for sparse reading)
+      AddActivity(i, obj);
+
       objects.push_back(obj);
 
       added = true;
@@ -194,4 +208,85 @@ void ADMAudioFileSamples::SeekAllCursors(uint64_t t)
   }
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Record period in which object is active on track
+ *
+ * @param track index of track cursor
+ * @param obj object that has been added on track
+ */
+/*--------------------------------------------------------------------------------*/
+void ADMAudioFileSamples::AddActivity(uint_t track, const ADMAudioObject *obj)
+{
+  // a cursor holding just this object gives the times of the object's blocks on the track
+  ADMTrackCursor cursor(cursors[track]->GetChannel());
+  INTERVAL       interval;
+
+  cursor.Add(obj);
+
+  interval.start = cursor.GetStartTime() / timebase;           // convert cursor start time from ns to samples
+  interval.end   = cursor.GetEndTime()   / timebase;           // convert cursor end   time from ns to samples
+
+  if (interval.end == interval.start)
+  {
+    interval.start = obj->GetStartTime() / timebase;
+    interval.end   = interval.start + obj->GetDuration() / timebase;
+  }
+
+  if (interval.end > interval.start)
+  {
+    std::vector<INTERVAL>& list = activity[track];
+    std::vector<INTERVAL>::iterator it = list.begin();
+
+    // insert in order, merging with any periods that overlap or touch it
+    while ((it != list.end()) && (it->end < interval.start)) ++it;
+    while ((it != list.end()) && (it->start <= interval.end))
+    {
+      interval.start = std::min(interval.start, it->start);
+      interval.end   = std::max(interval.end,   it->end);
+      it = list.erase(it);
+    }
+    list.insert(it, interval);
+
+    BBCDEBUG3(("Track %u active from %s to %s", cursors[track]->GetChannel() + 1, StringFrom(interval.start).c_str(), StringFrom(interval.end).c_str()));
+  }
+
+  anyactivity = true;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether an object added on a track is active at a time
+ *
+ * @param channel track (channel within file)
+ * @param pos absolute sample position
+ * @param change set to absolute sample position at which this changes (~0 for never)
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMAudioFileSamples::IsTrackActive(uint_t channel, uint64_t pos, uint64_t& change) const
+{
+  uint_t track = channel - initialclip.channel;
+  uint_t i;
+
+  change = ~(uint64_t)0;
+
+  // tracks without cursors are always read
+  if ((channel < initialclip.channel) || (track >= activity.size())) return true;
+
+  const std::vector<INTERVAL>& list = activity[track];
+  for (i = 0; i < list.size(); i++)
+  {
+    if (pos < list[i].start)
+    {
+      change = list[i].start;
+      return false;
+    }
+    if (pos < list[i].end)
+    {
+      change = list[i].end;
+      return true;
+    }
+  }
+
+  return false;
+}
+
 BBC_AUDIOTOOLBOX_END
@@ -41,11 +41,72 @@ public:
 
   virtual ADMAudioFileSamples *Duplicate() const {return new ADMAudioFileSamples(this);}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable sparse reading
+   *
+   * Once objects have been added, each track is only read whilst an object added on it is
+   * active (from the timing of its blocks or, failing that, of the object itself); at other
+   * times the track is treated as silent.  Periods in which none of the requested tracks are
+   * active are output as silence without reading the file at all
+   *
+   * @note disabled by default, any audio on a track outside its objects is then read as normal
+   */
+  /*--------------------------------------------------------------------------------*/
+  void EnableSparseReading(bool enable = true) {sparse = enable;}
+  bool SparseReadingEnabled() const {return sparse;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether an object added on a track is active at a time
+   *
+   * @param channel track (channel within file)
+   * @param pos absolute sample position
+   *
+   * @note tracks without any objects are inactive, tracks outside this object's cursors are active
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsTrackActive(uint_t channel, uint64_t pos) const {uint64_t change; return IsTrackActive(channel, pos, change);}
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Tracks are only read whilst active once sparse reading is enabled and objects have been added
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool HasInactiveChannels() const {return sparse && anyactivity;}
+  virtual bool IsChannelActive(uint_t channel, uint64_t pos, uint64_t& change) const {return IsTrackActive(channel, pos, change);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Record period in which object is active on track
+   *
+   * @param track index of track cursor
+   * @param obj object that has been added on track
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AddActivity(uint_t track, const ADMAudioObject *obj);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether an object added on a track is active at a time
+   *
+   * @param channel track (channel within file)
+   * @param pos absolute sample position
+   * @param change set to absolute sample position at which this changes (~0 for never)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsTrackActive(uint_t channel, uint64_t pos, uint64_t& change) const;
+
+  typedef struct
+  {
+    uint64_t start;
+    uint64_t end;
+  } INTERVAL;
+
 protected:
   const ADMData                       *adm;
   std::vector<ADMTrackCursor *>       cursors;
   std::vector<const ADMAudioObject *> objects;
   Clip_t                              initialclip;
+  std::vector<std::vector<INTERVAL> > activity;     // sorted, non-overlapping periods of activity of each track
+  bool                                sparse;
+  bool                                anyactivity;
 };
 
 BBC_AUDIOTOOLBOX_END
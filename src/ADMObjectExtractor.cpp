@@ -0,0 +1,354 @@
+
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "ADMObjectExtractor.h"
+#include "ADMRIFFFile.h"
+#include "RIFFChunks.h"
+#include "RIFFChunk_Definitions.h"
+#include "SampleConversion.h"
+
+BBC_AUDIOTOOLBOX_START
+
+ADMObjectExtractor::ADMObjectExtractor(const ADMRIFFFile& file) :
+  samples(file.GetSamples() ? file.GetSamples()->Duplicate() : NULL),
+  adm(file.GetADM()),
+  timereference(0),
+  blockframes(4096)
+{
+  const RIFFbextChunk *bext;
+
+  if (!samples) BBCERROR("Failed to open samples of ADM file for extraction");
+
+  // stems are timed from the same reference as the file
+  if ((bext = dynamic_cast<const RIFFbextChunk *>(file.GetChunk(bext_ID))) != NULL) timereference = bext->GetTimeReference();
+}
+
+ADMObjectExtractor::ADMObjectExtractor(const SoundFileSamples *samples, const ADMData *adm, uint64_t timereference) :
+  samples(samples ? samples->Duplicate() : NULL),
+  adm(adm),
+  timereference(timereference),
+  blockframes(4096)
+{
+  if (!this->samples) BBCERROR("Failed to open samples for extraction");
+}
+
+ADMObjectExtractor::~ADMObjectExtractor()
+{
+  uint_t i;
+
+  for (i = 0; i < objects.size(); i++)
+  {
+    if (objects[i]->file) delete objects[i]->file;
+    delete objects[i];
+  }
+
+  if (samples) delete samples;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Find tracks and window of object
+ *
+ * @return new entry or NULL if object has no audio in the file
+ */
+/*--------------------------------------------------------------------------------*/
+ADMObjectExtractor::OBJECT *ADMObjectExtractor::CreateObject(const ADMAudioObject *object)
+{
+  OBJECT *obj = NULL;
+
+  if (!samples || !adm)
+  {
+    BBCERROR("No samples or ADM to extract %s from", object->ToString().c_str());
+  }
+  else if (&object->GetOwner() != adm)
+  {
+    // objects from a different ADM have their audio in a different file
+    BBCERROR("Attempting to extract %s from *different* ADM (%s vs %s)", object->ToString().c_str(), StringFrom(&object->GetOwner()).c_str(), StringFrom(adm).c_str());
+  }
+  else
+  {
+    const SoundFileSamples::Clip_t& clip     = samples->GetClip();
+    const UniversalTime&            timebase = samples->GetTimeBase();
+    std::vector<uint_t> channels;
+    uint64_t start = ~(uint64_t)0, end = 0;
+    uint_t   i;
+
+    {
+      ThreadLock lock(*adm);
+
+      // use a cursor for each track to find the tracks (and times) of the object
+      for (i = 0; i < samples->GetChannels(); i++)
+      {
+        ADMTrackCursor cursor(samples->GetStartChannel() + i);
+
+        if (cursor.Add(object))
+        {
+          uint64_t startTime = cursor.GetStartTime() / timebase;      // convert cursor start time from ns to samples
+          uint64_t endTime   = cursor.GetEndTime()   / timebase;      // convert cursor end   time from ns to samples
+
+          if (endTime == startTime)
+          {
+            startTime = object->GetStartTime() / timebase;
+            endTime   = startTime + object->GetDuration() / timebase;
+          }
+
+          channels.push_back(i);
+          start = std::min(start, startTime);
+          end   = std::max(end,   endTime);
+        }
+      }
+    }
+
+    // keep within the audio of the file
+    start = std::max(start, clip.start);
+    end   = std::min(end,   clip.start + clip.nsamples);
+
+    if (channels.size() && (end > start))
+    {
+      obj = new OBJECT;
+
+      obj->object   = object;
+      obj->channels = channels;
+      obj->start    = start;
+      obj->end      = end;
+      obj->callback = NULL;
+      obj->context  = NULL;
+      obj->format   = SampleFormat_24bit;
+      obj->file     = NULL;
+      obj->active   = true;
+
+      BBCDEBUG2(("Extracting %s: %u tracks from %s to %s", object->ToString().c_str(), (uint_t)channels.size(), StringFrom(start).c_str(), StringFrom(end).c_str()));
+    }
+    else BBCDEBUG1(("%s has no audio in file, not extracting it", object->ToString().c_str()));
+  }
+
+  return obj;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add object to be extracted, passing its audio to a callback
+ *
+ * @return true if object has audio in the file
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMObjectExtractor::AddObject(const ADMAudioObject *object, SINKCALLBACK callback, void *context)
+{
+  OBJECT *obj;
+
+  if ((obj = CreateObject(object)) != NULL)
+  {
+    obj->callback = callback;
+    obj->context  = context;
+    objects.push_back(obj);
+  }
+
+  return (obj != NULL);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add object to be extracted, writing its audio to a stem file
+ *
+ * @param object audio object
+ * @param filename WAVE file to create (when Extract() is called)
+ * @param format sample format of file
+ *
+ * @return true if object has audio in the file
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMObjectExtractor::AddObject(const ADMAudioObject *object, const std::string& filename, SampleFormat_t format)
+{
+  OBJECT *obj;
+
+  if ((obj = CreateObject(object)) != NULL)
+  {
+    obj->filename = filename;
+    obj->format   = format;
+    objects.push_back(obj);
+  }
+
+  return (obj != NULL);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add objects to be extracted, each to a stem file named from its ID
+ *
+ * @param objects list of objects
+ * @param prefix path and filename prefix of stem files (stems are <prefix><object ID>.wav)
+ * @param format sample format of files
+ *
+ * @return number of objects added
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t ADMObjectExtractor::AddObjects(const std::vector<const ADMAudioObject *>& objects, const std::string& prefix, SampleFormat_t format)
+{
+  uint_t i, n = 0;
+
+  for (i = 0; i < objects.size(); i++)
+  {
+    if (AddObject(objects[i], prefix + objects[i]->GetID() + ".wav", format)) n++;
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read file once, passing the audio of every object to its sink
+ *
+ * @return true if every object was extracted
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMObjectExtractor::Extract()
+{
+  SampleFormat_t type = SampleFormatOf((const Sample_t *)NULL);
+  uint64_t pos = ~(uint64_t)0, end = 0;
+  uint_t   firstchannel = ~0, lastchannel = 0, maxchannels = 0;
+  uint_t   i, j;
+  bool     success = (samples != NULL);
+
+  if (!samples) BBCERROR("No samples to extract objects from");
+
+  // create stem files and find the tracks and times that must be read
+  for (i = 0; samples && (i < objects.size()); i++)
+  {
+    OBJECT *obj = objects[i];
+    uint_t nchannels = (uint_t)obj->channels.size();
+
+    obj->active = true;
+
+    if (!obj->callback)
+    {
+      if (!obj->file) obj->file = new RIFFFile;
+
+      obj->file->SetTimeReference(timereference + obj->start);
+      if (!obj->file->Create(obj->filename.c_str(), samples->GetFormat()->GetSampleRate(), nchannels, obj->format))
+      {
+        BBCERROR("Failed to create '%s' for %s", obj->filename.c_str(), obj->object->ToString().c_str());
+        obj->active = false;
+        success     = false;
+        continue;
+      }
+    }
+
+    firstchannel = std::min(firstchannel, obj->channels.front());
+    lastchannel  = std::max(lastchannel,  obj->channels.back());
+    maxchannels  = std::max(maxchannels,  nchannels);
+    pos          = std::min(pos, obj->start);
+    end          = std::max(end, obj->end);
+  }
+
+  if (pos < end)
+  {
+    uint_t nspan = lastchannel + 1 - firstchannel;
+
+    // each object picks its tracks out of the span of tracks read
+    for (i = 0; i < objects.size(); i++)
+    {
+      OBJECT *obj = objects[i];
+
+      if (!obj->active) continue;
+
+      obj->map.resize(obj->channels.size());
+      for (j = 0; j < obj->channels.size(); j++)
+      {
+        obj->map[j].channel = obj->channels[j] - firstchannel;
+        obj->map[j].slot    = j;
+        obj->map[j].gain    = 1.0;
+      }
+    }
+
+    blockbuffer.resize(blockframes * nspan);
+    objectbuffer.resize(blockframes * maxchannels);
+
+    BBCDEBUG2(("Extracting %u objects from tracks %u-%u, samples %s-%s", (uint_t)objects.size(), firstchannel, lastchannel, StringFrom(pos).c_str(), StringFrom(end).c_str()));
+
+    while (pos < end)
+    {
+      uint64_t next = end;
+      uint_t   nframes, n;
+
+      // skip to the start of the next active object if no object is active here
+      for (i = 0; i < objects.size(); i++)
+      {
+        const OBJECT *obj = objects[i];
+
+        if (obj->active && (obj->end > pos)) next = std::min(next, std::max(obj->start, pos));
+      }
+
+      if ((pos = next) >= end) break;
+
+      nframes = (uint_t)std::min((uint64_t)blockframes, end - pos);
+
+      if (samples->GetAbsoluteSamplePosition() != pos) samples->SetAbsoluteSamplePosition(pos);
+
+      if ((n = samples->ReadSamples((uint8_t *)&blockbuffer[0], type, 0, nspan, nframes, firstchannel, nspan)) == 0)
+      {
+        if (samples->InError())
+        {
+          BBCERROR("Failed to read samples at %s for extraction", StringFrom(pos).c_str());
+          success = false;
+        }
+        break;
+      }
+
+      // fan block out to every object active within it
+      for (i = 0; i < objects.size(); i++)
+      {
+        OBJECT   *obj  = objects[i];
+        uint64_t from  = std::max(obj->start, pos);
+        uint64_t until = std::min(obj->end,   pos + n);
+
+        if (!obj->active || (from >= until)) continue;
+
+        ConvertSamplesMapped(&blockbuffer[(from - pos) * nspan], type, MACHINE_IS_BIG_ENDIAN, 0, nspan,
+                             &objectbuffer[0], (uint_t)obj->channels.size(),
+                             &obj->map[0], (uint_t)obj->map.size(),
+                             nspan,
+                             (uint_t)(until - from));
+
+        if (!WriteObject(obj, &objectbuffer[0], (uint_t)(until - from), from - obj->start))
+        {
+          obj->active = false;
+          success     = false;
+        }
+      }
+
+      pos += n;
+    }
+  }
+
+  // finish stem files
+  for (i = 0; i < objects.size(); i++)
+  {
+    OBJECT *obj = objects[i];
+
+    if (obj->file)
+    {
+      obj->file->Close();
+      delete obj->file;
+      obj->file = NULL;
+    }
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Pass block of samples to sink of object
+ *
+ * @return false if sink failed
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMObjectExtractor::WriteObject(OBJECT *obj, const Sample_t *samples, uint_t nframes, uint64_t position)
+{
+  uint_t nchannels = (uint_t)obj->channels.size();
+  bool   success;
+
+  if (obj->callback) success = (*obj->callback)(obj->object, samples, nchannels, nframes, position, obj->context);
+  else               success = (obj->file && (obj->file->WriteSamples(samples, 0, nchannels, nframes) == (sint_t)nframes));
+
+  if (!success) BBCERROR("Failed to pass audio of %s to its sink, no longer extracting it", obj->object->ToString().c_str());
+
+  return success;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,167 @@
+#ifndef __ADM_OBJECT_EXTRACTOR__
+#define __ADM_OBJECT_EXTRACTOR__
+
+#include <string>
+#include <vector>
+
+#include <bbcat-adm/ADMData.h>
+
+#include "SoundFileAttributes.h"
+
+BBC_AUDIOTOOLBOX_START
+
+class ADMRIFFFile;
+class RIFFFile;
+
+/*--------------------------------------------------------------------------------*/
+/** Extracts the audio of many ADM audio objects in a single sequential pass over a file
+ *
+ * Each object is given a sink (a callback or a stem file) and is extracted over its own
+ * time window with its own tracks (those found by an ADMTrackCursor for the object, in track
+ * order).  Blocks of the tracks used by any object are read once and fanned out to every
+ * object active within the block; periods where no object is active are skipped
+ */
+/*--------------------------------------------------------------------------------*/
+class ADMObjectExtractor
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param file open ADM BWF (its samples are read through an independent copy)
+   *
+   * @note stem files are timed from the file's bext TimeReference (if it has one)
+   */
+  /*--------------------------------------------------------------------------------*/
+  ADMObjectExtractor(const ADMRIFFFile& file);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param samples samples to read (through an independent copy)
+   * @param adm ADM describing the samples
+   * @param timereference time reference of the samples (first sample count since midnight)
+   */
+  /*--------------------------------------------------------------------------------*/
+  ADMObjectExtractor(const SoundFileSamples *samples, const ADMData *adm, uint64_t timereference = 0);
+  ~ADMObjectExtractor();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Callback receiving the audio of an object
+   *
+   * @param object audio object
+   * @param samples interleaved samples of the object's tracks
+   * @param nchannels number of channels (tracks) of the object
+   * @param nframes number of frames
+   * @param position position of first frame relative to the start of the object's window
+   * @param context context passed to AddObject()
+   *
+   * @return false to stop extracting the object (Extract() will then fail)
+   */
+  /*--------------------------------------------------------------------------------*/
+  typedef bool (*SINKCALLBACK)(const ADMAudioObject *object, const Sample_t *samples, uint_t nchannels, uint_t nframes, uint64_t position, void *context);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set number of frames read in each block
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetBlockSize(uint_t frames) {blockframes = std::max(frames, (uint_t)1);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add object to be extracted, passing its audio to a callback
+   *
+   * @return true if object has audio in the file
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool AddObject(const ADMAudioObject *object, SINKCALLBACK callback, void *context = NULL);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add object to be extracted, writing its audio to a stem file
+   *
+   * @param object audio object
+   * @param filename WAVE file to create (when Extract() is called)
+   * @param format sample format of file
+   *
+   * @return true if object has audio in the file
+   *
+   * @note the bext TimeReference of the stem is the start of the object's window
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool AddObject(const ADMAudioObject *object, const std::string& filename, SampleFormat_t format = SampleFormat_24bit);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add objects to be extracted, each to a stem file named from its ID
+   *
+   * @param objects list of objects
+   * @param prefix path and filename prefix of stem files (stems are <prefix><object ID>.wav)
+   * @param format sample format of files
+   *
+   * @return number of objects added
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t AddObjects(const std::vector<const ADMAudioObject *>& objects, const std::string& prefix, SampleFormat_t format = SampleFormat_24bit);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of objects to be extracted
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetObjectCount() const {return (uint_t)objects.size();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read file once, passing the audio of every object to its sink
+   *
+   * @return true if every object was extracted
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Extract();
+
+protected:
+  typedef struct
+  {
+    const ADMAudioObject      *object;
+    std::vector<uint_t>       channels;     // tracks of object
+    std::vector<CHANNELROUTE> map;          // tracks (relative to first track read) to object channels
+    uint64_t                  start;        // window of object in samples
+    uint64_t                  end;
+    SINKCALLBACK              callback;
+    void                      *context;
+    std::string               filename;     // stem file (if no callback)
+    SampleFormat_t            format;
+    RIFFFile                  *file;
+    bool                      active;       // still being extracted
+  } OBJECT;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Find tracks and window of object
+   *
+   * @return new entry or NULL if object has no audio in the file
+   */
+  /*--------------------------------------------------------------------------------*/
+  OBJECT *CreateObject(const ADMAudioObject *object);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pass block of samples to sink of object
+   *
+   * @return false if sink failed
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WriteObject(OBJECT *obj, const Sample_t *samples, uint_t nframes, uint64_t position);
+
+protected:
+  SoundFileSamples      *samples;
+  const ADMData         *adm;
+  uint64_t              timereference;  // time reference of the samples being read
+  std::vector<OBJECT *> objects;
+  std::vector<Sample_t> blockbuffer;
+  std::vector<Sample_t> objectbuffer;
+  uint_t                blockframes;
+
+private:
+  // prevent copying
+  ADMObjectExtractor(const ADMObjectExtractor& obj);
+  ADMObjectExtractor& operator = (const ADMObjectExtractor& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
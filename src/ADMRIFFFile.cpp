@@ -5,17 +5,48 @@
 #include <math.h>
 
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <vector>
 
 #define BBCDEBUG_LEVEL 1
 #include <bbcat-base/PerformanceMonitor.h>
 
 #include "ADMRIFFFile.h"
 #include "RIFFChunk_Definitions.h"
+#include "TraceEvents.h"
 
 BBC_AUDIOTOOLBOX_START
 
+// longest wait of segment thread for a signal before checking again (waits are woken by signals, this is only a backstop)
+static const std::chrono::milliseconds SignalTimeout(100);
+
 ADMRIFFFile::ADMRIFFFile() : RIFFFile(),
-                             adm(NULL)
+                             adm(NULL),
+                             admcopied(false),
+                             segmentconfig(GetDefaultSegmentConfig()),
+                             segmentsamplerate(0),
+                             segmentchannels(0),
+                             segmentformat(SampleFormat_Unknown),
+                             segmentbackgroundconfig(BackgroundWriteFile::GetDefaultConfig()),
+                             segmentbackgroundwriting(false),
+                             segmentmapconfig(BackgroundWriteFile::GetDefaultMapConfig()),
+                             segmentmappedwriting(false),
+                             segmentframes(0),
+                             prepareframes(0),
+                             segmentstart(0),
+                             segmentlength(0),
+                             segmentindex(0),
+                             nextsegment(NULL),
+                             nextsegmentindex(0),
+                             nextsegmentstart(0),
+                             segmenting(false),
+                             segmentsstarted(false),
+                             nextsegmentrequested(false),
+                             creatingsegment(false),
+                             segmentfailed(false),
+                             segmentoverrun(false),
+                             segmentoverruns(0)
 {
 }
 
@@ -35,6 +66,7 @@ ADMRIFFFile::~ADMRIFFFile()
 /*--------------------------------------------------------------------------------*/
 bool ADMRIFFFile::Open(const char *filename, const std::string& standarddefinitionsfile)
 {
+  TraceScope trace("ADMRIFFFile::Open", "adm", filename);
   bool success = false;
 
   if ((adm = XMLADMData::CreateADM(standarddefinitionsfile)) != NULL)
@@ -46,6 +78,55 @@ bool ADMRIFFFile::Open(const char *filename, const std::string& standarddefiniti
   return success;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Re-open an existing ADM BWF file to append samples and ADM data to it
+ *
+ * @param filename filename of file to open
+ * @param standarddefinitionsfile filename of standard definitions XML file to use
+ *
+ * @return true if file opened and positioned at the end of the existing samples
+ *
+ * @note the existing ADM is read and new block formats written using the write cursors
+ * @note are merged into it, the axml and chna chunks are regenerated on Close()
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::Append(const char *filename, const std::string& standarddefinitionsfile)
+{
+  bool success = false;
+
+  if ((adm = XMLADMData::CreateADM(standarddefinitionsfile)) != NULL)
+  {
+    admstandarddefinitions = standarddefinitionsfile;
+
+    if (RIFFFile::Append(filename))
+    {
+      std::vector<const ADMAudioObject *> objects;
+      uint64_t endtime = filesamples->GetAbsolutePositionNS();
+      uint_t i;
+
+      // extend objects that run to the end of the existing samples so that the write cursors continue them
+      // (object limits are recalculated on Close())
+      adm->GetAudioObjectList(objects);
+      for (i = 0; i < objects.size(); i++)
+      {
+        ADMAudioObject *object = const_cast<ADMAudioObject *>(objects[i]);
+
+        if ((object->GetStartTime() + object->GetDuration()) >= endtime)
+        {
+          object->SetDuration(~(uint64_t)0 - object->GetStartTime());
+        }
+      }
+
+      PrepareCursors();
+
+      success = true;
+    }
+  }
+  else BBCERROR("No providers for ADM XML decoding!");
+
+  return success;
+}
+
 
 /*--------------------------------------------------------------------------------*/
 /** Optional stage to create extra chunks when writing WAV files
@@ -64,7 +145,8 @@ bool ADMRIFFFile::CreateExtraChunks()
 
     success = true;
 
-    for (i = 0; i < nchannels; i++)
+    // a copied ADM already has its tracks
+    for (i = 0; (i < nchannels) && !admcopied; i++)
     {
       ADMAudioTrack *track;
 
@@ -76,7 +158,9 @@ bool ADMRIFFFile::CreateExtraChunks()
       }
     }
 
-    if (!admfile.empty())
+    // can prepare cursors now since all objects have been copied
+    if (admcopied) PrepareCursors();
+    else if (!admfile.empty())
     {
       // create ADM structure (content and objects from file)
       if (adm->CreateFromFile(admfile.c_str()))
@@ -130,6 +214,9 @@ bool ADMRIFFFile::CreateADM(const std::string& standarddefinitionsfile)
   {
     if ((adm = XMLADMData::CreateADM(standarddefinitionsfile)) != NULL)
     {
+      // save standard definitions for any subsequent segments
+      admstandarddefinitions = standarddefinitionsfile;
+
       success = true;
     }
     else BBCERROR("No providers for ADM XML decoding!");
@@ -170,6 +257,37 @@ bool ADMRIFFFile::CreateADMFromFile(const std::string& filename, const std::stri
   return success;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Create ADM as a copy of another from its chna and axml data
+ *
+ * @param chna chna chunk data
+ * @param chnalength length of chna chunk data
+ * @param axml axml data
+ * @param standarddefinitionsfile filename of standard definitions XML file to use
+ *
+ * @return true if successful
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::CreateADMFromCopy(const uint8_t *chna, uint64_t chnalength, const char *axml, const std::string& standarddefinitionsfile)
+{
+  bool success = false;
+
+  if (CreateADM(standarddefinitionsfile))
+  {
+    TraceScope trace("CopyADM", "adm");
+
+    // decode as though read from a file
+    if (adm->Set(chna, chnalength, axml))
+    {
+      admcopied = true;
+      success   = true;
+    }
+    else BBCERROR("Failed to decode copy of ADM");
+  }
+
+  return success;
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Close RIFF file, writing chunks if file was opened for writing
  *
@@ -180,42 +298,71 @@ bool ADMRIFFFile::CreateADMFromFile(const std::string& filename, const std::stri
 /*--------------------------------------------------------------------------------*/
 void ADMRIFFFile::Close(bool abortwrite)
 {
-  EnhancedFile *file = fileref;
+  EnhancedFile   *file = fileref;
+  CLOSINGSEGMENT lastsegment;
+  bool           lastsegmentcallback = (segmentsstarted && file && writing && !abortwrite && segmentconfig.segmentcallback);
   uint_t i;
 
+  if (lastsegmentcallback)
+  {
+    lastsegment.file        = this;
+    lastsegment.filename    = file->getfilename();
+    lastsegment.startsample = segmentstart;
+    lastsegment.nsamples    = GetSampleLength();
+  }
+
+  // close any completed segments before this one
+  if (segmenting) StopSegmenting();
+
   if (file && adm && writing && !abortwrite)
   {
-    RIFFChunk *chunk;
-    uint64_t  endtime = filesamples ? filesamples->GetAbsolutePositionNS() : 0;
-    uint64_t  chnalen;
-    uint8_t   *chna;
+    TraceScope trace("FinaliseADM", "adm", file->getfilename());
+    RIFFChunk  *chunk;
+    uint64_t   endtime = filesamples ? filesamples->GetAbsolutePositionNS() : 0;
+    uint64_t   chnalen;
+    uint8_t    *chna;
 
     BBCDEBUG1(("Finalising ADM for '%s'...", file->getfilename().c_str()));
 
     BBCDEBUG1(("Finishing all blockformats"));
 
     // complete BlockFormats on all channels
-    for (i = 0; i < cursors.size(); i++)
     {
-      cursors[i]->Seek(endtime);
-      cursors[i]->EndChanges();
+      TraceScope trace("EndChanges", "adm");
+
+      for (i = 0; i < cursors.size(); i++)
+      {
+        cursors[i]->Seek(endtime);
+        cursors[i]->EndChanges();
+      }
     }
 
     // finalise ADM
-    adm->Finalise();
+    {
+      TraceScope trace("Finalise", "adm");
+      adm->Finalise();
+    }
 
     // update audio object time limits
-    adm->UpdateAudioObjectLimits();
+    {
+      TraceScope trace("UpdateAudioObjectLimits", "adm");
+      adm->UpdateAudioObjectLimits();
+    }
 
     BBCDEBUG1(("Creating ADM RIFF chunks"));
 
     // get ADM object to create chna chunk
-    if ((chna = adm->GetChna(chnalen)) != NULL)
     {
-      // and add it to the RIFF file
-      if ((chunk = GetChunk(chna_ID)) != NULL)
+      TraceScope trace("GetChna", "adm");
+      chna = adm->GetChna(chnalen);
+    }
+    if (chna)
+    {
+      // and add it to the RIFF file (when appending, the chunk is after the samples so its size can change)
+      if (((chunk = GetChunk(chna_ID)) != NULL) || (appending && ((chunk = AddChunk(chna_ID)) != NULL)))
       {
-        if (!chunk->UpdateChunkData(chna, chnalen)) BBCERROR("Failed to update chna data (possibly length has changed)");
+        if (appending) chunk->CreateChunkData(chna, chnalen);
+        else if (!chunk->UpdateChunkData(chna, chnalen)) BBCERROR("Failed to update chna data (possibly length has changed)");
       }
       else BBCERROR("Failed to add chna chunk");
 
@@ -225,13 +372,18 @@ void ADMRIFFFile::Close(bool abortwrite)
     else BBCERROR("No chna data available");
 
     // add axml chunk
-    if ((chunk = GetChunk(axml_ID)) != NULL)
+    if (((chunk = GetChunk(axml_ID)) != NULL) || (appending && ((chunk = AddChunk(axml_ID)) != NULL)))
     {
+      TraceScope trace("GenerateAxml", "adm");
+
       // first, calculate size of ADM (to save lots of memory allocations)
       uint64_t admlen = adm->GetAxmlBuffer(NULL, 0);
 
       BBCDEBUG1(("ADM size is %s bytes", StringFrom(admlen).c_str()));
-      
+
+      // existing axml data cannot be shrunk so discard it
+      if (appending) chunk->DeleteData();
+
       // allocate chunk data
       if (chunk->CreateChunkData(admlen))
       {
@@ -255,10 +407,18 @@ void ADMRIFFFile::Close(bool abortwrite)
 
   if (adm)
   {
+    TraceScope trace("DeleteADM", "adm");
+
     adm->Delete();
     delete adm;
     adm = NULL;
   }
+  admcopied = false;
+
+  if (lastsegmentcallback)
+  {
+    segmentconfig.segmentcallback(lastsegment.filename, lastsegment.startsample, lastsegment.nsamples, segmentconfig.callbackcontext);
+  }
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -482,4 +642,595 @@ void ADMRIFFFile::SetObjectParameters(uint_t channel, const AudioObjectParameter
   }
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Return default segmented recording configuration (one hour segments, no size limit)
+ */
+/*--------------------------------------------------------------------------------*/
+ADMRIFFFile::SEGMENTCONFIG ADMRIFFFile::GetDefaultSegmentConfig()
+{
+  SEGMENTCONFIG config;
+
+  config.segmenttime      = 3600.0;
+  config.segmentbytes     = 0;
+  config.preparetime      = 30.0;
+  config.settimereference = false;
+  config.timereference    = 0;
+  config.alignsegments    = false;
+  config.segmentcallback  = NULL;
+  config.callbackcontext  = NULL;
+
+  return config;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable segmented recording
+ *
+ * @param config segment length limits, bext time reference and callback
+ *
+ * @note this MUST be called before Create() for the time reference to be set on the first segment
+ * @note segmented recording is disabled when the file is closed
+ */
+/*--------------------------------------------------------------------------------*/
+void ADMRIFFFile::EnableSegmentedRecording(const SEGMENTCONFIG& config)
+{
+  if (!segmentsstarted)
+  {
+    segmentconfig = config;
+    segmenting    = true;
+
+    if (segmentconfig.settimereference) SetTimeReference(segmentconfig.timereference);
+  }
+  else BBCERROR("Cannot change segment configuration once segmented recording has started");
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return true if the next segment has been created by the segment thread and is
+ * waiting to be switched to at the boundary
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::IsNextSegmentReady() const
+{
+  ThreadLock lock(segmentlock);
+  return (nextsegment != NULL);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write sample frames, moving to a new segment at segment boundaries if enabled
+ *
+ * @param buffer source buffer
+ * @param type desired sample buffer format
+ * @param nframes number of sample frames to write
+ *
+ * @return number of frames written or -1 for an error (no open file for example)
+ */
+/*--------------------------------------------------------------------------------*/
+sint_t ADMRIFFFile::WriteSamples(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes)
+{
+  if (segmenting && !segmentsstarted) StartSegmenting();
+
+  if (!segmenting) return RIFFFile::WriteSamples(buffer, type, srcchannel, nsrcchannels, nsrcframes);
+
+  const uint_t bytesperframe = nsrcchannels * bbcat::GetBytesPerSample(type);
+  sint_t total = 0;
+
+  while (nsrcframes && filesamples)
+  {
+    uint_t n = (uint_t)std::min((uint64_t)nsrcframes, PrepareSegmentWrite());
+    sint_t res;
+
+    if ((res = RIFFFile::WriteSamples(buffer, type, srcchannel, nsrcchannels, n)) < 0)
+    {
+      if (!total) total = res;
+      break;
+    }
+
+    total      += res;
+    buffer     += res * bytesperframe;
+    nsrcframes -= res;
+
+    if ((uint_t)res < n) break;
+  }
+
+  return total;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write sample frames from separate (planar) buffers, moving to a new segment at segment
+ * boundaries if enabled
+ *
+ * @param src array of source buffers, one for each channel (NULL entries write silence)
+ * @param srcoffset offset in frames into each source buffer
+ * @param nsrcframes number of sample frames to write
+ *
+ * @return number of frames written or -1 for an error (no open file for example)
+ */
+/*--------------------------------------------------------------------------------*/
+sint_t ADMRIFFFile::WriteSamplesPlanar(const Sample_t *const *src, uint_t srcoffset, uint_t nsrcframes)
+{
+  if (segmenting && !segmentsstarted) StartSegmenting();
+
+  if (!segmenting) return RIFFFile::WriteSamplesPlanar(src, srcoffset, nsrcframes);
+
+  sint_t total = 0;
+
+  while (nsrcframes && filesamples)
+  {
+    uint_t n = (uint_t)std::min((uint64_t)nsrcframes, PrepareSegmentWrite());
+    sint_t res;
+
+    if ((res = RIFFFile::WriteSamplesPlanar(src, srcoffset, n)) < 0)
+    {
+      if (!total) total = res;
+      break;
+    }
+
+    total      += res;
+    srcoffset  += res;
+    nsrcframes -= res;
+
+    if ((uint_t)res < n) break;
+  }
+
+  return total;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Capture file parameters used to create subsequent segments and start the segment thread
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::StartSegmenting()
+{
+  EnhancedFile *file = fileref;
+  bool success = false;
+
+  if (file && writing && fileformat)
+  {
+    uint64_t timeframes  = (uint64_t)(segmentconfig.segmenttime * (double)GetSampleRate());
+    uint64_t bytesframes = segmentconfig.segmentbytes / fileformat->GetBytesPerFrame();
+
+    segmentfilename          = file->getfilename();
+    segmentsamplerate        = GetSampleRate();
+    segmentchannels          = GetChannels();
+    segmentformat            = GetSampleFormat();
+    segmentbackgroundconfig  = backgroundconfig;
+    segmentbackgroundwriting = backgroundwriting;
+    segmentmapconfig         = mapconfig;
+    segmentmappedwriting     = mappedwriting;
+    segmentoverrun           = false;
+    segmentoverruns          = 0;
+
+    segmentchna.clear();
+    segmentaxml.clear();
+
+    if (adm)
+    {
+      TraceScope trace("CopyADM", "adm");
+      uint64_t chnalen, axmllen;
+      uint8_t  *chna;
+
+      // copy ADM (without any samples written, this is the structure of the ADM plus any initial parameters) for subsequent segments
+      if ((chna = adm->GetChna(chnalen)) != NULL)
+      {
+        segmentchna.assign(chna, chna + chnalen);
+        free(chna);
+
+        if ((axmllen = adm->GetAxmlBuffer(NULL, 0)) > 0)
+        {
+          std::vector<uint8_t> axml(axmllen + 1);
+
+          axmllen = adm->GetAxmlBuffer(&axml[0], axmllen);
+          segmentaxml.assign((const char *)&axml[0], axmllen);
+        }
+      }
+
+      if (segmentchna.empty() || segmentaxml.empty())
+      {
+        BBCERROR("Failed to copy ADM for subsequent segments, they will use a new ADM");
+        segmentchna.clear();
+        segmentaxml.clear();
+      }
+    }
+
+    // segment length is the smaller of the two limits (either of which may be disabled)
+    segmentframes = (timeframes && bytesframes) ? std::min(timeframes, bytesframes) : std::max(timeframes, bytesframes);
+    prepareframes = (uint64_t)(segmentconfig.preparetime * (double)GetSampleRate());
+    segmentstart  = 0;
+    segmentindex  = 0;
+
+    if (segmentframes)
+    {
+      segmentlength = GetSegmentLength(segmentstart);
+
+      BBCDEBUG1(("Segmenting '%s' every %s samples (first segment %s samples)", segmentfilename.c_str(), StringFrom(segmentframes).c_str(), StringFrom(segmentlength).c_str()));
+
+      if (segmentthread.Start(&__SegmentThread, (void *)this)) success = true;
+      else BBCERROR("Failed to start segment thread, segmented recording disabled");
+    }
+    else BBCERROR("No segment time or size specified, segmented recording disabled");
+  }
+  else BBCERROR("Segmented recording requires a file being written");
+
+  segmentsstarted = true;
+  segmenting      = success;
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Stop the segment thread, close any completed segments and delete any unused segment
+ */
+/*--------------------------------------------------------------------------------*/
+void ADMRIFFFile::StopSegmenting()
+{
+  uint_t i;
+
+  // stop thread (any segment currently being created or closed will be completed)
+  if (segmentthread.IsRunning())
+  {
+    segmentthread.Stop(false);
+    segmentsignal.Signal();
+    segmentthread.Stop();
+  }
+
+  for (i = 0; i < closingsegments.size(); i++)
+  {
+    CloseSegment(closingsegments[i]);
+  }
+  closingsegments.clear();
+
+  segmentchna.clear();
+  segmentaxml.clear();
+
+  if (nextsegment)
+  {
+    // unused segment: abort writing and delete the file
+    std::string filename = nextsegment->GetFile() ? nextsegment->GetFile()->getfilename() : "";
+
+    nextsegment->Close(true);
+    delete nextsegment;
+    nextsegment = NULL;
+
+    if (!filename.empty()) remove(filename.c_str());
+  }
+
+  segmenting           = false;
+  segmentsstarted      = false;
+  nextsegmentrequested = false;
+  creatingsegment      = false;
+  segmentfailed        = false;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return filename of specified segment
+ */
+/*--------------------------------------------------------------------------------*/
+std::string ADMRIFFFile::GetSegmentFilename(uint_t index) const
+{
+  std::string filename = segmentfilename;
+
+  if (index)
+  {
+    size_t ext = filename.rfind('.');
+    size_t sep = filename.find_last_of("/\\");
+    std::string suffix;
+
+    // insert segment number before extension (if there is one)
+    if ((ext == std::string::npos) || ((sep != std::string::npos) && (ext < sep))) ext = filename.size();
+
+    Printf(suffix, "-%04u", index);
+    filename.insert(ext, suffix);
+  }
+
+  return filename;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return length in samples of segment starting at specified sample
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t ADMRIFFFile::GetSegmentLength(uint64_t startsample) const
+{
+  uint64_t length = segmentframes;
+
+  if (segmentconfig.alignsegments)
+  {
+    uint64_t period = (uint64_t)(segmentconfig.segmenttime * (double)segmentsamplerate);
+
+    // end segment at the next multiple of the segment time (relative to midnight)
+    if (period) length = std::min(length, period - ((segmentconfig.timereference + startsample) % period));
+  }
+
+  return length;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create, prepare and preallocate a segment
+ *
+ * @note this is called from the segment thread so must only use the parameters
+ * @note captured by StartSegmenting()
+ */
+/*--------------------------------------------------------------------------------*/
+ADMRIFFFile *ADMRIFFFile::CreateSegment(uint_t index, uint64_t startsample) const
+{
+  ADMRIFFFile *file;
+  std::string filename = GetSegmentFilename(index);
+
+  if ((file = new ADMRIFFFile) != NULL)
+  {
+    bool success;
+
+    file->EnableBackgroundWriting(segmentbackgroundwriting, segmentbackgroundconfig);
+    file->EnableMappedWriting(segmentmappedwriting, segmentmapconfig);
+
+    if (segmentconfig.settimereference) file->SetTimeReference(segmentconfig.timereference + startsample);
+
+    if (!segmentchna.empty()) success = file->CreateADMFromCopy(&segmentchna[0], segmentchna.size(), segmentaxml.c_str(), admstandarddefinitions);
+    else if (!admfile.empty()) success = file->CreateADMFromFile(admfile, admstandarddefinitions);
+    else                       success = file->CreateADM(admstandarddefinitions);
+
+    if (success && file->Create(filename.c_str(), segmentsamplerate, segmentchannels, segmentformat))
+    {
+      BackgroundWriteFile *bfile;
+
+      // reserve space for the sample data of the whole segment
+      if ((bfile = dynamic_cast<BackgroundWriteFile *>(file->GetFile())) != NULL)
+      {
+        bfile->Preallocate(GetSegmentLength(startsample) * segmentchannels * bbcat::GetBytesPerSample(segmentformat));
+      }
+
+      BBCDEBUG2(("Created segment %u '%s' starting at sample %s", index, filename.c_str(), StringFrom(startsample).c_str()));
+    }
+    else
+    {
+      BBCERROR("Failed to create segment '%s'", filename.c_str());
+      delete file;
+      file = NULL;
+    }
+  }
+
+  return file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Close a completed segment
+ */
+/*--------------------------------------------------------------------------------*/
+void ADMRIFFFile::CloseSegment(CLOSINGSEGMENT& segment) const
+{
+  BBCDEBUG2(("Closing segment '%s' (%s samples)", segment.filename.c_str(), StringFrom(segment.nsamples).c_str()));
+
+  segment.file->Close();
+  delete segment.file;
+  segment.file = NULL;
+
+  if (segmentconfig.segmentcallback) segmentconfig.segmentcallback(segment.filename, segment.startsample, segment.nsamples, segmentconfig.callbackcontext);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return buffer that sample frames can be written into directly, moving to a new segment
+ * at segment boundaries if enabled
+ *
+ * @param frames number of frames required, updated with the number of frames that can be
+ * written (limited to the end of the current segment)
+ *
+ * @return pointer to buffer or NULL
+ */
+/*--------------------------------------------------------------------------------*/
+uint8_t *ADMRIFFFile::GetWriteBuffer(uint_t& frames)
+{
+  if (segmenting && !segmentsstarted) StartSegmenting();
+
+  if (segmenting && filesamples) frames = (uint_t)std::min((uint64_t)frames, PrepareSegmentWrite());
+
+  return RIFFFile::GetWriteBuffer(frames);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request the next segment ahead of the boundary and switch to it at the boundary
+ *
+ * @return number of frames that can be written to the current segment
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t ADMRIFFFile::PrepareSegmentWrite()
+{
+  uint64_t pos = filesamples->GetSampleLength();
+
+  // request creation of the next segment in the background ahead of the boundary
+  if (!nextsegmentrequested && ((pos + prepareframes) >= segmentlength))
+  {
+    {
+      ThreadLock lock(segmentlock);
+
+      nextsegmentindex     = segmentindex + 1;
+      nextsegmentstart     = segmentstart + segmentlength;
+      nextsegmentrequested = true;
+    }
+
+    segmentsignal.Signal();
+  }
+
+  if ((pos >= segmentlength) && StartNextSegment()) pos = filesamples->GetSampleLength();
+
+  // until the next segment is ready, carry on writing to the current segment rather than wait or lose samples
+  return (pos < segmentlength) ? segmentlength - pos : ~(uint64_t)0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Switch writing to the next segment, splitting block formats at the boundary
+ *
+ * @return true if writing has switched to the next segment
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::StartNextSegment()
+{
+  ADMRIFFFile *next = NULL;
+  bool failed  = false;
+  bool success = false;
+
+  // take the next segment if the segment thread has created it
+  {
+    ThreadLock lock(segmentlock);
+
+    next        = nextsegment;
+    nextsegment = NULL;
+    failed      = segmentfailed;
+  }
+
+  if (next)
+  {
+    std::vector<AudioObjectParameters> parameters(cursors.size());
+    std::vector<bool> valid(cursors.size());
+    CLOSINGSEGMENT segment;
+    uint64_t endtime = filesamples ? filesamples->GetAbsolutePositionNS() : 0;
+    uint_t i;
+
+    // capture the parameters in effect at the boundary on each channel
+    for (i = 0; i < cursors.size(); i++)
+    {
+      cursors[i]->Seek(endtime);
+      valid[i] = cursors[i]->GetObjectParameters(parameters[i]);
+    }
+
+    segment.filename    = fileref.Obj() ? fileref.Obj()->getfilename() : "";
+    segment.startsample = segmentstart;
+    segment.nsamples    = GetSampleLength();
+
+    if (segmentoverrun)
+    {
+      BBCDEBUG("Segment %u started %s samples after its boundary", segmentindex + 1, StringFrom(segment.nsamples - segmentlength).c_str());
+      segmentoverrun = false;
+    }
+
+    // switch to new segment, next now holds the completed segment (whose block formats will be ended when it is closed)
+    Swap(*next);
+    segment.file = next;
+
+    segmentstart += segment.nsamples;
+    segmentindex++;
+    segmentlength = GetSegmentLength(segmentstart);
+
+    // segment may have started later than it was created for
+    if (segmentconfig.settimereference) SetTimeReference(segmentconfig.timereference + segmentstart);
+
+    // continue block formats at the start of the new segment
+    PrepareCursors();
+    for (i = 0; i < std::min(cursors.size(), parameters.size()); i++)
+    {
+      if (valid[i])
+      {
+        cursors[i]->Seek(0);
+        cursors[i]->SetObjectParameters(parameters[i]);
+      }
+    }
+
+    BBCDEBUG1(("Switched to segment %u at sample %s", segmentindex, StringFrom(segmentstart).c_str()));
+
+    {
+      ThreadLock lock(segmentlock);
+      closingsegments.push_back(segment);
+      nextsegmentrequested = false;
+    }
+
+    // segment thread closes the completed segment
+    segmentsignal.Signal();
+    success = true;
+  }
+  else if (failed)
+  {
+    BBCERROR("Failed to create segment %u, extending current segment", segmentindex + 1);
+
+    // retry at the next boundary
+    segmentlength += segmentframes;
+    segmentoverrun = false;
+
+    ThreadLock lock(segmentlock);
+    nextsegmentrequested = false;
+    segmentfailed        = false;
+  }
+  else if (!segmentoverrun)
+  {
+    BBCDEBUG("Segment %u not ready at boundary, continuing current segment until it is", segmentindex + 1);
+
+    segmentoverrun = true;
+    segmentoverruns++;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Perform one piece of background segment work
+ *
+ * @return true if anything was done
+ */
+/*--------------------------------------------------------------------------------*/
+bool ADMRIFFFile::ProcessSegments()
+{
+  CLOSINGSEGMENT segment;
+  uint64_t startsample = 0;
+  uint_t   index = 0;
+  bool     create = false, close = false;
+
+  {
+    ThreadLock lock(segmentlock);
+
+    // creating the next segment takes priority over closing completed ones
+    if (nextsegmentrequested && !nextsegment && !creatingsegment && !segmentfailed)
+    {
+      index           = nextsegmentindex;
+      startsample     = nextsegmentstart;
+      creatingsegment = create = true;
+    }
+    else if (closingsegments.size())
+    {
+      segment = closingsegments.front();
+      closingsegments.erase(closingsegments.begin());
+      close = true;
+    }
+  }
+
+  if (create)
+  {
+    ADMRIFFFile *file = CreateSegment(index, startsample);
+
+    ThreadLock lock(segmentlock);
+    nextsegment     = file;
+    segmentfailed   = !file;
+    creatingsegment = false;
+  }
+
+  if (close) CloseSegment(segment);
+
+  return (create || close);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Segment thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *ADMRIFFFile::SegmentThread(Thread& thread)
+{
+  while (!thread.StopRequested())
+  {
+    uint64_t seen = segmentsignal.GetCount();
+
+    if (!ProcessSegments()) segmentsignal.Wait(seen, SignalTimeout);
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Exchange the file, chunks, ADM and cursors with another object
+ */
+/*--------------------------------------------------------------------------------*/
+void ADMRIFFFile::Swap(ADMRIFFFile& obj)
+{
+  RIFFFile::Swap(obj);
+
+  std::swap(adm,       obj.adm);
+  std::swap(cursors,   obj.cursors);
+  std::swap(admcopied, obj.admcopied);
+}
+
 BBC_AUDIOTOOLBOX_END
@@ -4,10 +4,13 @@
 #include <string>
 #include <map>
 
+#include <bbcat-base/Thread.h>
+#include <bbcat-base/ThreadLock.h>
 #include <bbcat-adm/AudioObjectCursor.h>
 
 #include "RIFFFile.h"
 #include "XMLADMData.h"
+#include "ThreadSignal.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -44,6 +47,21 @@ public:
   virtual bool Open(const char *filename) {return Open(filename, "");}
   virtual bool Open(const char *filename, const std::string& standarddefinitionsfile);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Re-open an existing ADM BWF file to append samples and ADM data to it
+   *
+   * @param filename filename of file to open
+   * @param standarddefinitionsfile filename of standard definitions XML file to use
+   *
+   * @return true if file opened and positioned at the end of the existing samples
+   *
+   * @note the existing ADM is read and new block formats written using the write cursors
+   * @note are merged into it, the axml and chna chunks are regenerated on Close()
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Append(const char *filename) {return Append(filename, "");}
+  virtual bool Append(const char *filename, const std::string& standarddefinitionsfile);
+
   /*--------------------------------------------------------------------------------*/
   /** Create empty ADM and populate basic track information
    *
@@ -103,6 +121,109 @@ public:
 
   ADMData *GetADM() const {return adm;}
 
+  typedef void (*SEGMENTCALLBACK)(const std::string& filename, uint64_t startsample, uint64_t nsamples, void *context);
+
+  typedef struct
+  {
+    double          segmenttime;        // maximum length of each segment in seconds (0 for no time limit)
+    uint64_t        segmentbytes;       // maximum size of sample data of each segment in bytes (0 for no size limit)
+    double          preparetime;        // how long before the boundary the next segment is created
+    bool            settimereference;   // true to add a bext chunk with the TimeReference of each segment
+    uint64_t        timereference;      // TimeReference (samples since midnight) of the first sample of the first segment
+    bool            alignsegments;      // true to align segment boundaries to multiples of the segment time relative to midnight
+    SEGMENTCALLBACK segmentcallback;    // called (from a background thread) when each segment has been closed
+    void            *callbackcontext;
+  } SEGMENTCONFIG;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return default segmented recording configuration (one hour segments, no size limit)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static SEGMENTCONFIG GetDefaultSegmentConfig();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable segmented recording
+   *
+   * @param config segment length limits, bext time reference and callback
+   *
+   * When enabled, writing continues seamlessly into a new file each time the current
+   * file reaches a segment boundary.  The next file is created in the background before the
+   * boundary is reached and each completed file is closed in the background.
+   *
+   * The first segment uses the filename given to Create(), subsequent segments have
+   * '-0001', '-0002', etc inserted before the extension.
+   *
+   * ADM for subsequent segments is a copy (through generated chna and axml) of the ADM of the
+   * first segment as it is when writing starts and the current object parameters of each
+   * channel are carried over into the new segment
+   *
+   * Writing never waits for the next segment: if it is not ready at a boundary, writing
+   * continues into the current segment until it is (see GetSegmentOverruns())
+   *
+   * @note this MUST be called before Create() for the time reference to be set on the first segment
+   * @note segmented recording is disabled when the file is closed
+   */
+  /*--------------------------------------------------------------------------------*/
+  void EnableSegmentedRecording(const SEGMENTCONFIG& config);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return index of segment currently being written (0 for the first)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetSegmentIndex() const {return segmentindex;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of segment boundaries at which the next segment was not ready (and so
+   * the previous segment was extended)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetSegmentOverruns() const {return segmentoverruns;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return true if the next segment has been created by the segment thread and is
+   * waiting to be switched to at the boundary
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsNextSegmentReady() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write sample frames, moving to a new segment at segment boundaries if enabled
+   *
+   * @param buffer source buffer
+   * @param type desired sample buffer format
+   * @param nframes number of sample frames to write
+   *
+   * @return number of frames written or -1 for an error (no open file for example)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual sint_t WriteSamples(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1);
+  using RIFFFile::WriteSamples;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write sample frames from separate (planar) buffers, moving to a new segment at segment
+   * boundaries if enabled
+   *
+   * @param src array of source buffers, one for each channel (NULL entries write silence)
+   * @param srcoffset offset in frames into each source buffer
+   * @param nsrcframes number of sample frames to write
+   *
+   * @return number of frames written or -1 for an error (no open file for example)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual sint_t WriteSamplesPlanar(const Sample_t *const *src, uint_t srcoffset, uint_t nsrcframes = 1);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer that sample frames can be written into directly, moving to a new segment
+   * at segment boundaries if enabled
+   *
+   * @param frames number of frames required, updated with the number of frames that can be
+   * written (limited to the end of the current segment)
+   *
+   * @return pointer to buffer or NULL
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint8_t *GetWriteBuffer(uint_t& frames);
+
   /*--------------------------------------------------------------------------------*/
   /** Return array of track cursors that are used during writing (ONLY)
    */
@@ -129,10 +250,144 @@ protected:
   /*--------------------------------------------------------------------------------*/
   virtual void UpdateSamplePosition();
 
+  typedef struct
+  {
+    ADMRIFFFile *file;
+    std::string filename;
+    uint64_t    startsample;
+    uint64_t    nsamples;
+  } CLOSINGSEGMENT;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Create ADM as a copy of another from its chna and axml data
+   *
+   * @param chna chna chunk data
+   * @param chnalength length of chna chunk data
+   * @param axml axml data
+   * @param standarddefinitionsfile filename of standard definitions XML file to use
+   *
+   * @return true if successful
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool CreateADMFromCopy(const uint8_t *chna, uint64_t chnalength, const char *axml, const std::string& standarddefinitionsfile);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Capture file parameters and a copy of the ADM used to create subsequent segments and
+   * start the segment thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool StartSegmenting();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Stop the segment thread, close any completed segments and delete any unused segment
+   */
+  /*--------------------------------------------------------------------------------*/
+  void StopSegmenting();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return filename of specified segment
+   */
+  /*--------------------------------------------------------------------------------*/
+  std::string GetSegmentFilename(uint_t index) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return length in samples of segment starting at specified sample
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetSegmentLength(uint64_t startsample) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Create, prepare and preallocate a segment
+   *
+   * @note this is called from the segment thread so must only use the parameters
+   * @note captured by StartSegmenting()
+   */
+  /*--------------------------------------------------------------------------------*/
+  ADMRIFFFile *CreateSegment(uint_t index, uint64_t startsample) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Close a completed segment
+   */
+  /*--------------------------------------------------------------------------------*/
+  void CloseSegment(CLOSINGSEGMENT& segment) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Switch writing to the next segment, splitting block formats at the boundary
+   *
+   * @return true if writing has switched to the next segment, false if it is not ready yet
+   *
+   * @note this never waits for the segment thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool StartNextSegment();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request the next segment ahead of the boundary and switch to it at the boundary
+   *
+   * @return number of frames that can be written to the current segment
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t PrepareSegmentWrite();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Perform one piece of background segment work
+   *
+   * @return true if anything was done
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ProcessSegments();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Segment thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__SegmentThread(Thread& thread, void *arg) {return ((ADMRIFFFile *)arg)->SegmentThread(thread);}
+  void *SegmentThread(Thread& thread);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Exchange the file, chunks, ADM and cursors with another object
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Swap(ADMRIFFFile& obj);
+
 protected:
   std::string admfile;
+  std::string admstandarddefinitions;
   XMLADMData  *adm;
   std::vector<ADMTrackCursor *> cursors;        // *only* used during writing an ADM file
+  bool        admcopied;                        // true if ADM (including tracks) was created by CreateADMFromCopy()
+
+  // segmented recording (NOT exchanged by Swap())
+  ThreadLockObject            segmentlock;
+  Thread                      segmentthread;
+  ThreadSignal                segmentsignal;    // signalled when a segment is requested or completed
+  SEGMENTCONFIG               segmentconfig;
+  std::string                 segmentfilename;  // filename of first segment
+  uint32_t                    segmentsamplerate;
+  uint_t                      segmentchannels;
+  SampleFormat_t              segmentformat;
+  BackgroundWriteFile::CONFIG segmentbackgroundconfig;
+  bool                        segmentbackgroundwriting;
+  BackgroundWriteFile::MAPCONFIG segmentmapconfig;
+  bool                        segmentmappedwriting;
+  std::vector<uint8_t>        segmentchna;      // copy of ADM for subsequent segments
+  std::string                 segmentaxml;
+  uint64_t                    segmentframes;    // nominal length of each segment in samples
+  uint64_t                    prepareframes;
+  uint64_t                    segmentstart;     // sample position of start of current segment relative to start of recording
+  uint64_t                    segmentlength;    // length of current segment
+  uint_t                      segmentindex;
+  ADMRIFFFile                 *nextsegment;
+  uint_t                      nextsegmentindex;
+  uint64_t                    nextsegmentstart;
+  std::vector<CLOSINGSEGMENT> closingsegments;
+  bool                        segmenting;
+  bool                        segmentsstarted;
+  bool                        nextsegmentrequested;
+  bool                        creatingsegment;
+  bool                        segmentfailed;
+  bool                        segmentoverrun;   // true whilst writing past a boundary waiting for the next segment
+  uint_t                      segmentoverruns;
 };
 
 BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,1035 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <chrono>
+
+#define BBCDEBUG_LEVEL 1
+#include "BackgroundWriteFile.h"
+#include "TraceEvents.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// longest wait for a signal before checking again (waits are woken by signals, this is only a backstop)
+static const std::chrono::milliseconds SignalTimeout(100);
+
+BackgroundWriteFile::BackgroundWriteFile() : EnhancedFile(),
+                                             config(GetDefaultConfig()),
+                                             lentblock(NULL),
+                                             spillend(0),
+                                             spillflushed(0),
+                                             bytespersecond(0),
+                                             mapconfig(GetDefaultMapConfig()),
+                                             mapdata(NULL),
+                                             mapsize(0),
+                                             maplength(0),
+                                             mappos(0),
+                                             mapdirtystart(0),
+                                             mapdirtyend(0),
+                                             maplentbytes(0),
+                                             mapfd(-1),
+                                             mapped(false),
+                                             maplent(false),
+                                             background(false),
+                                             abovehighwater(false),
+                                             writeerror(false)
+{
+  ResetStats();
+  stats.queuedbytes       = 0;
+  stats.spillpendingbytes = 0;
+  stats.queuelimit        = ~(uint64_t)0;
+}
+
+BackgroundWriteFile::~BackgroundWriteFile()
+{
+  fclose();
+
+  uint_t i;
+  for (i = 0; i < freeblocks.size(); i++)
+  {
+    delete freeblocks[i];
+  }
+
+  if (lentblock) delete lentblock;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return default configuration (10s, block when full)
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundWriteFile::CONFIG BackgroundWriteFile::GetDefaultConfig()
+{
+  CONFIG defconfig;
+
+  defconfig.buffertime        = 10.0;
+  defconfig.highwaterpercent  = 75;
+  defconfig.policy            = QueueFull_Block;
+  defconfig.highwatercallback = NULL;
+  defconfig.callbackcontext   = NULL;
+
+  return defconfig;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set queue configuration
+ *
+ * @note can be called at any time
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::SetConfig(const CONFIG& newconfig)
+{
+  ThreadLock lock(tlock);
+
+  config = newconfig;
+  config.highwaterpercent = std::min(config.highwaterpercent, 100U);
+
+  UpdateQueueLimit();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set the data rate of the file, used to convert the queue depth from time to bytes
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::SetBytesPerSecond(uint64_t bytes)
+{
+  ThreadLock lock(tlock);
+
+  bytespersecond = bytes;
+
+  UpdateQueueLimit();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Recalculate queue limit from buffer time and data rate
+ *
+ * @note MUST be called with lock held
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::UpdateQueueLimit()
+{
+  // without a data rate, the queue is unlimited
+  stats.queuelimit = bytespersecond ? std::max((uint64_t)((double)bytespersecond * config.buffertime), (uint64_t)1) : ~(uint64_t)0;
+
+  BBCDEBUG2(("Background write queue limit %s bytes (%0.3lfs at %s bytes/s)", StringFrom(stats.queuelimit).c_str(), config.buffertime, StringFrom(bytespersecond).c_str()));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable background writing
+ *
+ * @note disabling waits for all queued data to be written
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::EnableBackground(bool enable)
+{
+  if (enable && mapped)
+  {
+    BBCDEBUG2(("Mapped writing enabled for '%s', not enabling background writing", getfilename().c_str()));
+  }
+  else if (enable && !background && isopen())
+  {
+    if (thread.IsRunning() || thread.Start(&__WriteThread, (void *)this))
+    {
+      background = true;
+    }
+    else BBCERROR("Failed to start background writing thread for '%s', writing in foreground", getfilename().c_str());
+  }
+  else if (!enable && background)
+  {
+    WaitForQueue();
+    background = false;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return default mapping configuration (64MB extents, checkpoint every 16MB)
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundWriteFile::MAPCONFIG BackgroundWriteFile::GetDefaultMapConfig()
+{
+  MAPCONFIG defconfig;
+
+  defconfig.extentbytes     = (uint64_t)64 << 20;
+  defconfig.checkpointbytes = (uint64_t)16 << 20;
+
+  return defconfig;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable writing through a memory mapping
+ *
+ * @param enable true to write through a mapping
+ * @param mapconfig extent and checkpoint sizes
+ *
+ * @return true if the requested mode is in effect (not supported on all platforms)
+ *
+ * @note enabling disables background writing
+ * @note disabling truncates the file to the amount of data written
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::EnableMapping(bool enable, const MAPCONFIG& newmapconfig)
+{
+  bool success = (enable == mapped);
+
+#ifndef _WIN32
+  if (enable && !mapped && isopen())
+  {
+    off_t pos, end;
+
+    EnableBackground(false);
+
+    // flush stream and find current position and length of file (the stream is not used whilst mapped)
+    if ((EnhancedFile::fflush() == 0) &&
+        ((pos = EnhancedFile::ftell()) >= 0) &&
+        (EnhancedFile::fseek(0, SEEK_END) == 0) &&
+        ((end = EnhancedFile::ftell()) >= 0) &&
+        ((mapfd = ::open(getfilename().c_str(), O_RDWR)) >= 0))
+    {
+      uint64_t pagesize = (uint64_t)sysconf(_SC_PAGESIZE);
+
+      // extents must be whole pages
+      mapconfig             = newmapconfig;
+      mapconfig.extentbytes = std::max((mapconfig.extentbytes + pagesize - 1) & ~(pagesize - 1), pagesize);
+
+      mapdata       = NULL;
+      mapsize       = 0;
+      maplength     = end;
+      mappos        = pos;
+      mapdirtystart = mapdirtyend = 0;
+
+      if (GrowMapping(maplength))
+      {
+        BBCDEBUG1(("Writing '%s' through mapping (%s byte extents)", getfilename().c_str(), StringFrom(mapconfig.extentbytes).c_str()));
+        mapped  = true;
+        success = true;
+      }
+      else
+      {
+        ::close(mapfd);
+        mapfd = -1;
+        EnhancedFile::fseek(pos, SEEK_SET);
+      }
+    }
+    else BBCERROR("Failed to prepare '%s' for mapping (%s)", getfilename().c_str(), strerror(errno));
+  }
+  else if (!enable && mapped) success = Unmap();
+#else
+  UNUSED_PARAMETER(newmapconfig);
+  if (enable) BBCERROR("Mapped writing not supported on this platform");
+#endif
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Ensure the mapping covers the file up to the specified offset, growing the file by
+ * whole extents if necessary
+ *
+ * @note invalidates any pointers into the mapping
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::GrowMapping(uint64_t end)
+{
+  bool success = (mapdata && (end <= mapsize));
+
+#ifndef _WIN32
+  if (!success)
+  {
+    uint64_t newsize = ((end / mapconfig.extentbytes) + 1) * mapconfig.extentbytes;
+    void     *data;
+
+    // flush modified region before the mapping is replaced
+    SyncMapping(false);
+
+    if (mapdata)
+    {
+      munmap(mapdata, mapsize);
+      mapdata = NULL;
+      mapsize = 0;
+    }
+
+    if (ftruncate(mapfd, (off_t)newsize) == 0)
+    {
+      if ((data = mmap(NULL, newsize, PROT_READ | PROT_WRITE, MAP_SHARED, mapfd, 0)) != MAP_FAILED)
+      {
+        BBCDEBUG3(("Mapped %s bytes of '%s'", StringFrom(newsize).c_str(), getfilename().c_str()));
+        mapdata = (uint8_t *)data;
+        mapsize = newsize;
+        success = true;
+      }
+      else BBCERROR("Failed to map %s bytes of '%s' (%s)", StringFrom(newsize).c_str(), getfilename().c_str(), strerror(errno));
+    }
+    else BBCERROR("Failed to extend '%s' to %s bytes (%s)", getfilename().c_str(), StringFrom(newsize).c_str(), strerror(errno));
+
+    if (!success) writeerror = true;
+  }
+#endif
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Record region of mapping as modified, flushing it if the checkpoint size is reached
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::MarkMappingDirty(uint64_t start, uint64_t end)
+{
+  if (mapdirtyend > mapdirtystart)
+  {
+    mapdirtystart = std::min(mapdirtystart, start);
+    mapdirtyend   = std::max(mapdirtyend,   end);
+  }
+  else
+  {
+    mapdirtystart = start;
+    mapdirtyend   = end;
+  }
+
+  if (mapconfig.checkpointbytes && ((mapdirtyend - mapdirtystart) >= mapconfig.checkpointbytes)) SyncMapping(false);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Flush modified region of mapping to disk
+ *
+ * @param wait true to wait for the data to be written (otherwise the flush is only scheduled)
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::SyncMapping(bool wait)
+{
+  bool success = true;
+
+#ifndef _WIN32
+  if (mapdata && (mapdirtyend > mapdirtystart))
+  {
+    TraceScope trace("SyncMapping", "writer");
+
+    // msync() requires a page aligned start address
+    uint64_t start = mapdirtystart & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+    uint64_t end   = std::min(mapdirtyend, mapsize);
+    uint64_t t     = GetNanosecondTicks();
+
+    if (msync(mapdata + start, end - start, wait ? MS_SYNC : MS_ASYNC) != 0)
+    {
+      BBCERROR("Failed to flush mapping of '%s' (%s)", getfilename().c_str(), strerror(errno));
+      success = false;
+    }
+
+    ThreadLock lock(tlock);
+    stats.writelatency.Add(GetNanosecondTicks() - t);
+  }
+#else
+  UNUSED_PARAMETER(wait);
+#endif
+
+  mapdirtystart = mapdirtyend = 0;
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Remove mapping, truncate file to its real length and restore stream position
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::Unmap()
+{
+  bool success = true;
+
+#ifndef _WIN32
+  if (mapped)
+  {
+    if (maplent) BBCERROR("Mapping of '%s' removed with write buffer outstanding", getfilename().c_str());
+
+    SyncMapping(false);
+
+    if (mapdata) munmap(mapdata, mapsize);
+
+    if (ftruncate(mapfd, (off_t)maplength) != 0)
+    {
+      BBCERROR("Failed to truncate '%s' to %s bytes (%s)", getfilename().c_str(), StringFrom(maplength).c_str(), strerror(errno));
+      success = false;
+    }
+
+    ::close(mapfd);
+
+    mapdata = NULL;
+    mapsize = 0;
+    mapfd   = -1;
+    mapped  = maplent = false;
+
+    // continue using the stream from the same position
+    success &= (EnhancedFile::fseek((off_t)mappos, SEEK_SET) == 0);
+  }
+#endif
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return snapshot of live statistics
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::GetStats(STATS& _stats) const
+{
+  ThreadLock lock(tlock);
+
+  _stats = stats;
+  _stats.oldestagens = queue.size() ? (GetNanosecondTicks() - queue.front()->queuedat) : 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset counters and histograms (but not queue state)
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::ResetStats()
+{
+  ThreadLock lock(tlock);
+
+  stats.peakqueuedbytes = stats.queuedbytes;
+  stats.oldestagens     = 0;
+  stats.writtenbytes    = 0;
+  stats.droppedbytes    = 0;
+  stats.droppedblocks   = 0;
+  stats.spilledbytes    = 0;
+  stats.highwaterevents = 0;
+  stats.blockedns       = 0;
+  stats.queuelatency.Reset();
+  stats.writelatency.Reset();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reserve disk space beyond the current end of the file without changing its length
+ *
+ * @param bytes number of bytes to reserve
+ *
+ * @return true if space was reserved (not supported on all platforms)
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::Preallocate(uint64_t bytes)
+{
+  bool success = false;
+
+#ifdef __linux__
+  int fd;
+
+  // use a separate descriptor so that the stream's buffering and position are not affected
+  if (isopen() && !mapped && ((fd = ::open(getfilename().c_str(), O_WRONLY)) >= 0))
+  {
+    off_t end = lseek(fd, 0, SEEK_END);
+
+    // FALLOC_FL_KEEP_SIZE allocates the blocks but leaves the file length unchanged
+    if ((end >= 0) && (fallocate(fd, FALLOC_FL_KEEP_SIZE, end, (off_t)bytes) == 0))
+    {
+      BBCDEBUG2(("Preallocated %s bytes for '%s'", StringFrom(bytes).c_str(), getfilename().c_str()));
+      success = true;
+    }
+    else BBCDEBUG("Failed to preallocate %s bytes for '%s' (%s)", StringFrom(bytes).c_str(), getfilename().c_str(), strerror(errno));
+
+    ::close(fd);
+  }
+#else
+  UNUSED_PARAMETER(bytes);
+#endif
+
+  return success;
+}
+
+bool BackgroundWriteFile::fopen(const char *filename, const char *mode)
+{
+  fclose();
+
+  writeerror = false;
+
+  return EnhancedFile::fopen(filename, mode);
+}
+
+void BackgroundWriteFile::fclose()
+{
+  Unmap();
+
+  if (thread.IsRunning())
+  {
+    WaitForQueue();
+
+    // request stop and wake thread
+    thread.Stop(false);
+    queuedsignal.Signal();
+    thread.Stop();
+  }
+  background = false;
+
+  if (spillwriter.isopen()) spillwriter.fclose();
+  if (spillreader.isopen()) spillreader.fclose();
+  if (!spillfilename.empty())
+  {
+    remove(spillfilename.c_str());
+    spillfilename = "";
+  }
+  spillend     = 0;
+  spillflushed = 0;
+
+  EnhancedFile::fclose();
+}
+
+size_t BackgroundWriteFile::fread(void *ptr, size_t size, size_t count)
+{
+  if (mapped)
+  {
+    count = size ? (size_t)std::min((uint64_t)count, (maplength - std::min(mappos, maplength)) / size) : 0;
+    if (count && mapdata) memcpy(ptr, mapdata + mappos, size * count);
+    mappos += size * count;
+    return count;
+  }
+
+  WaitForQueue();
+  return EnhancedFile::fread(ptr, size, count);
+}
+
+off_t BackgroundWriteFile::ftell()
+{
+  if (mapped) return (off_t)mappos;
+
+  WaitForQueue();
+  return EnhancedFile::ftell();
+}
+
+int BackgroundWriteFile::fseek(off_t offset, int origin)
+{
+  if (mapped)
+  {
+    sint64_t pos = offset;
+
+    if      (origin == SEEK_CUR) pos += mappos;
+    else if (origin == SEEK_END) pos += maplength;
+
+    if (pos < 0) return -1;
+
+    mappos = pos;
+    return 0;
+  }
+
+  WaitForQueue();
+  return EnhancedFile::fseek(offset, origin);
+}
+
+void BackgroundWriteFile::rewind()
+{
+  if (mapped)
+  {
+    mappos = 0;
+    return;
+  }
+
+  WaitForQueue();
+  EnhancedFile::rewind();
+}
+
+int BackgroundWriteFile::fflush()
+{
+  // in mapped mode, a flush is a checkpoint
+  if (mapped) return SyncMapping(true) ? 0 : EOF;
+
+  WaitForQueue();
+  return EnhancedFile::fflush();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write data, queueing it if background writing is enabled
+ */
+/*--------------------------------------------------------------------------------*/
+size_t BackgroundWriteFile::fwrite(const void *ptr, size_t size, size_t count)
+{
+  size_t bytes = size * count;
+
+  // foreground writing
+  if (!background) return size ? WriteToFile(ptr, bytes) / size : 0;
+
+  // report errors from background thread as a failed write
+  if (writeerror) return 0;
+
+  BLOCK *block;
+  if ((block = GetFreeBlock()) == NULL)
+  {
+    BBCERROR("Failed to allocate background write block for '%s'", getfilename().c_str());
+    return 0;
+  }
+
+  return (QueueBlock(block, ptr, bytes) == bytes) ? count : 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return buffer that the caller can write data into directly
+ *
+ * @param bytes number of bytes required
+ *
+ * @return pointer to buffer (valid until CommitWriteBuffer() is called) or NULL
+ *
+ * @note in background mode the buffer is the block that will be queued so the
+ * @note data is not copied again before being written to disk
+ */
+/*--------------------------------------------------------------------------------*/
+uint8_t *BackgroundWriteFile::GetWriteBuffer(size_t bytes)
+{
+  uint8_t *buffer = NULL;
+
+  if (writeerror) return NULL;
+
+  if (mapped)
+  {
+    // lend the mapping itself
+    if (GrowMapping(mappos + bytes))
+    {
+      buffer       = mapdata + mappos;
+      maplentbytes = bytes;
+      maplent      = true;
+    }
+  }
+  else if (lentblock || ((lentblock = GetFreeBlock()) != NULL))
+  {
+    // vector only reallocates if the block's capacity is too small
+    lentblock->data.resize(std::max(bytes, (size_t)1));
+    buffer = &lentblock->data[0];
+  }
+  else BBCERROR("Failed to allocate write buffer for '%s'", getfilename().c_str());
+
+  return buffer;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write or queue data previously written into the buffer returned by GetWriteBuffer()
+ *
+ * @param bytes number of bytes to commit (may be less than requested)
+ *
+ * @return number of bytes written/queued
+ */
+/*--------------------------------------------------------------------------------*/
+size_t BackgroundWriteFile::CommitWriteBuffer(size_t bytes)
+{
+  BLOCK  *block = lentblock;
+  size_t res    = 0;
+
+  if (maplent)
+  {
+    maplent = false;
+    res     = std::min(bytes, maplentbytes);
+
+    MarkMappingDirty(mappos, mappos + res);
+    mappos   += res;
+    maplength = std::max(maplength, mappos);
+
+    ThreadLock lock(tlock);
+    stats.writtenbytes += res;
+  }
+  else if (block)
+  {
+    lentblock = NULL;
+    bytes     = std::min(bytes, block->data.size());
+
+    if (background && !writeerror && bytes) res = QueueBlock(block, NULL, bytes);
+    else
+    {
+      if (!writeerror && bytes) res = WriteToFile(&block->data[0], bytes);
+
+      ThreadLock lock(tlock);
+      freeblocks.push_back(block);
+    }
+  }
+  else BBCERROR("CommitWriteBuffer() called without GetWriteBuffer() for '%s'", getfilename().c_str());
+
+  return res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Queue block for writing, applying the queue full policy
+ *
+ * @param block block to queue
+ * @param ptr data to be copied into block or NULL if the block already contains the data
+ * @param bytes number of bytes
+ *
+ * @return number of bytes queued (dropped data is counted as queued)
+ */
+/*--------------------------------------------------------------------------------*/
+size_t BackgroundWriteFile::QueueBlock(BLOCK *block, const void *ptr, size_t bytes)
+{
+  uint64_t          now = GetNanosecondTicks();
+  QueueFullPolicy_t policy;
+  HIGHWATERCALLBACK highwatercallback = NULL;
+  void              *callbackcontext = NULL;
+  bool              full, callback = false;
+  STATS             cbstats;
+
+  {
+    ThreadLock lock(tlock);
+    // a single write larger than the queue is allowed if the queue is empty
+    full   = (stats.queuedbytes && ((stats.queuedbytes + bytes) > stats.queuelimit));
+    // configuration may be changed by SetConfig() from another thread
+    policy = config.policy;
+  }
+
+  if (full && (policy == QueueFull_Block))
+  {
+    BBCDEBUG2(("Background write queue full for '%s', waiting", getfilename().c_str()));
+
+    // wait for the writing thread to free space in the queue
+    while (true)
+    {
+      uint64_t seen = writtensignal.GetCount();
+
+      {
+        ThreadLock lock(tlock);
+        full = (stats.queuedbytes && ((stats.queuedbytes + bytes) > stats.queuelimit));
+      }
+
+      if (!full || writeerror) break;
+
+      writtensignal.Wait(seen, SignalTimeout);
+    }
+
+    ThreadLock lock(tlock);
+    stats.blockedns += GetNanosecondTicks() - now;
+    now = GetNanosecondTicks();
+  }
+
+  block->length   = bytes;
+  block->queuedat = now;
+  block->spillpos = 0;
+  block->type     = Block_Data;
+
+  if (full && (policy == QueueFull_Spill) && SpillData(ptr ? ptr : &block->data[0], bytes, block->spillpos))
+  {
+    block->type = Block_Spilled;
+  }
+  else if (full && (policy != QueueFull_Block))
+  {
+    // drop data (also used if spilling fails)
+    block->type = Block_Dropped;
+  }
+  else if (ptr)
+  {
+    block->data.resize(bytes);
+    memcpy(&block->data[0], ptr, bytes);
+  }
+
+  {
+    ThreadLock lock(tlock);
+
+    switch (block->type)
+    {
+      case Block_Data:
+        stats.queuedbytes    += bytes;
+        stats.peakqueuedbytes = std::max(stats.peakqueuedbytes, stats.queuedbytes);
+        break;
+
+      case Block_Spilled:
+        stats.spillpendingbytes += bytes;
+        stats.spilledbytes      += bytes;
+        break;
+
+      case Block_Dropped:
+        stats.droppedbytes += bytes;
+        stats.droppedblocks++;
+        break;
+    }
+
+    queue.push_back(block);
+
+    // detect rising edge of high-water level
+    bool above = AboveHighWater();
+    if (above && !abovehighwater)
+    {
+      stats.highwaterevents++;
+      if (config.highwatercallback)
+      {
+        cbstats  = stats;
+        cbstats.oldestagens = GetNanosecondTicks() - queue.front()->queuedat;
+        highwatercallback   = config.highwatercallback;
+        callbackcontext     = config.callbackcontext;
+        callback = true;
+      }
+    }
+    abovehighwater = above;
+  }
+
+  // wake writing thread
+  queuedsignal.Signal();
+
+  // call callback outside of lock
+  if (callback) (*highwatercallback)(*this, cbstats, callbackcontext);
+
+  return bytes;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether queue is at or above high-water level
+ *
+ * @note MUST be called with lock held
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::AboveHighWater() const
+{
+  return (stats.queuedbytes >= ((stats.queuelimit / 100) * config.highwaterpercent));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wait until writing thread has written everything in the queue
+ */
+/*--------------------------------------------------------------------------------*/
+void BackgroundWriteFile::WaitForQueue()
+{
+  if (background)
+  {
+    TraceScope trace("WaitForQueue", "writer");
+
+    while (thread.IsRunning())
+    {
+      uint64_t seen = writtensignal.GetCount();
+      bool     empty;
+
+      {
+        ThreadLock lock(tlock);
+        empty = (queue.size() == 0);
+      }
+
+      if (empty) break;
+
+      writtensignal.Wait(seen, SignalTimeout);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write data to the file, recording latency
+ */
+/*--------------------------------------------------------------------------------*/
+size_t BackgroundWriteFile::WriteToFile(const void *ptr, size_t bytes)
+{
+  uint64_t t = GetNanosecondTicks();
+  size_t   res = 0;
+
+  if (!mapped) res = EnhancedFile::fwrite(ptr, 1, bytes);
+  else if (GrowMapping(mappos + bytes))
+  {
+    memcpy(mapdata + mappos, ptr, bytes);
+    MarkMappingDirty(mappos, mappos + bytes);
+    mappos   += bytes;
+    maplength = std::max(maplength, mappos);
+    res       = bytes;
+  }
+
+  t = GetNanosecondTicks() - t;
+
+  ThreadLock lock(tlock);
+  stats.writelatency.Add(t);
+  stats.writtenbytes += res;
+
+  return res;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write a queued block to the file (called from writing thread)
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::WriteBlock(BLOCK *block)
+{
+  TraceScope trace("WriteBlock", "writer");
+  bool success = false;
+
+  switch (block->type)
+  {
+    case Block_Data:
+      success = (WriteToFile(&block->data[0], block->length) == block->length);
+      break;
+
+    case Block_Spilled:
+    {
+      uint64_t end = block->spillpos + block->length;
+      bool     flushed;
+
+      // spilled data is only flushed when it is needed, not as each block is spilled
+      {
+        ThreadLock lock(spilllock);
+        if ((end > spillflushed) && (spillwriter.fflush() == 0)) spillflushed = spillend;
+        flushed = (end <= spillflushed);
+      }
+
+      // read back from spill file (reusing the block's buffer) and write to file
+      block->data.resize(block->length);
+
+      if (flushed &&
+          (spillreader.fseek(block->spillpos, SEEK_SET) == 0) &&
+          (spillreader.fread(&block->data[0], 1, block->length) == block->length))
+      {
+        success = (WriteToFile(&block->data[0], block->length) == block->length);
+      }
+      else BBCERROR("Failed to read %s bytes from spill file '%s' at %s", StringFrom(block->length).c_str(), spillfilename.c_str(), StringFrom(block->spillpos).c_str());
+
+      // once everything spilled has been written, empty the spill file (blocks are written in the order they were spilled)
+      if (success)
+      {
+        ThreadLock lock(spilllock);
+        if (end == spillend)
+        {
+          // re-open the reader too so that nothing it has buffered is read again
+          spillwriter.fclose();
+          spillreader.fclose();
+
+          if (spillwriter.fopen(spillfilename.c_str(), "wb") && spillreader.fopen(spillfilename.c_str(), "rb"))
+          {
+            BBCDEBUG3(("Emptied spill file '%s'", spillfilename.c_str()));
+            spillend = spillflushed = 0;
+          }
+          else
+          {
+            // spill file is re-created when next needed
+            BBCERROR("Failed to empty spill file '%s', error %s", spillfilename.c_str(), strerror(errno));
+            spillwriter.fclose();
+          }
+        }
+      }
+      break;
+    }
+
+    case Block_Dropped:
+      // leave a hole in the file (which will read as zeros)
+      success = (EnhancedFile::fseek(block->length, SEEK_CUR) == 0);
+      break;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append data to spill file, opening it if necessary
+ *
+ * @return true if successful
+ */
+/*--------------------------------------------------------------------------------*/
+bool BackgroundWriteFile::SpillData(const void *ptr, size_t bytes, uint64_t& pos)
+{
+  ThreadLock  lock(spilllock);
+  std::string spillpath;
+  bool success = false;
+
+  // configuration may be changed by SetConfig() from another thread
+  if (!spillwriter.isopen())
+  {
+    ThreadLock configlock(tlock);
+    spillpath = config.spillpath;
+  }
+
+  if (!spillwriter.isopen() && !spillpath.empty())
+  {
+    std::string filename = getfilename();
+    size_t p;
+
+    // create spill file from spill path and the filename of this file
+    if ((p = filename.find_last_of("/\\")) != std::string::npos) filename = filename.substr(p + 1);
+    spillfilename = spillpath + "/" + filename + ".spill";
+
+    if (spillwriter.fopen(spillfilename.c_str(), "wb") && spillreader.fopen(spillfilename.c_str(), "rb"))
+    {
+      BBCDEBUG1(("Opened spill file '%s' for '%s'", spillfilename.c_str(), getfilename().c_str()));
+      spillend = spillflushed = 0;
+    }
+    else
+    {
+      BBCERROR("Failed to open spill file '%s', error %s", spillfilename.c_str(), strerror(errno));
+      spillwriter.fclose();
+    }
+  }
+
+  if (spillwriter.isopen())
+  {
+    // the writing thread flushes the data when it needs it
+    if (spillwriter.fwrite(ptr, 1, bytes) == bytes)
+    {
+      pos       = spillend;
+      spillend += bytes;
+      success   = true;
+    }
+    else BBCERROR("Failed to write %s bytes to spill file '%s', error %s", StringFrom((uint64_t)bytes).c_str(), spillfilename.c_str(), strerror(spillwriter.ferror()));
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return unused block
+ */
+/*--------------------------------------------------------------------------------*/
+BackgroundWriteFile::BLOCK *BackgroundWriteFile::GetFreeBlock()
+{
+  BLOCK *block = NULL;
+
+  {
+    ThreadLock lock(tlock);
+    if (freeblocks.size())
+    {
+      block = freeblocks.back();
+      freeblocks.pop_back();
+    }
+  }
+
+  if (!block) block = new BLOCK;
+
+  return block;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Writing thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *BackgroundWriteFile::WriteThread(Thread& thread)
+{
+  TraceEvents::SetThreadName("BackgroundWriteFile " + getfilename());
+
+  while (!thread.StopRequested())
+  {
+    uint64_t seen  = queuedsignal.GetCount();
+    BLOCK    *block = NULL;
+
+    {
+      ThreadLock lock(tlock);
+      if (queue.size()) block = queue.front();
+    }
+
+    if (block)
+    {
+      // write block *outside* of lock
+      if (!WriteBlock(block))
+      {
+        BBCERROR("Background write of %s bytes to '%s' failed, error %s", StringFrom(block->length).c_str(), getfilename().c_str(), strerror(ferror()));
+        writeerror = true;
+      }
+
+      {
+        ThreadLock lock(tlock);
+        queue.pop_front();
+
+        if      (block->type == Block_Data)    stats.queuedbytes       -= block->length;
+        else if (block->type == Block_Spilled) stats.spillpendingbytes -= block->length;
+        stats.queuelatency.Add(GetNanosecondTicks() - block->queuedat);
+
+        abovehighwater &= AboveHighWater();
+
+        freeblocks.push_back(block);
+      }
+
+      // wake any blocked writers
+      writtensignal.Signal();
+    }
+    else queuedsignal.Wait(seen, SignalTimeout);
+  }
+
+  // wake anything waiting for the queue to empty
+  writtensignal.Signal();
+
+  return NULL;
+}
+
+BBC_AUDIOTOOLBOX_END
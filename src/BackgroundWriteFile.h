@@ -0,0 +1,348 @@
+#ifndef __BACKGROUND_WRITE_FILE__
+#define __BACKGROUND_WRITE_FILE__
+
+#include <deque>
+#include <vector>
+
+#include <bbcat-base/EnhancedFile.h>
+#include <bbcat-base/Thread.h>
+#include <bbcat-base/ThreadLock.h>
+
+#include "LatencyHistogram.h"
+#include "ThreadSignal.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** A file that can write data in the background using a bounded queue
+ *
+ * Whilst background writing is enabled, fwrite() queues data which is written to disk
+ * by a separate thread.  The depth of the queue is specified in time (seconds of audio)
+ * and the behaviour when the queue is full is configurable:
+ *   QueueFull_Block: the caller waits until there is space in the queue
+ *   QueueFull_Drop:  the data is discarded (and counted), the file position still advances
+ *                    so the dropped region is left as silence in the file
+ *   QueueFull_Spill: the data is written to a file on a secondary path and copied back
+ *                    by the writing thread when it catches up
+ *
+ * Any other file operation (fseek(), fread(), etc) waits until the queue is empty
+ * before being performed in the foreground
+ *
+ * Alternatively, the file can be written through a shared memory mapping which is grown
+ * in large extents (using ftruncate()) so that writes become memory copies with no system
+ * calls; the mapping is flushed (msync()) at regular checkpoints and the file is truncated
+ * to its real length when mapping is disabled or the file closed.  Mapped writing and
+ * background writing are mutually exclusive, mapped writing takes precedence
+ */
+/*--------------------------------------------------------------------------------*/
+class BackgroundWriteFile : public EnhancedFile
+{
+public:
+  BackgroundWriteFile();
+  virtual ~BackgroundWriteFile();
+
+  typedef enum
+  {
+    QueueFull_Block = 0,
+    QueueFull_Drop,
+    QueueFull_Spill,
+  } QueueFullPolicy_t;
+
+  typedef struct
+  {
+    uint64_t         queuedbytes;       // bytes currently held in memory waiting to be written
+    uint64_t         peakqueuedbytes;   // maximum value of the above
+    uint64_t         queuelimit;        // maximum number of bytes allowed in memory
+    uint64_t         spillpendingbytes; // bytes held in the spill file waiting to be written
+    uint64_t         oldestagens;       // age of the oldest unwritten data in ns
+    uint64_t         writtenbytes;      // total bytes written to the file
+    uint64_t         droppedbytes;      // total bytes dropped because the queue was full
+    uint_t           droppedblocks;     // number of writes dropped because the queue was full
+    uint64_t         spilledbytes;      // total bytes written to the spill file
+    uint_t           highwaterevents;   // number of times the high-water level has been crossed
+    uint64_t         blockedns;         // total time callers have spent waiting for the queue
+    LatencyHistogram queuelatency;      // time from queueing to data being written
+    LatencyHistogram writelatency;      // time taken by each write to the file
+  } STATS;
+
+  typedef void (*HIGHWATERCALLBACK)(BackgroundWriteFile& file, const STATS& stats, void *context);
+
+  typedef struct
+  {
+    double            buffertime;       // depth of queue in seconds of audio
+    uint_t            highwaterpercent; // queue level (percent of depth) at which the callback is called
+    QueueFullPolicy_t policy;           // what to do when the queue is full
+    std::string       spillpath;        // directory for spill file (QueueFull_Spill only)
+    HIGHWATERCALLBACK highwatercallback;
+    void              *callbackcontext;
+  } CONFIG;
+
+  typedef struct
+  {
+    uint64_t extentbytes;               // size of increments by which the file (and mapping) is grown
+    uint64_t checkpointbytes;           // amount of data written between asynchronous flushes (0 to disable)
+  } MAPCONFIG;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return default configuration (10s, block when full)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static CONFIG GetDefaultConfig();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set queue configuration
+   *
+   * @note can be called at any time
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetConfig(const CONFIG& newconfig);
+  const CONFIG& GetConfig() const {return config;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set the data rate of the file, used to convert the queue depth from time to bytes
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetBytesPerSecond(uint64_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable background writing
+   *
+   * @note disabling waits for all queued data to be written
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void EnableBackground(bool enable = true);
+  bool BackgroundEnabled() const {return background;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return default mapping configuration (64MB extents, checkpoint every 16MB)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static MAPCONFIG GetDefaultMapConfig();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable writing through a memory mapping
+   *
+   * @param enable true to write through a mapping
+   * @param mapconfig extent and checkpoint sizes
+   *
+   * @return true if the requested mode is in effect (not supported on all platforms)
+   *
+   * @note enabling disables background writing
+   * @note disabling truncates the file to the amount of data written
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool EnableMapping(bool enable, const MAPCONFIG& mapconfig);
+  bool EnableMapping(bool enable = true) {return EnableMapping(enable, GetDefaultMapConfig());}
+  bool MappingEnabled() const {return mapped;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether buffers returned by GetWriteBuffer() are written without further copying
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool WriteBufferIsDirect() const {return (background || mapped);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return snapshot of live statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  void GetStats(STATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reset counters and histograms (but not queue state)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ResetStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reserve disk space beyond the current end of the file without changing its length
+   *
+   * @param bytes number of bytes to reserve
+   *
+   * @return true if space was reserved (not supported on all platforms)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Preallocate(uint64_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer that the caller can write data into directly
+   *
+   * @param bytes number of bytes required
+   *
+   * @return pointer to buffer (valid until CommitWriteBuffer() is called) or NULL
+   *
+   * @note in background mode the buffer is the block that will be queued and in mapped
+   * @note mode it is the mapping itself so the data is not copied again
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint8_t *GetWriteBuffer(size_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write or queue data previously written into the buffer returned by GetWriteBuffer()
+   *
+   * @param bytes number of bytes to commit (may be less than requested)
+   *
+   * @return number of bytes written/queued
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t CommitWriteBuffer(size_t bytes);
+
+  virtual bool   fopen(const char *filename, const char *mode = "r");
+  virtual void   fclose();
+  virtual size_t fread(void *ptr, size_t size, size_t count);
+  virtual size_t fwrite(const void *ptr, size_t size, size_t count);
+  virtual off_t  ftell();
+  virtual int    fseek(off_t offset, int origin);
+  virtual void   rewind();
+  virtual int    fflush();
+
+protected:
+  typedef enum
+  {
+    Block_Data = 0,
+    Block_Spilled,
+    Block_Dropped,
+  } BlockType_t;
+
+  typedef struct
+  {
+    std::vector<uint8_t> data;
+    uint64_t             length;
+    uint64_t             spillpos;
+    uint64_t             queuedat;
+    BlockType_t          type;
+  } BLOCK;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Recalculate queue limit from buffer time and data rate
+   *
+   * @note MUST be called with lock held
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UpdateQueueLimit();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether queue is at or above high-water level
+   *
+   * @note MUST be called with lock held
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool AboveHighWater() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until writing thread has written everything in the queue
+   */
+  /*--------------------------------------------------------------------------------*/
+  void WaitForQueue();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write data to the file, recording latency
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t WriteToFile(const void *ptr, size_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Queue block for writing, applying the queue full policy
+   *
+   * @param block block to queue
+   * @param ptr data to be copied into block or NULL if the block already contains the data
+   * @param bytes number of bytes
+   *
+   * @return number of bytes queued (dropped data is counted as queued)
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t QueueBlock(BLOCK *block, const void *ptr, size_t bytes);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Ensure the mapping covers the file up to the specified offset, growing the file by
+   * whole extents if necessary
+   *
+   * @note invalidates any pointers into the mapping
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GrowMapping(uint64_t end);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Record region of mapping as modified, flushing it if the checkpoint size is reached
+   */
+  /*--------------------------------------------------------------------------------*/
+  void MarkMappingDirty(uint64_t start, uint64_t end);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Flush modified region of mapping to disk
+   *
+   * @param wait true to wait for the data to be written (otherwise the flush is only scheduled)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool SyncMapping(bool wait);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Remove mapping, truncate file to its real length and restore stream position
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Unmap();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write a queued block to the file (called from writing thread)
+   *
+   * @note may be overridden to throttle or hold up writing
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool WriteBlock(BLOCK *block);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Append data to spill file, opening it if necessary
+   *
+   * @return true if successful
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool SpillData(const void *ptr, size_t bytes, uint64_t& pos);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return unused block
+   */
+  /*--------------------------------------------------------------------------------*/
+  BLOCK *GetFreeBlock();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Writing thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__WriteThread(Thread& thread, void *arg) {return ((BackgroundWriteFile *)arg)->WriteThread(thread);}
+  void *WriteThread(Thread& thread);
+
+protected:
+  ThreadLockObject     tlock;
+  Thread               thread;
+  ThreadSignal         queuedsignal;    // signalled when a block is queued or the thread is stopped
+  ThreadSignal         writtensignal;   // signalled when a block has been written or the thread finishes
+  CONFIG               config;
+  STATS                stats;
+  std::deque<BLOCK *>  queue;
+  std::vector<BLOCK *> freeblocks;
+  BLOCK                *lentblock;
+  ThreadLockObject     spilllock;       // protects spill file between caller and writing thread
+  EnhancedFile         spillwriter;
+  EnhancedFile         spillreader;
+  std::string          spillfilename;
+  uint64_t             spillend;
+  uint64_t             spillflushed;    // amount of spill file flushed and so readable by the writing thread
+  uint64_t             bytespersecond;
+  MAPCONFIG            mapconfig;
+  uint8_t              *mapdata;
+  uint64_t             mapsize;         // size of mapping (and file on disk)
+  uint64_t             maplength;       // length of data in file
+  uint64_t             mappos;          // current position within file
+  uint64_t             mapdirtystart;   // region modified since the last flush
+  uint64_t             mapdirtyend;
+  size_t               maplentbytes;    // size of buffer lent from mapping (if any)
+  int                  mapfd;
+  bool                 mapped;
+  bool                 maplent;
+  bool                 background;
+  bool                 abovehighwater;
+  volatile bool        writeerror;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,298 @@
+
+#include <string.h>
+
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "EDLSoundFileSamples.h"
+#include "ResamplingSoundFileSamples.h"
+
+BBC_AUDIOTOOLBOX_START
+
+EDLSoundFileSamples::EDLSoundFileSamples(uint_t channels, uint32_t samplerate) :
+  SoundFileSamples(),
+  activesegment(~0),
+  activeoffset(0)
+{
+  outputformat.SetSampleRate(samplerate);
+  outputformat.SetChannels(channels);
+  outputformat.SetSampleFormat(SampleFormatOf((const Sample_t *)NULL));
+  outputformat.SetSamplesBigEndian(MACHINE_IS_BIG_ENDIAN);
+
+  // start of first segment / end of list
+  segmentstarts.push_back(0);
+
+  SetFormat(&outputformat);
+}
+
+EDLSoundFileSamples::~EDLSoundFileSamples()
+{
+  uint_t i;
+
+  for (i = 0; i < sources.size(); i++)
+  {
+    delete sources[i];
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add source that segments can be taken from
+ *
+ * @param source source object (will be DELETED on destruction of this object)
+ *
+ * @return source index for AddSegment()
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t EDLSoundFileSamples::AddSource(SoundFileSamples *source)
+{
+  const SoundFormat *sourceformat = source->GetFormat();
+
+  // convert source to output rate if necessary
+  if (sourceformat && (sourceformat->GetSampleRate() != outputformat.GetSampleRate()))
+  {
+    BBCDEBUG2(("Converting EDL source %u from %uHz to %uHz", (uint_t)sources.size(), sourceformat->GetSampleRate(), outputformat.GetSampleRate()));
+    source = new ResamplingSoundFileSamples(source, outputformat.GetSampleRate());
+  }
+
+  sources.push_back(source);
+  sourceclips.push_back(source->GetClip());
+
+  UpdateData();
+
+  return (uint_t)(sources.size() - 1);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add segment to the end of the list
+ *
+ * @param source source index returned by AddSource()
+ * @param start start of segment within source (relative to the source's clip)
+ * @param length length of segment in samples (limited to the end of the source)
+ * @param channelmap source channel for each output channel (-1 or missing entries for silence)
+ * @param gain linear gain applied to segment
+ *
+ * @return true if segment added
+ */
+/*--------------------------------------------------------------------------------*/
+bool EDLSoundFileSamples::AddSegment(uint_t source, uint64_t start, uint64_t length, const std::vector<sint_t>& channelmap, double gain)
+{
+  bool success = false;
+
+  if (source < sources.size())
+  {
+    const Clip_t& sourceclip = sourceclips[source];
+    SEGMENT segment;
+
+    start = std::min(start, sourceclip.nsamples);
+
+    segment.source          = (sint_t)source;
+    segment.clip.start      = sourceclip.start + start;
+    segment.clip.nsamples   = std::min(length, sourceclip.nsamples - start);
+    segment.clip.channel    = sourceclip.channel;
+    segment.clip.nchannels  = sourceclip.nchannels;
+    segment.channelmap      = channelmap;
+    segment.channelmap.resize(outputformat.GetChannels(), -1);
+    segment.gain            = (Sample_t)gain;
+
+    if (segment.clip.nsamples < length) BBCDEBUG1(("Segment %u truncated to end of source %u", (uint_t)segments.size(), source));
+
+    segments.push_back(segment);
+    segmentstarts.push_back(segmentstarts.back() + segment.clip.nsamples);
+
+    UpdateData();
+    success = true;
+  }
+  else BBCERROR("Invalid source %u for EDL segment", source);
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add segment with each output channel taken from the same source channel
+ */
+/*--------------------------------------------------------------------------------*/
+bool EDLSoundFileSamples::AddSegment(uint_t source, uint64_t start, uint64_t length, double gain)
+{
+  std::vector<sint_t> channelmap(outputformat.GetChannels());
+  uint_t i;
+
+  for (i = 0; i < channelmap.size(); i++) channelmap[i] = (sint_t)i;
+
+  return AddSegment(source, start, length, channelmap, gain);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add silent segment to the end of the list
+ */
+/*--------------------------------------------------------------------------------*/
+void EDLSoundFileSamples::AddSilence(uint64_t length)
+{
+  SEGMENT segment;
+
+  segment.source = -1;
+  memset(&segment.clip, 0, sizeof(segment.clip));
+  segment.clip.nsamples = length;
+  segment.gain          = 0.0;
+
+  segments.push_back(segment);
+  segmentstarts.push_back(segmentstarts.back() + length);
+
+  UpdateData();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return a copy of this object (and of all sources) that can be read independently
+ */
+/*--------------------------------------------------------------------------------*/
+SoundFileSamples *EDLSoundFileSamples::Duplicate() const
+{
+  EDLSoundFileSamples *obj;
+  uint_t i;
+
+  if ((obj = new EDLSoundFileSamples(outputformat.GetChannels(), outputformat.GetSampleRate())) != NULL)
+  {
+    for (i = 0; i < sources.size(); i++)
+    {
+      SoundFileSamples *source;
+
+      if ((source = sources[i]->Duplicate()) == NULL)
+      {
+        delete obj;
+        return NULL;
+      }
+
+      obj->sources.push_back(source);
+    }
+
+    obj->sourceclips   = sourceclips;
+    obj->segments      = segments;
+    obj->segmentstarts = segmentstarts;
+    obj->SetSampleBufferSize(samplebufferframes);
+    obj->SetClip(clip);
+  }
+
+  return obj;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return index of segment containing position (or number of segments at the end)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t EDLSoundFileSamples::FindSegment(uint64_t pos) const
+{
+  // segmentstarts is sorted, find last start at or before pos (skipping empty segments)
+  return (uint_t)(std::upper_bound(segmentstarts.begin(), segmentstarts.end(), pos) - segmentstarts.begin()) - 1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read frames of a segment
+ *
+ * @return false if source could not be read
+ */
+/*--------------------------------------------------------------------------------*/
+bool EDLSoundFileSamples::ReadSegment(uint_t index, uint64_t offset, Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  const SEGMENT& segment = segments[index];
+  uint_t i, j;
+
+  for (i = 0; i < frames; i++) memset(dst + i * ndstchannels, 0, nchannels * sizeof(*dst));
+
+  if (segment.source >= 0)
+  {
+    SoundFileSamples *source = sources[segment.source];
+    uint_t nsrcchannels = source->GetChannels();
+    uint_t n;
+
+    // only reposition source when not continuing from the last read, so that sources that
+    // keep state between reads (e.g. converters) are not reset at every read
+    if ((index != activesegment) || (offset != activeoffset))
+    {
+      source->SetClip(segment.clip);
+      source->SetSamplePosition(offset);
+    }
+
+    n = source->ReadSamples(&inputbuffer[0], 0, nsrcchannels, frames);
+
+    if (source->InError())
+    {
+      BBCERROR("Failed to read source %d of EDL segment %u", segment.source, index);
+      activesegment = ~0;
+      return false;
+    }
+
+    // anything the source could not provide is silence
+    if (n < frames) memset(&inputbuffer[n * nsrcchannels], 0, (frames - n) * nsrcchannels * sizeof(inputbuffer[0]));
+
+    activesegment = index;
+    activeoffset  = offset + frames;
+
+    for (j = 0; j < nchannels; j++)
+    {
+      sint_t srcchannel = segment.channelmap[firstchannel + j];
+
+      if ((srcchannel >= 0) && ((uint_t)srcchannel < nsrcchannels))
+      {
+        const Sample_t *src = &inputbuffer[srcchannel];
+        Sample_t       *d   = dst + j;
+
+        for (i = 0; i < frames; i++, src += nsrcchannels, d += ndstchannels) *d = *src * segment.gain;
+      }
+    }
+  }
+
+  return true;
+}
+
+uint_t EDLSoundFileSamples::ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  uint64_t pos = GetAbsoluteSamplePosition();
+  uint_t   n   = 0;
+
+  while (n < frames)
+  {
+    uint_t index = FindSegment(pos + n);
+
+    if (index >= segments.size()) break;
+
+    // reads continue into the following segments
+    uint64_t offset  = pos + n - segmentstarts[index];
+    uint_t   nframes = (uint_t)std::min((uint64_t)(frames - n), segmentstarts[index + 1] - (pos + n));
+
+    if (!ReadSegment(index, offset, dst + n * ndstchannels, ndstchannels, nframes, firstchannel, nchannels))
+    {
+      inerror = true;
+      break;
+    }
+
+    n += nframes;
+  }
+
+  return n;
+}
+
+void EDLSoundFileSamples::UpdateData()
+{
+  if (format)
+  {
+    uint_t i, maxchannels = 1;
+
+    for (i = 0; i < sources.size(); i++) maxchannels = std::max(maxchannels, sources[i]->GetChannels());
+
+    AllocateSampleBuffer();
+    inputbuffer.resize(samplebufferframes * maxchannels);
+    activesegment = ~0;
+
+    totalsamples = segmentstarts.back();
+
+    Clip_t newclip =
+    {
+      0, ~(uint64_t)0,
+      0, ~(uint_t)0,
+    };
+    SetClip(newclip);
+
+    timebase = format->GetTimeBase();
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
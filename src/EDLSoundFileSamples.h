@@ -0,0 +1,139 @@
+#ifndef __EDL_SOUND_FILE_SAMPLES__
+#define __EDL_SOUND_FILE_SAMPLES__
+
+#include <vector>
+
+#include "SoundFileAttributes.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Sound samples object that presents an edit decision list of segments of other
+ * objects as a single, contiguous file without rendering it
+ *
+ * Each segment is a range of a source (applied to the source as a Clip_t when the segment
+ * is read), a map of output channels to source channels and a gain.  Reads continue across
+ * segment boundaries and Duplicate() copies all sources so a Playlist can pre-roll or
+ * prefetch an EDL like any other file
+ *
+ * @note sources are DELETED on destruction of this object and may be shared by many segments
+ * @note sources at a different sample rate are converted (see ResamplingSoundFileSamples)
+ * @note this object is read-only
+ */
+/*--------------------------------------------------------------------------------*/
+class EDLSoundFileSamples : public SoundFileSamples
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param channels number of output channels
+   * @param samplerate output sample rate
+   */
+  /*--------------------------------------------------------------------------------*/
+  EDLSoundFileSamples(uint_t channels, uint32_t samplerate);
+  virtual ~EDLSoundFileSamples();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add source that segments can be taken from
+   *
+   * @param source source object (will be DELETED on destruction of this object)
+   *
+   * @return source index for AddSegment()
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t AddSource(SoundFileSamples *source);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add segment to the end of the list
+   *
+   * @param source source index returned by AddSource()
+   * @param start start of segment within source (relative to the source's clip)
+   * @param length length of segment in samples (limited to the end of the source)
+   * @param channelmap source channel for each output channel (-1 or missing entries for silence)
+   * @param gain linear gain applied to segment
+   *
+   * @return true if segment added
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool AddSegment(uint_t source, uint64_t start, uint64_t length, const std::vector<sint_t>& channelmap, double gain = 1.0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add segment with each output channel taken from the same source channel
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool AddSegment(uint_t source, uint64_t start, uint64_t length, double gain = 1.0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add silent segment to the end of the list
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AddSilence(uint64_t length);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of segments
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetSegmentCount() const {return (uint_t)segments.size();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return start position of segment within this object
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetSegmentPosition(uint_t index) const {return segmentstarts[std::min(index, (uint_t)segments.size())];}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return a copy of this object (and of all sources) that can be read independently
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual SoundFileSamples *Duplicate() const;
+
+protected:
+  virtual uint_t ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  typedef struct
+  {
+    sint_t              source;       // source index or -1 for silence
+    Clip_t              clip;         // range of source (absolute position)
+    std::vector<sint_t> channelmap;   // source channel of each output channel (-1 for silence)
+    Sample_t            gain;
+  } SEGMENT;
+
+  virtual void UpdateData();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return index of segment containing position (or number of segments at the end)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t FindSegment(uint64_t pos) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read frames of a segment
+   *
+   * @param index segment index
+   * @param offset position within segment
+   * @param dst destination for interleaved frames
+   * @param ndstchannels number of channels in each destination frame
+   * @param frames number of frames (no more than sample buffer size or remaining in segment)
+   * @param firstchannel first output channel required
+   * @param nchannels number of output channels required
+   *
+   * @return false if source could not be read
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ReadSegment(uint_t index, uint64_t offset, Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+protected:
+  SoundFormat                     outputformat;
+  std::vector<SoundFileSamples *> sources;
+  std::vector<Clip_t>             sourceclips;    // clip of each source when added (sources are re-clipped for each segment)
+  std::vector<SEGMENT>            segments;
+  std::vector<uint64_t>           segmentstarts;  // start position of each segment followed by total length
+  std::vector<Sample_t>           inputbuffer;
+  uint_t                          activesegment;  // segment the sources were last positioned for
+  uint64_t                        activeoffset;   // position within active segment sources are at
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
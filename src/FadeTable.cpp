@@ -0,0 +1,168 @@
+
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FADETABLE_SSE
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "FadeTable.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Scale a frame of interleaved audio by a single gain
+ *
+ * Overloaded on sample type so that the SSE version is only used for float samples
+ */
+/*--------------------------------------------------------------------------------*/
+static inline void ScaleFrame(float *dst, uint_t channels, float gain)
+{
+  uint_t i = 0;
+
+#ifdef FADETABLE_SSE
+  __m128 g = _mm_set1_ps(gain);
+  for (; (i + 4) <= channels; i += 4) _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(dst + i), g));
+#endif
+
+  for (; i < channels; i++) dst[i] *= gain;
+}
+
+static inline void ScaleFrame(double *dst, uint_t channels, double gain)
+{
+  uint_t i;
+
+  for (i = 0; i < channels; i++) dst[i] *= gain;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Mix two frames of interleaved audio: dst = dst * gain1 + src * gain2
+ */
+/*--------------------------------------------------------------------------------*/
+static inline void MixFrame(float *dst, const float *src, uint_t channels, float gain1, float gain2)
+{
+  uint_t i = 0;
+
+#ifdef FADETABLE_SSE
+  __m128 g1 = _mm_set1_ps(gain1);
+  __m128 g2 = _mm_set1_ps(gain2);
+  for (; (i + 4) <= channels; i += 4) _mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(dst + i), g1), _mm_mul_ps(_mm_loadu_ps(src + i), g2)));
+#endif
+
+  for (; i < channels; i++) dst[i] = dst[i] * gain1 + src[i] * gain2;
+}
+
+static inline void MixFrame(double *dst, const double *src, uint_t channels, double gain1, double gain2)
+{
+  uint_t i;
+
+  for (i = 0; i < channels; i++) dst[i] = dst[i] * gain1 + src[i] * gain2;
+}
+
+FadeTable::FadeTable() : length(0),
+                         shape(Shape_Linear)
+{
+  gains.push_back(1.0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set length and shape of fade, rebuilding table if either has changed
+ *
+ * @note the table only allocates memory when it grows
+ */
+/*--------------------------------------------------------------------------------*/
+void FadeTable::Set(uint_t newlength, Shape_t newshape)
+{
+  if ((newlength != length) || (newshape != shape))
+  {
+    uint_t i;
+
+    length = newlength;
+    shape  = newshape;
+    gains.resize(length + 1);
+
+    for (i = 0; i <= length; i++)
+    {
+      double x = length ? (double)i / (double)length : 1.0;
+      double g;
+
+      switch (shape)
+      {
+        case Shape_EqualPower:
+          g = sin(.5 * M_PI * x);
+          break;
+
+        case Shape_SCurve:
+          g = .5 - .5 * cos(M_PI * x);
+          break;
+
+        default:
+          g = x;
+          break;
+      }
+
+      gains[i] = (Sample_t)g;
+    }
+
+    BBCDEBUG2(("Fade table rebuilt: %u frames, shape %u", length, (uint_t)shape));
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Apply fade up to interleaved audio
+ *
+ * @param dst interleaved samples
+ * @param channels number of channels
+ * @param frames number of frames
+ * @param pos position within fade of first frame (0 = silence)
+ */
+/*--------------------------------------------------------------------------------*/
+void FadeTable::FadeUp(Sample_t *dst, uint_t channels, uint_t frames, uint_t pos) const
+{
+  uint_t i, n = std::min(frames, limited::subz(length, pos));
+
+  // frames beyond the end of the fade are left at unity gain
+  for (i = 0; i < n; i++, dst += channels) ScaleFrame(dst, channels, gains[pos + i]);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Apply fade down to interleaved audio
+ *
+ * @param dst interleaved samples
+ * @param channels number of channels
+ * @param frames number of frames
+ * @param remaining number of frames of fade left *including* the first frame
+ */
+/*--------------------------------------------------------------------------------*/
+void FadeTable::FadeDown(Sample_t *dst, uint_t channels, uint_t frames, uint_t remaining) const
+{
+  uint_t i;
+
+  // frames beyond the end of the fade are silenced
+  for (i = 0; i < frames; i++, dst += channels) ScaleFrame(dst, channels, (i < remaining) ? GetGain(remaining - 1 - i) : 0.0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Crossfade from one set of interleaved audio to another
+ *
+ * @param dst outgoing audio, overwritten by the mix
+ * @param src incoming audio
+ * @param channels number of channels
+ * @param frames number of frames
+ * @param pos position within crossfade of first frame (0 = all outgoing)
+ */
+/*--------------------------------------------------------------------------------*/
+void FadeTable::Crossfade(Sample_t *dst, const Sample_t *src, uint_t channels, uint_t frames, uint_t pos) const
+{
+  uint_t i;
+
+  for (i = 0; i < frames; i++, dst += channels, src += channels)
+  {
+    uint_t p = std::min(pos + i, length);
+
+    MixFrame(dst, src, channels, gains[length - p], gains[p]);
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
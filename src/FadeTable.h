@@ -0,0 +1,106 @@
+#ifndef __FADE_TABLE__
+#define __FADE_TABLE__
+
+#include <vector>
+#include <algorithm>
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Precomputed fade gain curve and routines to apply it to interleaved audio
+ *
+ * The table holds length + 1 gains running from silence (index 0) to unity (index length)
+ * so fades and crossfades need no divisions or transcendental functions per frame
+ *
+ * For a crossfade the outgoing audio uses the curve in reverse, which for the equal-power
+ * curve gives constant power and for the linear and S-curves gives constant amplitude
+ *
+ * @note this object does *not* lock, the owner must provide any protection needed
+ */
+/*--------------------------------------------------------------------------------*/
+class FadeTable
+{
+public:
+  typedef enum
+  {
+    Shape_Linear = 0,
+    Shape_EqualPower,           // quarter sine, for uncorrelated material
+    Shape_SCurve,               // raised cosine
+
+    Shape_Count,
+  } Shape_t;
+
+  FadeTable();
+  ~FadeTable() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set length and shape of fade, rebuilding table if either has changed
+   *
+   * @note the table only allocates memory when it grows
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Set(uint_t length, Shape_t shape);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return length of fade in frames
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetLength() const {return length;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return shape of fade
+   */
+  /*--------------------------------------------------------------------------------*/
+  Shape_t GetShape() const {return shape;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return gain at specified position (clamped to unity beyond the end of the fade)
+   */
+  /*--------------------------------------------------------------------------------*/
+  Sample_t GetGain(uint_t pos) const {return gains[std::min(pos, length)];}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Apply fade up to interleaved audio
+   *
+   * @param dst interleaved samples
+   * @param channels number of channels
+   * @param frames number of frames
+   * @param pos position within fade of first frame (0 = silence)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void FadeUp(Sample_t *dst, uint_t channels, uint_t frames, uint_t pos) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Apply fade down to interleaved audio
+   *
+   * @param dst interleaved samples
+   * @param channels number of channels
+   * @param frames number of frames
+   * @param remaining number of frames of fade left *including* the first frame
+   */
+  /*--------------------------------------------------------------------------------*/
+  void FadeDown(Sample_t *dst, uint_t channels, uint_t frames, uint_t remaining) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Crossfade from one set of interleaved audio to another
+   *
+   * @param dst outgoing audio, overwritten by the mix
+   * @param src incoming audio
+   * @param channels number of channels
+   * @param frames number of frames
+   * @param pos position within crossfade of first frame (0 = all outgoing)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Crossfade(Sample_t *dst, const Sample_t *src, uint_t channels, uint_t frames, uint_t pos) const;
+
+protected:
+  std::vector<Sample_t> gains;
+  uint_t                length;
+  Shape_t               shape;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
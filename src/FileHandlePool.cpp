@@ -0,0 +1,354 @@
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#define BBCDEBUG_LEVEL 1
+#include "FileHandlePool.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// longest wait for a signal before maintaining anyway (waits are woken by signals, this is only a backstop)
+static const std::chrono::milliseconds SignalTimeout(100);
+
+thread_local bool FileHandlePool::nonblocking = false;
+
+FileHandlePool::FileHandlePool(uint_t maxopen, uint_t nbuffers, size_t buffersize) :
+  bufferstore((size_t)nbuffers * buffersize),
+  freebuffers(std::max(nbuffers, (uint_t)1)),
+  buffersize(buffersize)
+{
+  uint_t i;
+
+  this->maxopen.store(maxopen);
+  open.store(0);
+  clock.store(0);
+  opens.store(0);
+  misses.store(0);
+  evictions.store(0);
+  silentreads.store(0);
+
+  for (i = 0; i < nbuffers; i++) freebuffers.Push(&bufferstore[(size_t)i * buffersize]);
+}
+
+FileHandlePool::~FileHandlePool()
+{
+  Stop();
+
+  ThreadLock lock(tlock);
+  while (entries.size())
+  {
+    ENTRY *entry = entries.back();
+
+    Close(entry);
+    delete entry;
+
+    entries.pop_back();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start maintenance thread
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+bool FileHandlePool::Start()
+{
+  bool success = thread.IsRunning() || thread.Start(&__MaintenanceThread, (void *)this);
+
+  if (!success) BBCERROR("Failed to start file handle maintenance thread");
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Stop maintenance thread
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::Stop()
+{
+  if (thread.IsRunning())
+  {
+    // request stop and wake thread
+    thread.Stop(false);
+    maintainsignal.Signal();
+    thread.Stop();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Register file with pool (file is not opened)
+ *
+ * @return entry to use with other calls
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+FileHandlePool::ENTRY *FileHandlePool::Register(const std::string& filename)
+{
+  ENTRY *entry;
+
+  if ((entry = new ENTRY) != NULL)
+  {
+    entry->filename = filename;
+    entry->file.store(NULL);
+    entry->users.store(0);
+    entry->pins.store(0);
+    entry->wanted.store(false);
+    entry->lastused.store(0);
+
+    ThreadLock lock(tlock);
+    entries.push_back(entry);
+  }
+
+  return entry;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Unregister file, closing it if it is open
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::Unregister(ENTRY *entry)
+{
+  ThreadLock lock(tlock);
+  std::vector<ENTRY *>::iterator it;
+
+  if ((it = std::find(entries.begin(), entries.end(), entry)) != entries.end())
+  {
+    Close(entry);
+    delete entry;
+
+    entries.erase(it);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return open file handle for entry, opening it if necessary
+ *
+ * @return file handle or NULL if file cannot be opened (or, if non-blocking, is not open)
+ *
+ * @note Release() MUST be called afterwards (even if NULL is returned)
+ * @note real-time safe if the file is already open (e.g. it is pinned) or if non-blocking
+ */
+/*--------------------------------------------------------------------------------*/
+EnhancedFile *FileHandlePool::Acquire(ENTRY *entry)
+{
+  EnhancedFile *file;
+
+  // registering as a user before looking at the handle prevents it being closed underneath us
+  entry->users.fetch_add(1);
+
+  if ((file = entry->file.load()) == NULL)
+  {
+    misses++;
+
+    if (nonblocking && thread.IsRunning())
+    {
+      // leave opening to the maintenance thread
+      entry->wanted.store(true);
+      maintainsignal.Signal();
+    }
+    else
+    {
+      BBCDEBUG2(("'%s' not open when acquired, opening now", entry->filename.c_str()));
+
+      file = Open(entry);
+
+      // keep within limit when nothing else is doing so
+      if (!thread.IsRunning()) Maintain();
+      else if (open.load() > maxopen.load()) maintainsignal.Signal();
+    }
+  }
+
+  entry->lastused.store(++clock, std::memory_order_relaxed);
+
+  return file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Pin/unpin file (pinned files are kept open and opened ahead of time)
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::Pin(ENTRY *entry, bool pin)
+{
+  if (pin) entry->pins.fetch_add(1);
+  else
+  {
+    uint_t pins = entry->pins.load();
+
+    // never let pin count go below zero
+    while (pins && !entry->pins.compare_exchange_weak(pins, pins - 1)) ;
+  }
+
+  // pinned file to open or unpinned file that may be closed
+  maintainsignal.Signal();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return shared sample buffer or NULL if none are free
+ *
+ * @param size set to size of buffer in bytes
+ */
+/*--------------------------------------------------------------------------------*/
+uint8_t *FileHandlePool::AcquireBuffer(size_t& size)
+{
+  uint8_t *buffer = NULL;
+
+  size = freebuffers.Pop(buffer) ? buffersize : 0;
+
+  return buffer;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return sample buffer to pool
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::ReleaseBuffer(uint8_t *buffer)
+{
+  if (buffer) freebuffers.Push(buffer);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return statistics
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::GetStats(STATS& stats) const
+{
+  ThreadLock lock(tlock);
+  uint_t i;
+
+  stats.registered = (uint_t)entries.size();
+  stats.open       = open.load();
+  stats.pinnedclosed = 0;
+  for (i = 0; i < entries.size(); i++) stats.pinnedclosed += (entries[i]->pins.load() && !entries[i]->file.load());
+  stats.opens      = opens.load();
+  stats.misses     = misses.load();
+  stats.evictions  = evictions.load();
+  stats.silentreads = silentreads.load();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open pinned files and close least recently used files beyond the limit
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::Maintain()
+{
+  ThreadLock lock(tlock);
+  uint_t i;
+
+  // open pinned files ahead of them being acquired and files non-blocking acquires found closed
+  for (i = 0; i < entries.size(); i++)
+  {
+    ENTRY *entry = entries[i];
+
+    if ((entry->pins.load() || entry->wanted.exchange(false)) && !entry->file.load())
+    {
+      // treat as just used so that it is not the first to be closed
+      if (Open(entry)) entry->lastused.store(++clock, std::memory_order_relaxed);
+    }
+  }
+
+  // close least recently used, unpinned, idle files until within limit
+  while (open.load() > maxopen.load())
+  {
+    ENTRY *oldest = NULL;
+
+    for (i = 0; i < entries.size(); i++)
+    {
+      ENTRY *entry = entries[i];
+
+      if (entry->file.load() && !entry->pins.load() && !entry->users.load() &&
+          (!oldest || (entry->lastused.load(std::memory_order_relaxed) < oldest->lastused.load(std::memory_order_relaxed)))) oldest = entry;
+    }
+
+    // everything open is pinned or in use
+    if (!oldest) break;
+
+    BBCDEBUG3(("Closing '%s' (%u files open, limit %u)", oldest->filename.c_str(), open.load(), maxopen.load()));
+
+    Close(oldest);
+    evictions++;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open file for entry, installing handle unless another thread has already done so
+ *
+ * @return installed handle
+ */
+/*--------------------------------------------------------------------------------*/
+EnhancedFile *FileHandlePool::Open(ENTRY *entry)
+{
+  EnhancedFile *file, *current = NULL;
+
+  if (((file = new EnhancedFile) != NULL) && file->fopen(entry->filename.c_str(), "rb"))
+  {
+    opens++;
+
+    if (entry->file.compare_exchange_strong(current, file)) open++;
+    else
+    {
+      // another thread got there first, use its handle
+      file->fclose();
+      delete file;
+      file = current;
+    }
+  }
+  else
+  {
+    BBCERROR("Failed to open '%s' for reading", entry->filename.c_str());
+    if (file) delete file;
+    file = entry->file.load();
+  }
+
+  return file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Close file of entry, waiting for any users to release it
+ *
+ * @note MUST be called with lock held
+ */
+/*--------------------------------------------------------------------------------*/
+void FileHandlePool::Close(ENTRY *entry)
+{
+  EnhancedFile *file;
+
+  // once removed, new users will open their own handle so only existing users need to finish
+  if ((file = entry->file.exchange(NULL)) != NULL)
+  {
+    while (entry->users.load()) std::this_thread::yield();
+
+    file->fclose();
+    delete file;
+
+    open--;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Maintenance thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *FileHandlePool::MaintenanceThread(Thread& thread)
+{
+  while (!thread.StopRequested())
+  {
+    uint64_t seen = maintainsignal.GetCount();
+
+    Maintain();
+
+    maintainsignal.Wait(seen, SignalTimeout);
+  }
+
+  return NULL;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,231 @@
+#ifndef __FILE_HANDLE_POOL__
+#define __FILE_HANDLE_POOL__
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include <bbcat-base/EnhancedFile.h>
+#include <bbcat-base/Thread.h>
+#include <bbcat-base/ThreadLock.h>
+
+#include "LockFreeQueue.h"
+#include "ThreadSignal.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Bounded pool of open file handles and shared sample buffers for lazily opened files
+ *
+ * Each registered file is opened (read-only) when it is first acquired and the least
+ * recently used handles are closed when more than the maximum number are open.  Files that
+ * are pinned are never closed and, whilst the maintenance thread is running, are opened
+ * ahead of being acquired so that the acquiring thread does not pay the cost of opening
+ *
+ * Acquire(), Release(), Pin(), AcquireBuffer() and ReleaseBuffer() take no locks unless a
+ * file has to be opened by Acquire()
+ *
+ * Real-time threads should read within the scope of a NonBlocking object, in which case
+ * Acquire() never opens a file: it returns NULL, leaving the maintenance thread to open the
+ * file, and reads through the pool output silence instead (see STATS::silentreads)
+ */
+/*--------------------------------------------------------------------------------*/
+class FileHandlePool
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param maxopen maximum number of unpinned files kept open
+   * @param nbuffers number of shared sample buffers
+   * @param buffersize size of each sample buffer in bytes
+   */
+  /*--------------------------------------------------------------------------------*/
+  FileHandlePool(uint_t maxopen = 64, uint_t nbuffers = 8, size_t buffersize = 65536);
+  ~FileHandlePool();
+
+  typedef struct
+  {
+    std::string                 filename;
+    std::atomic<EnhancedFile *> file;
+    std::atomic<uint_t>         users;      // number of callers between Acquire() and Release()
+    std::atomic<uint_t>         pins;
+    std::atomic<bool>           wanted;     // acquired whilst closed by a non-blocking thread
+    std::atomic<uint64_t>       lastused;
+  } ENTRY;
+
+  typedef struct
+  {
+    uint_t   registered;        // number of files registered
+    uint_t   open;              // number of files currently open
+    uint_t   pinnedclosed;      // number of pinned files waiting to be opened
+    uint64_t opens;             // total number of times files have been opened
+    uint64_t misses;            // number of times Acquire() has found a file closed
+    uint64_t evictions;         // number of times files have been closed to stay within the limit
+    uint64_t silentreads;       // number of non-blocking reads that output silence because the
+                                // file was closed or no sample buffer was free
+  } STATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Make Acquire() non-blocking for the calling thread for the lifetime of this object
+   */
+  /*--------------------------------------------------------------------------------*/
+  class NonBlocking
+  {
+  public:
+    NonBlocking() : previous(nonblocking) {nonblocking = true;}
+    ~NonBlocking() {nonblocking = previous;}
+
+  protected:
+    bool previous;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether Acquire() is non-blocking for the calling thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool IsNonBlocking() {return nonblocking;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set maximum number of unpinned files kept open
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetMaxOpen(uint_t n) {maxopen = n; maintainsignal.Signal();}
+  uint_t GetMaxOpen() const {return maxopen;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start/stop maintenance thread that opens pinned files ahead of time and closes
+   * least recently used files
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Start();
+  void Stop();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Register file with pool (file is not opened)
+   *
+   * @return entry to use with other calls
+   */
+  /*--------------------------------------------------------------------------------*/
+  ENTRY *Register(const std::string& filename);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Unregister file, closing it if it is open
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Unregister(ENTRY *entry);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return open file handle for entry, opening it if necessary
+   *
+   * @return file handle or NULL if file cannot be opened (or, if non-blocking, is not open)
+   *
+   * @note Release() MUST be called afterwards (even if NULL is returned)
+   * @note the handle must only be used by one thread at a time
+   * @note if non-blocking and the maintenance thread is running, a file that is not open is
+   * @note opened by the maintenance thread rather than by the caller
+   */
+  /*--------------------------------------------------------------------------------*/
+  EnhancedFile *Acquire(ENTRY *entry);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Allow file handle returned by Acquire() to be closed
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Release(ENTRY *entry)
+  {
+    // last user of a file that can now be closed to get within the limit
+    if ((entry->users.fetch_sub(1) == 1) && (open.load() > maxopen.load())) maintainsignal.Signal();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pin/unpin file (pinned files are kept open and opened ahead of time)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Pin(ENTRY *entry, bool pin = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return shared sample buffer or NULL if none are free
+   *
+   * @param size set to size of buffer in bytes
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint8_t *AcquireBuffer(size_t& size);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return sample buffer to pool
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ReleaseBuffer(uint8_t *buffer);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Count a non-blocking read that output silence
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AddSilentRead() {silentreads++;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  void GetStats(STATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open pinned files and close least recently used files beyond the limit
+   *
+   * @note called by the maintenance thread, may be called by anything else if it is not running
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Maintain();
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Open file for entry, installing handle unless another thread has already done so
+   *
+   * @return installed handle
+   */
+  /*--------------------------------------------------------------------------------*/
+  EnhancedFile *Open(ENTRY *entry);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Close file of entry, waiting for any users to release it
+   *
+   * @note MUST be called with lock held
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Close(ENTRY *entry);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Maintenance thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__MaintenanceThread(Thread& thread, void *arg) {return ((FileHandlePool *)arg)->MaintenanceThread(thread);}
+  void *MaintenanceThread(Thread& thread);
+
+protected:
+  ThreadLockObject        tlock;        // protects list of entries
+  Thread                  thread;
+  ThreadSignal            maintainsignal; // signalled when there may be files to open or close
+  std::vector<ENTRY *>    entries;
+  std::vector<uint8_t>    bufferstore;
+  LockFreeQueue<uint8_t *> freebuffers;
+  size_t                  buffersize;
+  std::atomic<uint_t>     maxopen;
+  std::atomic<uint_t>     open;
+  std::atomic<uint64_t>   clock;        // incremented by each Acquire() for LRU ordering
+  std::atomic<uint64_t>   opens;
+  std::atomic<uint64_t>   misses;
+  std::atomic<uint64_t>   evictions;
+  std::atomic<uint64_t>   silentreads;
+
+  static thread_local bool nonblocking;
+
+private:
+  // prevent copying
+  FileHandlePool(const FileHandlePool& obj);
+  FileHandlePool& operator = (const FileHandlePool& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,262 @@
+
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "IOStatistics.h"
+
+BBC_AUDIOTOOLBOX_START
+
+bool IOStatistics::defaultenable = false;
+
+IOStatistics::IOStatistics()
+{
+  ResetCounters(counters);
+  ResetCounters(processcounters);
+
+  ThreadLock lock(GetListLock());
+  GetList().push_back(this);
+}
+
+IOStatistics::~IOStatistics()
+{
+  ThreadLock lock(GetListLock());
+  std::vector<IOStatistics *>& list = GetList();
+  std::vector<IOStatistics *>::iterator it;
+
+  if ((it = std::find(list.begin(), list.end(), this)) != list.end()) list.erase(it);
+
+  // keep the contribution of this object to the process-wide statistics
+  AddCounters(GetDeletedCounters(), processcounters);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return lock and list of all objects (only used on creation, deletion and when the
+ * process-wide statistics are queried or reset)
+ */
+/*--------------------------------------------------------------------------------*/
+ThreadLockObject& IOStatistics::GetListLock()
+{
+  static ThreadLockObject tlock;
+  return tlock;
+}
+
+std::vector<IOStatistics *>& IOStatistics::GetList()
+{
+  static std::vector<IOStatistics *> list;
+  return list;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return process-wide counters of deleted objects (protected by the list lock)
+ */
+/*--------------------------------------------------------------------------------*/
+IOStatistics::COUNTERS& IOStatistics::GetDeletedCounters()
+{
+  static COUNTERS *counters = NULL;
+
+  // created under the list lock
+  if (!counters)
+  {
+    counters = new COUNTERS;
+    ResetCounters(*counters);
+  }
+
+  return *counters;
+}
+
+void IOStatistics::AddRead(uint64_t bytes, uint64_t ns)
+{
+  COUNTERS *list[] = {&counters, &processcounters};
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(list); i++)
+  {
+    list[i]->bytesread.fetch_add(bytes, std::memory_order_relaxed);
+    list[i]->reads.fetch_add(1, std::memory_order_relaxed);
+    list[i]->readlatency.Add(ns);
+  }
+}
+
+void IOStatistics::AddWrite(uint64_t bytes, uint64_t ns)
+{
+  COUNTERS *list[] = {&counters, &processcounters};
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(list); i++)
+  {
+    list[i]->byteswritten.fetch_add(bytes, std::memory_order_relaxed);
+    list[i]->writes.fetch_add(1, std::memory_order_relaxed);
+    list[i]->writelatency.Add(ns);
+  }
+}
+
+void IOStatistics::AddSeek(uint64_t ns)
+{
+  COUNTERS *list[] = {&counters, &processcounters};
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(list); i++)
+  {
+    list[i]->seeks.fetch_add(1, std::memory_order_relaxed);
+    list[i]->seeklatency.Add(ns);
+  }
+}
+
+void IOStatistics::AddConvert(uint64_t frames, uint64_t ns)
+{
+  COUNTERS *list[] = {&counters, &processcounters};
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(list); i++)
+  {
+    list[i]->frames.fetch_add(frames, std::memory_order_relaxed);
+    list[i]->convertlatency.Add(ns);
+  }
+}
+
+void IOStatistics::AddAcquire(uint64_t ns)
+{
+  COUNTERS *list[] = {&counters, &processcounters};
+  uint_t i;
+
+  for (i = 0; i < NUMBEROF(list); i++)
+  {
+    list[i]->acquirelatency.Add(ns);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return live statistics
+ *
+ * @note measurements being recorded whilst this is called may be partly included
+ */
+/*--------------------------------------------------------------------------------*/
+void IOStatistics::GetStats(STATS& stats) const
+{
+  ResetStats(stats);
+  AddToStats(stats, counters);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset counters and histograms (the process-wide statistics are not affected)
+ */
+/*--------------------------------------------------------------------------------*/
+void IOStatistics::ResetStats()
+{
+  ResetCounters(counters);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return statistics of all files with statistics enabled
+ */
+/*--------------------------------------------------------------------------------*/
+void IOStatistics::GetProcessStats(STATS& stats)
+{
+  ThreadLock lock(GetListLock());
+  const std::vector<IOStatistics *>& list = GetList();
+  uint_t i;
+
+  ResetStats(stats);
+  AddToStats(stats, GetDeletedCounters());
+
+  for (i = 0; i < list.size(); i++) AddToStats(stats, list[i]->processcounters);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset statistics of all files with statistics enabled (the statistics of each object are
+ * not affected)
+ */
+/*--------------------------------------------------------------------------------*/
+void IOStatistics::ResetProcessStats()
+{
+  ThreadLock lock(GetListLock());
+  const std::vector<IOStatistics *>& list = GetList();
+  uint_t i;
+
+  ResetCounters(GetDeletedCounters());
+
+  for (i = 0; i < list.size(); i++) ResetCounters(list[i]->processcounters);
+}
+
+void IOStatistics::ResetStats(STATS& stats)
+{
+  stats.bytesread    = 0;
+  stats.byteswritten = 0;
+  stats.reads        = 0;
+  stats.writes       = 0;
+  stats.seeks        = 0;
+  stats.frames       = 0;
+  stats.readlatency.Reset();
+  stats.writelatency.Reset();
+  stats.seeklatency.Reset();
+  stats.convertlatency.Reset();
+  stats.acquirelatency.Reset();
+}
+
+void IOStatistics::ResetCounters(COUNTERS& counters)
+{
+  counters.bytesread.store(0, std::memory_order_relaxed);
+  counters.byteswritten.store(0, std::memory_order_relaxed);
+  counters.reads.store(0, std::memory_order_relaxed);
+  counters.writes.store(0, std::memory_order_relaxed);
+  counters.seeks.store(0, std::memory_order_relaxed);
+  counters.frames.store(0, std::memory_order_relaxed);
+  counters.readlatency.Reset();
+  counters.writelatency.Reset();
+  counters.seeklatency.Reset();
+  counters.convertlatency.Reset();
+  counters.acquirelatency.Reset();
+}
+
+void IOStatistics::AddCounters(COUNTERS& counters, const COUNTERS& obj)
+{
+  counters.bytesread.fetch_add(obj.bytesread.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.byteswritten.fetch_add(obj.byteswritten.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.reads.fetch_add(obj.reads.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.writes.fetch_add(obj.writes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.seeks.fetch_add(obj.seeks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.frames.fetch_add(obj.frames.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  counters.readlatency.Add(obj.readlatency);
+  counters.writelatency.Add(obj.writelatency);
+  counters.seeklatency.Add(obj.seeklatency);
+  counters.convertlatency.Add(obj.convertlatency);
+  counters.acquirelatency.Add(obj.acquirelatency);
+}
+
+void IOStatistics::AddToStats(STATS& stats, const COUNTERS& counters)
+{
+  stats.bytesread    += counters.bytesread.load(std::memory_order_relaxed);
+  stats.byteswritten += counters.byteswritten.load(std::memory_order_relaxed);
+  stats.reads        += counters.reads.load(std::memory_order_relaxed);
+  stats.writes       += counters.writes.load(std::memory_order_relaxed);
+  stats.seeks        += counters.seeks.load(std::memory_order_relaxed);
+  stats.frames       += counters.frames.load(std::memory_order_relaxed);
+  counters.readlatency.AddTo(stats.readlatency);
+  counters.writelatency.AddTo(stats.writelatency);
+  counters.seeklatency.AddTo(stats.seeklatency);
+  counters.convertlatency.AddTo(stats.convertlatency);
+  counters.acquirelatency.AddTo(stats.acquirelatency);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return statistics as text (one line per item)
+ */
+/*--------------------------------------------------------------------------------*/
+std::string IOStatistics::ToString(const STATS& stats)
+{
+  std::string str;
+
+  Printf(str, "Read %s bytes in %s reads, wrote %s bytes in %s writes, %s seeks, %s frames converted\n",
+         StringFrom(stats.bytesread).c_str(), StringFrom(stats.reads).c_str(),
+         StringFrom(stats.byteswritten).c_str(), StringFrom(stats.writes).c_str(),
+         StringFrom(stats.seeks).c_str(), StringFrom(stats.frames).c_str());
+  Printf(str, "Read:    %s\n", stats.readlatency.ToString().c_str());
+  Printf(str, "Write:   %s\n", stats.writelatency.ToString().c_str());
+  Printf(str, "Seek:    %s\n", stats.seeklatency.ToString().c_str());
+  Printf(str, "Convert: %s\n", stats.convertlatency.ToString().c_str());
+  Printf(str, "Acquire: %s\n", stats.acquirelatency.ToString().c_str());
+
+  return str;
+}
+
+BBC_AUDIOTOOLBOX_END
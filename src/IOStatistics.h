@@ -0,0 +1,146 @@
+#ifndef __IO_STATISTICS__
+#define __IO_STATISTICS__
+
+#include <atomic>
+#include <vector>
+
+#include <bbcat-base/misc.h>
+#include <bbcat-base/ThreadLock.h>
+
+#include "LatencyHistogram.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Counters and latency histograms of the sample I/O of a file
+ *
+ * Measurements are recorded with relaxed atomic operations, without any locking, so any
+ * number of threads can record into the same object.  The process-wide statistics (see
+ * GetProcessStats()) are the sum, calculated when queried, of every object (including those
+ * that have been deleted) so that the total I/O of all files with statistics enabled can be
+ * queried without any shared state being updated by each operation
+ *
+ * Statistics are only gathered for files that have been given an object (see
+ * SoundFileSamples::SetIOStatistics() and RIFFFile::EnableIOStatistics()), otherwise the
+ * only cost is a NULL pointer check per operation
+ */
+/*--------------------------------------------------------------------------------*/
+class IOStatistics
+{
+public:
+  IOStatistics();
+  ~IOStatistics();
+
+  typedef struct
+  {
+    uint64_t         bytesread;
+    uint64_t         byteswritten;
+    uint64_t         reads;             // number of read calls
+    uint64_t         writes;            // number of write calls
+    uint64_t         seeks;             // number of seek calls
+    uint64_t         frames;            // number of sample frames converted (read or written)
+    LatencyHistogram readlatency;       // time taken by each read
+    LatencyHistogram writelatency;      // time taken by each write
+    LatencyHistogram seeklatency;       // time taken by each seek
+    LatencyHistogram convertlatency;    // time taken by each sample format conversion
+    LatencyHistogram acquirelatency;    // time waiting for a file handle and buffer from a FileHandlePool
+  } STATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Record operations
+   *
+   * @param bytes number of bytes read or written
+   * @param ns time taken
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AddRead(uint64_t bytes, uint64_t ns);
+  void AddWrite(uint64_t bytes, uint64_t ns);
+  void AddSeek(uint64_t ns);
+  void AddConvert(uint64_t frames, uint64_t ns);
+  void AddAcquire(uint64_t ns);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return live statistics
+   *
+   * @note measurements being recorded whilst this is called may be partly included
+   */
+  /*--------------------------------------------------------------------------------*/
+  void GetStats(STATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reset counters and histograms (the process-wide statistics are not affected)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ResetStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return/reset statistics of all files with statistics enabled
+   *
+   * @note resetting the process-wide statistics does not affect those of each object
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void GetProcessStats(STATS& stats);
+  static void ResetProcessStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable statistics for every RIFFFile subsequently created (disabled by default)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void EnableByDefault(bool enable = true) {defaultenable = enable;}
+  static bool IsEnabledByDefault() {return defaultenable;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return statistics as text (one line per item)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static std::string ToString(const STATS& stats);
+
+protected:
+  typedef struct
+  {
+    std::atomic<uint64_t>  bytesread;
+    std::atomic<uint64_t>  byteswritten;
+    std::atomic<uint64_t>  reads;
+    std::atomic<uint64_t>  writes;
+    std::atomic<uint64_t>  seeks;
+    std::atomic<uint64_t>  frames;
+    AtomicLatencyHistogram readlatency;
+    AtomicLatencyHistogram writelatency;
+    AtomicLatencyHistogram seeklatency;
+    AtomicLatencyHistogram convertlatency;
+    AtomicLatencyHistogram acquirelatency;
+  } COUNTERS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return lock and list of all objects (only used on creation, deletion and when the
+   * process-wide statistics are queried or reset)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static ThreadLockObject& GetListLock();
+  static std::vector<IOStatistics *>& GetList();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return process-wide counters of deleted objects (protected by the list lock)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static COUNTERS& GetDeletedCounters();
+
+  static void ResetStats(STATS& stats);
+  static void ResetCounters(COUNTERS& counters);
+  static void AddCounters(COUNTERS& counters, const COUNTERS& obj);
+  static void AddToStats(STATS& stats, const COUNTERS& counters);
+
+protected:
+  COUNTERS    counters;         // statistics of this object
+  COUNTERS    processcounters;  // contribution of this object to the process-wide statistics
+  static bool defaultenable;
+
+private:
+  // prevent copying
+  IOStatistics(const IOStatistics& obj);
+  IOStatistics& operator = (const IOStatistics& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
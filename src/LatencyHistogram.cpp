@@ -0,0 +1,228 @@
+
+#include <string.h>
+
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "LatencyHistogram.h"
+
+BBC_AUDIOTOOLBOX_START
+
+LatencyHistogram::LatencyHistogram()
+{
+  Reset();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Clear all counts
+ */
+/*--------------------------------------------------------------------------------*/
+void LatencyHistogram::Reset()
+{
+  memset(buckets, 0, sizeof(buckets));
+  count   = 0;
+  minns   = ~(uint64_t)0;
+  maxns   = 0;
+  totalns = 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add a latency measurement
+ *
+ * @param ns latency in nanoseconds
+ */
+/*--------------------------------------------------------------------------------*/
+void LatencyHistogram::Add(uint64_t ns)
+{
+  buckets[GetBucket(ns)]++;
+  count++;
+  minns    = std::min(minns, ns);
+  maxns    = std::max(maxns, ns);
+  totalns += ns;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Merge another histogram into this one
+ */
+/*--------------------------------------------------------------------------------*/
+void LatencyHistogram::Add(const LatencyHistogram& obj)
+{
+  uint_t i;
+
+  for (i = 0; i < Buckets; i++) buckets[i] += obj.buckets[i];
+
+  count   += obj.count;
+  minns    = std::min(minns, obj.minns);
+  maxns    = std::max(maxns, obj.maxns);
+  totalns += obj.totalns;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return upper limit (exclusive) of specified bucket in nanoseconds
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t LatencyHistogram::GetBucketLimitNS(uint_t bucket)
+{
+  return (bucket < (Buckets - 1)) ? ((uint64_t)1000 << bucket) : ~(uint64_t)0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return bucket for specified latency in nanoseconds
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t LatencyHistogram::GetBucket(uint64_t ns)
+{
+  uint64_t us = ns / 1000;
+  uint_t   bucket = 0;
+
+  // find highest set bit of microseconds value
+  while (us && (bucket < (Buckets - 1)))
+  {
+    us >>= 1;
+    bucket++;
+  }
+
+  return bucket;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return approximate latency below which the specified percentage of measurements fall
+ *
+ * @param percent percentage (0-100)
+ *
+ * @return upper limit of bucket containing the percentile (limited to the maximum)
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t LatencyHistogram::GetPercentileNS(double percent) const
+{
+  uint64_t ns = 0;
+
+  if (count)
+  {
+    uint64_t target = (uint64_t)((double)count * std::min(std::max(percent, 0.0), 100.0) / 100.0 + .5);
+    uint64_t total  = 0;
+    uint_t   i;
+
+    for (i = 0; i < Buckets; i++)
+    {
+      total += buckets[i];
+      if (total >= target) break;
+    }
+
+    ns = std::min(GetBucketLimitNS(i), maxns);
+  }
+
+  return ns;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return histogram as a single line of text
+ */
+/*--------------------------------------------------------------------------------*/
+std::string LatencyHistogram::ToString() const
+{
+  std::string str;
+  uint_t i;
+
+  Printf(str, "count %s min %sus mean %sus p99 %sus max %sus buckets(us)",
+         StringFrom(count).c_str(),
+         StringFrom(GetMinNS() / 1000).c_str(),
+         StringFrom(GetMeanNS() / 1000).c_str(),
+         StringFrom(GetPercentileNS(99.0) / 1000).c_str(),
+         StringFrom(GetMaxNS() / 1000).c_str());
+
+  for (i = 0; i < Buckets; i++)
+  {
+    if (buckets[i])
+    {
+      if (i < (Buckets - 1)) Printf(str, " <%s:%s", StringFrom(GetBucketLimitNS(i) / 1000).c_str(), StringFrom(buckets[i]).c_str());
+      else                   Printf(str, " >=%s:%s", StringFrom(GetBucketLimitNS(i - 1) / 1000).c_str(), StringFrom(buckets[i]).c_str());
+    }
+  }
+
+  return str;
+}
+
+AtomicLatencyHistogram::AtomicLatencyHistogram()
+{
+  Reset();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Clear all counts
+ */
+/*--------------------------------------------------------------------------------*/
+void AtomicLatencyHistogram::Reset()
+{
+  uint_t i;
+
+  for (i = 0; i < LatencyHistogram::Buckets; i++) buckets[i].store(0, std::memory_order_relaxed);
+
+  count.store(0, std::memory_order_relaxed);
+  minns.store(~(uint64_t)0, std::memory_order_relaxed);
+  maxns.store(0, std::memory_order_relaxed);
+  totalns.store(0, std::memory_order_relaxed);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add a latency measurement
+ *
+ * @param ns latency in nanoseconds
+ */
+/*--------------------------------------------------------------------------------*/
+void AtomicLatencyHistogram::Add(uint64_t ns)
+{
+  buckets[LatencyHistogram::GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+  count.fetch_add(1, std::memory_order_relaxed);
+  totalns.fetch_add(ns, std::memory_order_relaxed);
+  UpdateLimits(ns, ns);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Merge another histogram into this one
+ */
+/*--------------------------------------------------------------------------------*/
+void AtomicLatencyHistogram::Add(const AtomicLatencyHistogram& obj)
+{
+  uint_t i;
+
+  for (i = 0; i < LatencyHistogram::Buckets; i++) buckets[i].fetch_add(obj.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+  count.fetch_add(obj.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  totalns.fetch_add(obj.totalns.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  UpdateLimits(obj.minns.load(std::memory_order_relaxed), obj.maxns.load(std::memory_order_relaxed));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Merge a snapshot of this histogram into a LatencyHistogram
+ */
+/*--------------------------------------------------------------------------------*/
+void AtomicLatencyHistogram::AddTo(LatencyHistogram& hist) const
+{
+  uint_t i;
+
+  for (i = 0; i < LatencyHistogram::Buckets; i++) hist.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+
+  hist.count   += count.load(std::memory_order_relaxed);
+  hist.minns    = std::min(hist.minns, minns.load(std::memory_order_relaxed));
+  hist.maxns    = std::max(hist.maxns, maxns.load(std::memory_order_relaxed));
+  hist.totalns += totalns.load(std::memory_order_relaxed);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Update minimum and maximum
+ */
+/*--------------------------------------------------------------------------------*/
+void AtomicLatencyHistogram::UpdateLimits(uint64_t min, uint64_t max)
+{
+  uint64_t value;
+
+  // compare_exchange_weak() reloads value on failure
+  value = minns.load(std::memory_order_relaxed);
+  while ((min < value) && !minns.compare_exchange_weak(value, min, std::memory_order_relaxed)) {}
+
+  value = maxns.load(std::memory_order_relaxed);
+  while ((max > value) && !maxns.compare_exchange_weak(value, max, std::memory_order_relaxed)) {}
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,168 @@
+#ifndef __LATENCY_HISTOGRAM__
+#define __LATENCY_HISTOGRAM__
+
+#include <atomic>
+#include <string>
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Simple log2 histogram of latencies
+ *
+ * Bucket 0 holds latencies below 1us, bucket n holds latencies from 2^(n-1)us to
+ * 2^n us and the last bucket holds everything above that
+ *
+ * @note this object does *not* lock, the owner must provide any protection needed
+ */
+/*--------------------------------------------------------------------------------*/
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+  ~LatencyHistogram() {}
+
+  enum
+  {
+    Buckets = 28,       // last bucket starts at 2^26us (~67s)
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Clear all counts
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Reset();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add a latency measurement
+   *
+   * @param ns latency in nanoseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Add(uint64_t ns);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Merge another histogram into this one
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Add(const LatencyHistogram& obj);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of measurements
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetCount()   const {return count;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return min, max, mean and total of measurements in nanoseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetMinNS()   const {return count ? minns : 0;}
+  uint64_t GetMaxNS()   const {return maxns;}
+  uint64_t GetMeanNS()  const {return count ? totalns / count : 0;}
+  uint64_t GetTotalNS() const {return totalns;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return count in specified bucket
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetBucketCount(uint_t bucket) const {return (bucket < Buckets) ? buckets[bucket] : 0;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return upper limit (exclusive) of specified bucket in nanoseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint64_t GetBucketLimitNS(uint_t bucket);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return bucket for specified latency in nanoseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint_t GetBucket(uint64_t ns);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return approximate latency below which the specified percentage of measurements fall
+   *
+   * @param percent percentage (0-100)
+   *
+   * @return upper limit of bucket containing the percentile (limited to the maximum)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetPercentileNS(double percent) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return histogram as a single line of text
+   */
+  /*--------------------------------------------------------------------------------*/
+  std::string ToString() const;
+
+protected:
+  friend class AtomicLatencyHistogram;
+
+  uint64_t buckets[Buckets];
+  uint64_t count;
+  uint64_t minns, maxns, totalns;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Log2 histogram of latencies that can be added to from any number of threads without
+ * locking (see LatencyHistogram for buckets)
+ *
+ * Every value is updated with a relaxed atomic operation so a snapshot taken whilst
+ * measurements are being added may include part of a measurement
+ */
+/*--------------------------------------------------------------------------------*/
+class AtomicLatencyHistogram
+{
+public:
+  AtomicLatencyHistogram();
+  ~AtomicLatencyHistogram() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Clear all counts
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Reset();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add a latency measurement
+   *
+   * @param ns latency in nanoseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Add(uint64_t ns);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Merge another histogram into this one
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Add(const AtomicLatencyHistogram& obj);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Merge a snapshot of this histogram into a LatencyHistogram
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AddTo(LatencyHistogram& hist) const;
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Update minimum and maximum
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UpdateLimits(uint64_t min, uint64_t max);
+
+protected:
+  std::atomic<uint64_t> buckets[LatencyHistogram::Buckets];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> minns, maxns, totalns;
+
+private:
+  // prevent copying
+  AtomicLatencyHistogram(const AtomicLatencyHistogram& obj);
+  AtomicLatencyHistogram& operator = (const AtomicLatencyHistogram& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
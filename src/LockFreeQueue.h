@@ -0,0 +1,133 @@
+#ifndef __LOCK_FREE_QUEUE__
+#define __LOCK_FREE_QUEUE__
+
+#include <atomic>
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Bounded, lock-free queue of fixed size items
+ *
+ * Any number of threads can push and pop items without locking (and without memory
+ * allocation once constructed) so it is suitable for passing commands to or from a
+ * real-time thread
+ *
+ * Each cell carries a sequence number which tells producers and consumers whether the
+ * cell is free or full for the current lap around the buffer
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename TYPE>
+class LockFreeQueue
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param n maximum number of items in queue (rounded up to a power of 2)
+   */
+  /*--------------------------------------------------------------------------------*/
+  LockFreeQueue(uint_t n = 64) : cells(NULL),
+                                 mask(0),
+                                 head(0),
+                                 tail(0)
+  {
+    size_t size = 2, i;
+
+    while (size < n) size <<= 1;
+
+    cells = new CELL[size];
+    mask  = size - 1;
+
+    for (i = 0; i < size; i++) cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+  ~LockFreeQueue() {delete[] cells;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add item to queue
+   *
+   * @return false if queue is full
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Push(const TYPE& item)
+  {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    CELL   *cell;
+
+    while (true)
+    {
+      cell = cells + (pos & mask);
+
+      size_t   seq  = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+      if (diff == 0)
+      {
+        // cell is free, try and claim it
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      }
+      else if (diff < 0) return false;  // full
+      else pos = tail.load(std::memory_order_relaxed);
+    }
+
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Remove item from queue
+   *
+   * @return false if queue is empty
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Pop(TYPE& item)
+  {
+    size_t pos = head.load(std::memory_order_relaxed);
+    CELL   *cell;
+
+    while (true)
+    {
+      cell = cells + (pos & mask);
+
+      size_t   seq  = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+      if (diff == 0)
+      {
+        // cell is full, try and claim it
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      }
+      else if (diff < 0) return false;  // empty
+      else pos = head.load(std::memory_order_relaxed);
+    }
+
+    item = cell->item;
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+
+    return true;
+  }
+
+protected:
+  typedef struct
+  {
+    std::atomic<size_t> seq;
+    TYPE                item;
+  } CELL;
+
+  CELL                *cells;
+  size_t              mask;
+  std::atomic<size_t> head;
+  std::atomic<size_t> tail;
+
+private:
+  // prevent copying
+  LockFreeQueue(const LockFreeQueue& obj);
+  LockFreeQueue& operator = (const LockFreeQueue& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
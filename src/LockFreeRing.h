@@ -0,0 +1,129 @@
+#ifndef __LOCK_FREE_RING__
+#define __LOCK_FREE_RING__
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Single producer, single consumer lock-free ring buffer of fixed width items (e.g.
+ * interleaved frames of audio)
+ *
+ * The producer and consumer access the buffer directly through contiguous regions so that
+ * data can be generated into and used from the ring without intermediate copies
+ *
+ * @note Resize() is *not* thread-safe and must only be called when neither side is active
+ */
+/*--------------------------------------------------------------------------------*/
+template<typename TYPE>
+class LockFreeRing
+{
+public:
+  LockFreeRing() : size(0),
+                   mask(0),
+                   width(1),
+                   head(0),
+                   tail(0) {}
+  ~LockFreeRing() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set size of ring and empty it
+   *
+   * @param n minimum number of items (rounded up to a power of 2)
+   * @param itemwidth number of elements per item
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Resize(size_t n, uint_t itemwidth = 1)
+  {
+    size = 1;
+    while (size < n) size <<= 1;
+
+    mask  = size - 1;
+    width = std::max(itemwidth, (uint_t)1);
+    buffer.resize(size * width);
+    head.store(0);
+    tail.store(0);
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of items ring can hold and the width of each
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t GetCapacity() const {return size;}
+  uint_t GetWidth()    const {return width;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of items available to the consumer
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t GetReadable() const {return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of free items available to the producer
+   */
+  /*--------------------------------------------------------------------------------*/
+  size_t GetWritable() const {return size - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return contiguous region of items available to the consumer (consumer only)
+   *
+   * @param n set to number of items in region
+   */
+  /*--------------------------------------------------------------------------------*/
+  const TYPE *GetReadRegion(size_t& n) const
+  {
+    size_t pos = head.load(std::memory_order_relaxed) & mask;
+
+    n = std::min(GetReadable(), size - pos);
+
+    return n ? &buffer[pos * width] : NULL;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release items from the consumer side (consumer only)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Consume(size_t n) {head.fetch_add(n, std::memory_order_release);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return contiguous region of free items (producer only)
+   *
+   * @param n set to number of items in region
+   */
+  /*--------------------------------------------------------------------------------*/
+  TYPE *GetWriteRegion(size_t& n)
+  {
+    size_t pos = tail.load(std::memory_order_relaxed) & mask;
+
+    n = std::min(GetWritable(), size - pos);
+
+    return n ? &buffer[pos * width] : NULL;
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Make items written into the write region available to the consumer (producer only)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Commit(size_t n) {tail.fetch_add(n, std::memory_order_release);}
+
+protected:
+  std::vector<TYPE>   buffer;
+  size_t              size;
+  size_t              mask;
+  uint_t              width;
+  std::atomic<size_t> head;     // total items consumed
+  std::atomic<size_t> tail;     // total items committed
+
+private:
+  // prevent copying
+  LockFreeRing(const LockFreeRing& obj);
+  LockFreeRing& operator = (const LockFreeRing& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,153 @@
+
+#include <string.h>
+
+#define BBCDEBUG_LEVEL 1
+#include "MultitrackSoundFileSamples.h"
+#include "ResamplingSoundFileSamples.h"
+
+BBC_AUDIOTOOLBOX_START
+
+MultitrackSoundFileSamples::MultitrackSoundFileSamples(uint32_t samplerate) : SoundFileSamples()
+{
+  outputformat.SetSampleRate(samplerate);
+  outputformat.SetChannels(0);
+  outputformat.SetSampleFormat(SampleFormatOf((const Sample_t *)NULL));
+  outputformat.SetSamplesBigEndian(MACHINE_IS_BIG_ENDIAN);
+
+  SetFormat(&outputformat);
+}
+
+MultitrackSoundFileSamples::~MultitrackSoundFileSamples()
+{
+  uint_t i;
+
+  for (i = 0; i < sources.size(); i++)
+  {
+    delete sources[i].source;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Add source, its channels following those of sources already added
+ *
+ * @param source source object (will be DELETED on destruction of this object)
+ *
+ * @return first channel of source within this object
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t MultitrackSoundFileSamples::AddSource(SoundFileSamples *source)
+{
+  const SoundFormat *sourceformat = source->GetFormat();
+  SOURCE src;
+
+  // convert source to output rate if necessary
+  if (sourceformat && (sourceformat->GetSampleRate() != outputformat.GetSampleRate()))
+  {
+    BBCDEBUG2(("Converting multitrack source %u from %uHz to %uHz", (uint_t)sources.size(), sourceformat->GetSampleRate(), outputformat.GetSampleRate()));
+    source = new ResamplingSoundFileSamples(source, outputformat.GetSampleRate());
+  }
+
+  src.source  = source;
+  src.channel = outputformat.GetChannels();
+  sources.push_back(src);
+
+  outputformat.SetChannels(src.channel + source->GetChannels());
+
+  UpdateData();
+
+  return src.channel;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return a copy of this object (and of all sources) that can be read independently
+ */
+/*--------------------------------------------------------------------------------*/
+SoundFileSamples *MultitrackSoundFileSamples::Duplicate() const
+{
+  MultitrackSoundFileSamples *obj;
+  uint_t i;
+
+  if ((obj = new MultitrackSoundFileSamples(outputformat.GetSampleRate())) != NULL)
+  {
+    for (i = 0; i < sources.size(); i++)
+    {
+      SoundFileSamples *source;
+
+      if ((source = sources[i].source->Duplicate()) == NULL)
+      {
+        delete obj;
+        return NULL;
+      }
+
+      obj->AddSource(source);
+    }
+
+    obj->SetSampleBufferSize(samplebufferframes);
+    obj->SetClip(clip);
+  }
+
+  return obj;
+}
+
+uint_t MultitrackSoundFileSamples::ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  uint64_t pos = GetAbsoluteSamplePosition();
+  uint_t   i, j;
+
+  // read the same block from each source that provides any of the requested channels
+  for (i = 0; i < sources.size(); i++)
+  {
+    const SOURCE&    src    = sources[i];
+    SoundFileSamples *source = src.source;
+    uint_t           first  = std::max(firstchannel, src.channel);
+    uint_t           last   = std::min(firstchannel + nchannels, src.channel + source->GetChannels());
+    Sample_t         *d     = dst + (first - firstchannel);
+    uint_t           nread  = 0;
+
+    if (first >= last) continue;
+
+    if (pos < source->GetSampleLength())
+    {
+      // sources that were not needed for previous blocks must catch up
+      if (source->GetSamplePosition() != pos) source->SetSamplePosition(pos);
+
+      nread = source->ReadSamples(d, 0, ndstchannels, frames, first - src.channel, last - first);
+
+      if (source->InError())
+      {
+        BBCERROR("Failed to read multitrack source %u", i);
+        inerror = true;
+        return 0;
+      }
+    }
+
+    // pad shorter sources with silence
+    for (j = nread; j < frames; j++) memset(d + j * ndstchannels, 0, (last - first) * sizeof(*d));
+  }
+
+  return frames;
+}
+
+void MultitrackSoundFileSamples::UpdateData()
+{
+  if (format)
+  {
+    uint_t i;
+
+    AllocateSampleBuffer();
+
+    totalsamples = 0;
+    for (i = 0; i < sources.size(); i++) totalsamples = std::max(totalsamples, sources[i].source->GetSampleLength());
+
+    Clip_t newclip =
+    {
+      0, ~(uint64_t)0,
+      0, ~(uint_t)0,
+    };
+    SetClip(newclip);
+
+    timebase = format->GetTimeBase();
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,82 @@
+#ifndef __MULTITRACK_SOUND_FILE_SAMPLES__
+#define __MULTITRACK_SOUND_FILE_SAMPLES__
+
+#include <vector>
+
+#include "SoundFileAttributes.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Sound samples object that presents several other objects side by side as one wide,
+ * interleaved file (e.g. 16 8-channel stems or 128 mono files as one 128-channel file)
+ *
+ * The channels of each source follow those of the previous source.  Each block is read
+ * from every source that provides any of the requested channels in turn, so all sources
+ * are read in lockstep and sources whose channels are not requested are not read at all
+ *
+ * @note the length is that of the longest source, shorter sources are padded with silence
+ * @note sources are DELETED on destruction of this object
+ * @note sources at a different sample rate are converted (see ResamplingSoundFileSamples)
+ * @note this object is read-only
+ */
+/*--------------------------------------------------------------------------------*/
+class MultitrackSoundFileSamples : public SoundFileSamples
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param samplerate output sample rate
+   */
+  /*--------------------------------------------------------------------------------*/
+  MultitrackSoundFileSamples(uint32_t samplerate);
+  virtual ~MultitrackSoundFileSamples();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Add source, its channels following those of sources already added
+   *
+   * @param source source object (will be DELETED on destruction of this object)
+   *
+   * @return first channel of source within this object
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t AddSource(SoundFileSamples *source);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of sources
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetSourceCount() const {return (uint_t)sources.size();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return source
+   */
+  /*--------------------------------------------------------------------------------*/
+  SoundFileSamples *GetSource(uint_t index) const {return (index < sources.size()) ? sources[index].source : NULL;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return a copy of this object (and of all sources) that can be read independently
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual SoundFileSamples *Duplicate() const;
+
+protected:
+  virtual uint_t ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  typedef struct
+  {
+    SoundFileSamples *source;
+    uint_t           channel;       // first channel of source within this object
+  } SOURCE;
+
+  virtual void UpdateData();
+
+protected:
+  SoundFormat         outputformat;
+  std::vector<SOURCE> sources;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -3,36 +3,117 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+
 #define BBCDEBUG_LEVEL 1
 #include "Playlist.h"
 
 #include "SoundFileAttributes.h"
+#include "ResamplingSoundFileSamples.h"
+#include "SampleConversion.h"
 
 BBC_AUDIOTOOLBOX_START
 
-Playlist::Playlist() : filestartpos(0),
+// longest wait for a pre-roll signal before checking again (waits are woken by signals, this is only a backstop)
+static const std::chrono::milliseconds SignalTimeout(100);
+
+Playlist::Playlist() : commands(64),
+                       commandseq(0),
+                       latestpending(false),
+                       silencedreads(0),
+                       prerolleditems(0),
+                       prerollframes(0),
+                       handlepool(NULL),
+                       pinahead(2),
+                       lazyopen(false),
+                       filestartpos(0),
                        playlistlength(0),
-                       fadesamples(100),
+                       outputrate(0),
+                       newposition(0),
                        fadedowncount(0),
                        fadeupcount(0),
+                       pause(false),
+                       releaseplayback(false),
+                       positionchange(false),
+                       activepreroll(NULL),
+                       prerollpos(0),
+                       activestream(-1),
+                       fadetable(new FadeTable),
+                       newfadetable(NULL),
+                       oldfadetables(4),
+                       incoming(NULL),
+                       incomingpreroll(NULL),
+                       incomingpos(0),
+                       incomingstream(-1),
+                       crossfadelength(0),
+                       npinned(0),
+                       fadesamples(100),
+                       fadeshape(FadeTable::Shape_Linear),
+                       crossfade(false),
                        autoplay(true),
                        loop_all(false),
                        loop_file(false),
-                       pause(false),
-                       releaseplayback(false),
-                       positionchange(false)
+                       prerollms(0),
+                       progressseq(0),
+                       progressfile(NULL),
+                       progressposition(0),
+                       progressfileposition(0),
+                       progressindex(0),
+                       progresspaused(false)
 {
+  uint_t i;
+
+  // start of first item / end of playlist
+  itemstarts.push_back(0);
+
+  // build default fade table now rather than on the playback thread
+  fadetable->Set(fadesamples, FadeTable::Shape_Linear);
+
+  // nor allocate on the playback thread during crossfades or planar reads
+  crossfadebuffer.resize(CrossfadeBufferSamples);
+  planarbuffer.resize(PlanarBufferSamples);
+
+  for (i = 0; i < PrerollSlots; i++)
+  {
+    preroll[i].state.store(Preroll_Empty);
+    preroll[i].index    = 0;
+    preroll[i].file     = NULL;
+    preroll[i].frames   = 0;
+    preroll[i].channels = 0;
+  }
+
+  memset(&latestcommand, 0, sizeof(latestcommand));
+
   it = list.begin();
 }
 
 Playlist::~Playlist()
 {
-  uint_t i;
+  FadeTable *table;
+  uint_t    i;
+
+  // stop pre-roll thread and prefetch workers *before* deleting files
+  if (prerollthread.IsRunning())
+  {
+    prerollthread.Stop(false);
+    prerollsignal.Signal();
+    prerollthread.Stop();
+  }
+  prefetch.Stop();
+  if (handlepool) handlepool->Stop();
 
   for (i = 0; i < list.size(); i++)
   {
     delete list[i];
   }
+
+  // files unregister themselves from the pool so it MUST be deleted after them
+  if (handlepool) delete handlepool;
+
+  while (oldfadetables.Pop(table)) delete table;
+  if ((table = newfadetable.exchange(NULL)) != NULL) delete table;
+  delete fadetable;
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -44,13 +125,32 @@ Playlist::~Playlist()
 void Playlist::AddFile(SoundFileSamples *file)
 {
   ThreadLock lock(tlock);
+  std::lock_guard<std::mutex> render(renderlock);
+
+  // action any controls queued before the change
+  ProcessCommands();
+
+  ClearPreroll();
+
+  // convert file to output rate if necessary
+  if (outputrate && file->GetFormat() && (file->GetFormat()->GetSampleRate() != outputrate))
+  {
+    BBCDEBUG2(("Converting item %u from %uHz to %uHz", (uint_t)list.size(), file->GetFormat()->GetSampleRate(), outputrate));
+    file = new ResamplingSoundFileSamples(file, outputrate);
+  }
+
+  // release file handle until item is near the play head
+  if (lazyopen) file->UseFileHandlePool(handlepool);
 
   list.push_back(file);
+  itemstats.emplace_back();
 
   playlistlength += file->GetSampleLength();
+  itemstarts.push_back(playlistlength);
 
   // MUST reset here to ensure 'it' is always valid
-  Reset();
+  ResetEx();
+  PublishProgress();
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -59,13 +159,20 @@ void Playlist::AddFile(SoundFileSamples *file)
 /*--------------------------------------------------------------------------------*/
 void Playlist::UpdatePlaylistLength()
 {
+  ThreadLock lock(tlock);
+  std::lock_guard<std::mutex> render(renderlock);
   uint_t i;
 
   playlistlength = 0;
+  itemstarts.resize(list.size() + 1);
+  itemstarts[0] = 0;
   for (i = 0; i < list.size(); i++)
   {
-    playlistlength += list[i]->GetSampleLength();
+    playlistlength  += list[i]->GetSampleLength();
+    itemstarts[i + 1] = playlistlength;
   }
+
+  PublishProgress();
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -75,45 +182,351 @@ void Playlist::UpdatePlaylistLength()
 void Playlist::Clear()
 {
   ThreadLock lock(tlock);
+  std::lock_guard<std::mutex> render(renderlock);
+
+  // discard controls queued before the change
+  ProcessCommands();
+
+  ClearPreroll();
 
   while (list.size())
   {
     delete list.back();
     list.pop_back();
   }
+  itemstats.clear();
 
   playlistlength = 0;
+  itemstarts.resize(1);
     
   // MUST reset here to ensure 'it' is always valid
-  Reset();
+  ResetEx();
+  PublishProgress();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set number of samples used during fade up or down
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::SetFadeSamples(uint_t n)
+{
+  fadesamples.store(n);
+  UpdateFadeTable();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set shape of fades and crossfades
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::SetFadeShape(FadeTable::Shape_t shape)
+{
+  fadeshape.store((uint_t)shape);
+  UpdateFadeTable();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Build fade table from the current fade length and shape and pass it to the playback
+ * thread (NOT real-time safe)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::UpdateFadeTable()
+{
+  ThreadLock lock(tlock);
+  FadeTable *table;
+
+  // delete tables the playback thread has finished with
+  while (oldfadetables.Pop(table)) delete table;
+
+  // allocation and calculation of gains happens here, not on the playback thread
+  table = new FadeTable;
+  table->Set(fadesamples, (FadeTable::Shape_t)fadeshape.load());
+
+  // replace any table not yet picked up
+  if ((table = newfadetable.exchange(table)) != NULL) delete table;
+
+  // if ReadSamples() is not running, switch now so that controls use the new length
+  std::unique_lock<std::mutex> render(renderlock, std::try_to_lock);
+  if (render.owns_lock()) UseNewFadeTable();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Switch to fade table built by UpdateFadeTable(), if any, unless a fade or crossfade
+ * is in progress (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::UseNewFadeTable()
+{
+  // a fade in progress keeps the table it started with
+  if (!fadeupcount && !fadedowncount && !incoming && newfadetable.load(std::memory_order_relaxed))
+  {
+    FadeTable *table;
+
+    // the old table is deleted off this thread, keep it if it cannot be passed back
+    if (oldfadetables.Push(fadetable) && ((table = newfadetable.exchange(NULL)) != NULL))
+    {
+      fadetable = table;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Queue command and action it (and any queued before it) straight away if ReadSamples()
+ * is not running
+ *
+ * @return result of command if actioned, otherwise true
+ *
+ * @note if the queue is full, position commands (reset, position and index) replace any
+ * @note earlier position command that could not be queued and other commands wait for
+ * @note ReadSamples() to finish and are actioned by the caller, so no command is dropped
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::PostCommand(COMMAND& cmd)
+{
+  bool success = true;
+
+  cmd.seq = ++commandseq;
+
+  if (!commands.Push(cmd))
+  {
+    if ((cmd.type == Command_Reset) || (cmd.type == Command_SetPosition) || (cmd.type == Command_SetIndex))
+    {
+      // only the latest position matters so replace any earlier one that could not be queued
+      std::lock_guard<std::mutex> lock(latestlock);
+
+      BBCDEBUG2(("Playlist command queue full, command %u replaces latest position command", (uint_t)cmd.type));
+      latestcommand = cmd;
+      latestpending = true;
+    }
+    else
+    {
+      std::lock_guard<std::mutex> render(renderlock);
+
+      // action everything posted before this command and then this command
+      BBCDEBUG2(("Playlist command queue full, actioning command %u directly", (uint_t)cmd.type));
+      ProcessCommands();
+      success = ApplyCommand(cmd);
+      PublishProgress();
+      return success;
+    }
+  }
+
+  // if ReadSamples() is not running, action the command now (otherwise it is actioned by the
+  // next ReadSamples() call)
+  std::unique_lock<std::mutex> render(renderlock, std::try_to_lock);
+  if (render.owns_lock())
+  {
+    success = ProcessCommands(cmd.seq);
+    PublishProgress();
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Action all queued commands (with renderlock held)
+ *
+ * @param seq sequence number of command whose result is wanted
+ *
+ * @return result of command seq (true if it was not actioned)
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::ProcessCommands(uint64_t seq)
+{
+  COMMAND cmd;
+  COMMAND latest;
+  bool    haslatest = false;
+  bool    success   = true;
+
+  // fades started by the commands use the latest fade length and shape
+  UseNewFadeTable();
+
+  // pick up position command that could not be queued (if the lock is busy, it is picked up next time)
+  std::unique_lock<std::mutex> lock(latestlock, std::try_to_lock);
+  if (lock.owns_lock() && latestpending)
+  {
+    latest        = latestcommand;
+    latestpending = false;
+    haslatest     = true;
+  }
+  if (lock.owns_lock()) lock.unlock();
+
+  while (commands.Pop(cmd))
+  {
+    // action position command in the order it was posted
+    if (haslatest && (latest.seq < cmd.seq))
+    {
+      if (!ApplyCommand(latest) && (latest.seq == seq)) success = false;
+      haslatest = false;
+    }
+
+    if (!ApplyCommand(cmd) && (cmd.seq == seq)) success = false;
+  }
+
+  if (haslatest && !ApplyCommand(latest) && (latest.seq == seq)) success = false;
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Action single command (with renderlock held)
+ *
+ * @return false if position or index command could not be actioned
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::ApplyCommand(const COMMAND& cmd)
+{
+  bool success = true;
+
+  switch (cmd.type)
+  {
+    case Command_SetPosition:
+      success = SetPlaybackPositionRT(cmd.position, cmd.force);
+      break;
+
+    case Command_SetIndex:
+      if (!Empty())
+      {
+        uint_t   index = std::min(cmd.index, (uint_t)list.size() - 1);
+        uint64_t pos   = itemstarts[index];     // start of specified file
+
+        if (!cmd.fromstart && (it != list.end()))
+        {
+          // use current position within current file as offset
+          //TODO: limit offset
+          pos += GetItemPosition();
+          pos  = std::min(pos, playlistlength);
+        }
+
+        BBCDEBUG3(("SetPlaybackIndex %u pos %s", index, StringFrom(pos).c_str()));
+
+        success = SetPlaybackPositionRT(pos, cmd.force);
+
+        releaseplayback = true;
+      }
+      else success = false;
+      break;
+
+    case Command_Pause:
+      if (cmd.enable != pause)
+      {
+        // either fade up or down
+        if (pause) fadeupcount   = fadetable->GetLength();
+        else       fadedowncount = fadetable->GetLength();
+
+        pause = cmd.enable;
+      }
+      break;
+
+    case Command_Release:
+      releaseplayback = true;
+      break;
+
+    case Command_Reset:
+      ResetEx();
+      break;
+
+    case Command_Next:
+      NextEx();
+      break;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Publish progress snapshot (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::PublishProgress()
+{
+  SoundFileSamples *file = (it != list.end()) ? *it : NULL;
+  uint32_t         seq   = progressseq.load(std::memory_order_relaxed);
+
+  // odd sequence count tells readers an update is in progress
+  progressseq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  progressfile.store(file, std::memory_order_relaxed);
+  progressposition.store(filestartpos + GetItemPosition(), std::memory_order_relaxed);
+  progressfileposition.store(file ? file->GetAbsoluteSamplePosition() + (activepreroll ? prerollpos : 0) : 0, std::memory_order_relaxed);
+  progressindex.store((uint_t)(it - list.begin()), std::memory_order_relaxed);
+  progresspaused.store(pause, std::memory_order_relaxed);
+
+  progressseq.store(seq + 2, std::memory_order_release);
 }
 
 /*--------------------------------------------------------------------------------*/
 /** Reset to start of playback list
+ *
+ * @note actioned immediately unless ReadSamples() is running, in which case the request is
+ * @note queued and actioned by the next ReadSamples() call
  */
 /*--------------------------------------------------------------------------------*/
 void Playlist::Reset()
 {
-  ThreadLock lock(tlock);
+  COMMAND cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = Command_Reset;
+  PostCommand(cmd);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset to start of playback list (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::ResetEx()
+{
+  CancelCrossfade();
+  CancelPreroll();
 
   filestartpos    = 0;           // reset to start of playlist
   fadedowncount   = 0;           // stop fade down
-  fadeupcount     = fadesamples; // start fade up
+  fadeupcount     = fadetable->GetLength(); // start fade up
   positionchange  = false;       // cancel position change
   pause           = false;       // unpause audio
   releaseplayback = false;       // clear playback release
   
   it = list.begin();
   if (it != list.end()) (*it)->SetSamplePosition(0);
+
+  UsePreroll();
+  RequestPreroll();
 }
 
 /*--------------------------------------------------------------------------------*/
 /** Move onto next file (or stop if looping is disabled)
+ *
+ * @note actioned immediately unless ReadSamples() is running, in which case the request is
+ * @note queued and actioned by the next ReadSamples() call
  */
 /*--------------------------------------------------------------------------------*/
 void Playlist::Next()
 {
-  ThreadLock lock(tlock);
+  COMMAND cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = Command_Next;
+  PostCommand(cmd);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Move onto next file (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::NextEx()
+{
+  // item being crossfaded into (if any) has already been started
+  SoundFileSamples *started        = incoming;
+  PREROLL          *startedpreroll = incomingpreroll;
+  uint_t           startedpos      = incomingpos;
+  sint_t           startedstream   = incomingstream;
+
+  incoming        = NULL;
+  incomingpreroll = NULL;
+  incomingstream  = -1;
+
+  CancelPreroll();
 
   if (it != list.end())
   {
@@ -131,19 +544,30 @@ void Playlist::Next()
       }
     }
     
-    // reset position of file if not at end of list
-    if (it != list.end()) (*it)->SetSamplePosition(0);
-  }
-}
+    if ((it != list.end()) && (*it == started))
+    {
+      // continue from the end of the crossfade, from the same prefetch stream or still
+      // from pre-roll data if it is not used up
+      if (startedstream >= 0) activestream = startedstream;
+      else if (startedpreroll && (startedpos < startedpreroll->frames))
+      {
+        activepreroll = startedpreroll;
+        prerollpos    = startedpos;
+      }
+    }
+    else
+    {
+      if (startedstream >= 0) prefetch.Release(startedstream);
 
-/*--------------------------------------------------------------------------------*/
-/** Return current file or NULL if the end of the list has been reached
- */
-/*--------------------------------------------------------------------------------*/
-SoundFileSamples *Playlist::GetFile() const
-{
-  ThreadLock lock(tlock);
-  return (it != list.end()) ? *it : NULL;
+      // reset position of file if not at end of list
+      if (it != list.end()) (*it)->SetSamplePosition(0);
+
+      // play start of file from memory if it has been pre-rolled
+      UsePreroll();
+    }
+
+    RequestPreroll();
+  }
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -174,6 +598,18 @@ int Playlist::GetIndexOf(SoundFileSamples *file) const
 {
   ThreadLock lock(tlock);
   std::vector<SoundFileSamples *>::const_iterator it = std::find(list.begin(), list.end(), file);
+
+  if (it == list.end())
+  {
+    // file may have been wrapped for conversion to the output rate
+    for (it = list.begin(); it != list.end(); ++it)
+    {
+      const ResamplingSoundFileSamples *resampler;
+
+      if (((resampler = dynamic_cast<const ResamplingSoundFileSamples *>(*it)) != NULL) && (resampler->GetSource() == file)) break;
+    }
+  }
+
   return (it != list.end()) ? it - list.begin() : -1;
 }
 
@@ -197,30 +633,39 @@ uint_t Playlist::GetMaxOutputChannels() const
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Return current playback position (in samples)
+/** Set current playback position (in samples)
+ *
+ * @return true if position is valid (or, if ReadSamples() is running, if the request was queued)
+ *
+ * @note setting force to true may cause clicks!
+ * @note setting force to false causes a fade down *before* and a fade up *after*
+ * changing the position which means this doesn't actually change the position straight away!
+ * @note actioned immediately unless ReadSamples() is running, in which case the request is
+ * @note queued and actioned by the next ReadSamples() call
  */
 /*--------------------------------------------------------------------------------*/
-uint64_t Playlist::GetPlaybackPosition() const
+bool Playlist::SetPlaybackPosition(uint64_t pos, bool force)
 {
-  ThreadLock lock(tlock);
-  uint64_t pos = filestartpos;
-  if (it != list.end()) pos += (*it)->GetSamplePosition();
-  return pos;
+  COMMAND cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type     = Command_SetPosition;
+  cmd.position = pos;
+  cmd.force    = force;
+
+  return PostCommand(cmd);
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Set current playback position (in samples)
+/** Set position, either immediately or after fading down (with renderlock held)
  *
- * @note setting force to true may cause clicks!
- * @note setting force to false causes a fade down *before* and a fade up *after*
- * changing the position which means this doesn't actually change the position straight away!
+ * @return false if position is invalid
  */
 /*--------------------------------------------------------------------------------*/
-bool Playlist::SetPlaybackPosition(uint64_t pos, bool force)
+bool Playlist::SetPlaybackPositionRT(uint64_t pos, bool force)
 {
-  ThreadLock lock(tlock);
   bool success = false;
-  
+
   pos = std::min(pos, playlistlength);
 
   if (!Empty())
@@ -235,11 +680,10 @@ bool Playlist::SetPlaybackPosition(uint64_t pos, bool force)
       positionchange = false;
 
       // set position immediately and to hell with fading down
-      if (SetPlaybackPositionEx(pos))
+      if ((success = SetPlaybackPositionEx(pos)) == true)
       {
         // start fade up
-        fadeupcount = fadesamples;
-        success     = true;
+        fadeupcount = fadetable->GetLength();
       }
     }
     else
@@ -248,7 +692,7 @@ bool Playlist::SetPlaybackPosition(uint64_t pos, bool force)
       BBCDEBUG3(("Set new position request for position %s samples", StringFrom(pos).c_str()));
 
       // start fade down
-      fadedowncount  = fadesamples;
+      fadedowncount  = fadetable->GetLength();
 
       // set up for position change
       newposition    = pos;
@@ -268,27 +712,28 @@ bool Playlist::SetPlaybackPositionEx(uint64_t pos)
 {
   bool success = false;
 
+  CancelCrossfade();
+  CancelPreroll();
+
   // if looping is enabled, do not allow movement beyond last sample of playlist
   uint64_t len = loop_all ? limited::subz(playlistlength, (uint64_t)1) : playlistlength;
 
   // limit position
   pos = std::min(pos, len); 
-            
-  // move back if necessary
-  while ((it != list.begin()) && (pos < filestartpos))
+
+  if (pos < playlistlength)
   {
-    // move back
-    --it;
-    // move position back by new file's length
-    filestartpos -= (*it)->GetSampleLength();
+    // find last item starting at or before position (skipping any empty items)
+    uint_t index = (uint_t)(std::upper_bound(itemstarts.begin(), itemstarts.end() - 1, pos) - itemstarts.begin()) - 1;
+
+    it           = list.begin() + index;
+    filestartpos = itemstarts[index];
   }
-  // move forward if necessary
-  while ((it != list.end()) && (pos >= (filestartpos + (*it)->GetSampleLength())))
+  else
   {
-    // move position back by existing file's length
-    filestartpos += (*it)->GetSampleLength();
-    // move forward
-    ++it;
+    // beyond end of playlist
+    it           = list.end();
+    filestartpos = playlistlength;
   }
 
   if ((it != list.end()) && (pos >= filestartpos) && (pos < (filestartpos + (*it)->GetSampleLength())))
@@ -296,20 +741,13 @@ bool Playlist::SetPlaybackPositionEx(uint64_t pos)
     (*it)->SetSamplePosition(pos - filestartpos);
     success = true;
   }
+
+  // next item may have changed
+  RequestPreroll();
   
   return success;
 }
 
-/*--------------------------------------------------------------------------------*/
-/** Return current index in playlist
- */
-/*--------------------------------------------------------------------------------*/
-uint_t Playlist::GetPlaybackIndex() const
-{
-  ThreadLock lock(tlock);
-  return (uint_t)(it - list.begin());
-}
-
 /*--------------------------------------------------------------------------------*/
 /** Return maximum index in playlist
  *
@@ -329,51 +767,26 @@ uint_t Playlist::GetPlaybackCount() const
  * @param fromstart true to play new item from start, false to start playing new item from the *same* place as currently being played
  * @param force true to force position change immediately (see below)
  *
+ * @return true if position is valid (or, if ReadSamples() is running, if the request was queued)
+ *
  * @note setting force to true may cause clicks!
  * @note setting force to false causes a fade down *before* and a fade up *after*
  * changing the position which means this doesn't actually change the position straight away!
+ * @note actioned immediately unless ReadSamples() is running, in which case the request is
+ * @note queued and actioned by the next ReadSamples() call
  */
 /*--------------------------------------------------------------------------------*/
 bool Playlist::SetPlaybackIndex(uint_t index, bool fromstart, bool force)
 {
-  ThreadLock lock(tlock);
-  bool success = false;
+  COMMAND cmd;
 
-  if (!Empty())
-  {
-    uint64_t pos = 0;
-    uint_t   i;
-
-    index = std::min(index, GetPlaybackCount());
-
-    // find position of start of specified file
-    for (i = 0; i < index; i++)
-    {
-      pos += list[i]->GetSampleLength();
-    }
-
-    if (!fromstart)
-    {
-      // use current position within current file as offset
-      const SoundFileSamples *file = GetFile();
-      if (file)
-      {
-        uint64_t offset = file->GetSamplePosition();
-        //TODO: limit offset
-        pos += offset;
-        pos  = std::min(pos, playlistlength);
-      }
-    }
-    
-    BBCDEBUG3(("SetPlaybackIndex %u pos %s", index, StringFrom(pos).c_str()));
-  
-    // now just request change of position
-    success = SetPlaybackPosition(pos, force);
-
-    releaseplayback = true;
-  }
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type      = Command_SetIndex;
+  cmd.index     = index;
+  cmd.fromstart = fromstart;
+  cmd.force     = force;
 
-  return success;
+  return PostCommand(cmd);
 }
 
 /*--------------------------------------------------------------------------------*/
@@ -383,36 +796,746 @@ bool Playlist::SetPlaybackIndex(uint_t index, bool fromstart, bool force)
 PlaybackTracker::PLAYBACKPROGRESS Playlist::GetPlaybackProgress() const
 {
   PLAYBACKPROGRESS progress;
+  uint32_t seq;
+
+  // retry until the snapshot was not being updated whilst it was read
+  do
+  {
+    while ((seq = progressseq.load(std::memory_order_acquire)) & 1) ;
+
+    progress.file             = progressfile.load(std::memory_order_relaxed);
+    progress.absoluteposition = progressposition.load(std::memory_order_relaxed);
+    progress.fileposition     = progressfileposition.load(std::memory_order_relaxed);
+    progress.fileindex        = progressindex.load(std::memory_order_relaxed);
 
-  memset(&progress, 0, sizeof(progress));
-  progress.file             = GetFile();
-  progress.absoluteposition = GetPlaybackPosition();
-  progress.fileposition     = progress.file ? progress.file->GetAbsoluteSamplePosition() : 0;
-  progress.fileindex        = GetPlaybackIndex();
+    std::atomic_thread_fence(std::memory_order_acquire);
+  }
+  while (progressseq.load(std::memory_order_relaxed) != seq);
 
   return progress;
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Pause/unpause audio
+/** Get whether audio is paused
  */
 /*--------------------------------------------------------------------------------*/
-void Playlist::PauseAudio(bool enable)
+bool Playlist::IsAudioPaused() const
 {
-  if (enable != pause)
-  {
-    ThreadLock lock(tlock);
+  return progresspaused.load(std::memory_order_relaxed);
+}
 
-    // either fade up or down
-    if (pause) fadeupcount   = fadesamples;
-    else       fadedowncount = fadesamples;
+/*--------------------------------------------------------------------------------*/
+/** Release playback of audio that is current held
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::ReleasePlayback()
+{
+  COMMAND cmd;
 
-    pause = enable;
-  }
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type = Command_Release;
+  PostCommand(cmd);
 }
 
 /*--------------------------------------------------------------------------------*/
-/** Read samples into buffer
+/** Pause/unpause audio
+ *
+ * @note actioned immediately unless ReadSamples() is running, in which case the request is
+ * @note queued and actioned by the next ReadSamples() call
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::PauseAudio(bool enable)
+{
+  COMMAND cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.type   = Command_Pause;
+  cmd.enable = enable;
+  PostCommand(cmd);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set amount of the next item (and of the loop target when looping) to read ahead
+ *
+ * @param ms pre-roll time in ms (0 to disable)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::SetPrerollTime(uint_t ms)
+{
+  prerollms = ms;
+
+  // pre-roll thread is only started when required
+  if (ms && !prerollthread.IsRunning() && !prerollthread.Start(&__PrerollThread, (void *)this))
+  {
+    BBCERROR("Failed to start playlist pre-roll thread");
+  }
+
+  // requests are made by the playback thread on the next item change
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable decoding of items by a pool of worker threads
+ *
+ * @param workers number of worker threads (0 to disable)
+ * @param buffertimems amount of each item to decode ahead of playback
+ *
+ * @return true if the requested number of workers were started
+ *
+ * @note prefetching replaces pre-roll (see SetPrerollTime()) whilst enabled
+ * @note ReadSamples() outputs silence whilst prefetching is being changed
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::EnablePrefetch(uint_t workers, uint_t buffertimems)
+{
+  ThreadLock lock(tlock);
+  std::lock_guard<std::mutex> render(renderlock);
+  bool success = true;
+
+  ClearPreroll();
+
+  if (workers) success = prefetch.Start(workers, buffertimems);
+  else         prefetch.Stop();
+
+  // request streams (or pre-roll) for the current state of the playlist
+  RequestPreroll();
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether an item is being prefetched and its stream has been decoded as far
+ * ahead as it can be (see EnablePrefetch())
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::IsItemPrefetched(uint_t index) const
+{
+  ThreadLock lock(tlock);
+  sint_t stream;
+
+  return ((index < list.size()) &&
+          ((stream = prefetch.Find(list[index], index, true)) >= 0) &&
+          prefetch.IsFilled((uint_t)stream));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable lazy opening of files subsequently added
+ *
+ * @param maxopen maximum number of files kept open, in addition to pinned files (0 to disable)
+ * @param pinahead number of items after the current item to keep open (at least 1)
+ *
+ * @return true if enabled
+ *
+ * @note ReadSamples() outputs silence whilst lazy opening is being changed
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::EnableLazyOpen(uint_t maxopen, uint_t pinahead)
+{
+  ThreadLock lock(tlock);
+  std::lock_guard<std::mutex> render(renderlock);
+
+  if (maxopen)
+  {
+    if (!handlepool) handlepool = new FileHandlePool(maxopen, PoolReaders);
+    else             handlepool->SetMaxOpen(maxopen);
+
+    // the next item MUST be opened ahead of it being reached
+    this->pinahead = std::max(std::min(pinahead, (uint_t)MaxPinAhead), 1U);
+    lazyopen       = handlepool->Start();
+  }
+  else lazyopen = false;
+
+  // re-pin with new settings
+  ClearPins();
+  UpdatePins();
+
+  return lazyopen;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return file handle statistics of lazily opened files
+ *
+ * @return false if lazy opening has never been enabled
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::GetFileHandleStats(FileHandlePool::STATS& stats) const
+{
+  if (handlepool) handlepool->GetStats(stats);
+
+  return (handlepool != NULL);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return underrun statistics for an item
+ *
+ * @return false if index is out of range
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::GetPrefetchStats(uint_t index, PREFETCHSTATS& stats) const
+{
+  ThreadLock lock(tlock);
+  bool success = false;
+
+  if (index < itemstats.size())
+  {
+    stats.underruns      = itemstats[index].underruns.load();
+    stats.underrunframes = itemstats[index].underrunframes.load();
+    success = true;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Reset underrun statistics of all items
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::ResetPrefetchStats()
+{
+  ThreadLock lock(tlock);
+  uint_t i;
+
+  for (i = 0; i < itemstats.size(); i++)
+  {
+    itemstats[i].underruns.store(0);
+    itemstats[i].underrunframes.store(0);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return current position within current item, including any pre-roll played
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t Playlist::GetItemPosition() const
+{
+  if ((it != list.end()) && (activestream >= 0)) return prefetch.GetPosition(activestream);
+
+  return (it != list.end()) ? (*it)->GetSamplePosition() + (activepreroll ? prerollpos : 0) : 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples from current item, using pre-roll data if available
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadItem(SoundFileSamples *file, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
+{
+  if (activestream >= 0) return ReadStream(activestream, dst, channel, channels, frames);
+  if (!activepreroll)    return file->ReadSamples(dst, channel, channels, frames);
+
+  const PREROLL& slot = *activepreroll;
+  uint_t n = ReadPreroll(slot, prerollpos, dst, channel, channels, frames);
+
+  prerollframes.fetch_add(n, std::memory_order_relaxed);
+
+  if ((prerollpos += n) >= slot.frames)
+  {
+    // pre-roll used up, continue from the file itself
+    file->SetSamplePosition(slot.frames);
+    CancelPreroll();
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Copy samples from pre-roll data using the same channel placement as SoundFileSamples
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadPreroll(const PREROLL& slot, uint_t pos, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
+{
+  const Sample_t *src = &slot.buffer[0] + pos * slot.channels;
+  uint_t i, j, n = std::min(frames, limited::subz(slot.frames, pos));
+  uint_t nchannels = std::min(slot.channels, limited::subz(channels, channel));
+
+  // same channel placement as SoundFileSamples::ReadSamples()
+  for (i = 0; i < n; i++, src += slot.channels, dst += channels)
+  {
+    for (j = 0; j < nchannels; j++) dst[channel + j] = src[j];
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples from prefetch stream, recording any underrun against its item
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadStream(sint_t stream, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
+{
+  const SoundFileSamples *file;
+  uint_t missing, index;
+  uint_t n = prefetch.Read(stream, dst, channel, channels, frames, missing);
+
+  if (missing && prefetch.GetStream(stream, file, index) && (index < itemstats.size()))
+  {
+    BBCDEBUG3(("Prefetch underrun of %u frames on item %u", missing, index));
+
+    itemstats[index].underruns.fetch_add(1, std::memory_order_relaxed);
+    itemstats[index].underrunframes.fetch_add(missing, std::memory_order_relaxed);
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether the current item should crossfade into another
+ *
+ * @param index set to index of item to crossfade into
+ *
+ * @note items shorter than the fade length are not crossfaded
+ */
+/*--------------------------------------------------------------------------------*/
+bool Playlist::GetCrossfadeTarget(uint_t& index) const
+{
+  uint_t length = fadetable->GetLength();
+
+  // looping a file means crossfading into itself which would need a second reader of the same file
+  if (!crossfade || loop_file || !length || (it == list.end())) return false;
+
+  uint_t current = (uint_t)(it - list.begin());
+
+  if      ((current + 1) < list.size()) index = current + 1;
+  else if (loop_all)                    index = 0;
+  else return false;
+
+  return ((list[index] != *it) &&
+          ((*it)->GetSampleLength() >= length) &&
+          (list[index]->GetSampleLength() >= length));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples from current item, mixing in the next item if within the crossfade
+ *
+ * @note reads stop at the start of the crossfade so that it starts on an exact frame
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadCrossfaded(SoundFileSamples *file, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
+{
+  // crossfade buffer is never resized on the playback thread so each pass is limited to its size
+  uint_t maxframes = (uint_t)(crossfadebuffer.size() / std::max(channels, 1U));
+  uint_t index = 0;
+
+  if ((!incoming && !GetCrossfadeTarget(index)) || !maxframes) return ReadItem(file, dst, channel, channels, frames);
+
+  frames = std::min(frames, maxframes);
+
+  uint_t   length    = incoming ? crossfadelength : fadetable->GetLength();
+  uint64_t remaining = limited::subz(file->GetSampleLength(), GetItemPosition());
+
+  // before crossfade, read up to the start of it
+  if (remaining > length) return ReadItem(file, dst, channel, channels, (uint_t)std::min((uint64_t)frames, remaining - length));
+
+  // crossfades only start on their first frame (not, for example, after a seek into the middle of one)
+  if (!incoming && (remaining < length)) return ReadItem(file, dst, channel, channels, frames);
+
+  if (!incoming)
+  {
+    uint_t i;
+
+    BBCDEBUG3(("Starting %u frame crossfade into item %u", length, index));
+
+    incoming        = list[index];
+    incomingpreroll = NULL;
+    incomingpos     = 0;
+    incomingstream  = prefetch.Find(incoming, index, true);
+    crossfadelength = length;
+    incoming->SetSamplePosition(0);
+
+    // read start of incoming item from memory if it has been pre-rolled
+    for (i = 0; (incomingstream < 0) && (i < PrerollSlots); i++)
+    {
+      PREROLL& slot = preroll[i];
+
+      if ((&slot != activepreroll) && (slot.state.load(std::memory_order_acquire) == Preroll_Ready) && (slot.index == index) && (slot.file == incoming) && slot.frames)
+      {
+        incomingpreroll = &slot;
+        break;
+      }
+    }
+  }
+
+  uint_t nread = ReadItem(file, dst, channel, channels, (uint_t)std::min((uint64_t)frames, remaining));
+
+  if (nread)
+  {
+    uint_t pos = (uint_t)(length - remaining), n = 0, nn;
+
+    // channels not supplied by the incoming item must be silent
+    memset(&crossfadebuffer[0], 0, nread * channels * sizeof(crossfadebuffer[0]));
+
+    while ((n < nread) && ((nn = ReadIncoming(&crossfadebuffer[n * channels], channel, channels, nread - n)) > 0)) n += nn;
+
+    fadetable->Crossfade(dst, &crossfadebuffer[0], channels, nread, pos);
+  }
+
+  return nread;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples from the incoming item of a crossfade, using prefetch stream or pre-roll
+ * data if available
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadIncoming(Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
+{
+  uint_t n;
+
+  if (incomingstream >= 0) n = ReadStream(incomingstream, dst, channel, channels, frames);
+  else if (incomingpreroll && (incomingpos < incomingpreroll->frames))
+  {
+    n = ReadPreroll(*incomingpreroll, incomingpos, dst, channel, channels, frames);
+    prerollframes.fetch_add(n, std::memory_order_relaxed);
+
+    // pre-roll used up, continue from the file itself
+    if ((incomingpos + n) >= incomingpreroll->frames) incoming->SetSamplePosition(incomingpreroll->frames);
+  }
+  else n = incoming->ReadSamples(dst, channel, channels, frames);
+
+  incomingpos += n;
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Abandon crossfade in progress (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::CancelCrossfade()
+{
+  // stream has been partly read so cannot be used again
+  if (incomingstream >= 0) prefetch.Release(incomingstream);
+
+  incoming        = NULL;
+  incomingpreroll = NULL;
+  incomingpos     = 0;
+  incomingstream  = -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return indices of items to pre-roll or prefetch (next item and loop target)
+ *
+ * @return number of targets
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::GetPrerollTargets(uint_t targets[2]) const
+{
+  uint_t ntargets = 0, n = (uint_t)list.size();
+
+  if (it != list.end())
+  {
+    uint_t index = (uint_t)(it - list.begin());
+
+    // next item to be played
+    if      (loop_file)       targets[ntargets++] = index;
+    else if ((index + 1) < n) targets[ntargets++] = index + 1;
+
+    // loop target
+    if (loop_all && (!ntargets || targets[0])) targets[ntargets++] = 0;
+  }
+  else if (loop_all && n) targets[ntargets++] = 0;
+
+  return ntargets;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request pre-roll (or prefetch) of the next item and loop target (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::RequestPreroll()
+{
+  // open files ahead of them being read, whether by pre-roll, prefetch or this thread
+  UpdatePins();
+
+  if (prefetch.IsRunning()) RequestStreams();
+  else if (prerollms && prerollthread.IsRunning() && !Empty())
+  {
+    uint_t targets[2], ntargets = GetPrerollTargets(targets);
+    uint_t i, j;
+
+    // release pre-rolls that are no longer needed
+    for (i = 0; i < PrerollSlots; i++)
+    {
+      PREROLL& slot = preroll[i];
+
+      if ((&slot != activepreroll) && (slot.state.load(std::memory_order_acquire) == Preroll_Ready))
+      {
+        for (j = 0; (j < ntargets) && !((slot.index == targets[j]) && (slot.file == list[targets[j]])); j++) ;
+
+        if (j == ntargets) slot.state.store(Preroll_Empty, std::memory_order_relaxed);
+      }
+    }
+
+    // request pre-roll of targets not already requested
+    for (j = 0; j < ntargets; j++)
+    {
+      PREROLL *empty = NULL;
+
+      for (i = 0; i < PrerollSlots; i++)
+      {
+        PREROLL& slot = preroll[i];
+        uint_t   state = slot.state.load(std::memory_order_acquire);
+
+        if (state == Preroll_Empty)
+        {
+          if (!empty) empty = &slot;
+        }
+        else if ((&slot != activepreroll) && (slot.index == targets[j]) && (slot.file == list[targets[j]])) break;
+      }
+
+      if ((i == PrerollSlots) && empty)
+      {
+        empty->index = targets[j];
+        empty->file  = list[targets[j]];
+        empty->state.store(Preroll_Requested, std::memory_order_release);
+        prerollsignal.Signal();
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Pin lazily opened files of items near the play head and unpin those no longer near it
+ * (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::UpdatePins()
+{
+  SoundFileSamples *newpinned[MaxPinned];
+  uint_t i, n = (uint_t)list.size(), nnew = 0;
+
+  if (!handlepool) return;
+
+  if (it != list.end())
+  {
+    uint_t index = (uint_t)(it - list.begin());
+
+    for (i = 0; (i <= pinahead) && ((index + i) < n); i++) newpinned[nnew++] = list[index + i];
+    if (loop_all && index) newpinned[nnew++] = list[0];
+  }
+  else if (loop_all && n) newpinned[nnew++] = list[0];
+
+  // pin new set before unpinning old so that files in both are never unpinned
+  for (i = 0; i < nnew; i++) newpinned[i]->PinFile(true);
+  for (i = 0; i < npinned; i++) pinned[i]->PinFile(false);
+
+  for (i = 0; i < nnew; i++) pinned[i] = newpinned[i];
+  npinned = nnew;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Unpin all lazily opened files
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::ClearPins()
+{
+  uint_t i;
+
+  for (i = 0; i < npinned; i++) pinned[i]->PinFile(false);
+  npinned = 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request prefetch streams of the next item and loop target and release those no
+ * longer needed (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::RequestStreams()
+{
+  const SoundFileSamples *file;
+  uint_t targets[2], ntargets = GetPrerollTargets(targets);
+  uint_t i, j, id;
+  bool   found[2] = {false, false};
+
+  for (i = 0; i < PrefetchPool::MaxStreams; i++)
+  {
+    // streams being played cannot be reused
+    if (((sint_t)i == activestream) || ((sint_t)i == incomingstream) || !prefetch.GetStream(i, file, id)) continue;
+
+    for (j = 0; (j < ntargets) && !((id == targets[j]) && (file == list[targets[j]]) && !found[j]); j++) ;
+
+    // release streams that are no longer needed
+    if (j == ntargets) prefetch.Release(i);
+    else               found[j] = true;
+  }
+
+  // request streams of targets that don't have one
+  for (j = 0; j < ntargets; j++)
+  {
+    if (!found[j]) prefetch.Request(list[targets[j]], targets[j]);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start playing current item from prefetch stream or pre-roll data if it is ready
+ * (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::UsePreroll()
+{
+  CancelPreroll();
+
+  if (it != list.end())
+  {
+    uint_t index = (uint_t)(it - list.begin());
+    uint_t i;
+
+    // streams which have not been opened yet are not used as they would underrun
+    if ((activestream = prefetch.Find(*it, index, true)) >= 0)
+    {
+      BBCDEBUG3(("Playing item %u from prefetch stream %d", index, activestream));
+      return;
+    }
+
+    for (i = 0; i < PrerollSlots; i++)
+    {
+      PREROLL& slot = preroll[i];
+
+      if ((slot.state.load(std::memory_order_acquire) == Preroll_Ready) && (slot.index == index) && (slot.file == *it) && slot.frames)
+      {
+        BBCDEBUG3(("Playing %u frames of item %u from pre-roll", slot.frames, index));
+
+        activepreroll = &slot;
+        prerollpos    = 0;
+        break;
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Stop playing from prefetch stream or pre-roll data (with renderlock held)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::CancelPreroll()
+{
+  if (activestream >= 0)
+  {
+    // stream has been partly read so cannot be used again
+    prefetch.Release(activestream);
+    activestream = -1;
+
+    RequestPreroll();
+  }
+
+  if (activepreroll)
+  {
+    activepreroll->state.store(Preroll_Empty, std::memory_order_relaxed);
+    activepreroll = NULL;
+    prerollpos    = 0;
+
+    // slot is now free for the next request
+    RequestPreroll();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Discard all pre-roll data and prefetch streams, waiting for any in progress (NOT
+ * real-time safe)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::ClearPreroll()
+{
+  uint_t i;
+
+  // continue current item from the same place without pre-roll data or prefetch stream
+  if ((it != list.end()) && (activepreroll || (activestream >= 0))) (*it)->SetSamplePosition(GetItemPosition());
+
+  CancelCrossfade();
+
+  activepreroll = NULL;
+  prerollpos    = 0;
+  activestream  = -1;
+
+  // list may be about to change
+  ClearPins();
+
+  prefetch.ReleaseAll();
+
+  for (i = 0; i < PrerollSlots; i++)
+  {
+    PREROLL& slot = preroll[i];
+    uint_t   state;
+
+    // take request back from pre-roll thread or wait for it to complete
+    while (true)
+    {
+      uint64_t seen = prerolledsignal.GetCount();
+
+      state = slot.state.load(std::memory_order_acquire);
+      if ((state != Preroll_Requested) && (state != Preroll_Filling)) break;
+      if ((state == Preroll_Requested) && slot.state.compare_exchange_strong(state, Preroll_Empty)) break;
+
+      prerolledsignal.Wait(seen, SignalTimeout);
+    }
+
+    slot.state.store(Preroll_Empty);
+    slot.file = NULL;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read pre-roll data for slot (pre-roll thread)
+ */
+/*--------------------------------------------------------------------------------*/
+void Playlist::FillPreroll(PREROLL& slot)
+{
+  SoundFileSamples *file;
+
+  slot.frames = 0;
+
+  // read from a copy with its own file handle so that the playback thread is not affected
+  if ((file = slot.file->Duplicate()) != NULL)
+  {
+    const SoundFormat *format = file->GetFormat();
+    uint64_t frames = std::min((uint64_t)prerollms * (uint64_t)format->GetSampleRate() / 1000, file->GetSampleLength());
+
+    slot.channels = file->GetChannels();
+    slot.buffer.resize(std::max((size_t)frames * slot.channels, (size_t)1));
+
+    file->SetSamplePosition(0);
+    slot.frames = file->ReadSamples(&slot.buffer[0], 0, slot.channels, (uint_t)frames);
+
+    BBCDEBUG3(("Pre-rolled %u frames of item %u", slot.frames, slot.index));
+  }
+
+  if (file) delete file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Pre-roll thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *Playlist::PrerollThread(Thread& thread)
+{
+  while (!thread.StopRequested())
+  {
+    uint64_t seen = prerollsignal.GetCount();
+    bool     idle = true;
+    uint_t   i;
+
+    for (i = 0; i < PrerollSlots; i++)
+    {
+      PREROLL& slot  = preroll[i];
+      uint_t   state = Preroll_Requested;
+
+      // claim request
+      if (slot.state.compare_exchange_strong(state, Preroll_Filling, std::memory_order_acquire))
+      {
+        FillPreroll(slot);
+        if (slot.frames) prerolleditems.fetch_add(1, std::memory_order_relaxed);
+        slot.state.store(Preroll_Ready, std::memory_order_release);
+        prerolledsignal.Signal();
+        idle = false;
+      }
+    }
+
+    if (idle) prerollsignal.Wait(seen, SignalTimeout);
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples into buffer
  *
  * @param dst destination sample buffer
  * @param channel offset channel to read from
@@ -420,19 +1543,33 @@ void Playlist::PauseAudio(bool enable)
  * @param frames maximum number of frames to read
  *
  * @return actual number of frames read
+ *
+ * @note if the list is being changed, silence is output and frames is returned
  */
 /*--------------------------------------------------------------------------------*/
 uint_t Playlist::ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uint_t frames)
 {
-  ThreadLock lock(tlock);
+  std::unique_lock<std::mutex> render(renderlock, std::try_to_lock);
+  FileHandlePool::NonBlocking  nonblocking;     // never open files on this thread
   uint_t nframes = 0;
   bool   error = false;
-  
-  while (!AtEnd() && frames)
+
+  if (!render.owns_lock())
+  {
+    // list is being changed or controls are being actioned by another thread -> output silence
+    memset(dst, 0, frames * channels * sizeof(*dst));
+    silencedreads.fetch_add(1, std::memory_order_relaxed);
+    return frames;
+  }
+
+  // action playback controls at block boundary
+  ProcessCommands();
+
+  while ((it != list.end()) && frames)
   {
-    SoundFileSamples *file = GetFile();
+    SoundFileSamples *file = *it;
     uint_t nread = 0;
-    bool   playallowed = (autoplay || file->GetSamplePosition() || positionchange);
+    bool   playallowed = (autoplay || GetItemPosition() || positionchange);
 
     if (!playallowed && !releaseplayback)
     {
@@ -447,20 +1584,15 @@ uint_t Playlist::ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uin
       
       if (fadedowncount)
       {
-        uint_t i, j;
-
-        BBCDEBUG3(("Fading down: %u frames left, coeff %0.3f", fadedowncount, (Sample_t)(fadedowncount - 1) / (Sample_t)fadesamples));
+        BBCDEBUG3(("Fading down: %u frames left, coeff %0.3f", fadedowncount, fadetable->GetGain(fadedowncount - 1)));
 
         // fading down, limit to fadedowncount and fade after reading
-        nread = file->ReadSamples(dst, channel, channels, std::min(frames, fadedowncount));
+        nread = ReadCrossfaded(file, dst, channel, channels, std::min(frames, fadedowncount));
         BBCDEBUG3(("Read %u/%u/%u frames from file (fadedown)", nread, frames, fadedowncount));
 
         // fade read audio
-        for (i = 0; i < nread; i++, fadedowncount--)
-        {
-          Sample_t mul = (Sample_t)(fadedowncount - 1) / (Sample_t)fadesamples;
-          for (j = 0; j < channels; j++) dst[i * channels + j] *= mul;
-        }
+        fadetable->FadeDown(dst, channels, nread, fadedowncount);
+        fadedowncount -= nread;
       }
       else if (pause)
       {
@@ -479,33 +1611,30 @@ uint_t Playlist::ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uin
         positionchange = false;
 
         // start fadeup
-        fadeupcount = fadesamples;
+        fadeupcount = fadetable->GetLength();
 
         // force loop around
         continue;
       }
       else if (fadeupcount)
       {
-        uint_t i, j;
+        uint_t pos = limited::subz(fadetable->GetLength(), fadeupcount);
 
-        BBCDEBUG3(("Fading up: %u frames left, coeff %0.3f", fadeupcount, (Sample_t)(fadesamples - fadeupcount) / (Sample_t)fadesamples));
+        BBCDEBUG3(("Fading up: %u frames left, coeff %0.3f", fadeupcount, fadetable->GetGain(pos)));
 
         // fading up, limit to fadeupcount and fade after reading
-        nread = file->ReadSamples(dst, channel, channels, std::min(frames, fadeupcount));
+        nread = ReadCrossfaded(file, dst, channel, channels, std::min(frames, fadeupcount));
         BBCDEBUG3(("Read %u/%u/%u frames from file (fadeup)", nread, frames, fadeupcount));
 
         // fade read audio
-        for (i = 0; i < nread; i++, fadeupcount--)
-        {
-          Sample_t mul = (Sample_t)(fadesamples - fadeupcount) / (Sample_t)fadesamples;
-          for (j = 0; j < channels; j++) dst[i * channels + j] *= mul;
-        }
+        fadetable->FadeUp(dst, channels, nread, pos);
+        fadeupcount -= nread;
       }
       else
       {
         BBCDEBUG3(("Reading %u frames from file", frames));
-        // no position changes pending, simple read
-        nread = file->ReadSamples(dst, channel, channels, frames);
+        // no position changes pending, simple read (crossfading into the next item if enabled)
+        nread = ReadCrossfaded(file, dst, channel, channels, frames);
         BBCDEBUG3(("Read %u/%u frames from file", nread, frames));
       }
     }
@@ -520,7 +1649,7 @@ uint_t Playlist::ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uin
       // and break out of this loop to prevent endless attempts at reading
       if (error && newerror) break;
       // otherwise move onto next item in playlist
-      Next();
+      NextEx();
     }
 
     // keep error state
@@ -532,8 +1661,51 @@ uint_t Playlist::ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uin
   }
 
   BBCDEBUG3(("Total %u frames returned", nframes));
+
+  PublishProgress();
   
   return nframes;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Read samples into separate (planar) buffers, one per channel
+ *
+ * @param dst array of channels destination buffers (NULL entries are skipped)
+ * @param dstoffset offset in frames into each destination buffer
+ * @param channels number of channels to read
+ * @param frames maximum number of frames to read
+ *
+ * @return actual number of frames read
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t Playlist::ReadSamplesPlanar(Sample_t *const *dst, uint_t dstoffset, uint_t channels, uint_t frames)
+{
+  // buffer is never resized on the render thread, so wide reads use shorter blocks
+  uint_t blockframes = std::min((uint_t)PlanarBlockFrames, (uint_t)(planarbuffer.size() / std::max(channels, 1U)));
+  uint_t nframes = 0;
+
+  while (frames && channels && blockframes)
+  {
+    uint_t n = std::min(frames, blockframes), nread;
+
+    // channels not supplied by the current item must be silent
+    memset(&planarbuffer[0], 0, n * channels * sizeof(planarbuffer[0]));
+
+    nread = ReadSamples(&planarbuffer[0], 0, channels, n);
+
+    ConvertSamplesToPlanar(&planarbuffer[0], SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, channels,
+                           dst, dstoffset + nframes,
+                           channels,
+                           nread);
+
+    nframes += nread;
+    frames  -= nread;
+
+    // end of playback list
+    if (nread < n) break;
+  }
+
+  return nframes;
+}
+
 BBC_AUDIOTOOLBOX_END
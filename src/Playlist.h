@@ -2,13 +2,49 @@
 #define __SIMPLE_PLAYLIST__
 
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
 
+#include <bbcat-base/Thread.h>
 #include <bbcat-base/ThreadLock.h>
 
 #include "PlaybackTracker.h"
+#include "LockFreeQueue.h"
+#include "FadeTable.h"
+#include "PrefetchPool.h"
+#include "FileHandlePool.h"
+#include "ThreadSignal.h"
 
 BBC_AUDIOTOOLBOX_START
 
+/*--------------------------------------------------------------------------------*/
+/** List of files played back one after another
+ *
+ * ReadSamples() is intended to be called from a real-time audio thread and never waits for a
+ * lock: playback controls (position, index, pause, etc) are posted to a lock-free command
+ * queue which is processed at the start of each ReadSamples() call, or straight away by the
+ * caller if ReadSamples() is not running at the time (so controls of a stopped playlist take
+ * effect immediately), and playback progress is published through a sequence-locked snapshot
+ * which can be read from any thread
+ *
+ * Changes to the list itself (AddFile(), Clear(), UpdatePlaylistLength(), etc) wait for any
+ * ReadSamples() call in progress to finish and ReadSamples() outputs silence whilst they are
+ * being made (see GetSilencedReads())
+ *
+ * If enabled (see SetPrerollTime()), the start of the next item and of the loop target are
+ * read ahead on a background thread so that transitions between items never wait for I/O
+ *
+ * Alternatively, a pool of workers can decode the current item, the next item and the loop
+ * target into lock-free rings (see EnablePrefetch()), in which case ReadSamples() only copies
+ * and mixes decoded audio and any frames the workers have not decoded in time are replaced
+ * by silence and counted as underruns (see GetPrefetchStats())
+ *
+ * Fades use a precomputed gain curve (see SetFadeShape()) and, if enabled (see
+ * EnableCrossfade()), consecutive items overlap by the fade length, the end of one item
+ * being read and mixed with the start of the next
+ */
+/*--------------------------------------------------------------------------------*/
 class Playlist : public PlaybackTracker
 {
 public:
@@ -21,10 +57,30 @@ public:
   /*--------------------------------------------------------------------------------*/
   bool Empty() const {return (list.size() == 0);}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Set sample rate that files are played back at
+   *
+   * @param rate output sample rate (0 to play files at their own rates)
+   *
+   * @note files subsequently added at a different rate are converted (see
+   * @note ResamplingSoundFileSamples) and all positions and lengths are in output rate units
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetOutputSampleRate(uint32_t rate) {outputrate = rate;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return sample rate that files are played back at (0 if files are played at their own rates)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint32_t GetOutputSampleRate() const {return outputrate;}
+
   /*--------------------------------------------------------------------------------*/
   /** Add file to list
    *
    * @note object will be DELETED on destruction of this object!
+   * @note if the file's sample rate is not the output rate (see SetOutputSampleRate()) the
+   * @note list holds a converting object wrapped around the file
+   * @note ReadSamples() outputs silence whilst the file is being added
    */
   /*--------------------------------------------------------------------------------*/
   void AddFile(SoundFileSamples *file);
@@ -37,6 +93,8 @@ public:
 
   /*--------------------------------------------------------------------------------*/
   /** Clear playlist
+   *
+   * @note ReadSamples() outputs silence whilst the list is being cleared
    */
   /*--------------------------------------------------------------------------------*/
   void Clear();
@@ -45,64 +103,73 @@ public:
   /** Enable/disable looping
    */
   /*--------------------------------------------------------------------------------*/
-  void EnableLoop(bool enable = true) {loop_all = enable;}
+  void EnableLoop(bool enable = true) {loop_all.store(enable);}
 
   /*--------------------------------------------------------------------------------*/
   /** Get whether looping is enabled
    */
   /*--------------------------------------------------------------------------------*/
-  bool IsLoopEnabled() const {return loop_all;}
+  bool IsLoopEnabled() const {return loop_all.load();}
 
   /*--------------------------------------------------------------------------------*/
   /** Enable/disable looping of each file
    */
   /*--------------------------------------------------------------------------------*/
-  void EnableLoopFile(bool enable = true) {loop_file = enable;}
+  void EnableLoopFile(bool enable = true) {loop_file.store(enable);}
 
   /*--------------------------------------------------------------------------------*/
   /** Get whether looping of each file is enabled
    */
   /*--------------------------------------------------------------------------------*/
-  bool IsLoopFileEnabled() const {return loop_file;}
+  bool IsLoopFileEnabled() const {return loop_file.load();}
 
   /*--------------------------------------------------------------------------------*/
   /** Enable/disable autoplay of each file
    */
   /*--------------------------------------------------------------------------------*/
-  void EnableAutoPlay(bool enable) {autoplay = enable;}
+  void EnableAutoPlay(bool enable) {autoplay.store(enable);}
 
   /*--------------------------------------------------------------------------------*/
   /** Get whether autoplay of each file is enabled
    */
   /*--------------------------------------------------------------------------------*/
-  bool IsAutoPlayEnabled() const {return autoplay;}
+  bool IsAutoPlayEnabled() const {return autoplay.load();}
 
   /*--------------------------------------------------------------------------------*/
   /** Pause/unpause audio
+   *
+   * @note actioned immediately unless ReadSamples() is running, in which case the request is
+   * @note queued and actioned by the next ReadSamples() call
    */
   /*--------------------------------------------------------------------------------*/
   void PauseAudio(bool enable = true);
 
   /*--------------------------------------------------------------------------------*/
-  /** Get whether autoplay of each file is enabled
+  /** Get whether audio is paused
    */
   /*--------------------------------------------------------------------------------*/
-  bool IsAudioPaused() const {return pause;}
+  bool IsAudioPaused() const;
 
   /*--------------------------------------------------------------------------------*/
   /** Release playback of audio that is current held
    */
   /*--------------------------------------------------------------------------------*/
-  void ReleasePlayback() {releaseplayback = true;}
+  void ReleasePlayback();
 
   /*--------------------------------------------------------------------------------*/
   /** Reset to start of playback list
+   *
+   * @note actioned immediately unless ReadSamples() is running, in which case the request is
+   * @note queued and actioned by the next ReadSamples() call
    */
   /*--------------------------------------------------------------------------------*/
   void Reset();
 
   /*--------------------------------------------------------------------------------*/
   /** Move onto next file (or stop if looping is disabled)
+   *
+   * @note actioned immediately unless ReadSamples() is running, in which case the request is
+   * @note queued and actioned by the next ReadSamples() call
    */
   /*--------------------------------------------------------------------------------*/
   void Next();
@@ -111,13 +178,13 @@ public:
   /** Return whether the end of the playlist has been reached
    */
   /*--------------------------------------------------------------------------------*/
-  bool AtEnd() const {return (it == list.end());}
+  bool AtEnd() const {return (GetFile() == NULL);}
 
   /*--------------------------------------------------------------------------------*/
   /** Return current file or NULL if the end of the list has been reached
    */
   /*--------------------------------------------------------------------------------*/
-  SoundFileSamples *GetFile() const;
+  SoundFileSamples *GetFile() const {return GetPlaybackProgress().file;}
 
   /*--------------------------------------------------------------------------------*/
   /** Return file at specific index or NULL if index is out of range
@@ -133,6 +200,9 @@ public:
 
   /*--------------------------------------------------------------------------------*/
   /** Return index of specified file (or -1)
+   *
+   * @note files that are being converted to the output rate can be specified either as
+   * @note added or as held in the list
    */
   /*--------------------------------------------------------------------------------*/
   int GetIndexOf(SoundFileSamples *file) const;
@@ -153,7 +223,7 @@ public:
   /** Return current playback position (in samples)
    */
   /*--------------------------------------------------------------------------------*/
-  uint64_t GetPlaybackPosition() const;
+  uint64_t GetPlaybackPosition() const {return GetPlaybackProgress().absoluteposition;}
 
   /*--------------------------------------------------------------------------------*/
   /** Return length of playlist in samples
@@ -163,10 +233,14 @@ public:
 
   /*--------------------------------------------------------------------------------*/
   /** Set current playback position (in samples)
+   *
+   * @return true if position is valid (or, if ReadSamples() is running, if the request was queued)
    *
    * @note setting force to true may cause clicks!
    * @note setting force to false causes a fade down *before* and a fade up *after*
    * changing the position which means this doesn't actually change the position straight away!
+   * @note actioned immediately unless ReadSamples() is running, in which case the request is
+   * @note queued and actioned by the next ReadSamples() call
    */
   /*--------------------------------------------------------------------------------*/
   bool SetPlaybackPosition(uint64_t pos, bool force);
@@ -175,7 +249,7 @@ public:
   /** Return current index in playlist
    */
   /*--------------------------------------------------------------------------------*/
-  uint_t GetPlaybackIndex() const;
+  uint_t GetPlaybackIndex() const {return GetPlaybackProgress().fileindex;}
 
   /*--------------------------------------------------------------------------------*/
   /** Return maximum index in playlist
@@ -192,9 +266,13 @@ public:
    * @param fromstart true to play new item from start, false to start playing new item from the *same* place as currently being played
    * @param force true to force position change immediately (see below)
    *
+   * @return true if position is valid (or, if ReadSamples() is running, if the request was queued)
+   *
    * @note setting force to true may cause clicks!
    * @note setting force to false causes a fade down *before* and a fade up *after*
    * changing the position which means this doesn't actually change the position straight away!
+   * @note actioned immediately unless ReadSamples() is running, in which case the request is
+   * @note queued and actioned by the next ReadSamples() call
    */
   /*--------------------------------------------------------------------------------*/
   bool SetPlaybackIndex(uint_t index, bool fromstart, bool force);
@@ -203,16 +281,165 @@ public:
   /** Return number of samples used during fade up or down
    */
   /*--------------------------------------------------------------------------------*/
-  uint_t GetFadeSamples() const {return fadesamples;}
+  uint_t GetFadeSamples() const {return fadesamples.load();}
 
   /*--------------------------------------------------------------------------------*/
   /** Set number of samples used during fade up or down
+   *
+   * @note the fade table is built by the caller and used from the next fade or crossfade
    */
   /*--------------------------------------------------------------------------------*/
-  void SetFadeSamples(uint_t n) {fadesamples = n;}
-  
+  void SetFadeSamples(uint_t n);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set shape of fades and crossfades
+   *
+   * @note the fade table is built by the caller and used from the next fade or crossfade
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetFadeShape(FadeTable::Shape_t shape);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return shape of fades and crossfades
+   */
+  /*--------------------------------------------------------------------------------*/
+  FadeTable::Shape_t GetFadeShape() const {return (FadeTable::Shape_t)fadeshape.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable crossfading between consecutive items
+   *
+   * @note the crossfade length is the fade length (see SetFadeSamples()), items shorter than
+   * @note this are not crossfaded and items do not crossfade into themselves (i.e. when
+   * @note looping a single file)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void EnableCrossfade(bool enable = true) {crossfade.store(enable);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether crossfading between consecutive items is enabled
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsCrossfadeEnabled() const {return crossfade.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set amount of the next item (and of the loop target when looping) to read ahead
+   *
+   * @param ms pre-roll time in ms (0 to disable)
+   *
+   * @note pre-roll must cover the time taken to open and read the item from disk
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetPrerollTime(uint_t ms);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return pre-roll time in ms
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetPrerollTime() const {return prerollms.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable decoding of items by a pool of worker threads
+   *
+   * @param workers number of worker threads (0 to disable)
+   * @param buffertimems amount of each item to decode ahead of playback
+   *
+   * @return true if the requested number of workers were started
+   *
+   * @note prefetching replaces pre-roll (see SetPrerollTime()) whilst enabled
+   * @note ReadSamples() outputs silence whilst prefetching is being changed
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool EnablePrefetch(uint_t workers, uint_t buffertimems = 1000);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether items are being decoded by worker threads
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsPrefetchEnabled() const {return prefetch.IsRunning();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether an item is being prefetched and its stream has been decoded as far
+   * ahead as it can be (see EnablePrefetch())
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsItemPrefetched(uint_t index) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable lazy opening of files subsequently added
+   *
+   * @param maxopen maximum number of files kept open, in addition to pinned files (0 to disable)
+   * @param pinahead number of items after the current item to keep open (at least 1)
+   *
+   * @return true if enabled
+   *
+   * @note files near the play head (current item, next items and loop target) are pinned and
+   * @note opened ahead of time by a background thread so ReadSamples() does not open files
+   * @note ReadSamples() never opens a file itself: if an item is not open when it is reached
+   * @note (or its file cannot be opened) silence is output (see FileHandlePool::STATS)
+   * @note files already added keep their handles (or remain lazily opened if disabled)
+   * @note ReadSamples() outputs silence whilst lazy opening is being changed
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool EnableLazyOpen(uint_t maxopen = 64, uint_t pinahead = 2);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether files subsequently added are opened lazily
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsLazyOpenEnabled() const {return lazyopen;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return file handle statistics of lazily opened files
+   *
+   * @return false if lazy opening has never been enabled
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetFileHandleStats(FileHandlePool::STATS& stats) const;
+
+  typedef struct
+  {
+    uint64_t underruns;         // number of reads that could not be completely satisfied by the workers
+    uint64_t underrunframes;    // total number of frames replaced with silence
+  } PREFETCHSTATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return underrun statistics for an item
+   *
+   * @return false if index is out of range
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetPrefetchStats(uint_t index, PREFETCHSTATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Reset underrun statistics of all items
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ResetPrefetchStats();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of ReadSamples() calls that output silence because the list was being
+   * changed or playback controls were being actioned by another thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetSilencedReads() const {return silencedreads.load(std::memory_order_relaxed);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of items whose pre-roll data has been read by the pre-roll thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetPrerolledItems() const {return prerolleditems.load(std::memory_order_relaxed);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of frames played from pre-roll data rather than from the items themselves
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetPrerollFrames() const {return prerollframes.load(std::memory_order_relaxed);}
+
   /*--------------------------------------------------------------------------------*/
   /** Return playback progress object
+   *
+   * @note this is a consistent snapshot published by the last ReadSamples() call and
+   * @note is lock-free (and wait-free for the thread calling ReadSamples())
    */
   /*--------------------------------------------------------------------------------*/
   virtual PLAYBACKPROGRESS GetPlaybackProgress() const;
@@ -226,32 +453,349 @@ public:
    * @param frames maximum number of frames to read
    *
    * @return actual number of frames read
+   *
+   * @note never waits for a lock, any queued playback controls are actioned first
+   * @note if the list is being changed, silence is output and frames is returned
    */
   /*--------------------------------------------------------------------------------*/
   uint_t ReadSamples(Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples into separate (planar) buffers, one per channel
+   *
+   * @param dst array of channels destination buffers (NULL entries are skipped)
+   * @param dstoffset offset in frames into each destination buffer
+   * @param channels number of channels to read
+   * @param frames maximum number of frames to read
+   *
+   * @return actual number of frames read
+   *
+   * @note fades and crossfades are mixed interleaved so blocks of PlanarBlockFrames frames
+   * @note are read and de-interleaved whilst they are still in cache
+   * @note never waits for a lock, any queued playback controls are actioned first
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadSamplesPlanar(Sample_t *const *dst, uint_t dstoffset, uint_t channels, uint_t frames);
+
 protected:
+  typedef enum
+  {
+    Command_SetPosition = 0,
+    Command_SetIndex,
+    Command_Pause,
+    Command_Release,
+    Command_Reset,
+    Command_Next,
+  } CommandType_t;
+
+  typedef struct
+  {
+    CommandType_t type;
+    uint64_t      seq;              // order in which commands were posted
+    uint64_t      position;
+    uint_t        index;
+    bool          fromstart;
+    bool          force;
+    bool          enable;
+  } COMMAND;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Queue command and action it (and any queued before it) straight away if ReadSamples()
+   * is not running
+   *
+   * @return result of command if actioned, otherwise true
+   *
+   * @note if the queue is full, position commands (reset, position and index) replace any
+   * @note earlier position command that could not be queued and other commands wait for
+   * @note ReadSamples() to finish and are actioned by the caller, so no command is dropped
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool PostCommand(COMMAND& cmd);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Action all queued commands (with renderlock held)
+   *
+   * @param seq sequence number of command whose result is wanted
+   *
+   * @return result of command seq (true if it was not actioned)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ProcessCommands(uint64_t seq = 0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Action single command (with renderlock held)
+   *
+   * @return false if position or index command could not be actioned
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ApplyCommand(const COMMAND& cmd);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Publish progress snapshot (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void PublishProgress();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Build fade table from the current fade length and shape and pass it to the playback
+   * thread (NOT real-time safe)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UpdateFadeTable();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Switch to fade table built by UpdateFadeTable(), if any, unless a fade or crossfade
+   * is in progress (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UseNewFadeTable();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set position, either immediately or after fading down
+   *
+   * @return false if position is invalid
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool SetPlaybackPositionRT(uint64_t pos, bool force);
+
   /*--------------------------------------------------------------------------------*/
   /** Set current playback position (in samples)
    */
   /*--------------------------------------------------------------------------------*/
   bool SetPlaybackPositionEx(uint64_t pos);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Reset to start of playback list / move onto next file (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ResetEx();
+  void NextEx();
+
+  enum
+  {
+    Preroll_Empty = 0,
+    Preroll_Requested,
+    Preroll_Filling,
+    Preroll_Ready,
+
+    PrerollSlots = 3,           // next item, loop target and one being released
+
+    MaxPinAhead  = 8,
+    MaxPinned    = MaxPinAhead + 2,     // current item, items ahead and loop target
+
+    // only the playback thread reads through the file handle pool (pre-roll and prefetch
+    // read copies with their own handles) and it reads one item at a time
+    PoolReaders  = 1,
+
+    PlanarBlockFrames   = 256,
+    PlanarBufferSamples = PlanarBlockFrames * 64,   // wider reads use shorter blocks
+
+    // incoming audio of a crossfade is read in passes of up to this many samples (all channels)
+    CrossfadeBufferSamples = 16384,
+  };
+
+  typedef struct
+  {
+    std::atomic<uint_t>   state;      // ownership: Empty/Ready - playback thread, Requested/Filling - pre-roll thread
+    uint_t                index;      // index of item in list
+    SoundFileSamples      *file;      // item in list
+    std::vector<Sample_t> buffer;     // interleaved samples of all channels of item
+    uint_t                frames;
+    uint_t                channels;
+  } PREROLL;
+
+  typedef struct
+  {
+    std::atomic<uint64_t> underruns;
+    std::atomic<uint64_t> underrunframes;
+  } ITEMSTATS;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return current position within current item, including any pre-roll played
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetItemPosition() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples from current item, using pre-roll data if available
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadItem(SoundFileSamples *file, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Copy samples from pre-roll data using the same channel placement as SoundFileSamples
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint_t ReadPreroll(const PREROLL& slot, uint_t pos, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether the current item should crossfade into another
+   *
+   * @param index set to index of item to crossfade into
+   *
+   * @note items shorter than the fade length are not crossfaded
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetCrossfadeTarget(uint_t& index) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples from current item, mixing in the next item if within the crossfade
+   *
+   * @note reads stop at the start of the crossfade so that it starts on an exact frame
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadCrossfaded(SoundFileSamples *file, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples from the incoming item of a crossfade, using pre-roll data if available
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadIncoming(Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Abandon crossfade in progress (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void CancelCrossfade();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples from prefetch stream, recording any underrun against its item
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadStream(sint_t stream, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return indices of items to pre-roll or prefetch (next item and loop target)
+   *
+   * @return number of targets
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetPrerollTargets(uint_t targets[2]) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request pre-roll (or prefetch) of the next item and loop target (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void RequestPreroll();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pin lazily opened files of items near the play head and unpin those no longer near it
+   * (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UpdatePins();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Unpin all lazily opened files
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ClearPins();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request prefetch streams of the next item and loop target and release those no
+   * longer needed (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void RequestStreams();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start playing current item from prefetch stream or pre-roll data if it is ready
+   * (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void UsePreroll();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Stop playing from prefetch stream or pre-roll data (with renderlock held)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void CancelPreroll();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Discard all pre-roll data and prefetch streams, waiting for any in progress (NOT
+   * real-time safe)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ClearPreroll();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read pre-roll data for slot (pre-roll thread)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void FillPreroll(PREROLL& slot);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pre-roll thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__PrerollThread(Thread& thread, void *arg) {return ((Playlist *)arg)->PrerollThread(thread);}
+  void *PrerollThread(Thread& thread);
+
 protected:
-  ThreadLockObject                tlock;
+  ThreadLockObject                tlock;            // serialises list changes (never taken by ReadSamples())
+  std::mutex                      renderlock;       // held by ReadSamples(), list changes and controls actioned directly
   std::vector<SoundFileSamples *> list;
   std::vector<SoundFileSamples *>::iterator it;
+  std::vector<uint64_t>           itemstarts;      // start position of each item followed by end of playlist
+  LockFreeQueue<COMMAND>          commands;
+  std::atomic<uint64_t>           commandseq;
+  std::mutex                      latestlock;       // protects below (ReadSamples() only ever tries it)
+  COMMAND                         latestcommand;    // latest position command that could not be queued
+  bool                            latestpending;
+  std::atomic<uint64_t>           silencedreads;
+  std::atomic<uint64_t>           prerolleditems;
+  std::atomic<uint64_t>           prerollframes;
+  Thread                          prerollthread;
+  ThreadSignal                    prerollsignal;    // signalled when pre-roll is requested
+  ThreadSignal                    prerolledsignal;  // signalled when a pre-roll slot has been filled
+  PREROLL                         preroll[PrerollSlots];
+  PrefetchPool                    prefetch;
+  std::deque<ITEMSTATS>           itemstats;        // prefetch statistics for each item
+  FileHandlePool                  *handlepool;      // created when lazy opening is first enabled
+  uint_t                          pinahead;
+  bool                            lazyopen;
+
+  // owned by the playback thread
   uint64_t                        filestartpos, playlistlength;
+  uint32_t                        outputrate;
   uint64_t                        newposition;
-  uint_t                          fadesamples;
   uint_t                          fadedowncount;
   uint_t                          fadeupcount;
-  bool                            autoplay;
-  bool                            loop_all;
-  bool                            loop_file;
   bool                            pause;
   bool                            releaseplayback;
   bool                            positionchange;
+  PREROLL                         *activepreroll;   // pre-roll being played
+  uint_t                          prerollpos;       // position within pre-roll being played
+  sint_t                          activestream;     // prefetch stream being played (or -1)
+  FadeTable                       *fadetable;       // current table (only changed with renderlock held)
+  std::atomic<FadeTable *>        newfadetable;     // table built by UpdateFadeTable() and not yet used
+  LockFreeQueue<FadeTable *>      oldfadetables;    // tables finished with, deleted by UpdateFadeTable()
+  SoundFileSamples                *incoming;        // item being crossfaded into (or NULL)
+  PREROLL                         *incomingpreroll; // pre-roll of above being played
+  uint_t                          incomingpos;      // frames of above read so far
+  sint_t                          incomingstream;   // prefetch stream of above (or -1)
+  uint_t                          crossfadelength;  // length of crossfade in progress
+  std::vector<Sample_t>           crossfadebuffer;  // incoming audio (allocated on construction)
+  std::vector<Sample_t>           planarbuffer;     // interleaved block being de-interleaved (allocated on construction)
+  SoundFileSamples                *pinned[MaxPinned];
+  uint_t                          npinned;
+
+  // settings that can be changed from any thread
+  std::atomic<uint_t>             fadesamples;
+  std::atomic<uint_t>             fadeshape;
+  std::atomic<bool>               crossfade;
+  std::atomic<bool>               autoplay;
+  std::atomic<bool>               loop_all;
+  std::atomic<bool>               loop_file;
+  std::atomic<uint_t>             prerollms;
+
+  // progress snapshot, sequence count is odd whilst being updated
+  std::atomic<uint32_t>           progressseq;
+  std::atomic<SoundFileSamples *> progressfile;
+  std::atomic<uint64_t>           progressposition;
+  std::atomic<uint64_t>           progressfileposition;
+  std::atomic<uint_t>             progressindex;
+  std::atomic<bool>               progresspaused;
 };
 
 BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,263 @@
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "PolyphaseResampler.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// size of input window relative to filter length (reduces the number of times the window is moved)
+static const uint_t WindowMultiple = 4;
+
+// filter cutoff relative to the lower of the two Nyquist frequencies
+static const double Rolloff = .95;
+
+/*--------------------------------------------------------------------------------*/
+/** Accumulate a frame of interleaved audio multiplied by a single coefficient
+ *
+ * Overloaded on sample type so that the SSE version is only used for float samples
+ */
+/*--------------------------------------------------------------------------------*/
+static inline void AccumulateFrame(float *dst, const float *src, uint_t channels, float coeff)
+{
+  uint_t i = 0;
+
+#ifdef RESAMPLER_SSE
+  __m128 c = _mm_set1_ps(coeff);
+  for (; (i + 4) <= channels; i += 4) _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(src + i), c)));
+#endif
+
+  for (; i < channels; i++) dst[i] += src[i] * coeff;
+}
+
+static inline void AccumulateFrame(double *dst, const double *src, uint_t channels, double coeff)
+{
+  uint_t i;
+
+  for (i = 0; i < channels; i++) dst[i] += src[i] * coeff;
+}
+
+static uint32_t GCD(uint32_t a, uint32_t b)
+{
+  while (b)
+  {
+    uint32_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+PolyphaseResampler::PolyphaseResampler() : up(1),
+                                           down(1),
+                                           taps(0),
+                                           channels(0),
+                                           phase(0),
+                                           windowstart(0),
+                                           windowframes(0),
+                                           skip(0)
+{
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Build filter bank for conversion
+ *
+ * @param inrate input sample rate
+ * @param outrate output sample rate
+ * @param channels number of interleaved channels
+ * @param taps number of taps per phase when upsampling (increased in proportion when downsampling)
+ *
+ * @return true if successful
+ */
+/*--------------------------------------------------------------------------------*/
+bool PolyphaseResampler::Setup(uint32_t inrate, uint32_t outrate, uint_t nchannels, uint_t ntaps)
+{
+  bool success = false;
+
+  if (inrate && outrate && nchannels)
+  {
+    uint32_t g = GCD(inrate, outrate);
+    uint_t   p, j, half;
+
+    up       = outrate / g;
+    down     = inrate  / g;
+    channels = nchannels;
+
+    // when downsampling the filter must be longer to keep the same transition band
+    taps = std::max(ntaps, (uint_t)4);
+    if (down > up) taps = (uint_t)(((uint64_t)taps * down + up - 1) / up);
+    taps = (taps + 1) & ~1;
+    half = taps / 2 - 1;
+
+    // cutoff in cycles per input sample
+    double fc = .5 * Rolloff * std::min(1.0, (double)up / (double)down);
+
+    bank.resize((size_t)up * taps);
+    window.resize((size_t)taps * WindowMultiple * channels);
+
+    for (p = 0; p < up; p++)
+    {
+      Sample_t *h = &bank[p * taps];
+      double   sum = 0.0;
+
+      for (j = 0; j < taps; j++)
+      {
+        // distance of tap from output position in input samples
+        double d = ((double)j - (double)half) - (double)p / (double)up;
+        double x = d / (double)(taps / 2);
+        double w = (fabs(x) < 1.0) ? .42 + .5 * cos(M_PI * x) + .08 * cos(2.0 * M_PI * x) : 0.0;
+        double s = (d == 0.0) ? 1.0 : sin(2.0 * M_PI * fc * d) / (2.0 * M_PI * fc * d);
+        double v = 2.0 * fc * s * w;
+
+        h[j] = (Sample_t)v;
+        sum += v;
+      }
+
+      // unity gain at DC for every phase
+      if (sum != 0.0)
+      {
+        for (j = 0; j < taps; j++) h[j] = (Sample_t)(h[j] / sum);
+      }
+    }
+
+    BBCDEBUG2(("Resampler %u->%u: %u/%u, %u taps, %u coefficients", inrate, outrate, up, down, taps, (uint_t)bank.size()));
+
+    Reset();
+    success = true;
+  }
+  else BBCERROR("Invalid resampler parameters (%u->%u, %u channels)", inrate, outrate, nchannels);
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Map output position to input position and phase
+ *
+ * @param outpos output position
+ * @param phase set to phase (in units of 1/up input frames) beyond returned position
+ *
+ * @return input position at or before output position
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t PolyphaseResampler::GetInputPosition(uint64_t outpos, uint_t& phase) const
+{
+  uint64_t pos = outpos * down;
+
+  phase = (uint_t)(pos % up);
+
+  return pos / up;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Clear history ready for new input
+ *
+ * @param phase phase of first output frame (see GetInputPosition())
+ * @param zeros number of frames of silence to prime the history with (when the first
+ * output frame is closer than GetHistoryFrames() to the start of the input)
+ */
+/*--------------------------------------------------------------------------------*/
+void PolyphaseResampler::Reset(uint_t newphase, uint_t zeros)
+{
+  phase        = up ? newphase % up : 0;
+  windowstart  = 0;
+  windowframes = std::min(zeros, taps);
+  skip         = 0;
+
+  if (windowframes) memset(&window[0], 0, windowframes * channels * sizeof(window[0]));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append frames to window, discarding any frames that are to be skipped
+ *
+ * @return number of frames consumed
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t PolyphaseResampler::Append(const Sample_t *src, uint_t frames)
+{
+  uint_t used = 0, n;
+
+  if (skip)
+  {
+    used  = (uint_t)std::min((uint64_t)frames, skip);
+    skip -= used;
+  }
+
+  if ((n = std::min(frames - used, taps - windowframes)) > 0)
+  {
+    if ((windowstart + windowframes + n) > (taps * WindowMultiple))
+    {
+      // move window back to start of buffer
+      memmove(&window[0], &window[windowstart * channels], windowframes * channels * sizeof(window[0]));
+      windowstart = 0;
+    }
+
+    memcpy(&window[(windowstart + windowframes) * channels], src + used * channels, n * channels * sizeof(window[0]));
+    windowframes += n;
+    used         += n;
+  }
+
+  return used;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Convert audio
+ *
+ * @param src interleaved input frames
+ * @param srcframes number of input frames available
+ * @param used set to number of input frames consumed
+ * @param dst buffer for interleaved output frames
+ * @param dstframes maximum number of output frames
+ *
+ * @return number of output frames generated (less than dstframes if more input is needed)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t PolyphaseResampler::Process(const Sample_t *src, uint_t srcframes, uint_t& used, Sample_t *dst, uint_t dstframes)
+{
+  uint_t n = 0;
+
+  used = 0;
+
+  if (!taps) return 0;
+
+  while (n < dstframes)
+  {
+    if (windowframes < taps)
+    {
+      used += Append(src + used * channels, srcframes - used);
+
+      // need more input
+      if (windowframes < taps) break;
+    }
+
+    const Sample_t *h = &bank[phase * taps];
+    const Sample_t *x = &window[windowstart * channels];
+    uint_t j, adv;
+
+    memset(dst, 0, channels * sizeof(*dst));
+    for (j = 0; j < taps; j++, x += channels) AccumulateFrame(dst, x, channels, h[j]);
+
+    dst += channels;
+    n++;
+
+    // step input position on by down/up frames
+    phase += down;
+    adv    = phase / up;
+    phase -= adv * up;
+
+    // drop frames from window, any not yet received are dropped as they arrive
+    uint_t drop = std::min(adv, windowframes);
+    windowstart  += drop;
+    windowframes -= drop;
+    skip         += adv - drop;
+  }
+
+  return n;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,120 @@
+#ifndef __POLYPHASE_RESAMPLER__
+#define __POLYPHASE_RESAMPLER__
+
+#include <vector>
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Rational ratio polyphase sample rate converter for interleaved audio
+ *
+ * The ratio of output to input rate is reduced to up/down (e.g. 44.1k -> 48k is 160/147)
+ * and a windowed-sinc filter bank with one set of taps per output phase is precomputed so
+ * that each output frame costs one multiply-accumulate per tap per channel
+ *
+ * Output frame k is centred *exactly* on input position k * down / up so positions can be
+ * mapped between rates without drift; the filter needs GetHistoryFrames() frames before
+ * and GetLookaheadFrames() frames after that position which the caller provides by
+ * priming (see Reset()) and flushing with silence at the end of the input
+ */
+/*--------------------------------------------------------------------------------*/
+class PolyphaseResampler
+{
+public:
+  PolyphaseResampler();
+  ~PolyphaseResampler() {}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Build filter bank for conversion
+   *
+   * @param inrate input sample rate
+   * @param outrate output sample rate
+   * @param channels number of interleaved channels
+   * @param taps number of taps per phase when upsampling (increased in proportion when downsampling)
+   *
+   * @return true if successful
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Setup(uint32_t inrate, uint32_t outrate, uint_t channels, uint_t taps = 32);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return reduced conversion ratio (output rate / input rate = up / down)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetUpFactor()   const {return up;}
+  uint_t GetDownFactor() const {return down;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of input frames needed before and after each output position
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t GetHistoryFrames()   const {return taps / 2 - 1;}
+  uint_t GetLookaheadFrames() const {return taps / 2;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of output frames corresponding to a number of input frames (rounded up)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetOutputFrames(uint64_t inframes) const {return down ? (inframes * up + down - 1) / down : 0;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Map output position to input position and phase
+   *
+   * @param outpos output position
+   * @param phase set to phase (in units of 1/up input frames) beyond returned position
+   *
+   * @return input position at or before output position
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetInputPosition(uint64_t outpos, uint_t& phase) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Clear history ready for new input
+   *
+   * @param phase phase of first output frame (see GetInputPosition())
+   * @param zeros number of frames of silence to prime the history with (when the first
+   * output frame is closer than GetHistoryFrames() to the start of the input)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Reset(uint_t phase = 0, uint_t zeros = 0);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Convert audio
+   *
+   * @param src interleaved input frames
+   * @param srcframes number of input frames available
+   * @param used set to number of input frames consumed
+   * @param dst buffer for interleaved output frames
+   * @param dstframes maximum number of output frames
+   *
+   * @return number of output frames generated (less than dstframes if more input is needed)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Process(const Sample_t *src, uint_t srcframes, uint_t& used, Sample_t *dst, uint_t dstframes);
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Append frames to window, discarding any frames that are to be skipped
+   *
+   * @return number of frames consumed
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Append(const Sample_t *src, uint_t frames);
+
+protected:
+  std::vector<Sample_t> bank;       // taps for each phase
+  std::vector<Sample_t> window;     // interleaved input frames
+  uint_t                up, down;
+  uint_t                taps;
+  uint_t                channels;
+  uint_t                phase;
+  uint_t                windowstart;
+  uint_t                windowframes;
+  uint64_t              skip;       // input frames to discard before the window is complete
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
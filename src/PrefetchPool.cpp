@@ -0,0 +1,418 @@
+
+#include <string.h>
+
+#include <chrono>
+
+#define BBCDEBUG_LEVEL 1
+#include "PrefetchPool.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// longest wait for a signal before checking again (waits are woken by signals, this is only a backstop)
+static const std::chrono::milliseconds SignalTimeout(100);
+
+// maximum number of frames decoded in one go (so that other streams are serviced), rings are
+// only topped up once they have room for this many
+static const uint_t ChunkFrames = 4096;
+
+PrefetchPool::PrefetchPool() : bufferms(0)
+{
+  uint_t i;
+
+  for (i = 0; i < MaxStreams; i++)
+  {
+    STREAM& stream = streams[i];
+
+    stream.state.store(Stream_Empty);
+    stream.busy.store(false);
+    stream.finished.store(false);
+    stream.file     = NULL;
+    stream.id       = 0;
+    stream.length   = 0;
+    stream.reader   = NULL;
+    stream.position = 0;
+    stream.debt     = 0;
+  }
+}
+
+PrefetchPool::~PrefetchPool()
+{
+  Stop();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start worker threads
+ *
+ * @param workers number of worker threads
+ * @param buffertimems amount of audio to decode ahead of playback for each stream
+ *
+ * @return true if workers started
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+bool PrefetchPool::Start(uint_t nworkers, uint_t buffertimems)
+{
+  bool success = true;
+
+  Stop();
+
+  bufferms = buffertimems;
+
+  while (workers.size() < nworkers)
+  {
+    Thread *thread;
+
+    if (((thread = new Thread) != NULL) && thread->Start(&__WorkerThread, (void *)this))
+    {
+      workers.push_back(thread);
+    }
+    else
+    {
+      BBCERROR("Failed to start prefetch worker %u", (uint_t)workers.size());
+      if (thread) delete thread;
+      success = false;
+      break;
+    }
+  }
+
+  BBCDEBUG2(("Started %u prefetch workers with %ums buffers", (uint_t)workers.size(), bufferms));
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Release all streams and stop worker threads
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+void PrefetchPool::Stop()
+{
+  uint_t i;
+
+  ReleaseAll();
+
+  // request all workers stop and wake them
+  for (i = 0; i < workers.size(); i++) workers[i]->Stop(false);
+  worksignal.Signal();
+
+  while (workers.size())
+  {
+    Thread *thread = workers.back();
+
+    thread->Stop();
+    delete thread;
+
+    workers.pop_back();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Request stream of file from its start
+ *
+ * @param file file to decode (not modified, workers use their own copy)
+ * @param id caller's identifier for the stream (e.g. playlist index)
+ *
+ * @return stream number or -1 if no stream is free
+ */
+/*--------------------------------------------------------------------------------*/
+sint_t PrefetchPool::Request(SoundFileSamples *file, uint_t id)
+{
+  uint_t i;
+
+  if (!IsRunning()) return -1;
+
+  for (i = 0; i < MaxStreams; i++)
+  {
+    STREAM& stream = streams[i];
+
+    if (stream.state.load(std::memory_order_acquire) == Stream_Empty)
+    {
+      stream.file     = file;
+      stream.id       = id;
+      stream.length   = file->GetSampleLength();
+      stream.position = 0;
+      stream.debt     = 0;
+      stream.state.store(Stream_Requested, std::memory_order_release);
+      worksignal.Signal();
+
+      BBCDEBUG3(("Requested prefetch of item %u on stream %u", id, i));
+      return (sint_t)i;
+    }
+  }
+
+  return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Find stream of file
+ *
+ * @param file file being decoded
+ * @param id caller's identifier for the stream
+ * @param started true to only return a stream that has been opened successfully
+ *
+ * @return stream number or -1
+ */
+/*--------------------------------------------------------------------------------*/
+sint_t PrefetchPool::Find(const SoundFileSamples *file, uint_t id, bool started) const
+{
+  const SoundFileSamples *file1;
+  uint_t i, id1;
+
+  for (i = 0; i < MaxStreams; i++)
+  {
+    if (GetStream(i, file1, id1) && (file1 == file) && (id1 == id) &&
+        (!started || (streams[i].state.load(std::memory_order_acquire) == Stream_Running))) return (sint_t)i;
+  }
+
+  return -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether stream is in use and, if so, its file and identifier
+ */
+/*--------------------------------------------------------------------------------*/
+bool PrefetchPool::GetStream(uint_t stream, const SoundFileSamples *& file, uint_t& id) const
+{
+  uint_t state = streams[stream].state.load(std::memory_order_acquire);
+
+  if ((state == Stream_Empty) || (state == Stream_Releasing)) return false;
+
+  file = streams[stream].file;
+  id   = streams[stream].id;
+
+  return true;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether stream has been started and decoded as far ahead as it can be (its
+ * ring is full or the whole file has been decoded)
+ */
+/*--------------------------------------------------------------------------------*/
+bool PrefetchPool::IsFilled(uint_t stream) const
+{
+  const STREAM& s = streams[stream];
+
+  // same test as workers use to decide whether there is work to do
+  return ((s.state.load(std::memory_order_acquire) == Stream_Running) &&
+          (s.finished.load() || (s.ring.GetWritable() < ChunkFrames)));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples from stream
+ *
+ * @param stream stream number (which must have been started)
+ * @param dst destination sample buffer
+ * @param channel offset channel to read from
+ * @param channels number of channels to read
+ * @param frames maximum number of frames to read
+ * @param missing set to number of frames that had not been decoded and were replaced with silence
+ *
+ * @return number of frames read (only less than requested at the end of the file)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t PrefetchPool::Read(uint_t stream, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames, uint_t& missing)
+{
+  STREAM& s = streams[stream];
+  uint_t width     = s.ring.GetWidth();
+  uint_t nchannels = std::min(width, limited::subz(channels, channel));
+  uint_t i, j, n = (uint_t)std::min((uint64_t)frames, limited::subz(s.length, s.position)), done = 0;
+  size_t avail, writable = s.ring.GetWritable();
+
+  // skip frames previously replaced with silence
+  while (s.debt && ((avail = s.ring.GetReadable()) > 0))
+  {
+    avail = (size_t)std::min((uint64_t)avail, s.debt);
+    s.ring.Consume(avail);
+    s.debt -= avail;
+  }
+
+  while (!s.debt && (done < n))
+  {
+    const Sample_t *src = s.ring.GetReadRegion(avail);
+
+    if (!src) break;
+
+    avail = std::min(avail, (size_t)(n - done));
+
+    // same channel placement as SoundFileSamples::ReadSamples()
+    for (i = 0; i < avail; i++, src += width, dst += channels)
+    {
+      for (j = 0; j < nchannels; j++) dst[channel + j] = src[j];
+    }
+
+    s.ring.Consume(avail);
+    done += (uint_t)avail;
+  }
+
+  if ((missing = n - done) > 0)
+  {
+    // workers haven't kept up, output silence and skip these frames when they arrive
+    for (i = 0; i < missing; i++, dst += channels)
+    {
+      for (j = 0; j < nchannels; j++) dst[channel + j] = 0.0;
+    }
+
+    s.debt += missing;
+  }
+
+  s.position += n;
+
+  // wake workers once there is room for another chunk
+  if ((writable < ChunkFrames) && (s.ring.GetWritable() >= ChunkFrames)) worksignal.Signal();
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Release stream, workers close it in the background
+ */
+/*--------------------------------------------------------------------------------*/
+void PrefetchPool::Release(uint_t stream)
+{
+  if (streams[stream].state.load(std::memory_order_acquire) != Stream_Empty)
+  {
+    streams[stream].state.store(Stream_Releasing, std::memory_order_release);
+    worksignal.Signal();
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Release all streams, waiting for workers to close them
+ *
+ * @note NOT real-time safe
+ */
+/*--------------------------------------------------------------------------------*/
+void PrefetchPool::ReleaseAll()
+{
+  uint_t i;
+
+  for (i = 0; i < MaxStreams; i++)
+  {
+    STREAM& stream = streams[i];
+
+    Release(i);
+
+    if (IsRunning())
+    {
+      // workers close the stream
+      while (true)
+      {
+        uint64_t seen = emptysignal.GetCount();
+
+        if (stream.state.load(std::memory_order_acquire) == Stream_Empty) break;
+
+        emptysignal.Wait(seen, SignalTimeout);
+      }
+    }
+    else
+    {
+      // no workers, close the stream here
+      if (stream.reader) delete stream.reader;
+      stream.reader = NULL;
+      stream.state.store(Stream_Empty);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open, decode into or close stream as required (worker thread, stream claimed)
+ *
+ * @return true if any work was done
+ */
+/*--------------------------------------------------------------------------------*/
+bool PrefetchPool::Service(STREAM& stream)
+{
+  uint_t state = stream.state.load(std::memory_order_acquire);
+  bool   worked = false;
+
+  if (state == Stream_Requested)
+  {
+    SoundFileSamples *reader;
+
+    // decode from a copy with its own file handle so that the playback thread is not affected
+    if ((reader = stream.file->Duplicate()) != NULL)
+    {
+      const SoundFormat *format = reader->GetFormat();
+      uint64_t frames = std::max((uint64_t)bufferms * (uint64_t)format->GetSampleRate() / 1000, (uint64_t)ChunkFrames * 2);
+
+      reader->SetSamplePosition(0);
+      stream.reader = reader;
+      stream.ring.Resize((size_t)frames, reader->GetChannels());
+      stream.finished.store(false);
+      state = Stream_Running;
+    }
+    else
+    {
+      BBCERROR("Failed to open prefetch stream of item %u", stream.id);
+      if (reader) delete reader;
+      state = Stream_Failed;
+    }
+
+    // stream may have been released whilst being opened
+    uint_t requested = Stream_Requested;
+    if (!stream.state.compare_exchange_strong(requested, state, std::memory_order_acq_rel)) state = requested;
+
+    worked = true;
+  }
+
+  if ((state == Stream_Running) && !stream.finished.load() && (stream.ring.GetWritable() >= ChunkFrames))
+  {
+    size_t   n;
+    Sample_t *dst = stream.ring.GetWriteRegion(n);
+
+    if (dst)
+    {
+      uint_t nread = stream.reader->ReadSamples(dst, 0, stream.ring.GetWidth(), (uint_t)std::min(n, (size_t)ChunkFrames));
+
+      if (nread) stream.ring.Commit(nread);
+      else       stream.finished.store(true);
+
+      worked = true;
+    }
+  }
+  else if (state == Stream_Releasing)
+  {
+    if (stream.reader) delete stream.reader;
+    stream.reader = NULL;
+    stream.state.store(Stream_Empty, std::memory_order_release);
+    emptysignal.Signal();
+
+    worked = true;
+  }
+
+  return worked;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Worker thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *PrefetchPool::WorkerThread(Thread& thread)
+{
+  while (!thread.StopRequested())
+  {
+    uint64_t seen = worksignal.GetCount();
+    bool     idle = true;
+    uint_t   i;
+
+    for (i = 0; i < MaxStreams; i++)
+    {
+      STREAM& stream = streams[i];
+
+      // claim stream so that no other worker services it at the same time
+      if ((stream.state.load(std::memory_order_acquire) != Stream_Empty) && !stream.busy.exchange(true, std::memory_order_acquire))
+      {
+        if (Service(stream)) idle = false;
+        stream.busy.store(false, std::memory_order_release);
+      }
+    }
+
+    if (idle) worksignal.Wait(seen, SignalTimeout);
+  }
+
+  return NULL;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,192 @@
+#ifndef __PREFETCH_POOL__
+#define __PREFETCH_POOL__
+
+#include <vector>
+#include <atomic>
+
+#include <bbcat-base/Thread.h>
+
+#include "SoundFileAttributes.h"
+#include "LockFreeRing.h"
+#include "ThreadSignal.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Pool of worker threads that decode sound files into lock-free rings ahead of playback
+ *
+ * A stream is requested for a file (by the playback thread), a worker opens its own copy of
+ * the file and keeps the stream's ring topped up with interleaved frames of all channels
+ * until the stream is released.  The playback thread only ever copies out of the ring; if
+ * the workers have not kept up, the missing frames are replaced with silence (and skipped
+ * in the ring when they arrive) so that playback timing is never affected
+ *
+ * Request(), Find(), Read() and Release() take no locks and do not allocate memory and are
+ * intended to be called from a single (real-time) playback thread.  Idle workers sleep
+ * until a stream is requested or released or a ring has room for another chunk of frames
+ */
+/*--------------------------------------------------------------------------------*/
+class PrefetchPool
+{
+public:
+  PrefetchPool();
+  ~PrefetchPool();
+
+  enum
+  {
+    MaxStreams = 4,             // current item, next item, loop target and one being released
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start worker threads
+   *
+   * @param workers number of worker threads
+   * @param buffertimems amount of audio to decode ahead of playback for each stream
+   *
+   * @return true if workers started
+   *
+   * @note NOT real-time safe
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Start(uint_t workers, uint_t buffertimems);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release all streams and stop worker threads
+   *
+   * @note NOT real-time safe
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Stop();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether worker threads are running
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsRunning() const {return (workers.size() > 0);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Request stream of file from its start
+   *
+   * @param file file to decode (not modified, workers use their own copy)
+   * @param id caller's identifier for the stream (e.g. playlist index)
+   *
+   * @return stream number or -1 if no stream is free
+   */
+  /*--------------------------------------------------------------------------------*/
+  sint_t Request(SoundFileSamples *file, uint_t id);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Find stream of file
+   *
+   * @param file file being decoded
+   * @param id caller's identifier for the stream
+   * @param started true to only return a stream that has been opened successfully
+   *
+   * @return stream number or -1
+   */
+  /*--------------------------------------------------------------------------------*/
+  sint_t Find(const SoundFileSamples *file, uint_t id, bool started = false) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether stream is in use and, if so, its file and identifier
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetStream(uint_t stream, const SoundFileSamples *& file, uint_t& id) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether stream has been started and decoded as far ahead as it can be (its
+   * ring is full or the whole file has been decoded)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool IsFilled(uint_t stream) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples from stream
+   *
+   * @param stream stream number (which must have been started)
+   * @param dst destination sample buffer
+   * @param channel offset channel to read from
+   * @param channels number of channels to read
+   * @param frames maximum number of frames to read
+   * @param missing set to number of frames that had not been decoded and were replaced with silence
+   *
+   * @return number of frames read (only less than requested at the end of the file)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t Read(uint_t stream, Sample_t *dst, uint_t channel, uint_t channels, uint_t frames, uint_t& missing);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of frames read from stream
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetPosition(uint_t stream) const {return streams[stream].position;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release stream, workers close it in the background
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Release(uint_t stream);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Release all streams, waiting for workers to close them
+   *
+   * @note NOT real-time safe
+   */
+  /*--------------------------------------------------------------------------------*/
+  void ReleaseAll();
+
+protected:
+  enum
+  {
+    Stream_Empty = 0,
+    Stream_Requested,
+    Stream_Running,
+    Stream_Failed,
+    Stream_Releasing,
+  };
+
+  typedef struct
+  {
+    std::atomic<uint_t>    state;
+    std::atomic<bool>      busy;      // claimed by a worker
+    std::atomic<bool>      finished;  // whole file has been decoded
+    SoundFileSamples       *file;
+    uint_t                 id;
+    uint64_t               length;    // length of file in frames
+    SoundFileSamples       *reader;   // worker's copy of file
+    uint64_t               position;  // frames read by playback thread
+    uint64_t               debt;      // frames replaced with silence still to be skipped in ring
+    LockFreeRing<Sample_t> ring;
+  } STREAM;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open, decode into or close stream as required (worker thread, stream claimed)
+   *
+   * @return true if any work was done
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Service(STREAM& stream);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Worker thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__WorkerThread(Thread& thread, void *arg) {return ((PrefetchPool *)arg)->WorkerThread(thread);}
+  void *WorkerThread(Thread& thread);
+
+protected:
+  STREAM                streams[MaxStreams];
+  std::vector<Thread *> workers;
+  ThreadSignal          worksignal;     // signalled when there may be work for the workers
+  ThreadSignal          emptysignal;    // signalled when a stream has been closed
+  uint_t                bufferms;
+
+private:
+  // prevent copying
+  PrefetchPool(const PrefetchPool& obj);
+  PrefetchPool& operator = (const PrefetchPool& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -7,6 +7,7 @@
 
 #include "RIFFChunk.h"
 #include "RIFFFile.h"
+#include "TraceEvents.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -400,6 +401,9 @@ RIFFChunk *RIFFChunk::Create(EnhancedFile *file, const RIFFChunkSizeHandler *siz
     // treat ID as big-endian
     ByteSwap(id, SWAP_FOR_BE);
 
+    const char idname[] = {(char)(id >> 24), (char)(id >> 16), (char)(id >> 8), (char)id, 0};
+    TraceScope trace("ReadChunk", "riff", idname);
+
     // find provider to create RIFFChunk object
     std::map<uint32_t, PROVIDER>::iterator it = providermap.find(id);
 
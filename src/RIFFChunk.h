@@ -110,6 +110,18 @@ public:
   /*--------------------------------------------------------------------------------*/
   virtual void DeleteData();
 
+  /*--------------------------------------------------------------------------------*/
+  /** Ensure chunk data is held in memory so that the chunk can be re-written
+   *
+   * @param file file the chunk was read from
+   *
+   * @return true if data is available (or not required)
+   *
+   * @note used when an existing file is re-opened for appending
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool LoadData(EnhancedFile *file) {return ReadData(file);}
+
   /*--------------------------------------------------------------------------------*/
   /** By default, all chunks are written before samples (data chunk)
    */
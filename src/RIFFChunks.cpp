@@ -814,6 +814,23 @@ bool RIFFdataChunk::CreateWriteData()
   return true;
 }
 
+// re-open sample data for writing, positioned at the end of the existing data
+bool RIFFdataChunk::PrepareForAppend()
+{
+  RefCount<EnhancedFile> file = fileref;
+  bool success = false;
+
+  if (file.Obj())
+  {
+    SetFile(file, datapos, length, false);
+    SetSamplePosition(GetSampleLength());
+
+    if ((success = (file.Obj()->fseek(datapos + length, SEEK_SET) == 0)) == false) BBCERROR("Failed to seek to end of sample data, error %s", strerror(file.Obj()->ferror()));
+  }
+
+  return success;
+}
+
 // move over data that already been written
 bool RIFFdataChunk::WriteChunkData(EnhancedFile *file)
 {
@@ -29,6 +29,9 @@ public:
   // set chunk to RF64
   virtual void EnableRIFF64();
 
+  // chunk contains other chunks, nothing to load
+  virtual bool LoadData(EnhancedFile *file) {UNUSED_PARAMETER(file); return true;}
+
   // provider function register for this object
   static void Register();
 
@@ -349,6 +352,12 @@ public:
   // set up data length before data is written
   virtual bool CreateWriteData();
 
+  // sample data is never held in memory
+  virtual bool LoadData(EnhancedFile *file) {UNUSED_PARAMETER(file); return true;}
+
+  // re-open sample data for writing, positioned at the end of the existing data
+  bool PrepareForAppend();
+
   // provider function register for this object
   static void Register();
 
@@ -3,18 +3,24 @@
 
 #define BBCDEBUG_LEVEL 3
 
-#include <bbcat-base/BackgroundFile.h>
-
 #include "RIFFFile.h"
 #include "RIFFChunk_Definitions.h"
+#include "TraceEvents.h"
 
 BBC_AUDIOTOOLBOX_START
 
 RIFFFile::RIFFFile() : filetype(FileType_Unknown),
                        fileformat(NULL),
                        filesamples(NULL),
+                       iostatistics(IOStatistics::IsEnabledByDefault() ? new IOStatistics : NULL),
+                       backgroundconfig(BackgroundWriteFile::GetDefaultConfig()),
+                       mapconfig(BackgroundWriteFile::GetDefaultMapConfig()),
+                       timereference(0),
+                       settimereference(false),
+                       appending(false),
                        writing(false),
-                       backgroundwriting(false)
+                       backgroundwriting(false),
+                       mappedwriting(false)
 {
   if (sizeof(off_t) < sizeof(uint64_t))
   {
@@ -31,6 +37,8 @@ RIFFFile::RIFFFile() : filetype(FileType_Unknown),
 RIFFFile::~RIFFFile()
 {
   Close();
+
+  if (iostatistics) delete iostatistics;
 }
 
 bool RIFFFile::ReadChunks(uint64_t maxlength)
@@ -78,6 +86,7 @@ bool RIFFFile::ReadChunks(uint64_t maxlength)
       {
         filesamples = dynamic_cast<SoundFileSamples *>(chunk);
         if (fileformat) filesamples->SetFormat(fileformat);
+        filesamples->SetIOStatistics(iostatistics);
 
         BBCDEBUG3(("Found data chunk (%s)", chunk->GetName()));
       }
@@ -87,6 +96,8 @@ bool RIFFFile::ReadChunks(uint64_t maxlength)
 
     if (success)
     {
+      TraceScope trace("PostReadChunks", "riff");
+
       success = PostReadChunks();
       if (!success) BBCERROR("Failed post read chunks processing");
     }
@@ -97,6 +108,7 @@ bool RIFFFile::ReadChunks(uint64_t maxlength)
 
 bool RIFFFile::Open(const char *filename)
 {
+  TraceScope trace("RIFFFile::Open", "riff", filename);
   bool success = false;
 
   if (!IsOpen())
@@ -126,6 +138,200 @@ bool RIFFFile::Open(const char *filename)
   return success;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Re-open an existing WAVE/RF64 file to append samples to it
+ *
+ * @param filename filename of file to open
+ *
+ * @return true if file opened and positioned at the end of the existing samples
+ *
+ * @note the file is promoted to RF64 on Close() if necessary, this requires either a
+ * @note ds64 chunk or a JUNK chunk of the correct size immediately after the WAVE ID
+ */
+/*--------------------------------------------------------------------------------*/
+bool RIFFFile::Append(const char *filename)
+{
+  bool success = false;
+
+  if (!IsOpen())
+  {
+    BackgroundWriteFile *file;
+
+    if ((file = new BackgroundWriteFile) != NULL)
+    {
+      // NOTE: file starts in foreground writing mode!
+      fileref = file;
+
+      if (file->fopen(filename, "rb+"))
+      {
+        RIFFChunk *chunk;
+
+        if ((chunk = RIFFChunk::Create(file)) != NULL)
+        {
+          chunklist.push_back(chunk);
+          chunkmap[chunk->GetID()] = chunk;
+
+          if ((chunk->GetID() == RIFF_ID) || (chunk->GetID() == RF64_ID))
+          {
+            filetype = FileType_WAV;
+
+            if (ReadChunks(chunk->GetLength()))
+            {
+              writing   = true;
+              appending = true;
+
+              success = PrepareForAppend();
+            }
+          }
+          else BBCERROR("'%s' is not a WAVE file", filename);
+        }
+      }
+      else BBCERROR("Failed to open '%s' for appending", filename);
+    }
+
+    // abort so that nothing is written to the existing file
+    if (!success) Close(true);
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Prepare chunks read from an existing file for appending
+ *
+ * @return true if file can be appended to
+ *
+ * @note all chunks are re-written on Close() so must be held in memory and any chunk
+ * @note that would move relative to the sample data is relocated or replaced with JUNK
+ */
+/*--------------------------------------------------------------------------------*/
+bool RIFFFile::PrepareForAppend()
+{
+  BackgroundWriteFile *file = dynamic_cast<BackgroundWriteFile *>(fileref.Obj());
+  RIFFdataChunk       *data = dynamic_cast<RIFFdataChunk *>(GetChunk(data_ID));
+  ChunkList_t         before, after;
+  RIFFChunk           *chunk, *newchunk;
+  uint_t i;
+  bool   found = false, success = true;
+
+  if (!file || !fileformat || !data)
+  {
+    BBCERROR("No format and/or data chunk found, cannot append");
+    return false;
+  }
+
+  for (i = 0; i < chunklist.size(); i++)
+  {
+    chunk = chunklist[i];
+
+    if (chunk == data)
+    {
+      found = true;
+      continue;
+    }
+
+    if (success && !(success = chunk->LoadData(file)))
+    {
+      BBCERROR("Failed to read data of chunk '%s', cannot append", chunk->GetName());
+    }
+
+    if (!found)
+    {
+      RIFFds64Chunk *ds64;
+
+      if (i == 0)
+      {
+        // replace RIFF/RF64 chunk with a new RIFF chunk, its size will be calculated on close
+        if ((newchunk = RIFFChunk::Create(RIFF_ID)) != NULL)
+        {
+          before.push_back(newchunk);
+          chunkmap.erase(chunk->GetID());
+          chunkmap[RIFF_ID] = newchunk;
+          delete chunk;
+        }
+        else
+        {
+          before.push_back(chunk);
+          success = false;
+        }
+      }
+      else if ((i == 2) && (chunk->GetID() == JUNK_ID) && !GetChunk(ds64_ID) &&
+               (chunk->GetLength() >= sizeof(ds64_CHUNK)) &&
+               (((chunk->GetLength() - sizeof(ds64_CHUNK)) % sizeof(CHUNKSIZE64)) == 0) &&
+               ((ds64 = dynamic_cast<RIFFds64Chunk *>(RIFFChunk::Create(ds64_ID))) != NULL))
+      {
+        // JUNK chunk reserved for ds64: convert it so that the file can be promoted to RF64
+        ds64->SetTableCount((uint32_t)((chunk->GetLength() - sizeof(ds64_CHUNK)) / sizeof(CHUNKSIZE64)));
+        ds64->CreateWriteData();
+
+        BBCDEBUG2(("Converted JUNK chunk to ds64 chunk with %u table entries", ds64->GetTableCount()));
+
+        before.push_back(ds64);
+        if (GetChunk(JUNK_ID) == chunk) chunkmap.erase(JUNK_ID);
+        chunkmap[ds64_ID] = ds64;
+        delete chunk;
+      }
+      else if (!chunk->WriteChunkBeforeSamples())
+      {
+        // chunk would be re-written after the samples, leave a JUNK chunk of the same size in its place
+        if (((newchunk = RIFFChunk::Create(JUNK_ID)) != NULL) && newchunk->CreateChunkData(chunk->GetLength()))
+        {
+          BBCDEBUG2(("Moving chunk '%s' to after samples", chunk->GetName()));
+
+          before.push_back(newchunk);
+          after.push_back(chunk);
+        }
+        else
+        {
+          delete newchunk;
+          before.push_back(chunk);
+          success = false;
+        }
+      }
+      else before.push_back(chunk);
+    }
+    else if (chunk->WriteChunkBeforeSamples())
+    {
+      // chunk would be re-written before the samples, replace with a plain chunk written after them
+      if ((newchunk = new UserRIFFChunk(chunk->GetID(), chunk->GetData(), chunk->GetLength(), false)) != NULL)
+      {
+        after.push_back(newchunk);
+        chunkmap[chunk->GetID()] = newchunk;
+        delete chunk;
+      }
+      else
+      {
+        after.push_back(chunk);
+        success = false;
+      }
+    }
+    else after.push_back(chunk);
+  }
+
+  // rebuild chunk list: chunks before samples (unchanged in size), data, then chunks after samples
+  chunklist = before;
+  chunklist.push_back(data);
+  chunklist.insert(chunklist.end(), after.begin(), after.end());
+
+  if (success)
+  {
+    if (!GetChunk(ds64_ID)) BBCERROR("No ds64 chunk in '%s', it cannot be extended beyond 4GB", file->getfilename().c_str());
+
+    // position samples at the end of the existing data
+    if ((success = data->PrepareForAppend()) == true)
+    {
+      file->SetConfig(backgroundconfig);
+      file->SetBytesPerSecond((uint64_t)fileformat->GetSampleRate() * (uint64_t)fileformat->GetBytesPerFrame());
+      if (mappedwriting) file->EnableMapping(true, mapconfig);
+      file->EnableBackground(backgroundwriting);
+
+      BBCDEBUG1(("Appending to '%s' at sample %s", file->getfilename().c_str(), StringFrom(filesamples->GetSamplePosition()).c_str()));
+    }
+  }
+
+  return success;
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Enable/disable background file writing
  *
@@ -134,17 +340,120 @@ bool RIFFFile::Open(const char *filename)
 /*--------------------------------------------------------------------------------*/
 void RIFFFile::EnableBackgroundWriting(bool enable)
 {
-  BackgroundFile *file;
+  EnableBackgroundWriting(enable, backgroundconfig);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable background file writing with specific queue configuration
+ *
+ * @param enable true to enable background writing
+ * @param config queue depth (in time), high-water callback and full queue policy
+ *
+ * @note can be called at any time to enable/disable or to change the configuration
+ */
+/*--------------------------------------------------------------------------------*/
+void RIFFFile::EnableBackgroundWriting(bool enable, const BackgroundWriteFile::CONFIG& config)
+{
+  BackgroundWriteFile *file;
 
   backgroundwriting = enable;
+  backgroundconfig  = config;
 
   // if we're writing a file, and it is a background capable file, enable or disable background mode
-  if (writing && ((file = dynamic_cast<BackgroundFile *>(fileref.Obj())) != NULL))
+  if (writing && ((file = dynamic_cast<BackgroundWriteFile *>(fileref.Obj())) != NULL))
+  {
+    file->SetConfig(backgroundconfig);
+    file->EnableBackground(backgroundwriting);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable writing through a memory mapping of the file
+ *
+ * @param enable true to enable mapped writing
+ * @param config extent (by which the file is grown) and checkpoint (flush) sizes
+ *
+ * @note can be called at any time to enable/disable
+ */
+/*--------------------------------------------------------------------------------*/
+void RIFFFile::EnableMappedWriting(bool enable, const BackgroundWriteFile::MAPCONFIG& config)
+{
+  BackgroundWriteFile *file;
+
+  mappedwriting = enable;
+  mapconfig     = config;
+
+  if (writing && ((file = dynamic_cast<BackgroundWriteFile *>(fileref.Obj())) != NULL))
   {
+    // background writing is resumed (if enabled) when mapping is disabled
+    file->EnableMapping(mappedwriting, mapconfig);
     file->EnableBackground(backgroundwriting);
   }
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Return live statistics of background writing
+ *
+ * @param stats structure to be populated
+ *
+ * @return true if file is being written (and therefore stats are valid)
+ */
+/*--------------------------------------------------------------------------------*/
+bool RIFFFile::GetBackgroundWritingStats(BackgroundWriteFile::STATS& stats) const
+{
+  const BackgroundWriteFile *file;
+  bool success = false;
+
+  if (writing && ((file = dynamic_cast<const BackgroundWriteFile *>(fileref.Obj())) != NULL))
+  {
+    file->GetStats(stats);
+    success = true;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable gathering of sample I/O statistics
+ *
+ * @note statistics are kept (and accumulate) across files opened or created by this object
+ */
+/*--------------------------------------------------------------------------------*/
+void RIFFFile::EnableIOStatistics(bool enable)
+{
+  if (enable && !iostatistics) iostatistics = new IOStatistics;
+
+  // samples (and any duplicates of them) MUST stop using the statistics before they are deleted
+  if (filesamples) filesamples->SetIOStatistics(enable ? iostatistics : NULL);
+
+  if (!enable && iostatistics)
+  {
+    delete iostatistics;
+    iostatistics = NULL;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return live statistics of sample I/O
+ *
+ * @param stats structure to be populated
+ *
+ * @return true if statistics are enabled (and therefore stats are valid)
+ */
+/*--------------------------------------------------------------------------------*/
+bool RIFFFile::GetIOStatistics(IOStatistics::STATS& stats) const
+{
+  bool success = false;
+
+  if (iostatistics)
+  {
+    iostatistics->GetStats(stats);
+    success = true;
+  }
+
+  return success;
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Create a WAVE/RIFF file
  *
@@ -163,10 +472,10 @@ bool RIFFFile::Create(const char *filename, uint32_t samplerate, uint_t nchannel
   if (!IsOpen())
   {
     // use background file writing mechanism
-    BackgroundFile *file;
+    BackgroundWriteFile *file;
 
     if (samplerate && nchannels &&
-        ((file = (new BackgroundFile)) != NULL) && file->fopen(filename, "wb+"))
+        ((file = (new BackgroundWriteFile)) != NULL) && file->fopen(filename, "wb+"))
     {
       const uint32_t ids[] = {RIFF_ID, WAVE_ID, ds64_ID, fmt_ID, data_ID};
       uint_t i;
@@ -192,10 +501,24 @@ bool RIFFFile::Create(const char *filename, uint32_t samplerate, uint_t nchannel
 
           filesamples->SetFormat(fileformat);
 
+          // configure background writing queue (depth is specified in time)
+          file->SetConfig(backgroundconfig);
+          file->SetBytesPerSecond((uint64_t)samplerate * (uint64_t)fileformat->GetBytesPerFrame());
+
           filetype = FileType_WAV;
 
           if (CreateExtraChunks())
           {
+            RIFFbextChunk *bext;
+
+            // add bext chunk to hold time reference, if required
+            if (settimereference &&
+                (((bext = dynamic_cast<RIFFbextChunk *>(GetChunk(bext_ID))) != NULL) ||
+                 ((bext = dynamic_cast<RIFFbextChunk *>(AddChunk(bext_ID))) != NULL)))
+            {
+              bext->SetTimeReference(timereference);
+            }
+
             RIFFds64Chunk *ds64;
             if ((ds64 = dynamic_cast<RIFFds64Chunk *>(chunkmap[ds64_ID])) != NULL)
             {
@@ -221,6 +544,56 @@ bool RIFFFile::Create(const char *filename, uint32_t samplerate, uint_t nchannel
   return success;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Set bext TimeReference (first sample count since midnight) of file being written
+ *
+ * @param samples time reference in samples
+ *
+ * @note if called before Create(), a bext chunk will be added to the file
+ * @note if called afterwards, any existing bext chunk will be updated
+ */
+/*--------------------------------------------------------------------------------*/
+void RIFFFile::SetTimeReference(uint64_t samples)
+{
+  RIFFbextChunk *bext;
+
+  timereference    = samples;
+  settimereference = true;
+
+  if (writing && ((bext = dynamic_cast<RIFFbextChunk *>(GetChunk(bext_ID))) != NULL))
+  {
+    bext->SetTimeReference(timereference);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Exchange the file and all its chunks with another object
+ *
+ * @note background and mapped writing settings are exchanged as well
+ */
+/*--------------------------------------------------------------------------------*/
+void RIFFFile::Swap(RIFFFile& obj)
+{
+  RefCount<EnhancedFile> ref = fileref;
+
+  fileref     = obj.fileref;
+  obj.fileref = ref;
+
+  std::swap(filetype,          obj.filetype);
+  std::swap(fileformat,        obj.fileformat);
+  std::swap(filesamples,       obj.filesamples);
+  std::swap(chunklist,         obj.chunklist);
+  std::swap(chunkmap,          obj.chunkmap);
+  std::swap(backgroundconfig,  obj.backgroundconfig);
+  std::swap(mapconfig,         obj.mapconfig);
+  std::swap(timereference,     obj.timereference);
+  std::swap(settimereference,  obj.settimereference);
+  std::swap(appending,         obj.appending);
+  std::swap(writing,           obj.writing);
+  std::swap(backgroundwriting, obj.backgroundwriting);
+  std::swap(mappedwriting,     obj.mappedwriting);
+}
+
 /*--------------------------------------------------------------------------------*/
 /** Write all chunks necessary
  *
@@ -229,8 +602,8 @@ bool RIFFFile::Create(const char *filename, uint32_t samplerate, uint_t nchannel
 /*--------------------------------------------------------------------------------*/
 void RIFFFile::WriteChunks(bool closing)
 {
-  EnhancedFile   *file  = fileref;
-  BackgroundFile *bfile = dynamic_cast<BackgroundFile *>(file);
+  EnhancedFile        *file  = fileref;
+  BackgroundWriteFile *bfile = dynamic_cast<BackgroundWriteFile *>(file);
   RIFFChunk *chunk;
   uint_t i;
 
@@ -285,7 +658,8 @@ void RIFFFile::WriteChunks(bool closing)
 
   if (!closing && bfile)
   {
-    // now switch to background writing mode if enabled
+    // now switch to mapped or background writing mode if enabled
+    if (mappedwriting) bfile->EnableMapping(true, mapconfig);
     bfile->EnableBackground(backgroundwriting);
   }
 }
@@ -305,6 +679,8 @@ void RIFFFile::Close(bool abortwrite)
 
   if (file)
   {
+    TraceScope trace("RIFFFile::Close", "riff", file->getfilename());
+
     if (writing && !abortwrite)
     {
       RIFFds64Chunk  *ds64  = dynamic_cast<RIFFds64Chunk *>(GetChunk(ds64_ID));
@@ -376,18 +752,27 @@ void RIFFFile::Close(bool abortwrite)
       chunkmap[RIFF_ID]->CreateChunkData(NULL, totalbytes);
 
       // write/re-write all chunks
-      WriteChunks(true);
+      {
+        TraceScope trace("WriteChunks", "riff");
+        WriteChunks(true);
+      }
 
       BBCDEBUG1(("Closed file '%s'", file->getfilename().c_str()));
     }
 
-    fileref = NULL;
+    {
+      // releasing the (usually last) reference closes the file, waiting for any background writing
+      TraceScope trace("CloseFile", "riff");
+      fileref = NULL;
+    }
   }
 
-  filetype    = FileType_Unknown;
-  fileformat  = NULL;
-  filesamples = NULL;
-  writing     = false;
+  filetype         = FileType_Unknown;
+  fileformat       = NULL;
+  filesamples      = NULL;
+  settimereference = false;
+  appending        = false;
+  writing          = false;
 
   for (i = 0; i < chunklist.size(); i++)
   {
@@ -437,6 +822,7 @@ RIFFChunk *RIFFFile::AddChunk(uint32_t id)
         if ((smpschunk = dynamic_cast<SoundFileSamples *>(chunk)) != NULL)
         {
           filesamples = smpschunk;
+          filesamples->SetIOStatistics(iostatistics);
         }
       }
       else
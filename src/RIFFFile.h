@@ -7,6 +7,7 @@
 #include <bbcat-base/RefCount.h>
 
 #include "RIFFChunks.h"
+#include "BackgroundWriteFile.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -33,6 +34,19 @@ public:
   /*--------------------------------------------------------------------------------*/
   virtual bool Open(const char *filename);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Re-open an existing WAVE/RF64 file to append samples to it
+   *
+   * @param filename filename of file to open
+   *
+   * @return true if file opened and positioned at the end of the existing samples
+   *
+   * @note the file is promoted to RF64 on Close() if necessary, this requires either a
+   * @note ds64 chunk or a JUNK chunk of the correct size immediately after the WAVE ID
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool Append(const char *filename);
+
   /*--------------------------------------------------------------------------------*/
   /** Enable/disable background file writing
    *
@@ -41,6 +55,63 @@ public:
   /*--------------------------------------------------------------------------------*/
   virtual void EnableBackgroundWriting(bool enable);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable background file writing with specific queue configuration
+   *
+   * @param enable true to enable background writing
+   * @param config queue depth (in time), high-water callback and full queue policy
+   *
+   * @note can be called at any time to enable/disable or to change the configuration
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void EnableBackgroundWriting(bool enable, const BackgroundWriteFile::CONFIG& config);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return live statistics of background writing
+   *
+   * @param stats structure to be populated
+   *
+   * @return true if file is being written (and therefore stats are valid)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetBackgroundWritingStats(BackgroundWriteFile::STATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable gathering of sample I/O statistics (bytes, calls and latency histograms
+   * of reads, writes, seeks and sample conversion)
+   *
+   * @note disabled by default unless IOStatistics::EnableByDefault() has been called
+   * @note statistics are kept (and accumulate) across files opened or created by this object
+   * @note and are also added to the process-wide statistics (see IOStatistics::GetProcessStats())
+   * @note duplicates of the samples (see GetSamples()) share the statistics so MUST be deleted
+   * @note before this object or disabling statistics
+   */
+  /*--------------------------------------------------------------------------------*/
+  void EnableIOStatistics(bool enable = true);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return live statistics of sample I/O
+   *
+   * @param stats structure to be populated
+   *
+   * @return true if statistics are enabled (and therefore stats are valid)
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool GetIOStatistics(IOStatistics::STATS& stats) const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable writing through a memory mapping of the file
+   *
+   * @param enable true to enable mapped writing
+   * @param config extent (by which the file is grown) and checkpoint (flush) sizes
+   *
+   * @note can be called at any time to enable/disable
+   * @note takes precedence over background writing, intended for offline rendering
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void EnableMappedWriting(bool enable, const BackgroundWriteFile::MAPCONFIG& config);
+  virtual void EnableMappedWriting(bool enable = true) {EnableMappedWriting(enable, mapconfig);}
+
   /*--------------------------------------------------------------------------------*/
   /** Create a WAVE/RIFF file
    *
@@ -54,6 +125,17 @@ public:
   /*--------------------------------------------------------------------------------*/
   virtual bool Create(const char *filename, uint32_t samplerate = 48000, uint_t nchannels = 2, SampleFormat_t format = SampleFormat_24bit);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Set bext TimeReference (first sample count since midnight) of file being written
+   *
+   * @param samples time reference in samples
+   *
+   * @note if called before Create(), a bext chunk will be added to the file
+   * @note if called afterwards, any existing bext chunk will be updated
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetTimeReference(uint64_t samples);
+
   /*--------------------------------------------------------------------------------*/
   /** Return whether a file is open
    *
@@ -275,6 +357,32 @@ public:
   sint_t ReadSamples(float   *buffer, uint_t dstchannel, uint_t ndstchannels, uint_t nframes = 1) {return ReadSamples((uint8_t *)buffer, SampleFormatOf(buffer), dstchannel, ndstchannels, nframes);}
   sint_t ReadSamples(double  *buffer, uint_t dstchannel, uint_t ndstchannels, uint_t nframes = 1) {return ReadSamples((uint8_t *)buffer, SampleFormatOf(buffer), dstchannel, ndstchannels, nframes);}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames into separate (planar) buffers, one per channel
+   *
+   * @param dst array of destination buffers, one for each channel (NULL entries are skipped)
+   * @param dstoffset offset in frames into each destination buffer
+   * @param nframes number of sample frames to read
+   *
+   * @return number of frames read or -1 for an error (no open file for example)
+   */
+  /*--------------------------------------------------------------------------------*/
+  sint_t ReadSamplesPlanar(Sample_t *const *dst, uint_t dstoffset, uint_t nframes) {return filesamples ? filesamples->ReadSamplesPlanar(dst, dstoffset, nframes) : -1;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames through a channel map, applying gain in the same pass
+   *
+   * @param dst interleaved destination buffer
+   * @param ndstchannels number of channels in each destination frame
+   * @param map array of channel map entries (channels of file to destination channels)
+   * @param nmap number of entries in map
+   * @param nframes number of sample frames to read
+   *
+   * @return number of frames read or -1 for an error (no open file for example)
+   */
+  /*--------------------------------------------------------------------------------*/
+  sint_t ReadSamplesMapped(Sample_t *dst, uint_t ndstchannels, const CHANNELROUTE *map, uint_t nmap, uint_t nframes) {return filesamples ? filesamples->ReadSamplesMapped(dst, ndstchannels, nframes, map, nmap) : -1;}
+
   /*--------------------------------------------------------------------------------*/
   /** Write sample frames
    *
@@ -287,12 +395,49 @@ public:
    * @return number of frames written or -1 for an error (no open file for example)
    */
   /*--------------------------------------------------------------------------------*/
-  sint_t WriteSamples(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return filesamples ? filesamples->WriteSamples((const uint8_t *)buffer, type, srcchannel, nsrcchannels, nsrcframes) : -1;}
+  virtual sint_t WriteSamples(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return filesamples ? filesamples->WriteSamples((const uint8_t *)buffer, type, srcchannel, nsrcchannels, nsrcframes) : -1;}
   sint_t WriteSamples(const int16_t *buffer, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return WriteSamples((const uint8_t *)buffer, SampleFormatOf(buffer), srcchannel, nsrcchannels, nsrcframes);}
   sint_t WriteSamples(const int32_t *buffer, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return WriteSamples((const uint8_t *)buffer, SampleFormatOf(buffer), srcchannel, nsrcchannels, nsrcframes);}
   sint_t WriteSamples(const float   *buffer, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return WriteSamples((const uint8_t *)buffer, SampleFormatOf(buffer), srcchannel, nsrcchannels, nsrcframes);}
   sint_t WriteSamples(const double  *buffer, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1) {return WriteSamples((const uint8_t *)buffer, SampleFormatOf(buffer), srcchannel, nsrcchannels, nsrcframes);}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Write sample frames from separate (planar) buffers, one per channel
+   *
+   * @param src array of source buffers, one for each channel (NULL entries write silence)
+   * @param srcoffset offset in frames into each source buffer
+   * @param nsrcframes number of sample frames to write
+   *
+   * @return number of frames written or -1 for an error (no open file for example)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual sint_t WriteSamplesPlanar(const Sample_t *const *src, uint_t srcoffset, uint_t nsrcframes = 1) {return filesamples ? filesamples->WriteSamplesPlanar(src, srcoffset, nsrcframes) : -1;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer that sample frames can be written into directly, avoiding the copy made by WriteSamples()
+   *
+   * @param frames number of frames required, updated with the number of frames that can be written
+   *
+   * @return pointer to buffer for interleaved frames of all channels in the file's sample format
+   * and endianness (see GetSamples()->GetFormat()) or NULL
+   *
+   * @note the buffer is only valid until CommitWriteBuffer() is called
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint8_t *GetWriteBuffer(uint_t& frames) {return filesamples ? filesamples->GetWriteBuffer(frames) : NULL;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write frames previously written into buffer returned by GetWriteBuffer()
+   *
+   * @param frames number of frames to write (no more than returned by GetWriteBuffer())
+   *
+   * @return number of frames written or -1 for an error (no open file for example)
+   *
+   * @note MUST be called after every successful call to GetWriteBuffer(), even if no frames are written
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual sint_t CommitWriteBuffer(uint_t frames) {return filesamples ? (sint_t)filesamples->CommitWriteBuffer(frames) : -1;}
+
 protected:
   /*--------------------------------------------------------------------------------*/
   /** Read as many chunks as possible
@@ -328,6 +473,17 @@ protected:
   /*--------------------------------------------------------------------------------*/
   virtual bool PostReadChunks() {return true;}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Prepare chunks read from an existing file for appending
+   *
+   * @return true if file can be appended to
+   *
+   * @note all chunks are re-written on Close() so must be held in memory and any chunk
+   * @note that would move relative to the sample data is relocated or replaced with JUNK
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool PrepareForAppend();
+
   /*--------------------------------------------------------------------------------*/
   /** Optional stage to create extra chunks when writing WAV files
    */
@@ -348,6 +504,14 @@ protected:
   /*--------------------------------------------------------------------------------*/
   virtual void UpdateSamplePosition() {}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Exchange the file and all its chunks with another object
+   *
+   * @note background and mapped writing settings are exchanged as well
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Swap(RIFFFile& obj);
+
   typedef std::vector<RIFFChunk *>        ChunkList_t;
   typedef std::map<uint32_t, RIFFChunk *> ChunkMap_t;
 
@@ -356,10 +520,17 @@ protected:
   uint8_t                filetype;
   SoundFormat            *fileformat;
   SoundFileSamples       *filesamples;
+  IOStatistics           *iostatistics;
   ChunkList_t            chunklist;
   ChunkMap_t             chunkmap;
+  BackgroundWriteFile::CONFIG backgroundconfig;
+  BackgroundWriteFile::MAPCONFIG mapconfig;
+  uint64_t               timereference;
+  bool                   settimereference;
+  bool                   appending;
   bool                   writing;
   bool                   backgroundwriting;
+  bool                   mappedwriting;
 };
 
 BBC_AUDIOTOOLBOX_END
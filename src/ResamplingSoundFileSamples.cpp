@@ -0,0 +1,179 @@
+
+#include <string.h>
+
+#define BBCDEBUG_LEVEL 1
+#include "ResamplingSoundFileSamples.h"
+#include "SampleConversion.h"
+
+BBC_AUDIOTOOLBOX_START
+
+ResamplingSoundFileSamples::ResamplingSoundFileSamples(SoundFileSamples *source, uint32_t outputrate, uint_t taps) :
+  SoundFileSamples(),
+  source(source),
+  inputpos(0),
+  inputframes(0),
+  readpos(0),
+  convpos(~(uint64_t)0),
+  taps(taps)
+{
+  const SoundFormat *sourceformat = source->GetFormat();
+
+  outputformat.SetSampleRate(outputrate);
+  outputformat.SetChannels(source->GetChannels());
+  outputformat.SetSampleFormat(SampleFormatOf((const Sample_t *)NULL));
+  outputformat.SetSamplesBigEndian(MACHINE_IS_BIG_ENDIAN);
+
+  if (sourceformat)
+  {
+    resampler.Setup(sourceformat->GetSampleRate(), outputrate, source->GetChannels(), taps);
+  }
+  else BBCERROR("Source has no format, cannot resample");
+
+  SetFormat(&outputformat);
+}
+
+ResamplingSoundFileSamples::~ResamplingSoundFileSamples()
+{
+  delete source;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return a copy of this object (and of the source) that can be read independently
+ */
+/*--------------------------------------------------------------------------------*/
+SoundFileSamples *ResamplingSoundFileSamples::Duplicate() const
+{
+  SoundFileSamples *obj = source->Duplicate();
+
+  return obj ? new ResamplingSoundFileSamples(obj, outputformat.GetSampleRate(), taps) : NULL;
+}
+
+uint_t ResamplingSoundFileSamples::ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  uint_t nsrcchannels = source->GetChannels();
+  uint_t nout = 0;
+
+  while (nout < frames)
+  {
+    uint_t used, nres;
+
+    if (inputpos == inputframes)
+    {
+      inputpos = 0;
+
+      // source may have been moved to track output, continue from the end of the last input
+      if (source->GetSamplePosition() != readpos) source->SetSamplePosition(readpos);
+
+      inputframes = source->ReadSamples(&inputbuffer[0], 0, nsrcchannels, samplebufferframes);
+      readpos     = source->GetSamplePosition();
+
+      if (inputframes == 0)
+      {
+        if (source->InError())
+        {
+          BBCERROR("Failed to read source samples for conversion");
+          inerror = true;
+          break;
+        }
+
+        // beyond the end of the source, flush filter with silence
+        memset(&inputbuffer[0], 0, inputbuffer.size() * sizeof(inputbuffer[0]));
+        inputframes = samplebufferframes;
+      }
+    }
+
+    nres = resampler.Process(&inputbuffer[inputpos * nsrcchannels], inputframes - inputpos, used, &outputbuffer[nout * nsrcchannels], frames - nout);
+
+    // no progress means the resampler could not be set up
+    if (!nres && !used)
+    {
+      inerror = true;
+      break;
+    }
+
+    inputpos += used;
+    nout     += nres;
+  }
+
+  // extract requested channels
+  ConvertSamples(&outputbuffer[0], SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, firstchannel, nsrcchannels,
+                 dst, SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, ndstchannels,
+                 nchannels,
+                 nout);
+
+  convpos += nout;
+
+  return nout;
+}
+
+void ResamplingSoundFileSamples::UpdateData()
+{
+  if (format && source)
+  {
+    const Clip_t& sourceclip = source->GetClip();
+    uint_t channels = std::max(source->GetChannels(), (uint_t)1);
+
+    AllocateSampleBuffer();
+    inputbuffer.resize(samplebufferframes * channels);
+    outputbuffer.resize(samplebufferframes * channels);
+    inputpos = inputframes = 0;
+
+    // restart conversion when the clip is set below
+    convpos = ~(uint64_t)0;
+
+    // present source clip in output rate units
+    Clip_t newclip =
+    {
+      resampler.GetOutputFrames(sourceclip.start),
+      resampler.GetOutputFrames(sourceclip.nsamples),
+      0, source->GetChannels(),
+    };
+    totalsamples = newclip.start + newclip.nsamples;
+
+    timebase = format->GetTimeBase();
+
+    SetClip(newclip);
+  }
+}
+
+void ResamplingSoundFileSamples::UpdatePosition()
+{
+  SoundFileSamples::UpdatePosition();
+
+  if (source)
+  {
+    // position changed by caller rather than by reading, restart conversion from new position
+    if (GetAbsoluteSamplePosition() != convpos) Seek();
+    else
+    {
+      uint_t phase;
+
+      // move source (and its ADM cursors) to the input position of the new output position
+      source->SetAbsoluteSamplePosition(resampler.GetInputPosition(convpos, phase));
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Restart conversion from current position
+ */
+/*--------------------------------------------------------------------------------*/
+void ResamplingSoundFileSamples::Seek()
+{
+  // positions are mapped absolutely since this object may be clipped differently to the source (e.g. by an EDL)
+  uint_t   phase, history = resampler.GetHistoryFrames();
+  uint64_t sourcestart = source->GetClip().start;
+  uint64_t pos   = std::max(resampler.GetInputPosition(GetAbsoluteSamplePosition(), phase), sourcestart);
+  uint64_t start = std::max(limited::subz(pos, (uint64_t)history), sourcestart);
+
+  // prime filter history with silence before the start of the source
+  resampler.Reset(phase, history - (uint_t)(pos - start));
+  source->SetAbsoluteSamplePosition(start);
+
+  readpos  = source->GetSamplePosition();
+  inputpos = inputframes = 0;
+  convpos  = GetAbsoluteSamplePosition();
+  inerror  = false;
+}
+
+BBC_AUDIOTOOLBOX_END
@@ -0,0 +1,86 @@
+#ifndef __RESAMPLING_SOUND_FILE_SAMPLES__
+#define __RESAMPLING_SOUND_FILE_SAMPLES__
+
+#include <vector>
+
+#include "SoundFileAttributes.h"
+#include "PolyphaseResampler.h"
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Sound samples object that presents another at a different sample rate
+ *
+ * All positions, lengths and times of this object are in output rate units (so it can be
+ * used anywhere a SoundFileSamples can, e.g. in a Playlist) and are mapped exactly to the
+ * source object's positions (so that, for example, ADM cursors of the source track
+ * playback)
+ *
+ * @note input is read ahead for conversion but after every read the source is moved back
+ * @note to the input position of this object's position (moving its ADM cursors with it)
+ * @note and then returned to the read-ahead position before it is next read
+ * @note the source object is DELETED on destruction of this object
+ * @note this object is read-only
+ */
+/*--------------------------------------------------------------------------------*/
+class ResamplingSoundFileSamples : public SoundFileSamples
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param source object to read from (will be DELETED on destruction of this object)
+   * @param outputrate sample rate to present
+   * @param taps number of filter taps per phase (see PolyphaseResampler::Setup())
+   */
+  /*--------------------------------------------------------------------------------*/
+  ResamplingSoundFileSamples(SoundFileSamples *source, uint32_t outputrate, uint_t taps = 32);
+  virtual ~ResamplingSoundFileSamples();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return object being read from
+   */
+  /*--------------------------------------------------------------------------------*/
+  SoundFileSamples *GetSource() const {return source;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return a copy of this object (and of the source) that can be read independently
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual SoundFileSamples *Duplicate() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** File handle pooling applies to the source
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool UseFileHandlePool(FileHandlePool *pool) {return source->UseFileHandlePool(pool);}
+  virtual void PinFile(bool pin = true) {source->PinFile(pin);}
+
+protected:
+  virtual uint_t ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  virtual void UpdateData();
+  virtual void UpdatePosition();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Restart conversion from current position
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Seek();
+
+protected:
+  SoundFileSamples      *source;
+  SoundFormat           outputformat;
+  PolyphaseResampler    resampler;
+  std::vector<Sample_t> inputbuffer;
+  std::vector<Sample_t> outputbuffer;
+  uint_t                inputpos;
+  uint_t                inputframes;
+  uint64_t              readpos;     // source position that the next input should be read from
+  uint64_t              convpos;     // absolute output position that conversion has reached
+  uint_t                taps;
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
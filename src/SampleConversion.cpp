@@ -0,0 +1,1151 @@
+
+#include <string.h>
+#include <math.h>
+
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CONVERSION_SSE2
+#endif
+
+// AVX2 kernels are compiled for any x86 target and only used if the processor supports them
+#if defined(CONVERSION_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CONVERSION_AVX2
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERSION_NEON
+#endif
+
+#define BBCDEBUG_LEVEL 1
+#include "SampleConversion.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// full scale of each integer format
+static const float Scale16 = 32768.0f;
+static const float Scale24 = 8388608.0f;
+static const float Scale32 = 2147483648.0f;
+
+// largest float below 2^31 (2^31 itself would overflow on conversion)
+static const float Max32 = 2147483520.0f;
+
+typedef enum
+{
+  Kernel_Read16 = 0,
+  Kernel_Read24,
+  Kernel_Read32,
+  Kernel_Copy,
+  Kernel_Write16,
+  Kernel_Write24,
+  Kernel_Write32,
+
+  Kernel_Count,
+} Kernel_t;
+
+// convert frames of channels, strides in bytes per frame
+typedef void (*KERNEL)(const uint8_t *src, size_t srcstride, uint8_t *dst, size_t dststride, uint_t nchannels, uint_t nframes);
+
+// convert contiguous samples
+typedef void (*RUN)(const uint8_t *src, uint8_t *dst, uint_t n);
+
+/*--------------------------------------------------------------------------------*/
+/** Scalar conversion of single samples, which define the results of all kernels
+ */
+/*--------------------------------------------------------------------------------*/
+static inline sint32_t Load32(const uint8_t *p)
+{
+  sint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline float Read16(const uint8_t *p)
+{
+  return (float)(sint16_t)((uint_t)p[0] | ((uint_t)p[1] << 8)) * (1.0f / Scale16);
+}
+
+static inline float Read24(const uint8_t *p)
+{
+  return (float)((sint32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8) * (1.0f / Scale24);
+}
+
+static inline float Read32(const uint8_t *p)
+{
+  return (float)Load32(p) * (1.0f / Scale32);
+}
+
+static inline sint32_t Quantise(float x, float scale, float lo, float hi)
+{
+  float y = x * scale;
+
+  // same ordering (and NaN handling) as SIMD max then min
+  y = (y > lo) ? y : lo;
+  y = (y < hi) ? y : hi;
+
+  return (sint32_t)lrintf(y);
+}
+
+static inline void Write16(uint8_t *p, float x)
+{
+  sint32_t v = Quantise(x, Scale16, -Scale16, Scale16 - 1.0f);
+
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void Write24(uint8_t *p, sint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+}
+
+static inline void Write24(uint8_t *p, float x)
+{
+  Write24(p, Quantise(x, Scale24, -Scale24, Scale24 - 1.0f));
+}
+
+static inline void Write32(uint8_t *p, float x)
+{
+  sint32_t v = Quantise(x, Scale32, -Scale32, Max32);
+
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline float ReadFloat(const uint8_t *p)
+{
+  float v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void WriteFloat(uint8_t *p, float x)
+{
+  memcpy(p, &x, sizeof(x));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Apply a contiguous run conversion to frames of channels
+ */
+/*--------------------------------------------------------------------------------*/
+template<RUN run, uint_t srcbps, uint_t dstbps>
+static void Strided(const uint8_t *src, size_t srcstride, uint8_t *dst, size_t dststride, uint_t nchannels, uint_t nframes)
+{
+  uint_t i;
+
+  // when all channels are transferred the frames are contiguous and can be converted in one run
+  if ((srcstride == (nchannels * srcbps)) && (dststride == (nchannels * dstbps))) run(src, dst, nchannels * nframes);
+  else
+  {
+    for (i = 0; i < nframes; i++) run(src + i * srcstride, dst + i * dststride, nchannels);
+  }
+}
+
+static void CopyRun(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  memcpy(dst, src, n * sizeof(float));
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+static void ScalarRead16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i;
+
+  for (i = 0; i < n; i++) d[i] = Read16(src + i * 2);
+}
+
+static void ScalarRead24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i;
+
+  for (i = 0; i < n; i++) d[i] = Read24(src + i * 3);
+}
+
+static void ScalarRead32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i;
+
+  for (i = 0; i < n; i++) d[i] = Read32(src + i * 4);
+}
+
+static void ScalarWrite16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float *s = (const float *)src;
+  uint_t i;
+
+  for (i = 0; i < n; i++) Write16(dst + i * 2, s[i]);
+}
+
+static void ScalarWrite24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float *s = (const float *)src;
+  uint_t i;
+
+  for (i = 0; i < n; i++) Write24(dst + i * 3, s[i]);
+}
+
+static void ScalarWrite32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float *s = (const float *)src;
+  uint_t i;
+
+  for (i = 0; i < n; i++) Write32(dst + i * 4, s[i]);
+}
+
+static const KERNEL ScalarKernels[Kernel_Count] =
+{
+  &Strided<&ScalarRead16,  2, 4>,
+  &Strided<&ScalarRead24,  3, 4>,
+  &Strided<&ScalarRead32,  4, 4>,
+  &Strided<&CopyRun,       4, 4>,
+  &Strided<&ScalarWrite16, 4, 2>,
+  &Strided<&ScalarWrite24, 4, 3>,
+  &Strided<&ScalarWrite32, 4, 4>,
+};
+
+/*----------------------------------------------------------------------------------------------------*/
+
+#ifdef CONVERSION_SSE2
+static inline __m128i SSE2Quantise(__m128 x, __m128 scale, __m128 lo, __m128 hi)
+{
+  return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(x, scale), lo), hi));
+}
+
+static void SSE2Read16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / Scale16);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i *)(src + i * 2));
+
+    // duplicate each sample into both halves of 32 bits then shift down to sign extend
+    _mm_storeu_ps(d + i,     _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16)), scale));
+    _mm_storeu_ps(d + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16)), scale));
+  }
+
+  for (; i < n; i++) d[i] = Read16(src + i * 2);
+}
+
+static void SSE2Read24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / Scale24);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  // each 32-bit load includes a byte of the next sample so the last group must not be the end
+  for (; (i + 5) <= n; i += 4)
+  {
+    const uint8_t *p = src + i * 3;
+    __m128i x = _mm_set_epi32(Load32(p + 9), Load32(p + 6), Load32(p + 3), Load32(p));
+
+    _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(x, 8), 8)), scale));
+  }
+
+  for (; i < n; i++) d[i] = Read24(src + i * 3);
+}
+
+static void SSE2Read32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / Scale32);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 4) <= n; i += 4) _mm_storeu_ps(d + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(src + i * 4))), scale));
+
+  for (; i < n; i++) d[i] = Read32(src + i * 4);
+}
+
+static void SSE2Write16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(Scale16), lo = _mm_set1_ps(-Scale16), hi = _mm_set1_ps(Scale16 - 1.0f);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8)
+  {
+    __m128i a = SSE2Quantise(_mm_loadu_ps(s + i),     scale, lo, hi);
+    __m128i b = SSE2Quantise(_mm_loadu_ps(s + i + 4), scale, lo, hi);
+
+    _mm_storeu_si128((__m128i *)(dst + i * 2), _mm_packs_epi32(a, b));
+  }
+
+  for (; i < n; i++) Write16(dst + i * 2, s[i]);
+}
+
+static void SSE2Write24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(Scale24), lo = _mm_set1_ps(-Scale24), hi = _mm_set1_ps(Scale24 - 1.0f);
+  const float *s = (const float *)src;
+  sint32_t    v[4];
+  uint_t      i = 0, j;
+
+  for (; (i + 4) <= n; i += 4)
+  {
+    _mm_storeu_si128((__m128i *)v, SSE2Quantise(_mm_loadu_ps(s + i), scale, lo, hi));
+
+    for (j = 0; j < 4; j++) Write24(dst + (i + j) * 3, v[j]);
+  }
+
+  for (; i < n; i++) Write24(dst + i * 3, s[i]);
+}
+
+static void SSE2Write32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m128 scale = _mm_set1_ps(Scale32), lo = _mm_set1_ps(-Scale32), hi = _mm_set1_ps(Max32);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 4) <= n; i += 4) _mm_storeu_si128((__m128i *)(dst + i * 4), SSE2Quantise(_mm_loadu_ps(s + i), scale, lo, hi));
+
+  for (; i < n; i++) Write32(dst + i * 4, s[i]);
+}
+
+static const KERNEL SSE2Kernels[Kernel_Count] =
+{
+  &Strided<&SSE2Read16,  2, 4>,
+  &Strided<&SSE2Read24,  3, 4>,
+  &Strided<&SSE2Read32,  4, 4>,
+  &Strided<&CopyRun,     4, 4>,
+  &Strided<&SSE2Write16, 4, 2>,
+  &Strided<&SSE2Write24, 4, 3>,
+  &Strided<&SSE2Write32, 4, 4>,
+};
+#endif
+
+/*----------------------------------------------------------------------------------------------------*/
+
+#ifdef CONVERSION_AVX2
+AVX2_TARGET static inline __m256i AVX2Quantise(__m256 x, __m256 scale, __m256 lo, __m256 hi)
+{
+  return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x, scale), lo), hi));
+}
+
+AVX2_TARGET static void AVX2Read16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / Scale16);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + i * 2)))), scale));
+
+  for (; i < n; i++) d[i] = Read16(src + i * 2);
+}
+
+AVX2_TARGET static void AVX2Read24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256  scale = _mm256_set1_ps(1.0f / Scale24);
+  const __m256i index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  // each 32-bit gather includes a byte of the next sample so the last group must not be the end
+  for (; (i + 9) <= n; i += 8)
+  {
+    __m256i x = _mm256_i32gather_epi32((const int *)(src + i * 3), index, 1);
+
+    _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(x, 8), 8)), scale));
+  }
+
+  for (; i < n; i++) d[i] = Read24(src + i * 3);
+}
+
+AVX2_TARGET static void AVX2Read32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / Scale32);
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8) _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)(src + i * 4))), scale));
+
+  for (; i < n; i++) d[i] = Read32(src + i * 4);
+}
+
+AVX2_TARGET static void AVX2Write16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256 scale = _mm256_set1_ps(Scale16), lo = _mm256_set1_ps(-Scale16), hi = _mm256_set1_ps(Scale16 - 1.0f);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 16) <= n; i += 16)
+  {
+    __m256i a = AVX2Quantise(_mm256_loadu_ps(s + i),     scale, lo, hi);
+    __m256i b = AVX2Quantise(_mm256_loadu_ps(s + i + 8), scale, lo, hi);
+
+    // packing works within 128-bit lanes, put the 64-bit quarters back in order
+    _mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+  }
+
+  for (; i < n; i++) Write16(dst + i * 2, s[i]);
+}
+
+AVX2_TARGET static void AVX2Write24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256 scale = _mm256_set1_ps(Scale24), lo = _mm256_set1_ps(-Scale24), hi = _mm256_set1_ps(Scale24 - 1.0f);
+  const float *s = (const float *)src;
+  sint32_t    v[8];
+  uint_t      i = 0, j;
+
+  for (; (i + 8) <= n; i += 8)
+  {
+    _mm256_storeu_si256((__m256i *)v, AVX2Quantise(_mm256_loadu_ps(s + i), scale, lo, hi));
+
+    for (j = 0; j < 8; j++) Write24(dst + (i + j) * 3, v[j]);
+  }
+
+  for (; i < n; i++) Write24(dst + i * 3, s[i]);
+}
+
+AVX2_TARGET static void AVX2Write32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const __m256 scale = _mm256_set1_ps(Scale32), lo = _mm256_set1_ps(-Scale32), hi = _mm256_set1_ps(Max32);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8) _mm256_storeu_si256((__m256i *)(dst + i * 4), AVX2Quantise(_mm256_loadu_ps(s + i), scale, lo, hi));
+
+  for (; i < n; i++) Write32(dst + i * 4, s[i]);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Convert a few channels of many frames by gathering each channel across 8 frames
+ *
+ * Each gather loads the 32 bits ending with the sample (so frame 0 is converted separately)
+ * and shifts the sample down to sign extend it
+ */
+/*--------------------------------------------------------------------------------*/
+template<RUN run, uint_t srcbps>
+AVX2_TARGET static void AVX2GatherRead(const uint8_t *src, size_t srcstride, uint8_t *dst, size_t dststride, uint_t nchannels, uint_t nframes)
+{
+  // contiguous or wide frames are better handled by runs
+  if ((nchannels >= 8) || (srcstride == (nchannels * srcbps)) || (srcstride > 0x0fffffff))
+  {
+    Strided<run, srcbps, 4>(src, srcstride, dst, dststride, nchannels, nframes);
+    return;
+  }
+
+  const __m256  scale = _mm256_set1_ps(1.0f / (float)(1U << (srcbps * 8 - 1)));
+  const __m128i shift = _mm_cvtsi32_si128(32 - srcbps * 8);
+  const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)srcstride));
+  float  v[8];
+  uint_t c, i, j;
+
+  run(src, dst, nchannels);
+
+  for (c = 0; c < nchannels; c++)
+  {
+    const uint8_t *s = src + c * srcbps - (4 - srcbps);
+    uint8_t       *d = dst + c * sizeof(float);
+
+    for (i = 1; (i + 8) <= nframes; i += 8)
+    {
+      __m256i x = _mm256_sra_epi32(_mm256_i32gather_epi32((const int *)(s + i * srcstride), index, 1), shift);
+
+      _mm256_storeu_ps(v, _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+
+      for (j = 0; j < 8; j++) memcpy(d + (i + j) * dststride, &v[j], sizeof(v[j]));
+    }
+
+    for (; i < nframes; i++) run(src + i * srcstride + c * srcbps, d + i * dststride, 1);
+  }
+}
+
+static const KERNEL AVX2Kernels[Kernel_Count] =
+{
+  &AVX2GatherRead<&AVX2Read16, 2>,
+  &AVX2GatherRead<&AVX2Read24, 3>,
+  &AVX2GatherRead<&AVX2Read32, 4>,
+  &Strided<&CopyRun,     4, 4>,
+  &Strided<&AVX2Write16, 4, 2>,
+  &Strided<&AVX2Write24, 4, 3>,
+  &Strided<&AVX2Write32, 4, 4>,
+};
+#endif
+
+/*----------------------------------------------------------------------------------------------------*/
+
+#ifdef CONVERSION_NEON
+static inline int32x4_t NEONQuantise(float32x4_t x, float scale, float32x4_t lo, float32x4_t hi)
+{
+  float32x4_t y = vmulq_n_f32(x, scale);
+
+  // selects rather than vmaxq/vminq to match the scalar handling of NaN
+  y = vbslq_f32(vcgtq_f32(y, lo), y, lo);
+  y = vbslq_f32(vcltq_f32(y, hi), y, hi);
+
+  return vcvtnq_s32_f32(y);
+}
+
+static void NEONRead16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8)
+  {
+    int16x8_t x = vld1q_s16((const int16_t *)(src + i * 2));
+
+    vst1q_f32(d + i,     vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))),  1.0f / Scale16));
+    vst1q_f32(d + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), 1.0f / Scale16));
+  }
+
+  for (; i < n; i++) d[i] = Read16(src + i * 2);
+}
+
+static void NEONRead24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i = 0, h, q;
+
+  for (; (i + 16) <= n; i += 16)
+  {
+    // de-interleave bytes of 16 samples and reassemble as (sample << 8) in 32 bits
+    uint8x16x3_t b  = vld3q_u8(src + i * 3);
+    uint8x16x2_t z0 = vzipq_u8(vdupq_n_u8(0), b.val[0]);
+    uint8x16x2_t z1 = vzipq_u8(b.val[1], b.val[2]);
+
+    for (h = 0; h < 2; h++)
+    {
+      uint16x8x2_t w = vzipq_u16(vreinterpretq_u16_u8(z0.val[h]), vreinterpretq_u16_u8(z1.val[h]));
+
+      for (q = 0; q < 2; q++)
+      {
+        vst1q_f32(d + i + h * 8 + q * 4, vmulq_n_f32(vcvtq_f32_s32(vshrq_n_s32(vreinterpretq_s32_u16(w.val[q]), 8)), 1.0f / Scale24));
+      }
+    }
+  }
+
+  for (; i < n; i++) d[i] = Read24(src + i * 3);
+}
+
+static void NEONRead32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  float  *d = (float *)dst;
+  uint_t i = 0;
+
+  for (; (i + 4) <= n; i += 4) vst1q_f32(d + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32((const int32_t *)(src + i * 4))), 1.0f / Scale32));
+
+  for (; i < n; i++) d[i] = Read32(src + i * 4);
+}
+
+static void NEONWrite16(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float32x4_t lo = vdupq_n_f32(-Scale16), hi = vdupq_n_f32(Scale16 - 1.0f);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 8) <= n; i += 8)
+  {
+    int32x4_t a = NEONQuantise(vld1q_f32(s + i),     Scale16, lo, hi);
+    int32x4_t b = NEONQuantise(vld1q_f32(s + i + 4), Scale16, lo, hi);
+
+    vst1q_s16((int16_t *)(dst + i * 2), vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+  }
+
+  for (; i < n; i++) Write16(dst + i * 2, s[i]);
+}
+
+static void NEONWrite24(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float32x4_t lo = vdupq_n_f32(-Scale24), hi = vdupq_n_f32(Scale24 - 1.0f);
+  const float *s = (const float *)src;
+  sint32_t    v[4];
+  uint_t      i = 0, j;
+
+  for (; (i + 4) <= n; i += 4)
+  {
+    vst1q_s32((int32_t *)v, NEONQuantise(vld1q_f32(s + i), Scale24, lo, hi));
+
+    for (j = 0; j < 4; j++) Write24(dst + (i + j) * 3, v[j]);
+  }
+
+  for (; i < n; i++) Write24(dst + i * 3, s[i]);
+}
+
+static void NEONWrite32(const uint8_t *src, uint8_t *dst, uint_t n)
+{
+  const float32x4_t lo = vdupq_n_f32(-Scale32), hi = vdupq_n_f32(Max32);
+  const float *s = (const float *)src;
+  uint_t i = 0;
+
+  for (; (i + 4) <= n; i += 4) vst1q_s32((int32_t *)(dst + i * 4), NEONQuantise(vld1q_f32(s + i), Scale32, lo, hi));
+
+  for (; i < n; i++) Write32(dst + i * 4, s[i]);
+}
+
+static const KERNEL NEONKernels[Kernel_Count] =
+{
+  &Strided<&NEONRead16,  2, 4>,
+  &Strided<&NEONRead24,  3, 4>,
+  &Strided<&NEONRead32,  4, 4>,
+  &Strided<&CopyRun,     4, 4>,
+  &Strided<&NEONWrite16, 4, 2>,
+  &Strided<&NEONWrite24, 4, 3>,
+  &Strided<&NEONWrite32, 4, 4>,
+};
+#endif
+
+/*----------------------------------------------------------------------------------------------------*/
+
+// frames converted per channel before moving to the next so that the source stays in cache
+static const uint_t PlanarBlockFrames = 64;
+
+// convert frames of channels to/from planar buffers, source/destination strides in bytes per frame
+typedef void (*PLANARREAD)(const uint8_t *src, size_t srcstride, Sample_t *const *dst, uint_t dstoffset, uint_t nchannels, uint_t nframes);
+typedef void (*PLANARWRITE)(const Sample_t *const *src, uint_t srcoffset, uint8_t *dst, size_t dststride, uint_t nchannels, uint_t nframes);
+
+template<float (*read)(const uint8_t *), uint_t srcbps>
+static void PlanarRead(const uint8_t *src, size_t srcstride, Sample_t *const *dst, uint_t dstoffset, uint_t nchannels, uint_t nframes)
+{
+  uint_t f, c, i, n;
+
+  for (f = 0; f < nframes; f += n)
+  {
+    n = std::min(nframes - f, PlanarBlockFrames);
+
+    for (c = 0; c < nchannels; c++)
+    {
+      if (dst[c])
+      {
+        const uint8_t *s = src + f * srcstride + c * srcbps;
+        Sample_t      *d = dst[c] + dstoffset + f;
+
+        for (i = 0; i < n; i++) d[i] = read(s + i * srcstride);
+      }
+    }
+  }
+}
+
+template<void (*write)(uint8_t *, float), uint_t dstbps>
+static void PlanarWrite(const Sample_t *const *src, uint_t srcoffset, uint8_t *dst, size_t dststride, uint_t nchannels, uint_t nframes)
+{
+  uint_t f, c, i, n;
+
+  for (f = 0; f < nframes; f += n)
+  {
+    n = std::min(nframes - f, PlanarBlockFrames);
+
+    for (c = 0; c < nchannels; c++)
+    {
+      uint8_t *d = dst + f * dststride + c * dstbps;
+
+      if (src[c])
+      {
+        const Sample_t *s = src[c] + srcoffset + f;
+
+        for (i = 0; i < n; i++) write(d + i * dststride, s[i]);
+      }
+      else
+      {
+        for (i = 0; i < n; i++) write(d + i * dststride, 0.0f);
+      }
+    }
+  }
+}
+
+static const PLANARREAD ScalarPlanarReads[] =
+{
+  &PlanarRead<&Read16,    2>,
+  &PlanarRead<&Read24,    3>,
+  &PlanarRead<&Read32,    4>,
+  &PlanarRead<&ReadFloat, 4>,
+};
+
+static const PLANARWRITE PlanarWrites[] =
+{
+  &PlanarWrite<&Write16,    2>,
+  &PlanarWrite<&Write24,    3>,
+  &PlanarWrite<&Write32,    4>,
+  &PlanarWrite<&WriteFloat, 4>,
+};
+
+#ifdef CONVERSION_AVX2
+/*--------------------------------------------------------------------------------*/
+/** Convert each channel by gathering 8 frames at a time straight into its planar buffer
+ *
+ * Each gather loads the 32 bits ending with the sample and shifts the sample down to sign
+ * extend it (floats are gathered as they are)
+ */
+/*--------------------------------------------------------------------------------*/
+template<float (*read)(const uint8_t *), uint_t srcbps, bool isfloat>
+AVX2_TARGET static void AVX2PlanarRead(const uint8_t *src, size_t srcstride, Sample_t *const *dst, uint_t dstoffset, uint_t nchannels, uint_t nframes)
+{
+  if (srcstride > 0x0fffffff)
+  {
+    PlanarRead<read, srcbps>(src, srcstride, dst, dstoffset, nchannels, nframes);
+    return;
+  }
+
+  const __m256  scale = _mm256_set1_ps(1.0f / (float)(1U << (srcbps * 8 - 1)));
+  const __m128i shift = _mm_cvtsi32_si128(32 - srcbps * 8);
+  const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)srcstride));
+  uint_t f, c, i, n;
+
+  for (f = 0; f < nframes; f += n)
+  {
+    n = std::min(nframes - f, PlanarBlockFrames);
+
+    for (c = 0; c < nchannels; c++)
+    {
+      if (dst[c])
+      {
+        const uint8_t *s = src + f * srcstride + c * srcbps;
+        Sample_t      *d = dst[c] + dstoffset + f;
+
+        i = 0;
+
+        // the bytes before the very first sample may not be part of the buffer
+        if (!f && ((c * srcbps) < (4 - srcbps)))
+        {
+          d[0] = read(s);
+          i    = 1;
+        }
+
+        for (; (i + 8) <= n; i += 8)
+        {
+          __m256i x = _mm256_i32gather_epi32((const int *)(s + i * srcstride - (4 - srcbps)), index, 1);
+
+          if (isfloat) _mm256_storeu_ps(d + i, _mm256_castsi256_ps(x));
+          else         _mm256_storeu_ps(d + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sra_epi32(x, shift)), scale));
+        }
+
+        for (; i < n; i++) d[i] = read(s + i * srcstride);
+      }
+    }
+  }
+}
+
+static const PLANARREAD AVX2PlanarReads[] =
+{
+  &AVX2PlanarRead<&Read16,    2, false>,
+  &AVX2PlanarRead<&Read24,    3, false>,
+  &AVX2PlanarRead<&Read32,    4, false>,
+  &AVX2PlanarRead<&ReadFloat, 4, true>,
+};
+#endif
+
+// gather channels of frames through a channel map, source stride in bytes per frame
+typedef void (*MAPPEDREAD)(const uint8_t *src, size_t srcstride, Sample_t *dst, uint_t ndstchannels, const CHANNELROUTE *map, uint_t nmap, uint_t nframes);
+
+template<float (*read)(const uint8_t *), uint_t srcbps>
+static void MappedRead(const uint8_t *src, size_t srcstride, Sample_t *dst, uint_t ndstchannels, const CHANNELROUTE *map, uint_t nmap, uint_t nframes)
+{
+  uint_t i, j;
+
+  for (i = 0; i < nframes; i++, src += srcstride, dst += ndstchannels)
+  {
+    for (j = 0; j < nmap; j++) dst[map[j].slot] = read(src + map[j].channel * srcbps) * map[j].gain;
+  }
+}
+
+static const MAPPEDREAD ScalarMappedReads[] =
+{
+  &MappedRead<&Read16,    2>,
+  &MappedRead<&Read24,    3>,
+  &MappedRead<&Read32,    4>,
+  &MappedRead<&ReadFloat, 4>,
+};
+
+#ifdef CONVERSION_AVX2
+/*--------------------------------------------------------------------------------*/
+/** Gather 8 map entries of each frame at a time, writing them directly if their destination
+ * channels are consecutive
+ */
+/*--------------------------------------------------------------------------------*/
+template<float (*read)(const uint8_t *), uint_t srcbps, bool isfloat>
+AVX2_TARGET static void AVX2MappedRead(const uint8_t *src, size_t srcstride, Sample_t *dst, uint_t ndstchannels, const CHANNELROUTE *map, uint_t nmap, uint_t nframes)
+{
+  const __m256  scale = _mm256_set1_ps(1.0f / (float)(1U << (srcbps * 8 - 1)));
+  const __m128i shift = _mm_cvtsi32_si128(32 - srcbps * 8);
+  uint_t j = 0;
+
+  for (; (j + 8) <= nmap; j += 8)
+  {
+    const CHANNELROUTE *group = map + j;
+    int    offsets[8];
+    float  gains[8], v[8];
+    bool   consecutive = true, early = false;
+    uint_t i = 0, k;
+
+    for (k = 0; k < 8; k++)
+    {
+      // each gather loads the 32 bits ending with the sample
+      offsets[k]   = (int)(group[k].channel * srcbps) - (int)(4 - srcbps);
+      gains[k]     = group[k].gain;
+      consecutive &= (group[k].slot == (group[0].slot + k));
+      early       |= (offsets[k] < 0);
+    }
+
+    const __m256i index = _mm256_loadu_si256((const __m256i *)offsets);
+    const __m256  gain  = _mm256_loadu_ps(gains);
+
+    // the bytes before the very first sample may not be part of the buffer
+    if (early && nframes)
+    {
+      MappedRead<read, srcbps>(src, srcstride, dst, ndstchannels, group, 8, 1);
+      i = 1;
+    }
+
+    for (; i < nframes; i++)
+    {
+      __m256i x = _mm256_i32gather_epi32((const int *)(src + i * srcstride), index, 1);
+      __m256  y;
+
+      if (isfloat) y = _mm256_mul_ps(_mm256_castsi256_ps(x), gain);
+      else         y = _mm256_mul_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sra_epi32(x, shift)), scale), gain);
+
+      Sample_t *d = dst + i * ndstchannels;
+
+      if (consecutive) _mm256_storeu_ps(d + group[0].slot, y);
+      else
+      {
+        _mm256_storeu_ps(v, y);
+        for (k = 0; k < 8; k++) d[group[k].slot] = v[k];
+      }
+    }
+  }
+
+  if (j < nmap) MappedRead<read, srcbps>(src, srcstride, dst, ndstchannels, map + j, nmap - j, nframes);
+}
+
+static const MAPPEDREAD AVX2MappedReads[] =
+{
+  &AVX2MappedRead<&Read16,    2, false>,
+  &AVX2MappedRead<&Read24,    3, false>,
+  &AVX2MappedRead<&Read32,    4, false>,
+  &AVX2MappedRead<&ReadFloat, 4, true>,
+};
+#endif
+
+/*--------------------------------------------------------------------------------*/
+/** Return index of planar kernel for sample format or -1 if kernels cannot be used
+ */
+/*--------------------------------------------------------------------------------*/
+static sint_t GetPlanarKernel(SampleFormat_t format, bool be)
+{
+  // kernels handle little-endian data and float planar buffers only
+  if (!be && !MACHINE_IS_BIG_ENDIAN && (SampleFormatOf((const Sample_t *)NULL) == SampleFormat_Float))
+  {
+    switch (format)
+    {
+      case SampleFormat_16bit: return 0;
+      case SampleFormat_24bit: return 1;
+      case SampleFormat_32bit: return 2;
+      case SampleFormat_Float: return 3;
+      default: break;
+    }
+  }
+
+  return -1;
+}
+
+/*----------------------------------------------------------------------------------------------------*/
+
+// selected kernels (-1 until first used)
+static std::atomic<int> selectedkernels(-1);
+
+/*--------------------------------------------------------------------------------*/
+/** Return table of kernels (NULL if not compiled)
+ */
+/*--------------------------------------------------------------------------------*/
+static const KERNEL *GetKernelTable(ConversionKernels_t kernels)
+{
+  switch (kernels)
+  {
+    case ConversionKernels_Scalar: return ScalarKernels;
+#ifdef CONVERSION_SSE2
+    case ConversionKernels_SSE2:   return SSE2Kernels;
+#endif
+#ifdef CONVERSION_AVX2
+    case ConversionKernels_AVX2:   return AVX2Kernels;
+#endif
+#ifdef CONVERSION_NEON
+    case ConversionKernels_NEON:   return NEONKernels;
+#endif
+    default: break;
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether a set of kernels can be used on this machine
+ */
+/*--------------------------------------------------------------------------------*/
+bool ConversionKernelsAvailable(ConversionKernels_t kernels)
+{
+  bool available = (GetKernelTable(kernels) != NULL);
+
+#ifdef CONVERSION_AVX2
+  if (kernels == ConversionKernels_AVX2) available = (__builtin_cpu_supports("avx2") != 0);
+#endif
+
+  return available;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return set of kernels in use (by default the fastest available)
+ */
+/*--------------------------------------------------------------------------------*/
+ConversionKernels_t GetConversionKernels()
+{
+  int kernels;
+
+  if ((kernels = selectedkernels.load(std::memory_order_relaxed)) < 0)
+  {
+    static const ConversionKernels_t preference[] = {ConversionKernels_AVX2, ConversionKernels_SSE2, ConversionKernels_NEON};
+    uint_t i;
+
+    kernels = ConversionKernels_Scalar;
+    for (i = 0; i < NUMBEROF(preference); i++)
+    {
+      if (ConversionKernelsAvailable(preference[i]))
+      {
+        kernels = preference[i];
+        break;
+      }
+    }
+
+    BBCDEBUG2(("Using %s sample conversion kernels", GetConversionKernelsName((ConversionKernels_t)kernels)));
+
+    selectedkernels.store(kernels, std::memory_order_relaxed);
+  }
+
+  return (ConversionKernels_t)kernels;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Select set of kernels (e.g. for testing)
+ *
+ * @return false if kernels are not available on this machine
+ */
+/*--------------------------------------------------------------------------------*/
+bool SetConversionKernels(ConversionKernels_t kernels)
+{
+  bool success = false;
+
+  if (ConversionKernelsAvailable(kernels))
+  {
+    selectedkernels.store(kernels, std::memory_order_relaxed);
+    success = true;
+  }
+  else BBCERROR("%s sample conversion kernels are not available", GetConversionKernelsName(kernels));
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return name of a set of kernels
+ */
+/*--------------------------------------------------------------------------------*/
+const char *GetConversionKernelsName(ConversionKernels_t kernels)
+{
+  static const char *names[ConversionKernels_Count] = {"scalar", "SSE2", "AVX2", "NEON"};
+
+  return ((uint_t)kernels < NUMBEROF(names)) ? names[kernels] : "unknown";
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Copy/interleave/de-interleave/convert samples, with the same arguments and result as
+ * TransferSamples()
+ */
+/*--------------------------------------------------------------------------------*/
+void ConvertSamples(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                    void *dst, SampleFormat_t dstformat, bool dstbe, uint_t dstchannel, uint_t ndstchannels,
+                    uint_t nchannels, uint_t nframes)
+{
+  sint_t kernel = -1;
+
+  // kernels handle little-endian data only
+  if (!srcbe && !dstbe && !MACHINE_IS_BIG_ENDIAN)
+  {
+    if (dstformat == SampleFormat_Float)
+    {
+      switch (srcformat)
+      {
+        case SampleFormat_16bit: kernel = Kernel_Read16; break;
+        case SampleFormat_24bit: kernel = Kernel_Read24; break;
+        case SampleFormat_32bit: kernel = Kernel_Read32; break;
+        case SampleFormat_Float: kernel = Kernel_Copy;   break;
+        default: break;
+      }
+    }
+    else if (srcformat == SampleFormat_Float)
+    {
+      switch (dstformat)
+      {
+        case SampleFormat_16bit: kernel = Kernel_Write16; break;
+        case SampleFormat_24bit: kernel = Kernel_Write24; break;
+        case SampleFormat_32bit: kernel = Kernel_Write32; break;
+        default: break;
+      }
+    }
+  }
+
+  if (kernel >= 0)
+  {
+    uint_t srcbps = GetBytesPerSample(srcformat);
+    uint_t dstbps = GetBytesPerSample(dstformat);
+
+    nchannels = std::min(nchannels, std::min(limited::subz(nsrcchannels, srcchannel), limited::subz(ndstchannels, dstchannel)));
+
+    if (nchannels && nframes)
+    {
+      (*GetKernelTable(GetConversionKernels())[kernel])((const uint8_t *)src + srcchannel * srcbps, nsrcchannels * srcbps,
+                                                        (uint8_t *)dst + dstchannel * dstbps, ndstchannels * dstbps,
+                                                        nchannels, nframes);
+    }
+  }
+  else TransferSamples(src, srcformat, srcbe, srcchannel, nsrcchannels,
+                       dst, dstformat, dstbe, dstchannel, ndstchannels,
+                       nchannels, nframes);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** De-interleave/convert samples into separate (planar) buffers, one per channel
+ */
+/*--------------------------------------------------------------------------------*/
+void ConvertSamplesToPlanar(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                            Sample_t *const *dst, uint_t dstoffset,
+                            uint_t nchannels, uint_t nframes)
+{
+  uint_t srcbps = GetBytesPerSample(srcformat);
+  sint_t kernel;
+
+  nchannels = std::min(nchannels, limited::subz(nsrcchannels, srcchannel));
+  if (!nchannels || !nframes) return;
+
+  if ((kernel = GetPlanarKernel(srcformat, srcbe)) >= 0)
+  {
+    const PLANARREAD *reads = ScalarPlanarReads;
+
+#ifdef CONVERSION_AVX2
+    if (GetConversionKernels() == ConversionKernels_AVX2) reads = AVX2PlanarReads;
+#endif
+
+    (*reads[kernel])((const uint8_t *)src + srcchannel * srcbps, nsrcchannels * srcbps, dst, dstoffset, nchannels, nframes);
+  }
+  else
+  {
+    uint_t c;
+
+    for (c = 0; c < nchannels; c++)
+    {
+      if (dst[c]) TransferSamples(src, srcformat, srcbe, srcchannel + c, nsrcchannels,
+                                  dst[c] + dstoffset, SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, 1,
+                                  1, nframes);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Interleave/convert samples from separate (planar) buffers, one per channel
+ */
+/*--------------------------------------------------------------------------------*/
+void ConvertSamplesFromPlanar(const Sample_t *const *src, uint_t srcoffset,
+                              void *dst, SampleFormat_t dstformat, bool dstbe, uint_t dstchannel, uint_t ndstchannels,
+                              uint_t nchannels, uint_t nframes)
+{
+  uint_t dstbps = GetBytesPerSample(dstformat);
+  sint_t kernel;
+
+  nchannels = std::min(nchannels, limited::subz(ndstchannels, dstchannel));
+  if (!nchannels || !nframes) return;
+
+  if ((kernel = GetPlanarKernel(dstformat, dstbe)) >= 0)
+  {
+    (*PlanarWrites[kernel])(src, srcoffset, (uint8_t *)dst + dstchannel * dstbps, ndstchannels * dstbps, nchannels, nframes);
+  }
+  else
+  {
+    static const Sample_t silence[PlanarBlockFrames] = {0};
+    uint_t c, f, n;
+
+    for (c = 0; c < nchannels; c++)
+    {
+      if (src[c]) TransferSamples(src[c] + srcoffset, SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, 1,
+                                  dst, dstformat, dstbe, dstchannel + c, ndstchannels,
+                                  1, nframes);
+      else
+      {
+        for (f = 0; f < nframes; f += n)
+        {
+          n = std::min(nframes - f, PlanarBlockFrames);
+          TransferSamples(silence, SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, 1,
+                          (uint8_t *)dst + f * ndstchannels * dstbps, dstformat, dstbe, dstchannel + c, ndstchannels,
+                          1, n);
+        }
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Gather/convert channels through a channel map with gain applied in the same pass
+ */
+/*--------------------------------------------------------------------------------*/
+void ConvertSamplesMapped(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                          Sample_t *dst, uint_t ndstchannels,
+                          const CHANNELROUTE *map, uint_t nmap,
+                          uint_t nchannels, uint_t nframes)
+{
+  uint_t srcbps = GetBytesPerSample(srcformat);
+  uint_t i, j;
+  sint_t kernel;
+  bool   valid = true;
+
+  nchannels = std::min(nchannels, limited::subz(nsrcchannels, srcchannel));
+  if (!nmap || !nframes) return;
+
+  for (j = 0; j < nmap; j++) valid &= ((map[j].channel < nchannels) && (map[j].slot < ndstchannels));
+
+  if ((kernel = GetPlanarKernel(srcformat, srcbe)) >= 0)
+  {
+    const MAPPEDREAD *reads = ScalarMappedReads;
+    const uint8_t    *src8  = (const uint8_t *)src + srcchannel * srcbps;
+
+#ifdef CONVERSION_AVX2
+    if (GetConversionKernels() == ConversionKernels_AVX2) reads = AVX2MappedReads;
+#endif
+
+    if (valid) (*reads[kernel])(src8, nsrcchannels * srcbps, dst, ndstchannels, map, nmap, nframes);
+    else
+    {
+      // skip invalid entries, keeping the order of the rest
+      for (j = 0; j < nmap; j++)
+      {
+        if ((map[j].channel < nchannels) && (map[j].slot < ndstchannels)) (*reads[kernel])(src8, nsrcchannels * srcbps, dst, ndstchannels, map + j, 1, nframes);
+      }
+    }
+  }
+  else
+  {
+    for (j = 0; j < nmap; j++)
+    {
+      if ((map[j].channel < nchannels) && (map[j].slot < ndstchannels))
+      {
+        TransferSamples(src, srcformat, srcbe, srcchannel + map[j].channel, nsrcchannels,
+                        dst, SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, map[j].slot, ndstchannels,
+                        1, nframes);
+
+        if (map[j].gain != 1.0)
+        {
+          for (i = 0; i < nframes; i++) dst[i * ndstchannels + map[j].slot] *= map[j].gain;
+        }
+      }
+    }
+  }
+}
+
+BBC_AUDIOTOOLBOX_END
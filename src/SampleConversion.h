@@ -0,0 +1,149 @@
+#ifndef __SAMPLE_CONVERSION__
+#define __SAMPLE_CONVERSION__
+
+#include <bbcat-base/misc.h>
+#include <bbcat-dsp/SoundFormatConversions.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Entry of a channel map, taking one source channel into one destination channel with gain
+ */
+/*--------------------------------------------------------------------------------*/
+typedef struct
+{
+  uint_t   channel;         // source channel
+  uint_t   slot;            // destination channel
+  Sample_t gain;            // linear gain
+} CHANNELROUTE;
+
+/*--------------------------------------------------------------------------------*/
+/** Sets of conversion kernels used by ConvertSamples()
+ */
+/*--------------------------------------------------------------------------------*/
+typedef enum
+{
+  ConversionKernels_Scalar = 0,
+  ConversionKernels_SSE2,
+  ConversionKernels_AVX2,
+  ConversionKernels_NEON,
+
+  ConversionKernels_Count,
+} ConversionKernels_t;
+
+/*--------------------------------------------------------------------------------*/
+/** Copy/interleave/de-interleave/convert samples, with the same arguments and result as
+ * TransferSamples()
+ *
+ * Little-endian 16-bit, 24-bit, 32-bit and float samples to and from float samples are
+ * converted by dedicated kernels (SIMD where available, selected at runtime), everything
+ * else is passed on to TransferSamples()
+ *
+ * Integers are scaled by 2^-(bits-1) to floats.  Floats are scaled by 2^(bits-1), clipped
+ * to the integer range (NaNs to its most negative value, 32-bit samples to the largest
+ * float below 2^31) and rounded to the nearest integer, ties to even - exactly as
+ * TransferSamples() does.  Every set of kernels gives bit-identical results, which the
+ * sampleconversion_transfersamples test checks against TransferSamples() for every 16-bit
+ * value, 24/32-bit extremes and floats including rounding ties, out of range values,
+ * infinities, NaNs and denormals.  The same applies to ConvertSamplesToPlanar(),
+ * ConvertSamplesFromPlanar() and ConvertSamplesMapped()
+ */
+/*--------------------------------------------------------------------------------*/
+extern void ConvertSamples(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                           void *dst, SampleFormat_t dstformat, bool dstbe, uint_t dstchannel, uint_t ndstchannels,
+                           uint_t nchannels = ~0, uint_t nframes = 1);
+
+/*--------------------------------------------------------------------------------*/
+/** De-interleave/convert samples into separate (planar) buffers, one per channel
+ *
+ * @param src source buffer
+ * @param srcformat source sample format
+ * @param srcbe true if source samples are big-endian
+ * @param srcchannel first channel to transfer within source
+ * @param nsrcchannels number of channels in each source frame
+ * @param dst array of nchannels destination buffers (NULL entries are skipped)
+ * @param dstoffset offset in frames into each destination buffer
+ * @param nchannels number of channels to transfer
+ * @param nframes number of frames to transfer
+ *
+ * @note gives the same results as ConvertSamples() to Sample_t samples
+ */
+/*--------------------------------------------------------------------------------*/
+extern void ConvertSamplesToPlanar(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                                   Sample_t *const *dst, uint_t dstoffset,
+                                   uint_t nchannels, uint_t nframes);
+
+/*--------------------------------------------------------------------------------*/
+/** Interleave/convert samples from separate (planar) buffers, one per channel
+ *
+ * @param src array of nchannels source buffers (NULL entries give silence)
+ * @param srcoffset offset in frames into each source buffer
+ * @param dst destination buffer
+ * @param dstformat destination sample format
+ * @param dstbe true if destination samples are big-endian
+ * @param dstchannel first channel to transfer within destination
+ * @param ndstchannels number of channels in each destination frame
+ * @param nchannels number of channels to transfer
+ * @param nframes number of frames to transfer
+ *
+ * @note gives the same results as ConvertSamples() from Sample_t samples
+ */
+/*--------------------------------------------------------------------------------*/
+extern void ConvertSamplesFromPlanar(const Sample_t *const *src, uint_t srcoffset,
+                                     void *dst, SampleFormat_t dstformat, bool dstbe, uint_t dstchannel, uint_t ndstchannels,
+                                     uint_t nchannels, uint_t nframes);
+
+/*--------------------------------------------------------------------------------*/
+/** Gather/convert channels through a channel map with gain applied in the same pass
+ *
+ * @param src source buffer
+ * @param srcformat source sample format
+ * @param srcbe true if source samples are big-endian
+ * @param srcchannel channel within source that map channels are relative to
+ * @param nsrcchannels number of channels in each source frame
+ * @param dst interleaved destination buffer
+ * @param ndstchannels number of channels in each destination frame
+ * @param map array of channel map entries (entries outside source or destination are ignored)
+ * @param nmap number of entries in map
+ * @param nchannels number of source channels available from srcchannel
+ * @param nframes number of frames to transfer
+ *
+ * @note destination channels not in the map are left untouched and where a destination
+ * @note channel appears more than once the last entry wins
+ * @note with unity gain gives the same results as ConvertSamples() to Sample_t samples
+ */
+/*--------------------------------------------------------------------------------*/
+extern void ConvertSamplesMapped(const void *src, SampleFormat_t srcformat, bool srcbe, uint_t srcchannel, uint_t nsrcchannels,
+                                 Sample_t *dst, uint_t ndstchannels,
+                                 const CHANNELROUTE *map, uint_t nmap,
+                                 uint_t nchannels, uint_t nframes);
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether a set of kernels can be used on this machine
+ */
+/*--------------------------------------------------------------------------------*/
+extern bool ConversionKernelsAvailable(ConversionKernels_t kernels);
+
+/*--------------------------------------------------------------------------------*/
+/** Return set of kernels in use (by default the fastest available)
+ */
+/*--------------------------------------------------------------------------------*/
+extern ConversionKernels_t GetConversionKernels();
+
+/*--------------------------------------------------------------------------------*/
+/** Select set of kernels (e.g. for testing)
+ *
+ * @return false if kernels are not available on this machine
+ */
+/*--------------------------------------------------------------------------------*/
+extern bool SetConversionKernels(ConversionKernels_t kernels);
+
+/*--------------------------------------------------------------------------------*/
+/** Return name of a set of kernels
+ */
+/*--------------------------------------------------------------------------------*/
+extern const char *GetConversionKernelsName(ConversionKernels_t kernels);
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -3,6 +3,9 @@
 
 #define BBCDEBUG_LEVEL 1
 #include "SoundFileAttributes.h"
+#include "BackgroundWriteFile.h"
+#include "SampleConversion.h"
+#include "TraceEvents.h"
 
 BBC_AUDIOTOOLBOX_START
 
@@ -22,12 +25,17 @@ SoundFormat::~SoundFormat()
 
 SoundFileSamples::SoundFileSamples() :
   format(NULL),
+  handlepool(NULL),
+  handleentry(NULL),
+  transposedcache(NULL),
+  iostats(NULL),
   filepos(0),
   samplepos(0),
   totalsamples(0),
   totalbytes(0),
   samplebuffer(NULL),
   samplebufferframes(256),
+  lentframes(0),
   readonly(true),
   inerror(false)
 {
@@ -36,12 +44,17 @@ SoundFileSamples::SoundFileSamples() :
 
 SoundFileSamples::SoundFileSamples(const SoundFileSamples *obj) :
   format(NULL),
+  handlepool(NULL),
+  handleentry(NULL),
+  transposedcache(NULL),
+  iostats(NULL),
   filepos(0),
   samplepos(0),
   totalsamples(0),
   totalbytes(0),
   samplebuffer(NULL),
   samplebufferframes(256),
+  lentframes(0),
   readonly(true),
   inerror(false)
 {
@@ -50,12 +63,23 @@ SoundFileSamples::SoundFileSamples(const SoundFileSamples *obj) :
   SetFormat(obj->GetFormat());
   SetFile(obj->fileref, obj->filepos, obj->totalbytes);
   SetClip(obj->GetClip());
+
+  // pooled objects hold no handle, remember file so that ReopenFile() can open it
+  if (obj->handlepool) filename = obj->filename;
+
+  // the cache is for the same file so can be shared
+  transposedcache = obj->transposedcache;
+
+  // as are the statistics
+  iostats = obj->iostats;
 }
 
 SoundFileSamples::~SoundFileSamples()
 {
   if (samplebuffer) delete[] samplebuffer;
 
+  if (handlepool) handlepool->Unregister(handleentry);
+
   EnhancedFile *file;
   if ((file = fileref.Obj()) != NULL)
   {
@@ -86,6 +110,131 @@ void SoundFileSamples::SetFile(const RefCount<EnhancedFile>& file, uint64_t pos,
   UpdateData();
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Replace the (possibly shared) file handle with a separately opened, read-only handle
+ * to the same file so that this object can be read independently of any object it was
+ * copied from (e.g. from another thread)
+ *
+ * @return true if file re-opened
+ */
+/*--------------------------------------------------------------------------------*/
+bool SoundFileSamples::ReopenFile()
+{
+  EnhancedFile *file = fileref, *newfile;
+  std::string  filename = (file && file->isopen()) ? file->getfilename() : this->filename;
+  bool success = false;
+
+  if (!filename.empty())
+  {
+    if (((newfile = new EnhancedFile) != NULL) && newfile->fopen(filename.c_str(), "rb"))
+    {
+      fileref  = newfile;
+      readonly = true;
+      success  = true;
+    }
+    else
+    {
+      BBCERROR("Failed to re-open '%s' for reading", filename.c_str());
+      if (newfile) delete newfile;
+
+      // MUST NOT keep shared handle since it would be closed on destruction
+      fileref = NULL;
+    }
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return a copy of this object that can be read independently of it (e.g. from another
+ * thread), with its own file handle (see ReopenFile())
+ *
+ * @return new object (owned by the caller) or NULL on failure
+ */
+/*--------------------------------------------------------------------------------*/
+SoundFileSamples *SoundFileSamples::Duplicate() const
+{
+  SoundFileSamples *obj;
+
+  if (((obj = new SoundFileSamples(this)) != NULL) && !obj->ReopenFile())
+  {
+    delete obj;
+    obj = NULL;
+  }
+
+  return obj;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open file lazily through a pool instead of holding a file handle and sample buffer
+ * for the lifetime of this object
+ *
+ * @param pool pool to take file handles and sample buffers from (MUST outlive this object)
+ *
+ * @return true if object now uses pool
+ */
+/*--------------------------------------------------------------------------------*/
+bool SoundFileSamples::UseFileHandlePool(FileHandlePool *pool)
+{
+  EnhancedFile *file = fileref;
+  bool success = false;
+
+  if (handlepool) success = (pool == handlepool);
+  else if (file && file->isopen() && readonly)
+  {
+    if ((handleentry = pool->Register(file->getfilename())) != NULL)
+    {
+      filename   = file->getfilename();
+      handlepool = pool;
+
+      // drop this object's handle (the file is closed once no other object shares it) and buffer
+      fileref = NULL;
+      if (samplebuffer) delete[] samplebuffer;
+      samplebuffer = NULL;
+
+      success = true;
+    }
+  }
+  else BBCERROR("Only open, read-only files can use a file handle pool");
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Serve reads of a few channels from a transposed (channel-major) sidecar of the file
+ * instead of reading every channel of each frame
+ *
+ * @param cache cache to use (MUST outlive this object, may be shared with duplicates of
+ * this object) or NULL to stop using one
+ * @param cachefilename sidecar file (empty for the default, see TransposedCache)
+ *
+ * @return true if cache is in use
+ */
+/*--------------------------------------------------------------------------------*/
+bool SoundFileSamples::UseTransposedCache(TransposedCache *cache, const std::string& cachefilename)
+{
+  EnhancedFile *file = fileref;
+  std::string  name  = (file && file->isopen()) ? file->getfilename() : filename;
+  bool success = false;
+
+  if (!cache)
+  {
+    transposedcache = NULL;
+    success = true;
+  }
+  else if (!format || !readonly || name.empty())
+  {
+    BBCERROR("Only open, read-only files can use a transposed cache");
+  }
+  else if (cache->Open(name, filepos, totalsamples, *format, cachefilename))
+  {
+    transposedcache = cache;
+    success = true;
+  }
+
+  return success;
+}
+
 void SoundFileSamples::SetClip(const Clip_t& newclip)
 {
   clip = newclip;
@@ -98,53 +247,445 @@ void SoundFileSamples::SetClip(const Clip_t& newclip)
   UpdatePosition();
 }
 
-uint_t SoundFileSamples::ReadSamples(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames into an interleaved buffer or, if planar is not NULL, into separate
+ * buffers for each channel or, if map is not NULL, through a channel map into an interleaved
+ * Sample_t buffer (see ReadSamples(), ReadSamplesPlanar() and ReadSamplesMapped())
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
 {
-  EnhancedFile *file = fileref;
-  uint_t n = 0;
+  if (!format)
+  {
+    BBCERROR("No format");
+    return 0;
+  }
+
+  frames = (uint_t)std::min((uint64_t)frames, clip.nsamples - samplepos);
+
+  if (!frames)
+  {
+    BBCDEBUG3(("No sample data left (pos = %s, nsamples = %s)!", StringFrom(samplepos).c_str(), StringFrom(clip.nsamples).c_str()));
+  }
+
+  firstchannel = std::min(firstchannel, clip.nchannels);
+  nchannels    = std::min(nchannels,    clip.nchannels - firstchannel);
+
+  // mapped reads can pick any channel of the clip
+  if (!map)
+  {
+    dstchannel = std::min(dstchannel,   ndstchannels);
+    nchannels  = std::min(nchannels,    ndstchannels - dstchannel);
+  }
+
+  if (!nchannels)
+  {
+    // no channels to transfer, just increment position and return number of requested frames
+    samplepos += frames;
+    UpdatePosition();
+    return frames;
+  }
+
+  if (HasInactiveChannels()) return ReadSparseFrames(buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+
+  return ReadSourceFrames(buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames, outputting silence for channels that are inactive (see
+ * IsChannelActive()) and reading only the span of active channels
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadSparseFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  uint_t bps = GetBytesPerSample(type);
+  uint_t n = 0, i, j;
 
-  if (file && file->isopen() && samplebuffer)
+  active.resize(nchannels);
+
+  while (frames && !inerror)
   {
-    frames = (uint_t)std::min((uint64_t)frames, clip.nsamples - samplepos);
+    uint64_t pos   = clip.start + samplepos;
+    uint64_t next  = ~(uint64_t)0;
+    uint_t   first = nchannels, last = 0, nactive = 0;
+    uint_t   nframes, nread;
 
-    if (!frames)
+    // find requested channels that are active and how long for
+    for (i = 0; i < nchannels; i++)
     {
-      BBCDEBUG3(("No sample data left (pos = %s, nsamples = %s)!", StringFrom(samplepos).c_str(), StringFrom(clip.nsamples).c_str()));
+      uint64_t change;
+
+      active[i] = IsChannelActive(clip.channel + firstchannel + i, pos, change);
+      next      = std::min(next, change);
+
+      if (active[i])
+      {
+        first = std::min(first, i);
+        last  = i;
+        nactive++;
+      }
     }
 
-    firstchannel = std::min(firstchannel, clip.nchannels);
-    nchannels    = std::min(nchannels,    clip.nchannels - firstchannel);
+    nframes = (uint_t)std::min((uint64_t)frames, next - pos);
+
+    if (!nactive)
+    {
+      // nothing to read, output silence (all zero bytes for every sample format)
+      if (map)
+      {
+        for (j = 0; j < nmap; j++)
+        {
+          if ((map[j].channel >= nchannels) || (map[j].slot >= ndstchannels)) continue;
+
+          for (i = 0; i < nframes; i++) ((Sample_t *)buffer)[i * ndstchannels + map[j].slot] = 0.0;
+        }
+      }
+      else
+      {
+        for (j = 0; j < nchannels; j++)
+        {
+          if (planar)
+          {
+            if (planar[j]) memset(planar[j] + planaroffset + n, 0, nframes * sizeof(*planar[j]));
+          }
+          else
+          {
+            for (i = 0; i < nframes; i++) memset(buffer + ((i * ndstchannels) + dstchannel + j) * bps, 0, bps);
+          }
+        }
+      }
+
+      nread      = nframes;
+      samplepos += nframes;
+      UpdatePosition();
+    }
+    else if (map)
+    {
+      // only the last entry for each slot counts: slots of inactive channels are silenced
+      // directly and only the span of active channels is read, through the remaining entries
+      sparsemap.clear();
+      slotmapped.assign(ndstchannels, 0);
+      for (j = nmap; j > 0; j--)
+      {
+        const CHANNELROUTE& route = map[j - 1];
+
+        if ((route.channel >= nchannels) || (route.slot >= ndstchannels) || slotmapped[route.slot]) continue;
+
+        slotmapped[route.slot] = 1;
+
+        if (active[route.channel])
+        {
+          sparsemap.push_back(route);
+          sparsemap.back().channel -= first;
+        }
+        else
+        {
+          for (i = 0; i < nframes; i++) ((Sample_t *)buffer)[i * ndstchannels + route.slot] = 0.0;
+        }
+      }
+
+      if (sparsemap.size())
+      {
+        nread = ReadSourceFrames(buffer, type, dstchannel, ndstchannels, NULL, 0, &sparsemap[0], (uint_t)sparsemap.size(), nframes, firstchannel + first, last + 1 - first);
+      }
+      else
+      {
+        // no active channel is mapped, nothing to read
+        nread      = nframes;
+        samplepos += nframes;
+        UpdatePosition();
+      }
+    }
+    else
+    {
+      // read only the span of active channels then silence the inactive ones
+      nread = ReadSourceFrames(buffer, type, dstchannel + first, ndstchannels, planar ? planar + first : NULL, planaroffset + n, NULL, 0, nframes, firstchannel + first, last + 1 - first);
+
+      for (j = 0; j < nchannels; j++)
+      {
+        if (active[j]) continue;
+
+        if (planar)
+        {
+          if (planar[j]) memset(planar[j] + planaroffset + n, 0, nread * sizeof(*planar[j]));
+        }
+        else
+        {
+          for (i = 0; i < nread; i++) memset(buffer + ((i * ndstchannels) + dstchannel + j) * bps, 0, bps);
+        }
+      }
+    }
+
+    n      += nread;
+    if (!planar) buffer += nread * ndstchannels * bps;
+    frames -= nread;
+
+    if (nread < nframes) break;
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames (already limited to the clip) from the file or, for objects without
+ * a file, from ReadSampleBlock()
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadSourceFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  if (fileref.Obj() || handlepool) return ReadFileFrames(buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+
+  return ReadBlockFrames(buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames through ReadSampleBlock() into the sample buffer and output them from there
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadBlockFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  SampleFormat_t blocktype = SampleFormatOf((const Sample_t *)NULL);
+  Sample_t       *block    = (Sample_t *)samplebuffer;
+  uint_t         first = 0, nblockchannels = nchannels;
+  uint_t         n = 0, i;
+
+  if (!block)
+  {
+    BBCERROR("No sample buffer");
+    return 0;
+  }
+
+  if (map)
+  {
+    // only the span of channels that are mapped is needed
+    first          = nchannels;
+    nblockchannels = 0;
+    for (i = 0; i < nmap; i++)
+    {
+      if ((map[i].channel >= nchannels) || (map[i].slot >= ndstchannels)) continue;
+
+      first          = std::min(first,          map[i].channel);
+      nblockchannels = std::max(nblockchannels, map[i].channel + 1);
+    }
+
+    if (first >= nblockchannels)
+    {
+      // nothing mapped, nothing to read
+      samplepos += frames;
+      UpdatePosition();
+      return frames;
+    }
+  }
+
+  while (frames && !inerror)
+  {
+    uint_t nframes = std::min(frames, samplebufferframes);
+    uint_t nread;
+
+    // block holds frames of nblockchannels channels, channels before first are not produced
+    nread = ReadSampleBlock(block + first, nblockchannels, nframes, clip.channel + firstchannel + first, nblockchannels - first);
+
+    if (planar)
+    {
+      ConvertSamplesToPlanar(block, blocktype, MACHINE_IS_BIG_ENDIAN, 0, nblockchannels,
+                             planar, planaroffset + n,
+                             nchannels,
+                             nread);
+    }
+    else
+    {
+      if (map)
+      {
+        // gather and apply gain in the same pass
+        ConvertSamplesMapped(block, blocktype, MACHINE_IS_BIG_ENDIAN, 0, nblockchannels,
+                             (Sample_t *)buffer, ndstchannels,
+                             map, nmap,
+                             nblockchannels,
+                             nread);
+      }
+      else
+      {
+        ConvertSamples(block, blocktype, MACHINE_IS_BIG_ENDIAN, 0, nblockchannels,
+                       buffer, type, MACHINE_IS_BIG_ENDIAN, dstchannel, ndstchannels,
+                       nchannels,
+                       nread);
+      }
+
+      buffer += nread * ndstchannels * GetBytesPerSample(type);
+    }
 
-    dstchannel   = std::min(dstchannel,   ndstchannels);
-    nchannels    = std::min(nchannels,    ndstchannels - dstchannel);
+    n         += nread;
+    frames    -= nread;
+    samplepos += nread;
 
+    if (nread < nframes) break;
+  }
+
+  UpdatePosition();
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Produce sample frames from the current position for objects that do not read a file
+ *
+ * @param dst destination for interleaved frames
+ * @param ndstchannels number of channels in each destination frame
+ * @param frames number of frames (no more than the sample buffer size or remaining in the clip)
+ * @param firstchannel first channel (within the format, not the clip) to produce
+ * @param nchannels number of channels to produce
+ *
+ * @return number of frames produced (fewer than requested at the end or on error)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  UNUSED_PARAMETER(dst);
+  UNUSED_PARAMETER(ndstchannels);
+  UNUSED_PARAMETER(frames);
+  UNUSED_PARAMETER(firstchannel);
+  UNUSED_PARAMETER(nchannels);
+
+  BBCERROR("No file or sample buffer");
+
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames (already limited to the clip) from the file
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadFileFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  TraceScope   trace("ReadSamples", "samples");
+  uint64_t     t    = iostats ? GetNanosecondTicks() : 0;
+  EnhancedFile *file = handlepool ? handlepool->Acquire(handleentry) : fileref.Obj();
+  uint8_t *sbuffer = samplebuffer, *pooledbuffer = NULL;
+  uint_t  sbufferframes = samplebufferframes;
+  uint_t  n = 0;
+  bool    nonblocking = (handlepool && FileHandlePool::IsNonBlocking());
+
+  if (handlepool && file && format)
+  {
+    size_t size;
+
+    // borrow a shared sample buffer, falling back to a private one if none are free or big enough
+    if ((pooledbuffer = handlepool->AcquireBuffer(size)) != NULL)
+    {
+      sbuffer       = pooledbuffer;
+      sbufferframes = std::min(samplebufferframes, (uint_t)(size / format->GetBytesPerFrame()));
+    }
+
+    if (!sbufferframes)
+    {
+      handlepool->ReleaseBuffer(pooledbuffer);
+      pooledbuffer  = NULL;
+      sbufferframes = samplebufferframes;
+    }
+
+    if (!pooledbuffer && nonblocking)
+    {
+      // no allocation on a real-time thread, output silence instead
+      sbuffer = NULL;
+    }
+    else if (!pooledbuffer)
+    {
+      BBCDEBUG1(("No shared sample buffer available, using private buffer"));
+      if (!samplebuffer) samplebuffer = new uint8_t[samplebufferframes * format->GetChannels() * sizeof(double)];
+      sbuffer = samplebuffer;
+    }
+
+    if (iostats) iostats->AddAcquire(GetNanosecondTicks() - t);
+  }
+
+  if (file && file->isopen() && sbuffer)
+  {
     n = 0;
     if (nchannels)
     {
+      if (transposedcache)
+      {
+        uint_t ncached = nchannels, i;
+
+        if (map)
+        {
+          for (i = ncached = 0; i < nmap; i++) ncached += ((map[i].channel < nchannels) && (map[i].slot < ndstchannels));
+        }
+
+        // reads of a few channels of a wide file are served from the transposed cache when it is ready
+        if (transposedcache->UseFor(ncached))
+        {
+          if (iostats) t = GetNanosecondTicks();
+          n       = ReadTransposedFrames(sbuffer, sbufferframes, buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+          // recorded as a single read (including conversion)
+          if (iostats) iostats->AddRead((uint64_t)n * ncached * format->GetBytesPerSample(), GetNanosecondTicks() - t);
+          frames -= n;
+          if (!planar) buffer += n * ndstchannels * GetBytesPerSample(type);
+        }
+      }
+
+      // read the rest (or everything) from the file itself
       while (frames)
       {
-        uint_t nframes = std::min(frames, samplebufferframes);
+        uint_t nframes = std::min(frames, sbufferframes);
         size_t res;
 
+        bool   seeked;
+
         BBCDEBUG4(("Seeking to %s", StringFrom(filepos + (clip.start + samplepos) * format->GetBytesPerFrame()).c_str()));
-        if (file->fseek(filepos + samplepos * format->GetBytesPerFrame(), SEEK_SET) == 0)
+        if (iostats) t = GetNanosecondTicks();
+        seeked = (file->fseek(filepos + (clip.start + samplepos) * format->GetBytesPerFrame(), SEEK_SET) == 0);
+        if (iostats) iostats->AddSeek(GetNanosecondTicks() - t);
+
+        if (seeked)
         {
           BBCDEBUG4(("Reading %u x %u bytes", nframes, format->GetBytesPerFrame()));
 
-          if ((res = file->fread(samplebuffer, format->GetBytesPerFrame(), nframes)) > 0)
+          if (iostats) t = GetNanosecondTicks();
+          res = file->fread(sbuffer, format->GetBytesPerFrame(), nframes);
+          if (iostats) iostats->AddRead((uint64_t)res * format->GetBytesPerFrame(), GetNanosecondTicks() - t);
+
+          if (res > 0)
           {
             nframes = (uint_t)res;
 
             BBCDEBUG4(("Read %u frames, extracting channels %u-%u (from 0-%u), converting and copying to destination", nframes, clip.channel + firstchannel, clip.channel + firstchannel + nchannels, format->GetChannels()));
 
+            if (iostats) t = GetNanosecondTicks();
+
             // de-interleave, convert and transfer samples
-            TransferSamples(samplebuffer, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
-                            buffer, type, MACHINE_IS_BIG_ENDIAN, dstchannel, ndstchannels,
-                            nchannels,
-                            nframes);
+            if (planar)
+            {
+              ConvertSamplesToPlanar(sbuffer, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
+                                     planar, planaroffset + n,
+                                     nchannels,
+                                     nframes);
+            }
+            else
+            {
+              if (map)
+              {
+                // gather and apply gain in the same pass
+                ConvertSamplesMapped(sbuffer, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
+                                     (Sample_t *)buffer, ndstchannels,
+                                     map, nmap,
+                                     nchannels,
+                                     nframes);
+              }
+              else
+              {
+                ConvertSamples(sbuffer, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
+                               buffer, type, MACHINE_IS_BIG_ENDIAN, dstchannel, ndstchannels,
+                               nchannels,
+                               nframes);
+              }
+
+              buffer += nframes * ndstchannels * GetBytesPerSample(type);
+            }
+
+            if (iostats) iostats->AddConvert(nframes, GetNanosecondTicks() - t);
 
             n         += nframes;
-            buffer    += nframes * ndstchannels * GetBytesPerSample(type);
             frames    -= nframes;
             samplepos += nframes;
           }
@@ -178,18 +719,157 @@ uint_t SoundFileSamples::ReadSamples(uint8_t *buffer, SampleFormat_t type, uint_
 
     UpdatePosition();
   }
+  else if (nonblocking && format)
+  {
+    // file not open yet (the pool's maintenance thread opens it) or no buffer free
+    n = ReadSilentFrames(buffer, type, dstchannel, ndstchannels, planar, planaroffset, map, nmap, frames, firstchannel, nchannels);
+    handlepool->AddSilentRead();
+  }
   else BBCERROR("No file or sample buffer");
 
+  if (handlepool)
+  {
+    handlepool->ReleaseBuffer(pooledbuffer);
+    handlepool->Release(handleentry);
+  }
+
   return n;
 }
 
-uint_t SoundFileSamples::WriteSamples(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes, uint_t firstchannel, uint_t nchannels)
+/*--------------------------------------------------------------------------------*/
+/** Output silence in place of sample frames and move position on (see ReadFileFrames())
+ *
+ * @return number of frames of silence
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadSilentFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  uint_t bps = GetBytesPerSample(type);
+  uint_t i, j;
+
+  UNUSED_PARAMETER(firstchannel);
+
+  if (planar)
+  {
+    for (i = 0; i < nchannels; i++)
+    {
+      if (planar[i]) memset(planar[i] + planaroffset, 0, frames * sizeof(*planar[i]));
+    }
+  }
+  else if (map)
+  {
+    Sample_t *dst = (Sample_t *)buffer;
+
+    // only mapped slots would have been written
+    for (i = 0; i < frames; i++, dst += ndstchannels)
+    {
+      for (j = 0; j < nmap; j++)
+      {
+        if ((map[j].channel < nchannels) && (map[j].slot < ndstchannels)) dst[map[j].slot] = 0.0;
+      }
+    }
+  }
+  else if (nchannels)
+  {
+    for (i = 0; i < frames; i++) memset(buffer + (i * ndstchannels + dstchannel) * bps, 0, nchannels * bps);
+  }
+
+  samplepos += frames;
+  UpdatePosition();
+
+  return frames;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read sample frames one channel at a time from the transposed cache (see ReadFileFrames())
+ *
+ * @param sbuffer buffer for samples of one channel
+ * @param sbufferframes number of frames sbuffer can hold
+ *
+ * @return number of frames read (fewer than requested if the cache cannot be read)
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::ReadTransposedFrames(uint8_t *sbuffer, uint_t sbufferframes, uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels)
+{
+  SampleFormat_t srcformat = format->GetSampleFormat();
+  bool           srcbe     = format->GetSamplesBigEndian();
+  uint_t         nreads    = map ? nmap : nchannels;
+  uint_t         n         = 0;
+  bool           success   = true;
+
+  while (success && frames)
+  {
+    uint_t   nframes = std::min(frames, sbufferframes);
+    uint64_t pos     = clip.start + samplepos;
+    uint_t   i;
+
+    for (i = 0; success && (i < nreads); i++)
+    {
+      if (map)
+      {
+        CHANNELROUTE route = map[i];
+
+        // entries outside the clip or destination are ignored
+        if ((route.channel >= nchannels) || (route.slot >= ndstchannels)) continue;
+
+        if ((success = transposedcache->ReadChannel(clip.channel + firstchannel + route.channel, pos, nframes, sbuffer)) == true)
+        {
+          route.channel = 0;
+          ConvertSamplesMapped(sbuffer, srcformat, srcbe, 0, 1,
+                               (Sample_t *)buffer, ndstchannels,
+                               &route, 1,
+                               1,
+                               nframes);
+        }
+      }
+      else if (planar)
+      {
+        if (!planar[i]) continue;
+
+        if ((success = transposedcache->ReadChannel(clip.channel + firstchannel + i, pos, nframes, sbuffer)) == true)
+        {
+          ConvertSamplesToPlanar(sbuffer, srcformat, srcbe, 0, 1,
+                                 planar + i, planaroffset + n,
+                                 1,
+                                 nframes);
+        }
+      }
+      else if ((success = transposedcache->ReadChannel(clip.channel + firstchannel + i, pos, nframes, sbuffer)) == true)
+      {
+        ConvertSamples(sbuffer, srcformat, srcbe, 0, 1,
+                       buffer, type, MACHINE_IS_BIG_ENDIAN, dstchannel + i, ndstchannels,
+                       1,
+                       nframes);
+      }
+    }
+
+    // a block that could not be read completely is read again from the file
+    if (success)
+    {
+      n         += nframes;
+      if (!planar) buffer += nframes * ndstchannels * GetBytesPerSample(type);
+      frames    -= nframes;
+      samplepos += nframes;
+    }
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write sample frames from an interleaved buffer or, if planar is not NULL, from separate
+ * buffers for each channel (see WriteSamples() and WriteSamplesPlanar())
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::WriteFrames(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, const Sample_t *const *planar, uint_t planaroffset, uint_t nsrcframes, uint_t firstchannel, uint_t nchannels)
 {
   EnhancedFile *file = fileref;
-  uint_t n = 0;
+  uint64_t     t     = 0;
+  uint_t       n     = 0;
 
   if (file && file->isopen() && samplebuffer && !readonly)
   {
+    BackgroundWriteFile *bfile = dynamic_cast<BackgroundWriteFile *>(file);
     uint_t bpf = format->GetBytesPerFrame();
 
     firstchannel = std::min(firstchannel, clip.nchannels);
@@ -203,32 +883,73 @@ uint_t SoundFileSamples::WriteSamples(const uint8_t *buffer, SampleFormat_t type
     {
       while (nsrcframes)
       {
-        uint_t nframes = std::min(nsrcframes, samplebufferframes);
-        size_t res;
+        uint_t  nframes = std::min(nsrcframes, samplebufferframes);
+        uint8_t *dst    = samplebuffer;
+        bool    lent    = false;
+        size_t  res;
+
+        // if all channels are being written and the file can lend memory that is written
+        // without further copying (e.g. a mapping), convert directly into it
+        if (bfile && bfile->WriteBufferIsDirect() && (nchannels == format->GetChannels()) &&
+            ((dst = bfile->GetWriteBuffer(nframes * bpf)) != NULL))
+        {
+          lent = true;
+        }
+        else dst = samplebuffer;
 
         if (nchannels < format->GetChannels())
         {
           // read existing sample data to allow overwriting of channels
+          if (iostats) t = GetNanosecondTicks();
           res = file->fread(samplebuffer, bpf, nframes);
+          if (iostats) iostats->AddRead((uint64_t)res * bpf, GetNanosecondTicks() - t);
 
           // clear rest of buffer
           if (res < (bpf * nframes)) memset(samplebuffer + res * bpf, 0, (nframes - res) * bpf);
 
           // move back in file for write
-          if (res) file->fseek(-(long)(res * bpf), SEEK_CUR);
+          if (res)
+          {
+            if (iostats) t = GetNanosecondTicks();
+            file->fseek(-(long)(res * bpf), SEEK_CUR);
+            if (iostats) iostats->AddSeek(GetNanosecondTicks() - t);
+          }
         }
 
+        if (iostats) t = GetNanosecondTicks();
+
         // copy/interleave/convert samples
-        TransferSamples(buffer, type, MACHINE_IS_BIG_ENDIAN, srcchannel, nsrcchannels,
-                        samplebuffer, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, nchannels,
-                        ~0,       // number of channels actually transfer will be limited by nsrcchannels and nchannels above
-                        nframes);
+        if (planar)
+        {
+          ConvertSamplesFromPlanar(planar, planaroffset + n,
+                                   dst, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
+                                   nchannels,
+                                   nframes);
+        }
+        else
+        {
+          ConvertSamples(buffer, type, MACHINE_IS_BIG_ENDIAN, srcchannel, nsrcchannels,
+                         dst, format->GetSampleFormat(), format->GetSamplesBigEndian(), clip.channel + firstchannel, format->GetChannels(),
+                         nchannels,
+                         nframes);
+        }
 
-        if ((res = file->fwrite(samplebuffer, bpf, nframes)) > 0)
+        if (iostats)
+        {
+          iostats->AddConvert(nframes, GetNanosecondTicks() - t);
+          t = GetNanosecondTicks();
+        }
+
+        if (lent) res = bfile->CommitWriteBuffer(nframes * bpf) / bpf;
+        else      res = file->fwrite(samplebuffer, bpf, nframes);
+
+        if (iostats) iostats->AddWrite((uint64_t)res * bpf, GetNanosecondTicks() - t);
+
+        if (res > 0)
         {
           nframes     = (uint_t)res;
           n          += nframes;
-          buffer     += nframes * nsrcchannels * GetBytesPerSample(type);
+          if (!planar) buffer += nframes * nsrcchannels * GetBytesPerSample(type);
           nsrcframes -= nframes;
           samplepos  += nframes;
 
@@ -264,13 +985,120 @@ uint_t SoundFileSamples::WriteSamples(const uint8_t *buffer, SampleFormat_t type
   return n;
 }
 
+/*--------------------------------------------------------------------------------*/
+/** Return buffer that sample frames can be written into directly, avoiding an intermediate copy
+ *
+ * @param frames number of frames required
+ *
+ * @return pointer to buffer for interleaved frames of *all* channels in the file's sample format
+ * and endianness (see GetFormat()) or NULL
+ *
+ * @note the buffer is only valid until CommitWriteBuffer() is called
+ */
+/*--------------------------------------------------------------------------------*/
+uint8_t *SoundFileSamples::GetWriteBuffer(uint_t frames)
+{
+  EnhancedFile *file = fileref;
+  uint8_t *buffer = NULL;
+
+  if (file && file->isopen() && format && !readonly)
+  {
+    BackgroundWriteFile *bfile;
+    size_t bytes = (size_t)frames * format->GetBytesPerFrame();
+
+    if ((bfile = dynamic_cast<BackgroundWriteFile *>(file)) != NULL)
+    {
+      // borrow block from the file's write queue
+      buffer = bfile->GetWriteBuffer(bytes);
+    }
+    else
+    {
+      if (lendbuffer.size() < bytes) lendbuffer.resize(bytes);
+      buffer = lendbuffer.size() ? &lendbuffer[0] : NULL;
+    }
+
+    lentframes = buffer ? frames : 0;
+  }
+  else BBCERROR("No file or file not writable");
+
+  return buffer;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames previously written into buffer returned by GetWriteBuffer()
+ *
+ * @param frames number of frames to write (may be fewer than requested)
+ *
+ * @return number of frames written
+ */
+/*--------------------------------------------------------------------------------*/
+uint_t SoundFileSamples::CommitWriteBuffer(uint_t frames)
+{
+  EnhancedFile *file = fileref;
+  uint_t n = 0;
+
+  if (file && file->isopen() && format && lentframes)
+  {
+    BackgroundWriteFile *bfile;
+    uint_t bpf = format->GetBytesPerFrame();
+
+    uint64_t t = iostats ? GetNanosecondTicks() : 0;
+
+    frames = std::min(frames, lentframes);
+    lentframes = 0;
+
+    if ((bfile = dynamic_cast<BackgroundWriteFile *>(file)) != NULL)
+    {
+      // the borrowed block MUST be returned, even if no frames are being written
+      n = (uint_t)(bfile->CommitWriteBuffer((size_t)frames * bpf) / bpf);
+    }
+    else if (frames) n = (uint_t)file->fwrite(&lendbuffer[0], bpf, frames);
+
+    if (iostats) iostats->AddWrite((uint64_t)n * bpf, GetNanosecondTicks() - t);
+
+    if (n < frames)
+    {
+      BBCERROR("Failed to write %u frames (%u bytes) to file, error %s", frames, frames * bpf, strerror(file->ferror()));
+      inerror = true;
+    }
+
+    samplepos    += n;
+    totalsamples  = std::max(totalsamples,  samplepos);
+    clip.nsamples = std::max(clip.nsamples, totalsamples - clip.start);
+    totalbytes    = totalsamples * bpf;
+
+    UpdatePosition();
+  }
+  else BBCERROR("No write buffer outstanding");
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** (Re)allocate sample buffer for samplebufferframes frames of all channels
+ *
+ * @note large enough for frames of Sample_t samples as well as of the file's format
+ */
+/*--------------------------------------------------------------------------------*/
+void SoundFileSamples::AllocateSampleBuffer()
+{
+  if (samplebuffer) delete[] samplebuffer;
+  samplebuffer = format ? new uint8_t[samplebufferframes * format->GetChannels() * sizeof(double)] : NULL;
+}
+
 void SoundFileSamples::UpdateData()
 {
   if (format)
   {
     totalsamples = totalbytes / format->GetBytesPerFrame();
-    if (samplebuffer) delete[] samplebuffer;
-    samplebuffer = new uint8_t[samplebufferframes * format->GetChannels() * sizeof(double)];
+
+    // pooled objects borrow sample buffers whilst reading
+    if (handlepool)
+    {
+      if (samplebuffer) delete[] samplebuffer;
+      samplebuffer = NULL;
+    }
+    else AllocateSampleBuffer();
 
     Clip_t newclip =
     {
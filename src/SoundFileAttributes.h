@@ -2,6 +2,7 @@
 #define __SOUND_FILE_ATTRIBUTES__
 
 #include <string>
+#include <vector>
 
 #include <bbcat-base/misc.h>
 #include <bbcat-base/EnhancedFile.h>
@@ -10,6 +11,11 @@
 
 #include <bbcat-dsp/SoundFormatConversions.h>
 
+#include "FileHandlePool.h"
+#include "SampleConversion.h"
+#include "TransposedCache.h"
+#include "IOStatistics.h"
+
 BBC_AUDIOTOOLBOX_START
 
 /*--------------------------------------------------------------------------------*/
@@ -63,6 +69,75 @@ public:
   const SoundFormat *GetFormat() const {return format;}
   virtual void SetFile(const RefCount<EnhancedFile>& file, uint64_t pos, uint64_t bytes, bool readonly = true);
 
+  /*--------------------------------------------------------------------------------*/
+  /** Replace the (possibly shared) file handle with a separately opened, read-only handle
+   * to the same file so that this object can be read independently of any object it was
+   * copied from (e.g. from another thread)
+   *
+   * @return true if file re-opened
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ReopenFile();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return a copy of this object that can be read independently of it (e.g. from another
+   * thread), with its own file handle (see ReopenFile())
+   *
+   * @return new object (owned by the caller) or NULL on failure
+   *
+   * @note derived classes which change how samples are read override this to copy themselves
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual SoundFileSamples *Duplicate() const;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open file lazily through a pool instead of holding a file handle and sample buffer
+   * for the lifetime of this object
+   *
+   * @param pool pool to take file handles and sample buffers from (MUST outlive this object)
+   *
+   * @return true if object now uses pool
+   *
+   * @note only read-only objects can use a pool
+   * @note the current file handle is closed once no other object shares it
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool UseFileHandlePool(FileHandlePool *pool);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Pin/unpin file in pool so that it is kept open (and opened ahead of reading)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual void PinFile(bool pin = true) {if (handlepool) handlepool->Pin(handleentry, pin);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Serve reads of a few channels from a transposed (channel-major) sidecar of the file
+   * instead of reading every channel of each frame
+   *
+   * @param cache cache to use (MUST outlive this object, may be shared with duplicates of
+   * this object) or NULL to stop using one
+   * @param cachefilename sidecar file (empty for the default, see TransposedCache)
+   *
+   * @return true if cache is in use
+   *
+   * @note only read-only objects can use a cache
+   * @note reads are served from the file until the sidecar has been built
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool UseTransposedCache(TransposedCache *cache, const std::string& cachefilename = "");
+
+  /*--------------------------------------------------------------------------------*/
+  /** Gather counters and latency histograms of the sample I/O of this object
+   *
+   * @param stats statistics to add to (MUST outlive this object, may be shared with
+   * duplicates of this object) or NULL to stop gathering statistics
+   *
+   * @note disabled by default, nothing is timed or counted whilst disabled
+   */
+  /*--------------------------------------------------------------------------------*/
+  void          SetIOStatistics(IOStatistics *stats) {iostats = stats;}
+  IOStatistics *GetIOStatistics() const {return iostats;}
+
   /*--------------------------------------------------------------------------------*/
   /** Return whether read or write error has occurred
    */
@@ -104,19 +179,205 @@ public:
   const Clip_t& GetClip() const {return clip;}
   void SetClip(const Clip_t& newclip);
 
-  virtual uint_t ReadSamples(uint8_t  *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0);
+  virtual uint_t ReadSamples(uint8_t  *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadFrames(buffer, type, dstchannel, ndstchannels, NULL, 0, NULL, 0, frames, firstchannel, nchannels);}
   virtual uint_t ReadSamples(sint16_t *dst, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadSamples((uint8_t *)dst, SampleFormatOf(dst), dstchannel, ndstchannels, frames, firstchannel, nchannels);}
   virtual uint_t ReadSamples(sint32_t *dst, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadSamples((uint8_t *)dst, SampleFormatOf(dst), dstchannel, ndstchannels, frames, firstchannel, nchannels);}
   virtual uint_t ReadSamples(float    *dst, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadSamples((uint8_t *)dst, SampleFormatOf(dst), dstchannel, ndstchannels, frames, firstchannel, nchannels);}
   virtual uint_t ReadSamples(double   *dst, uint_t dstchannel, uint_t ndstchannels, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadSamples((uint8_t *)dst, SampleFormatOf(dst), dstchannel, ndstchannels, frames, firstchannel, nchannels);}
 
-  virtual uint_t WriteSamples(const uint8_t  *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0);
+  virtual uint_t WriteSamples(const uint8_t  *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteFrames(buffer, type, srcchannel, nsrcchannels, NULL, 0, nsrcframes, firstchannel, nchannels);}
   virtual uint_t WriteSamples(const sint16_t *src, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteSamples((const uint8_t *)src, SampleFormatOf(src), srcchannel, nsrcchannels, nsrcframes, firstchannel, nchannels);}
   virtual uint_t WriteSamples(const sint32_t *src, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteSamples((const uint8_t *)src, SampleFormatOf(src), srcchannel, nsrcchannels, nsrcframes, firstchannel, nchannels);}
   virtual uint_t WriteSamples(const float    *src, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteSamples((const uint8_t *)src, SampleFormatOf(src), srcchannel, nsrcchannels, nsrcframes, firstchannel, nchannels);}
   virtual uint_t WriteSamples(const double   *src, uint_t srcchannel, uint_t nsrcchannels, uint_t nsrcframes = 1, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteSamples((const uint8_t *)src, SampleFormatOf(src), srcchannel, nsrcchannels, nsrcframes, firstchannel, nchannels);}
 
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames into separate (planar) buffers, one per channel
+   *
+   * @param dst array of destination buffers, one for each channel read (NULL entries are skipped)
+   * @param dstoffset offset in frames into each destination buffer
+   * @param frames maximum number of frames to read
+   * @param firstchannel first channel (within clip) to read
+   * @param nchannels maximum number of channels to read
+   *
+   * @return number of frames read
+   *
+   * @note samples are de-interleaved and converted straight from the file's sample buffer
+   * @note into the destination buffers, without an intermediate interleaved buffer
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t ReadSamplesPlanar(Sample_t *const *dst, uint_t dstoffset, uint_t frames, uint_t firstchannel = 0, uint_t nchannels = ~0) {return ReadFrames(NULL, SampleFormatOf((const Sample_t *)NULL), 0, ~0, dst, dstoffset, NULL, 0, frames, firstchannel, nchannels);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames, picking any channels through a channel map with gain applied
+   *
+   * @param dst interleaved destination buffer
+   * @param ndstchannels number of channels in each destination frame
+   * @param frames maximum number of frames to read
+   * @param map array of channel map entries, source channels relative to the clip
+   * (entries outside the clip or the destination are ignored)
+   * @param nmap number of entries in map
+   *
+   * @return number of frames read
+   *
+   * @note each block is read and converted once in a single pass, however many channels are picked
+   * @note destination channels not in the map are left untouched
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t ReadSamplesMapped(Sample_t *dst, uint_t ndstchannels, uint_t frames, const CHANNELROUTE *map, uint_t nmap) {return ReadFrames((uint8_t *)dst, SampleFormatOf(dst), 0, ndstchannels, NULL, 0, map, nmap, frames, 0, ~0);}
+  uint_t ReadSamplesMapped(Sample_t *dst, uint_t ndstchannels, uint_t frames, const std::vector<CHANNELROUTE>& map) {return ReadSamplesMapped(dst, ndstchannels, frames, map.empty() ? NULL : &map[0], (uint_t)map.size());}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write sample frames from separate (planar) buffers, one per channel
+   *
+   * @param src array of source buffers, one for each channel written (NULL entries write silence)
+   * @param srcoffset offset in frames into each source buffer
+   * @param nsrcframes number of frames to write
+   * @param firstchannel first channel (within clip) to write
+   * @param nchannels maximum number of channels to write
+   *
+   * @return number of frames written
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t WriteSamplesPlanar(const Sample_t *const *src, uint_t srcoffset, uint_t nsrcframes, uint_t firstchannel = 0, uint_t nchannels = ~0) {return WriteFrames(NULL, SampleFormatOf((const Sample_t *)NULL), 0, ~0, src, srcoffset, nsrcframes, firstchannel, nchannels);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer that sample frames can be written into directly, avoiding an intermediate copy
+   *
+   * @param frames number of frames required
+   *
+   * @return pointer to buffer for interleaved frames of *all* channels in the file's sample format
+   * and endianness (see GetFormat()) or NULL
+   *
+   * @note the buffer is only valid until CommitWriteBuffer() is called
+   * @note where the file supports it (e.g. background writing), the buffer is owned by the file
+   * @note and is written to disk without being copied again
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint8_t *GetWriteBuffer(uint_t frames);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write frames previously written into buffer returned by GetWriteBuffer()
+   *
+   * @param frames number of frames to write (may be fewer than requested)
+   *
+   * @return number of frames written
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t   CommitWriteBuffer(uint_t frames);
+
 protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames into an interleaved buffer or, if planar is not NULL, into separate
+   * buffers for each channel or, if map is not NULL, through a channel map into an interleaved
+   * Sample_t buffer (see ReadSamples(), ReadSamplesPlanar() and ReadSamplesMapped())
+   *
+   * @note the request is limited to the clip here, once, for every type of read; derived
+   * @note objects that provide samples from elsewhere override ReadSampleBlock() and
+   * @note objects that know when channels are silent override IsChannelActive()
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Produce sample frames from the current position for objects that do not read a file
+   *
+   * @param dst destination for interleaved frames
+   * @param ndstchannels number of channels in each destination frame
+   * @param frames number of frames (no more than the sample buffer size or remaining in the clip)
+   * @param firstchannel first channel (within the format, not the clip) to produce
+   * @param nchannels number of channels to produce
+   *
+   * @return number of frames produced (fewer than requested at the end or on error)
+   *
+   * @note MUST NOT move the position, ReadFrames() does that and converts the frames into the
+   * @note destination(s) of the read (interleaved, planar or mapped)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual uint_t ReadSampleBlock(Sample_t *dst, uint_t ndstchannels, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether any channel may be inactive (see IsChannelActive())
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool HasInactiveChannels() const {return false;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether a channel is active at a position, inactive channels are output as
+   * silence without being read
+   *
+   * @param channel channel (within the format, not the clip)
+   * @param pos absolute sample position
+   * @param change set to absolute sample position at which this changes (~0 for never)
+   */
+  /*--------------------------------------------------------------------------------*/
+  virtual bool IsChannelActive(uint_t channel, uint64_t pos, uint64_t& change) const {UNUSED_PARAMETER(channel); UNUSED_PARAMETER(pos); change = ~(uint64_t)0; return true;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames, outputting silence for channels that are inactive (see
+   * IsChannelActive()) and reading only the span of active channels
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadSparseFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames (already limited to the clip) from the file or, for objects without
+   * a file, from ReadSampleBlock()
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadSourceFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames (already limited to the clip) from the file
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadFileFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames through ReadSampleBlock() into the sample buffer and output them from there
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadBlockFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write sample frames from an interleaved buffer or, if planar is not NULL, from separate
+   * buffers for each channel (see WriteSamples() and WriteSamplesPlanar())
+   *
+   * @note only objects with a writable file can be written to
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t WriteFrames(const uint8_t *buffer, SampleFormat_t type, uint_t srcchannel, uint_t nsrcchannels, const Sample_t *const *planar, uint_t planaroffset, uint_t nsrcframes, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read sample frames one channel at a time from the transposed cache (see ReadFileFrames())
+   *
+   * @param sbuffer buffer for samples of one channel
+   * @param sbufferframes number of frames sbuffer can hold
+   *
+   * @return number of frames read (fewer than requested if the cache cannot be read)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadTransposedFrames(uint8_t *sbuffer, uint_t sbufferframes, uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Output silence in place of sample frames and move position on (see ReadFileFrames())
+   *
+   * @return number of frames of silence
+   *
+   * @note used by non-blocking reads through a pool when the file is not open or no sample
+   * @note buffer is free (see FileHandlePool::NonBlocking)
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint_t ReadSilentFrames(uint8_t *buffer, SampleFormat_t type, uint_t dstchannel, uint_t ndstchannels, Sample_t *const *planar, uint_t planaroffset, const CHANNELROUTE *map, uint_t nmap, uint_t frames, uint_t firstchannel, uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** (Re)allocate sample buffer for samplebufferframes frames of all channels
+   *
+   * @note large enough for frames of Sample_t samples as well as of the file's format
+   */
+  /*--------------------------------------------------------------------------------*/
+  void AllocateSampleBuffer();
+
   virtual void UpdateData();
   virtual void UpdatePosition() {timebase.Set(GetAbsoluteSamplePosition());}
 
@@ -124,6 +385,11 @@ protected:
   const SoundFormat      *format;
   UniversalTime          timebase;
   RefCount<EnhancedFile> fileref;
+  FileHandlePool         *handlepool;
+  FileHandlePool::ENTRY  *handleentry;
+  std::string            filename;         // used to re-open file when no handle is held
+  TransposedCache        *transposedcache;
+  IOStatistics           *iostats;
   Clip_t                 clip;
   uint64_t               filepos;
   uint64_t               samplepos;
@@ -131,6 +397,11 @@ protected:
   uint64_t               totalbytes;
   uint8_t                *samplebuffer;
   uint_t                 samplebufferframes;
+  std::vector<uint8_t>   lendbuffer;
+  uint_t                 lentframes;
+  std::vector<uint8_t>   active;           // activity of requested channels during a sparse read
+  std::vector<CHANNELROUTE> sparsemap;     // channel map of active channels only
+  std::vector<uint8_t>   slotmapped;       // destination slots already taken whilst building sparsemap
   bool                   readonly;
   bool                   inerror;
 };
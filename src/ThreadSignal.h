@@ -0,0 +1,166 @@
+#ifndef __THREAD_SIGNAL__
+#define __THREAD_SIGNAL__
+
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <errno.h>
+#include <semaphore.h>
+#include <time.h>
+#endif
+
+#include <bbcat-base/misc.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Wakes threads waiting for something to change (work queued, queue space freed, etc)
+ *
+ * Each Signal() increments a count; a waiter reads the count with GetCount() *before*
+ * testing whatever it is waiting for and then waits for the count to change, so a change
+ * signalled between the test and the wait is never missed and any number of threads can
+ * wait on the same object
+ *
+ * Waiters sleep on a semaphore rather than a mutex and condition variable: Signal() never
+ * takes a lock, it only posts the semaphore (once per sleeping thread) if a thread is
+ * actually waiting, so it may be called from a real-time thread
+ */
+/*--------------------------------------------------------------------------------*/
+class ThreadSignal
+{
+public:
+  ThreadSignal() : count(0),
+                   sleepers(0)
+  {
+#ifdef _WIN32
+    sem = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+#elif defined(__APPLE__)
+    sem = dispatch_semaphore_create(0);
+#else
+    sem_init(&sem, 0, 0);
+#endif
+  }
+  ~ThreadSignal()
+  {
+#ifdef _WIN32
+    CloseHandle(sem);
+#elif defined(__APPLE__)
+    dispatch_release(sem);
+#else
+    sem_destroy(&sem);
+#endif
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return current count, to be passed to Wait()
+   */
+  /*--------------------------------------------------------------------------------*/
+  uint64_t GetCount() const {return count.load();}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wake all waiting threads
+   *
+   * @note lock-free, may be called from a real-time thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Signal()
+  {
+    uint_t n;
+
+    count.fetch_add(1);
+
+    // a waiter registers itself before re-checking the count so it either sees the new count or is posted
+    for (n = sleepers.load(); n; n--) Post();
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait until Signal() has been called since GetCount() returned seen
+   *
+   * @param seen value returned by GetCount() before testing the condition being waited for
+   * @param timeout maximum time to wait
+   *
+   * @return true if signalled, false if timed out
+   */
+  /*--------------------------------------------------------------------------------*/
+  template<typename DURATION>
+  bool Wait(uint64_t seen, const DURATION& timeout)
+  {
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    std::chrono::steady_clock::time_point now;
+
+    sleepers.fetch_add(1);
+
+    // posts left over from earlier signals wake early, so keep waiting until the count changes
+    while ((count.load() == seen) && ((now = std::chrono::steady_clock::now()) < end))
+    {
+      TimedWait(std::chrono::duration_cast<std::chrono::microseconds>(end - now).count());
+    }
+
+    sleepers.fetch_sub(1);
+
+    return (count.load() != seen);
+  }
+
+protected:
+  /*--------------------------------------------------------------------------------*/
+  /** Post semaphore
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Post()
+  {
+#ifdef _WIN32
+    ReleaseSemaphore(sem, 1, NULL);
+#elif defined(__APPLE__)
+    dispatch_semaphore_signal(sem);
+#else
+    sem_post(&sem);
+#endif
+  }
+
+  /*--------------------------------------------------------------------------------*/
+  /** Wait for semaphore to be posted for up to us microseconds
+   */
+  /*--------------------------------------------------------------------------------*/
+  void TimedWait(int64_t us)
+  {
+#ifdef _WIN32
+    WaitForSingleObject(sem, (DWORD)((us + 999) / 1000));
+#elif defined(__APPLE__)
+    dispatch_semaphore_wait(sem, dispatch_time(DISPATCH_TIME_NOW, us * 1000));
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    us += ts.tv_nsec / 1000;
+    ts.tv_sec  += (time_t)(us / 1000000);
+    ts.tv_nsec  = (long)(us % 1000000) * 1000;
+
+    while ((sem_timedwait(&sem, &ts) < 0) && (errno == EINTR)) ;
+#endif
+  }
+
+protected:
+  std::atomic<uint64_t> count;
+  std::atomic<uint_t>   sleepers;
+#ifdef _WIN32
+  HANDLE                sem;
+#elif defined(__APPLE__)
+  dispatch_semaphore_t  sem;
+#else
+  sem_t                 sem;
+#endif
+
+private:
+  // prevent copying
+  ThreadSignal(const ThreadSignal& obj);
+  ThreadSignal& operator = (const ThreadSignal& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,364 @@
+
+#include <string.h>
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include <bbcat-base/EnhancedFile.h>
+
+#include "TraceEvents.h"
+
+BBC_AUDIOTOOLBOX_START
+
+std::atomic<bool>     TraceEvents::enabled(false);
+std::atomic<uint_t>   TraceEvents::eventsperthread((uint_t)TraceEvents::DefaultEventsPerThread);
+std::atomic<uint64_t> TraceEvents::origin(0);
+
+/*--------------------------------------------------------------------------------*/
+/** Enable/disable tracing (disabled by default)
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::Enable(bool enable, uint_t n)
+{
+  uint64_t zero = 0;
+
+  eventsperthread.store(std::max(n, (uint_t)1));
+
+  // timestamps are relative to the first time tracing is enabled
+  if (enable) origin.compare_exchange_strong(zero, GetNanosecondTicks());
+
+  enabled.store(enable);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return lock, buffer list and free list, creating as necessary
+ *
+ * @note buffers are never deleted so that the events of threads that have finished can
+ * @note still be exported, instead they are put on the free list for new threads to use
+ */
+/*--------------------------------------------------------------------------------*/
+ThreadLockObject& TraceEvents::GetLock()
+{
+  static ThreadLockObject tlock;
+  return tlock;
+}
+
+std::vector<TraceEvents::BUFFER *>& TraceEvents::GetBufferList()
+{
+  static std::vector<BUFFER *> buffers;
+  return buffers;
+}
+
+std::vector<TraceEvents::BUFFER *>& TraceEvents::GetFreeList()
+{
+  static std::vector<BUFFER *> freebuffers;
+  return freebuffers;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create new buffer and add it to the list
+ */
+/*--------------------------------------------------------------------------------*/
+TraceEvents::BUFFER *TraceEvents::CreateBuffer()
+{
+  std::vector<BUFFER *>& buffers = GetBufferList();
+  BUFFER *buffer = new BUFFER;
+
+  buffer->events.resize(eventsperthread.load());
+  buffer->count.store(0);
+  buffer->dropped.store(0);
+
+  {
+    ThreadLock lock(GetLock());
+
+    buffer->tid = (uint_t)buffers.size() + 1;
+    buffers.push_back(buffer);
+  }
+
+  return buffer;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return buffer to the free list for another thread to use
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::RetireBuffer(BUFFER *buffer)
+{
+  ThreadLock lock(GetLock());
+
+  GetFreeList().push_back(buffer);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return buffer of calling thread, creating it if necessary
+ */
+/*--------------------------------------------------------------------------------*/
+TraceEvents::BUFFER *TraceEvents::GetThreadBuffer()
+{
+  static thread_local ThreadBuffer threadbuffer;
+
+  if (!threadbuffer.buffer)
+  {
+    BUFFER *buffer = NULL;
+
+    {
+      ThreadLock lock(GetLock());
+      std::vector<BUFFER *>& freebuffers = GetFreeList();
+
+      // take over the buffer of a thread that has finished, its events are kept and the
+      // events of this thread follow on from them (on the same timeline row)
+      if (freebuffers.size())
+      {
+        buffer = freebuffers.back();
+        freebuffers.pop_back();
+        buffer->threadname.clear();
+      }
+    }
+
+    threadbuffer.buffer = buffer ? buffer : CreateBuffer();
+  }
+
+  return threadbuffer.buffer;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create (or take over) the buffer of the calling thread now rather than on its first event
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::PrepareThread()
+{
+  GetThreadBuffer();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create buffers ready for threads that have not been started yet
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::ReserveBuffers(uint_t n)
+{
+  uint_t navailable;
+
+  {
+    ThreadLock lock(GetLock());
+    navailable = (uint_t)GetFreeList().size();
+  }
+
+  for (; navailable < n; navailable++) RetireBuffer(CreateBuffer());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Record a complete event in the buffer of the calling thread
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::Add(const char *name, const char *category, uint64_t start, uint64_t end, const char *arg)
+{
+  if (IsEnabled())
+  {
+    BUFFER *buffer = GetThreadBuffer();
+    uint_t n       = buffer->count.load(std::memory_order_relaxed);
+
+    if (n < buffer->events.size())
+    {
+      EVENT& event = buffer->events[n];
+
+      event.name     = name;
+      event.category = category;
+      event.start    = start;
+      event.duration = end - start;
+      if (arg)
+      {
+        strncpy(event.arg, arg, sizeof(event.arg) - 1);
+        event.arg[sizeof(event.arg) - 1] = 0;
+      }
+      else event.arg[0] = 0;
+
+      // publish event to exporter
+      buffer->count.store(n + 1, std::memory_order_release);
+    }
+    else buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Name the calling thread on the timeline (only if tracing is enabled)
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::SetThreadName(const std::string& name)
+{
+  if (IsEnabled())
+  {
+    BUFFER *buffer = GetThreadBuffer();
+    ThreadLock lock(GetLock());
+
+    buffer->threadname = name;
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return number of events dropped because buffers were full
+ */
+/*--------------------------------------------------------------------------------*/
+uint64_t TraceEvents::GetDropped()
+{
+  const std::vector<BUFFER *>& buffers = GetBufferList();
+  ThreadLock lock(GetLock());
+  uint64_t dropped = 0;
+  uint_t   i;
+
+  for (i = 0; i < buffers.size(); i++) dropped += buffers[i]->dropped.load(std::memory_order_relaxed);
+
+  return dropped;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Append string to JSON, escaping as necessary
+ */
+/*--------------------------------------------------------------------------------*/
+static void AppendJSONString(std::string& json, const char *str)
+{
+  json += '"';
+  for (; *str; str++)
+  {
+    char c = *str;
+
+    if      ((c == '"') || (c == '\\')) {json += '\\'; json += c;}
+    else if ((uint8_t)c < 0x20) Printf(json, "\\u%04x", (uint_t)(uint8_t)c);
+    else json += c;
+  }
+  json += '"';
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Generate Chrome trace-event JSON of all recorded events
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::GetJSON(std::string& json)
+{
+  const std::vector<BUFFER *>& buffers = GetBufferList();
+  ThreadLock lock(GetLock());
+  uint64_t t0      = origin.load();
+  uint64_t dropped = 0;
+  bool     first   = true;
+  uint_t   i, j;
+
+  json = "{\"traceEvents\":[\n";
+
+  for (i = 0; i < buffers.size(); i++)
+  {
+    const BUFFER& buffer = *buffers[i];
+    uint_t n = buffer.count.load(std::memory_order_acquire);
+
+    if (!buffer.threadname.empty())
+    {
+      Printf(json, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", buffer.tid);
+      AppendJSONString(json, buffer.threadname.c_str());
+      json += "}}";
+      first = false;
+    }
+
+    for (j = 0; j < n; j++)
+    {
+      const EVENT& event = buffer.events[j];
+      uint64_t start = (event.start > t0) ? event.start - t0 : 0;
+
+      // timestamps are in microseconds
+      Printf(json, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%s.%03u,\"dur\":%s.%03u",
+             first ? "" : ",\n",
+             event.name, event.category, buffer.tid,
+             StringFrom(start / 1000).c_str(), (uint_t)(start % 1000),
+             StringFrom(event.duration / 1000).c_str(), (uint_t)(event.duration % 1000));
+      if (event.arg[0])
+      {
+        json += ",\"args\":{\"arg\":";
+        AppendJSONString(json, event.arg);
+        json += "}";
+      }
+      json += "}";
+      first = false;
+    }
+
+    dropped += buffer.dropped.load(std::memory_order_relaxed);
+  }
+
+  Printf(json, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%s}}\n", StringFrom(dropped).c_str());
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write Chrome trace-event JSON of all recorded events to a file
+ */
+/*--------------------------------------------------------------------------------*/
+bool TraceEvents::WriteJSON(const char *filename)
+{
+  EnhancedFile fp;
+  bool success = false;
+
+  if (fp.fopen(filename, "w"))
+  {
+    std::string json;
+
+    GetJSON(json);
+
+    if (fp.fwrite(json.c_str(), 1, json.size()) == json.size()) success = true;
+    else BBCERROR("Failed to write trace events to '%s'", filename);
+
+    fp.fclose();
+  }
+  else BBCERROR("Failed to open '%s' for writing trace events", filename);
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Discard all recorded events
+ */
+/*--------------------------------------------------------------------------------*/
+void TraceEvents::Clear()
+{
+  const std::vector<BUFFER *>& buffers = GetBufferList();
+  ThreadLock lock(GetLock());
+  uint_t i;
+
+  for (i = 0; i < buffers.size(); i++)
+  {
+    buffers[i]->count.store(0);
+    buffers[i]->dropped.store(0);
+  }
+}
+
+TraceScope::TraceScope(const char *name, const char *category, const char *arg) : name(name),
+                                                                                   category(category),
+                                                                                   start(0)
+{
+  if (TraceEvents::IsEnabled())
+  {
+    SetArg(arg);
+    start = GetNanosecondTicks();
+  }
+}
+
+TraceScope::TraceScope(const char *name, const char *category, const std::string& arg) : name(name),
+                                                                                          category(category),
+                                                                                          start(0)
+{
+  if (TraceEvents::IsEnabled())
+  {
+    SetArg(arg.c_str());
+    start = GetNanosecondTicks();
+  }
+}
+
+TraceScope::~TraceScope()
+{
+  if (start) TraceEvents::Add(name, category, start, GetNanosecondTicks(), arg[0] ? arg : NULL);
+}
+
+void TraceScope::SetArg(const char *str)
+{
+  if (str)
+  {
+    strncpy(arg, str, sizeof(arg) - 1);
+    arg[sizeof(arg) - 1] = 0;
+  }
+  else arg[0] = 0;
+}
+
+BBC_AUDIOTOOLBOX_END
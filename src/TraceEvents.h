@@ -0,0 +1,208 @@
+#ifndef __TRACE_EVENTS__
+#define __TRACE_EVENTS__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <bbcat-base/misc.h>
+#include <bbcat-base/ThreadLock.h>
+
+BBC_AUDIOTOOLBOX_START
+
+/*--------------------------------------------------------------------------------*/
+/** Optional timeline tracing of file operations (opening, ADM parsing, sample I/O, closing)
+ *
+ * When enabled, scoped events (see TraceScope) are recorded into a fixed size buffer per
+ * thread and can be exported in Chrome trace-event JSON format (viewable in chrome://tracing
+ * or Perfetto) to show on one timeline where the time of an operation went
+ *
+ * Recording is lock-free: each thread only ever appends to its own buffer (the lock is only
+ * taken the first time a thread records an event and when exporting)
+ *
+ * When a thread exits its buffer (and the events in it) is kept for export and handed on to
+ * the next new thread, so memory is bounded by the number of threads running at once rather
+ * than by the number of threads ever started.  Real-time threads should call PrepareThread()
+ * before starting real-time work so that recording never allocates or locks on them
+ *
+ * Tracing is disabled by default, in which case the only cost of a TraceScope is an atomic
+ * flag test
+ */
+/*--------------------------------------------------------------------------------*/
+class TraceEvents
+{
+public:
+  enum
+  {
+    DefaultEventsPerThread = 16384,
+    MaxArgLength           = 48,        // maximum length of argument string (including terminator)
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable tracing (disabled by default)
+   *
+   * @param enable true to record events
+   * @param eventsperthread number of events each thread can record (applies to threads
+   * that have not yet recorded any events), events beyond this are dropped
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void Enable(bool enable = true, uint_t eventsperthread = DefaultEventsPerThread);
+  static bool IsEnabled() {return enabled.load(std::memory_order_relaxed);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Record a complete event in the buffer of the calling thread
+   *
+   * @param name event name (MUST be a string constant, only the pointer is stored)
+   * @param category event category (MUST be a string constant, only the pointer is stored)
+   * @param start start time (from GetNanosecondTicks())
+   * @param end end time (from GetNanosecondTicks())
+   * @param arg optional argument (e.g. filename), copied and truncated to MaxArgLength - 1 characters
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void Add(const char *name, const char *category, uint64_t start, uint64_t end, const char *arg = NULL);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Create (or take over) the buffer of the calling thread now rather than on its first event
+   *
+   * @note done whether or not tracing is enabled, so that enabling tracing later does not
+   * @note cause allocation or locking on the thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void PrepareThread();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Create buffers ready for threads that have not been started yet
+   *
+   * @param n number of buffers to make available (including any already available)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void ReserveBuffers(uint_t n);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Name the calling thread on the timeline (only if tracing is enabled)
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void SetThreadName(const std::string& name);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return number of events dropped because buffers were full
+   */
+  /*--------------------------------------------------------------------------------*/
+  static uint64_t GetDropped();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Generate Chrome trace-event JSON of all recorded events
+   *
+   * @note events can continue to be recorded whilst this is called
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void GetJSON(std::string& json);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Write Chrome trace-event JSON of all recorded events to a file
+   *
+   * @return true if file written successfully
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool WriteJSON(const char *filename);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Discard all recorded events
+   *
+   * @note this is *not* thread-safe against recording and must only be called when no
+   * @note traced operations are in progress
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void Clear();
+
+protected:
+  typedef struct
+  {
+    const char *name;
+    const char *category;
+    uint64_t   start;
+    uint64_t   duration;
+    char       arg[MaxArgLength];
+  } EVENT;
+
+  typedef struct
+  {
+    std::vector<EVENT>    events;       // fixed size, allocated on creation
+    std::atomic<uint_t>   count;        // number of events completed (written only by owning thread)
+    std::atomic<uint64_t> dropped;
+    uint_t                tid;
+    std::string           threadname;   // protected by the list lock
+  } BUFFER;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Holder of the buffer of a thread, retiring the buffer when the thread exits
+   */
+  /*--------------------------------------------------------------------------------*/
+  class ThreadBuffer
+  {
+  public:
+    ThreadBuffer() : buffer(NULL) {}
+    ~ThreadBuffer() {if (buffer) RetireBuffer(buffer);}
+
+    BUFFER *buffer;
+  };
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer of calling thread, creating it if necessary
+   */
+  /*--------------------------------------------------------------------------------*/
+  static BUFFER *GetThreadBuffer();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Create new buffer and add it to the list
+   */
+  /*--------------------------------------------------------------------------------*/
+  static BUFFER *CreateBuffer();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return buffer to the free list for another thread to use
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void RetireBuffer(BUFFER *buffer);
+
+  static ThreadLockObject& GetLock();
+  static std::vector<BUFFER *>& GetBufferList();
+  static std::vector<BUFFER *>& GetFreeList();
+
+protected:
+  static std::atomic<bool>     enabled;
+  static std::atomic<uint_t>   eventsperthread;
+  static std::atomic<uint64_t> origin;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Record an event covering the lifetime of this object
+ *
+ * @note name and category MUST be string constants
+ */
+/*--------------------------------------------------------------------------------*/
+class TraceScope
+{
+public:
+  TraceScope(const char *name, const char *category, const char *arg = NULL);
+  TraceScope(const char *name, const char *category, const std::string& arg);
+  ~TraceScope();
+
+protected:
+  void SetArg(const char *str);
+
+protected:
+  const char *name;
+  const char *category;
+  uint64_t   start;
+  char       arg[TraceEvents::MaxArgLength];
+
+private:
+  // prevent copying
+  TraceScope(const TraceScope& obj);
+  TraceScope& operator = (const TraceScope& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -0,0 +1,430 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <algorithm>
+
+#define BBCDEBUG_LEVEL 1
+#include "TransposedCache.h"
+#include "SoundFileAttributes.h"
+
+BBC_AUDIOTOOLBOX_START
+
+// identifies sidecar files (and, through the version, the byte order of their headers)
+static const char     Magic[8] = {'B', 'B', 'C', 'T', 'R', 'N', 'S', 'P'};
+static const uint32_t Version  = 1;
+
+TransposedCache::TransposedCache(uint_t blockframes) :
+  cachefile(NULL),
+  blockframes(std::max(blockframes, (uint_t)1)),
+  channelfraction(.125)
+{
+  memset(&header, 0, sizeof(header));
+
+  maxchannels.store(0);
+  state.store(State_Closed);
+  autobuild.store(true);
+}
+
+TransposedCache::~TransposedCache()
+{
+  Close();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open cache for sample data of a sound file, validating any existing sidecar
+ *
+ * @param filename sound file
+ * @param datapos position of sample data within sound file
+ * @param nframes number of frames of sample data
+ * @param format format of sample data
+ * @param cachefilename sidecar file (empty for the default, see GetDefaultCacheFilename())
+ *
+ * @return true if cache is open for the given sample data (possibly already by another object)
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::Open(const std::string& filename, uint64_t datapos, uint64_t nframes, const SoundFormat& format, const std::string& cachefilename)
+{
+  ThreadLock lock(tlock);
+  HEADER hdr;
+  bool   success = false;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, Magic, sizeof(hdr.magic));
+  hdr.version        = Version;
+  hdr.channels       = format.GetChannels();
+  hdr.sampleformat   = (uint32_t)format.GetSampleFormat();
+  hdr.bigendian      = format.GetSamplesBigEndian();
+  hdr.bytespersample = format.GetBytesPerSample();
+  hdr.blockframes    = blockframes;
+  hdr.datapos        = datapos;
+  hdr.nframes        = nframes;
+
+  if (GetState() != State_Closed)
+  {
+    // already open (e.g. by another object reading the same file), the sample data must be the same
+    hdr.filesize = header.filesize;
+    hdr.filetime = header.filetime;
+
+    if ((filename == this->filename) && (memcmp(&hdr, &header, sizeof(hdr)) == 0)) success = true;
+    else BBCERROR("Transposed cache for '%s' cannot be used for '%s'", this->filename.c_str(), filename.c_str());
+  }
+  else if (!hdr.channels || !hdr.bytespersample)
+  {
+    BBCERROR("Invalid format for transposed cache of '%s'", filename.c_str());
+  }
+  else if (!GetFileIdentity(filename, hdr))
+  {
+    BBCERROR("Failed to examine '%s' for transposed cache, error %s", filename.c_str(), strerror(errno));
+  }
+  else
+  {
+    this->filename      = filename;
+    this->cachefilename = cachefilename.empty() ? GetDefaultCacheFilename(filename) : cachefilename;
+    header              = hdr;
+
+    state.store(OpenCacheFile() ? State_Ready : State_Missing);
+    UpdateMaxChannels();
+
+    BBCDEBUG2(("Transposed cache '%s' for '%s' is %s", this->cachefilename.c_str(), filename.c_str(), IsReady() ? "ready" : "missing"));
+
+    success = true;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Stop any build and close sidecar
+ */
+/*--------------------------------------------------------------------------------*/
+void TransposedCache::Close()
+{
+  StopBuild();
+
+  ThreadLock lock(tlock);
+  if (cachefile)
+  {
+    cachefile->fclose();
+    delete cachefile;
+    cachefile = NULL;
+  }
+
+  filename.clear();
+  cachefilename.clear();
+  memset(&header, 0, sizeof(header));
+
+  state.store(State_Closed);
+  UpdateMaxChannels();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Build sidecar in the calling thread
+ *
+ * @return true if sidecar is ready
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::Build()
+{
+  uint_t expected = State_Missing;
+
+  // claim build, retrying if a previous build failed
+  if (state.compare_exchange_strong(expected, State_Building) ||
+      ((expected == State_Failed) && state.compare_exchange_strong(expected, State_Building)))
+  {
+    FinishBuild(BuildCacheFile(NULL), false);
+  }
+
+  return IsReady();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Start building sidecar in a background thread (if it is not ready or being built)
+ *
+ * @return true if sidecar is ready or being built
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::StartBuild()
+{
+  uint_t expected = State_Missing;
+
+  if (state.compare_exchange_strong(expected, State_Building) ||
+      ((expected == State_Failed) && state.compare_exchange_strong(expected, State_Building)))
+  {
+    // collect previous (finished) build thread
+    if (thread.IsRunning()) thread.Stop();
+
+    BBCDEBUG2(("Building transposed cache '%s' in background", cachefilename.c_str()));
+
+    if (!thread.Start(&__BuildThread, (void *)this))
+    {
+      BBCERROR("Failed to start transposed cache build thread");
+      state.store(State_Failed);
+    }
+  }
+
+  expected = state.load();
+
+  return ((expected == State_Building) || (expected == State_Ready));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Abandon background build
+ */
+/*--------------------------------------------------------------------------------*/
+void TransposedCache::StopBuild()
+{
+  if (thread.IsRunning()) thread.Stop();
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether a read of nchannels channels should be served from the cache, starting
+ * a background build if the sidecar is missing and automatic building is enabled
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::UseFor(uint_t nchannels)
+{
+  uint_t current = state.load();
+
+  if ((current == State_Missing) && autobuild && nchannels && (nchannels <= maxchannels)) StartBuild();
+
+  return ((current == State_Ready) && nchannels && (nchannels <= maxchannels));
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read samples of a single channel from the sidecar
+ *
+ * @param channel channel within sound file
+ * @param frame first frame to read
+ * @param nframes number of frames to read
+ * @param dst destination for nframes contiguous samples in the sound file's sample format
+ *
+ * @return true if all samples were read
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::ReadChannel(uint_t channel, uint64_t frame, uint_t nframes, uint8_t *dst)
+{
+  ThreadLock lock(tlock);
+  uint64_t bpb     = (uint64_t)header.blockframes * header.channels * header.bytespersample;
+  bool     success = (cachefile && (channel < header.channels) && ((frame + nframes) <= header.nframes));
+
+  while (success && nframes)
+  {
+    // each block holds all samples of channel 0, then all of channel 1, etc (the last block may be short)
+    uint64_t block  = frame / header.blockframes;
+    uint_t   offset = (uint_t)(frame - block * header.blockframes);
+    uint_t   nb     = (uint_t)std::min((uint64_t)header.blockframes, header.nframes - block * header.blockframes);
+    uint_t   n      = std::min(nframes, nb - offset);
+    uint64_t pos    = sizeof(header) + block * bpb + ((uint64_t)channel * nb + offset) * header.bytespersample;
+
+    if ((cachefile->fseek((off_t)pos, SEEK_SET) == 0) && (cachefile->fread(dst, header.bytespersample, n) == n))
+    {
+      dst     += n * header.bytespersample;
+      frame   += n;
+      nframes -= n;
+    }
+    else
+    {
+      BBCERROR("Failed to read from transposed cache '%s', error %s (no longer using it)", cachefilename.c_str(), strerror(cachefile->ferror()));
+      state.store(State_Failed);
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Fill header with size and modification time of sound file
+ *
+ * @return false if sound file cannot be examined
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::GetFileIdentity(const std::string& filename, HEADER& hdr)
+{
+  struct stat st;
+  bool success = false;
+
+  if (stat(filename.c_str(), &st) == 0)
+  {
+    hdr.filesize = (uint64_t)st.st_size;
+    hdr.filetime = (uint64_t)st.st_mtime;
+    success = true;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open existing sidecar if it matches header
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::OpenCacheFile()
+{
+  EnhancedFile *file = new EnhancedFile;
+  HEADER hdr;
+  bool   success = false;
+
+  if (file->fopen(cachefilename.c_str(), "rb"))
+  {
+    uint64_t bytes = sizeof(header) + header.nframes * header.channels * header.bytespersample;
+
+    // header (including sound file identity) and size must match
+    if ((file->fread(&hdr, sizeof(hdr), 1) == 1) &&
+        (memcmp(&hdr, &header, sizeof(hdr)) == 0) &&
+        (file->fseek(0, SEEK_END) == 0) &&
+        ((uint64_t)file->ftell() == bytes))
+    {
+      success = true;
+    }
+    else BBCDEBUG1(("Transposed cache '%s' does not match '%s', ignoring it", cachefilename.c_str(), filename.c_str()));
+  }
+
+  if (success)
+  {
+    if (cachefile) delete cachefile;
+    cachefile = file;
+  }
+  else delete file;
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Transpose sound file into temporary file and replace sidecar with it
+ *
+ * @param thread thread doing the build (to check for stop requests) or NULL
+ */
+/*--------------------------------------------------------------------------------*/
+bool TransposedCache::BuildCacheFile(const Thread *thread)
+{
+  EnhancedFile src, dst;
+  std::string  tmpfilename = cachefilename + ".tmp";
+  HEADER       hdr = header;
+  uint_t       bps = hdr.bytespersample;
+  size_t       bpf = (size_t)hdr.channels * bps;
+  bool         success = false;
+
+  if (!src.fopen(filename.c_str(), "rb"))
+  {
+    BBCERROR("Failed to open '%s' for reading", filename.c_str());
+  }
+  else if (!dst.fopen(tmpfilename.c_str(), "wb"))
+  {
+    BBCERROR("Failed to open '%s' for writing", tmpfilename.c_str());
+  }
+  else if ((src.fseek((off_t)hdr.datapos, SEEK_SET) != 0) || (dst.fwrite(&hdr, sizeof(hdr), 1) != 1))
+  {
+    BBCERROR("Failed to start transposed cache '%s'", tmpfilename.c_str());
+  }
+  else
+  {
+    std::vector<uint8_t> interleaved(hdr.blockframes * bpf), transposed(interleaved.size());
+    uint64_t frame;
+
+    success = true;
+    for (frame = 0; success && (frame < hdr.nframes); frame += hdr.blockframes)
+    {
+      uint_t nb = (uint_t)std::min((uint64_t)hdr.blockframes, hdr.nframes - frame);
+      uint_t i, j;
+
+      if (thread && thread->StopRequested())
+      {
+        BBCDEBUG2(("Abandoned building transposed cache '%s'", cachefilename.c_str()));
+        success = false;
+      }
+      else if (src.fread(&interleaved[0], bpf, nb) != nb)
+      {
+        BBCERROR("Failed to read frames %s-%s of '%s', error %s", StringFrom(frame).c_str(), StringFrom(frame + nb).c_str(), filename.c_str(), strerror(src.ferror()));
+        success = false;
+      }
+      else
+      {
+        // transpose block so that all samples of each channel are together
+        for (i = 0; i < hdr.channels; i++)
+        {
+          const uint8_t *s = &interleaved[i * bps];
+          uint8_t       *d = &transposed[i * nb * bps];
+
+          for (j = 0; j < nb; j++, s += bpf, d += bps) memcpy(d, s, bps);
+        }
+
+        if (dst.fwrite(&transposed[0], bpf, nb) != nb)
+        {
+          BBCERROR("Failed to write to '%s', error %s", tmpfilename.c_str(), strerror(dst.ferror()));
+          success = false;
+        }
+      }
+    }
+  }
+
+  src.fclose();
+  dst.fclose();
+
+  // the sound file must not have changed whilst it was being transposed
+  if (success)
+  {
+    HEADER current = hdr;
+
+    if (!GetFileIdentity(filename, current) || (current.filesize != hdr.filesize) || (current.filetime != hdr.filetime))
+    {
+      BBCERROR("'%s' changed whilst building transposed cache", filename.c_str());
+      success = false;
+    }
+  }
+
+  if (success && (rename(tmpfilename.c_str(), cachefilename.c_str()) != 0))
+  {
+    BBCERROR("Failed to rename '%s' to '%s', error %s", tmpfilename.c_str(), cachefilename.c_str(), strerror(errno));
+    success = false;
+  }
+
+  if (!success) remove(tmpfilename.c_str());
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open built sidecar and update state
+ *
+ * @param success true if sidecar was built
+ * @param abandoned true if build was stopped (the sidecar is still missing rather than failed)
+ */
+/*--------------------------------------------------------------------------------*/
+void TransposedCache::FinishBuild(bool success, bool abandoned)
+{
+  ThreadLock lock(tlock);
+
+  if (success && OpenCacheFile())
+  {
+    BBCDEBUG2(("Transposed cache '%s' ready", cachefilename.c_str()));
+    state.store(State_Ready);
+  }
+  else state.store(abandoned ? State_Missing : State_Failed);
+}
+
+void TransposedCache::UpdateMaxChannels()
+{
+  uint_t channels = (GetState() != State_Closed) ? header.channels : 0;
+
+  // reads of all channels are always better served from the sound file itself
+  maxchannels.store(channels ? std::min((uint_t)std::max(channels * channelfraction, 1.0), channels - 1) : 0);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Build thread
+ */
+/*--------------------------------------------------------------------------------*/
+void *TransposedCache::BuildThread(Thread& thread)
+{
+  bool success = BuildCacheFile(&thread);
+
+  FinishBuild(success, thread.StopRequested());
+
+  return NULL;
+}
+
+BBC_AUDIOTOOLBOX_END
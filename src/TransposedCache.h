@@ -0,0 +1,225 @@
+#ifndef __TRANSPOSED_CACHE__
+#define __TRANSPOSED_CACHE__
+
+#include <string>
+#include <atomic>
+
+#include <bbcat-base/EnhancedFile.h>
+#include <bbcat-base/Thread.h>
+#include <bbcat-base/ThreadLock.h>
+
+BBC_AUDIOTOOLBOX_START
+
+class SoundFormat;
+
+/*--------------------------------------------------------------------------------*/
+/** Sidecar file holding the sample data of a sound file channel-major (transposed) in large
+ * blocks so that a few channels can be read from a wide file without reading every channel
+ *
+ * The sidecar stores, for each block of frames, every sample of channel 0, then every sample
+ * of channel 1, etc, in the file's own sample format.  Reading one channel of a block is
+ * therefore a single contiguous read.  The sidecar records the size and modification time of
+ * the sound file and the position and size of its sample data; a sidecar that does not match
+ * the sound file is ignored and rebuilt
+ *
+ * The sidecar can be built in the calling thread (Build()), in a background thread
+ * (StartBuild()) or automatically in a background thread when it is first needed.  It is
+ * written to a temporary file which only replaces the sidecar once complete so a sidecar is
+ * never seen part-built
+ *
+ * One cache can be shared by several SoundFileSamples objects of the same file (e.g.
+ * duplicates read from other threads), see SoundFileSamples::UseTransposedCache()
+ */
+/*--------------------------------------------------------------------------------*/
+class TransposedCache
+{
+public:
+  /*--------------------------------------------------------------------------------*/
+  /** Constructor
+   *
+   * @param blockframes number of frames in each block of the sidecar
+   */
+  /*--------------------------------------------------------------------------------*/
+  TransposedCache(uint_t blockframes = 16384);
+  ~TransposedCache();
+
+  typedef enum
+  {
+    State_Closed = 0,             // not opened
+    State_Missing,                // no valid sidecar (not yet built)
+    State_Building,               // sidecar being built
+    State_Ready,                  // sidecar valid and open for reading
+    State_Failed,                 // sidecar could not be built or read
+  } State_t;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open cache for sample data of a sound file, validating any existing sidecar
+   *
+   * @param filename sound file
+   * @param datapos position of sample data within sound file
+   * @param nframes number of frames of sample data
+   * @param format format of sample data
+   * @param cachefilename sidecar file (empty for the default, see GetDefaultCacheFilename())
+   *
+   * @return true if cache is open for the given sample data (possibly already by another object)
+   *
+   * @note a sidecar is only valid if the size and modification time of the sound file match
+   * @note those recorded when it was built
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Open(const std::string& filename, uint64_t datapos, uint64_t nframes, const SoundFormat& format, const std::string& cachefilename = "");
+
+  /*--------------------------------------------------------------------------------*/
+  /** Stop any build and close sidecar
+   */
+  /*--------------------------------------------------------------------------------*/
+  void Close();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return default sidecar filename for a sound file
+   */
+  /*--------------------------------------------------------------------------------*/
+  static std::string GetDefaultCacheFilename(const std::string& filename) {return filename + ".transposed";}
+  const std::string& GetCacheFilename() const {return cachefilename;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Build sidecar in the calling thread
+   *
+   * @return true if sidecar is ready
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool Build();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Start building sidecar in a background thread (if it is not ready or being built)
+   *
+   * @return true if sidecar is ready or being built
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool StartBuild();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Abandon background build (it is started again when needed if automatic building is enabled)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void StopBuild();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Enable/disable building in the background when the sidecar is first needed (enabled by default)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void SetAutoBuild(bool enable = true) {autobuild = enable;}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Set largest fraction of the file's channels that reads are served from the cache for
+   * (reads of more channels are better served by reading interleaved frames)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void   SetChannelFraction(double fraction) {channelfraction = fraction; UpdateMaxChannels();}
+  double GetChannelFraction() const          {return channelfraction;}
+
+  State_t GetState() const {return (State_t)state.load();}
+  bool    IsReady()  const {return (GetState() == State_Ready);}
+
+  /*--------------------------------------------------------------------------------*/
+  /** Return whether a read of nchannels channels should be served from the cache, starting
+   * a background build if the sidecar is missing and automatic building is enabled
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool UseFor(uint_t nchannels);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Read samples of a single channel from the sidecar
+   *
+   * @param channel channel within sound file
+   * @param frame first frame to read
+   * @param nframes number of frames to read
+   * @param dst destination for nframes contiguous samples in the sound file's sample format
+   *
+   * @return true if all samples were read
+   *
+   * @note a read error marks the cache as failed so that it is no longer used
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool ReadChannel(uint_t channel, uint64_t frame, uint_t nframes, uint8_t *dst);
+
+protected:
+  typedef struct
+  {
+    char     magic[8];
+    uint32_t version;
+    uint32_t channels;
+    uint32_t sampleformat;
+    uint32_t bigendian;
+    uint32_t bytespersample;
+    uint32_t blockframes;
+    uint64_t filesize;          // size of sound file
+    uint64_t filetime;          // modification time of sound file
+    uint64_t datapos;
+    uint64_t nframes;
+  } HEADER;
+
+  /*--------------------------------------------------------------------------------*/
+  /** Fill header with size and modification time of sound file
+   *
+   * @return false if sound file cannot be examined
+   */
+  /*--------------------------------------------------------------------------------*/
+  static bool GetFileIdentity(const std::string& filename, HEADER& hdr);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open existing sidecar if it matches header
+   *
+   * @note MUST be called with lock held
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool OpenCacheFile();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Transpose sound file into temporary file and replace sidecar with it
+   *
+   * @param thread thread doing the build (to check for stop requests) or NULL
+   */
+  /*--------------------------------------------------------------------------------*/
+  bool BuildCacheFile(const Thread *thread);
+
+  /*--------------------------------------------------------------------------------*/
+  /** Open built sidecar and update state
+   *
+   * @param success true if sidecar was built
+   * @param abandoned true if build was stopped (the sidecar is still missing rather than failed)
+   */
+  /*--------------------------------------------------------------------------------*/
+  void FinishBuild(bool success, bool abandoned);
+
+  void UpdateMaxChannels();
+
+  /*--------------------------------------------------------------------------------*/
+  /** Build thread
+   */
+  /*--------------------------------------------------------------------------------*/
+  static void *__BuildThread(Thread& thread, void *arg) {return ((TransposedCache *)arg)->BuildThread(thread);}
+  void *BuildThread(Thread& thread);
+
+protected:
+  ThreadLockObject    tlock;        // protects sidecar file handle
+  Thread              thread;
+  std::string         filename;
+  std::string         cachefilename;
+  HEADER              header;
+  EnhancedFile        *cachefile;
+  uint_t              blockframes;
+  double              channelfraction;
+  std::atomic<uint_t> maxchannels;
+  std::atomic<uint_t> state;
+  std::atomic<bool>   autobuild;
+
+private:
+  // prevent copying
+  TransposedCache(const TransposedCache& obj);
+  TransposedCache& operator = (const TransposedCache& obj);
+};
+
+BBC_AUDIOTOOLBOX_END
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "XMLADMData.h"
 #include "RIFFChunk_Definitions.h"
+#include "TraceEvents.h"
 
 // currently the chna chunk is specified as having either 32 or 2048 entries for tracks
 // define CHNA_FIXED_UIDS_LOWER as 0 to disable this behaviour
@@ -60,6 +61,7 @@ bool XMLADMData::LoadStandardDefinitions(const std::string& filename)
     "share",                        // local location
     "{sharedir}/bbcat-fileio",      // global location
   };
+  TraceScope  trace("LoadStandardDefinitions", "adm");
   std::string filename2 = filename;
   bool success = false;
 
@@ -108,6 +110,7 @@ bool XMLADMData::LoadStandardDefinitions(const std::string& filename)
 /*--------------------------------------------------------------------------------*/
 bool XMLADMData::SetChna(const uint8_t *data, uint64_t len)
 {
+  TraceScope trace("SetChna", "adm");
   const CHNA_CHUNK& chna = *(const CHNA_CHUNK *)data;
   uint_t maxuids = (uint_t)((len - sizeof(CHNA_CHUNK)) / sizeof(chna.UIDs[0]));   // calculate maximum number of UIDs given chunk length
   std::string terminator;
@@ -178,13 +181,18 @@ bool XMLADMData::SetChna(const uint8_t *data, uint64_t len)
 /*--------------------------------------------------------------------------------*/
 bool XMLADMData::SetAxml(const char *data, bool finalise)
 {
+  TraceScope trace("SetAxml", "adm");
   bool success = false;
 
   BBCDEBUG3(("Read XML:\n%s", data));
 
   if (TranslateXML(data))
   {
-    if (finalise) Finalise();
+    if (finalise)
+    {
+      TraceScope trace("Finalise", "adm");
+      Finalise();
+    }
 
     success = true;
   }
@@ -203,13 +211,18 @@ bool XMLADMData::SetAxml(const char *data, bool finalise)
 /*--------------------------------------------------------------------------------*/
 bool XMLADMData::SetAxml(const std::string& data, bool finalise)
 {
+  TraceScope trace("SetAxml", "adm");
   bool success = false;
 
   BBCDEBUG3(("Read XML:\n%s", data.c_str()));
 
   if (TranslateXML(data.c_str()))
   {
-    if (finalise) Finalise();
+    if (finalise)
+    {
+      TraceScope trace("Finalise", "adm");
+      Finalise();
+    }
 
     success = true;
   }
@@ -0,0 +1,357 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "ADMRIFFFile.h"
+#include "ADMAudioFileSamples.h"
+#include "ADMObjectExtractor.h"
+#include "RIFFChunk_Definitions.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+static const uint32_t SampleRate    = 48000;
+static const uint_t   Channels      = 4;
+static const uint_t   ObjectStep    = 4800;                   // object on each track starts 100ms after the previous one
+static const uint64_t FileFrames    = Channels * ObjectStep;
+static const uint64_t TimeReference = 123456789;
+
+/*--------------------------------------------------------------------------------*/
+/** Return sample of test signal (exact in 24 bits)
+ */
+/*--------------------------------------------------------------------------------*/
+static sint32_t testsample(uint64_t frame, uint_t channel)
+{
+  return (sint32_t)((uint32_t)(((frame * Channels + channel) * 2654435761U) & 0xffffff) << 8);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames of test signal at the current position of file
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeframes(RIFFFile& file, uint64_t start, uint64_t nframes)
+{
+  std::vector<sint32_t> buffer(nframes * Channels);
+  uint64_t i;
+  uint_t   j;
+
+  for (i = 0; i < nframes; i++)
+  {
+    for (j = 0; j < Channels; j++) buffer[i * Channels + j] = testsample(start + i, j);
+  }
+
+  return (file.WriteSamples(&buffer[0], 0, Channels, (uint_t)nframes) == (sint_t)nframes);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return name of the object on a track
+ */
+/*--------------------------------------------------------------------------------*/
+static std::string objectname(uint_t track)
+{
+  std::string name;
+
+  Printf(name, "Object %u", track + 1);
+
+  return name;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create ADM with a separate object on each track
+ */
+/*--------------------------------------------------------------------------------*/
+static void createobjects(ADMRIFFFile& file)
+{
+  ADMData *adm = file.GetADM();
+
+  if (adm)
+  {
+    const ADMData::TRACKLIST& tracklist = adm->GetTrackList();
+    ADMData::OBJECTNAMES names;
+    uint_t t;
+
+    names.programmeName = "ADM Object Test Programme";
+    names.contentName   = "ADM Object Test Content";
+    names.typeLabel     = ADMObject::TypeLabel_Objects;
+
+    for (t = 0; t < tracklist.size(); t++)
+    {
+      std::string trackname;
+
+      Printf(trackname, "Track %u", t + 1);
+
+      names.objectName        = objectname(t);
+      names.packFormatName    = "Pack of " + names.objectName;
+      names.trackNumber       = t;
+      names.channelFormatName = trackname;
+      names.streamFormatName  = "PCM_" + trackname;
+      names.trackFormatName   = "PCM_" + trackname;
+
+      adm->CreateObjects(names);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set position of the object on a track (adding a blockFormat at the current position)
+ */
+/*--------------------------------------------------------------------------------*/
+static void setposition(ADMRIFFFile& file, uint_t track)
+{
+  AudioObjectParameters params;
+  Position pos;
+
+  pos.polar  = true;
+  pos.pos.az = (double)track * 30.0;
+  pos.pos.el = 0.0;
+  pos.pos.d  = 1.0;
+  params.SetPosition(pos);
+
+  file.SetObjectParameters(track, params);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create ADM BWF with an object on each track, the object on track t starting at
+ * t * ObjectStep and running to the end of the file
+ */
+/*--------------------------------------------------------------------------------*/
+static bool createadmfile(const char *filename)
+{
+  ADMRIFFFile file;
+  bool success = false;
+
+  file.CreateADM();
+  file.SetTimeReference(TimeReference);
+
+  if (file.Create(filename, SampleRate, Channels, SampleFormat_24bit))
+  {
+    uint_t t;
+
+    createobjects(file);
+
+    success = true;
+    for (t = 0; success && (t < Channels); t++)
+    {
+      setposition(file, t);
+      success = writeframes(file, t * ObjectStep, ObjectStep);
+    }
+
+    file.Close();
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return object of ADM with the specified name (or NULL)
+ */
+/*--------------------------------------------------------------------------------*/
+static const ADMAudioObject *findobject(const ADMRIFFFile& file, const std::string& name)
+{
+  std::vector<const ADMAudioObject *> objects;
+  uint_t i;
+
+  if (file.GetADM()) file.GetADM()->GetAudioObjectList(objects);
+
+  for (i = 0; i < objects.size(); i++)
+  {
+    if (objects[i]->GetName() == name) return objects[i];
+  }
+
+  return NULL;
+}
+
+TEST_CASE("admobject_extractstems")
+{
+  static const char *filename = "admobjecttest-extract.wav";
+  static const std::string prefix = "admobjecttest-stem-";
+  std::vector<const ADMAudioObject *> objects;
+  std::vector<std::string> stems;
+  uint_t t;
+
+  REQUIRE(createadmfile(filename));
+
+  {
+    ADMRIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    REQUIRE(file.GetADM() != NULL);
+
+    for (t = 0; t < Channels; t++)
+    {
+      const ADMAudioObject *object;
+
+      REQUIRE((object = findobject(file, objectname(t))) != NULL);
+      objects.push_back(object);
+      stems.push_back(prefix + object->GetID() + ".wav");
+    }
+
+    {
+      ADMObjectExtractor extractor(file);
+
+      // blocks that straddle the start of each object
+      extractor.SetBlockSize(1000);
+      CHECK(extractor.AddObjects(objects, prefix) == Channels);
+      CHECK(extractor.GetObjectCount() == Channels);
+      CHECK(extractor.Extract());
+    }
+
+    file.Close();
+  }
+
+  // each stem holds the single track of its object over the object's window only
+  for (t = 0; t < Channels; t++)
+  {
+    const uint64_t start = t * ObjectStep, nframes = FileFrames - start;
+    std::vector<sint32_t> buffer(nframes);
+    RIFFFile stem;
+    RIFFbextChunk *bext;
+    uint64_t i, bad = 0;
+
+    INFO("object " << t);
+    REQUIRE(stem.Open(stems[t].c_str()));
+    CHECK(stem.GetChannels() == 1);
+    REQUIRE(stem.GetSampleLength() == nframes);
+
+    REQUIRE(stem.ReadSamples(&buffer[0], 0, 1, (uint_t)nframes) == (sint_t)nframes);
+    for (i = 0; i < nframes; i++) bad += (buffer[i] != testsample(start + i, t));
+    CHECK(bad == 0);
+
+    // stems are timed from the source's TimeReference
+    REQUIRE((bext = dynamic_cast<RIFFbextChunk *>(stem.GetChunk(bext_ID))) != NULL);
+    CHECK(bext->GetTimeReference() == (TimeReference + start));
+    stem.Close();
+
+    remove(stems[t].c_str());
+  }
+
+  remove(filename);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return whether a track is expected to be read at an absolute frame when only the
+ * objects on tracks 1 and 2 have been added
+ */
+/*--------------------------------------------------------------------------------*/
+static bool trackactive(uint_t track, uint64_t frame)
+{
+  return ((track == 1) || (track == 2)) && (frame >= (track * ObjectStep));
+}
+
+TEST_CASE("admobject_sparsereading")
+{
+  static const char *filename = "admobjecttest-sparse.wav";
+  static const uint_t BlockFrames = 1000;                     // blocks straddle the start of the object on track 2
+  // the last entry for each slot wins: slot 1 takes track 1 (active) and not track 0 (inactive)
+  static const CHANNELROUTE map[] =
+  {
+    {2, 0, 1.0},
+    {0, 1, 1.0},
+    {1, 1, 0.5},
+    {3, 2, 1.0},
+  };
+  static const uint_t MapChannels = 4;                        // slot 3 is not mapped and must be left untouched
+  std::vector<sint32_t> buffer(BlockFrames * Channels);
+  std::vector<Sample_t> reference(BlockFrames * MapChannels), mapped(BlockFrames * MapChannels);
+  uint64_t start, pos, bad;
+  uint_t   i, j;
+
+  REQUIRE(createadmfile(filename));
+
+  {
+    ADMRIFFFile file;
+    const ADMAudioObject *objects[2];
+
+    REQUIRE(file.Open(filename));
+    REQUIRE(file.GetADM() != NULL);
+    REQUIRE((objects[0] = findobject(file, objectname(1))) != NULL);
+    REQUIRE((objects[1] = findobject(file, objectname(2))) != NULL);
+
+    ADMAudioFileSamples samples(file);
+
+    REQUIRE(samples.Add(objects, NUMBEROF(objects)));
+
+    // clip is brought in to the start of the first object added
+    start = samples.GetClip().start;
+    CHECK(start == ObjectStep);
+    CHECK(samples.GetClip().nsamples == (FileFrames - start));
+
+    // activity follows the blocks of the objects added, tracks without objects are inactive
+    CHECK(!samples.IsTrackActive(0, start));
+    CHECK(samples.IsTrackActive(1, start));
+    CHECK(!samples.IsTrackActive(2, 2 * ObjectStep - 1));
+    CHECK(samples.IsTrackActive(2, 2 * ObjectStep));
+    CHECK(!samples.IsTrackActive(3, FileFrames - 1));
+
+    // without sparse reading every track is read
+    CHECK(!samples.SparseReadingEnabled());
+    for (pos = start, bad = 0; pos < FileFrames; pos += BlockFrames)
+    {
+      uint_t n = (uint_t)std::min((uint64_t)BlockFrames, FileFrames - pos);
+
+      REQUIRE(samples.ReadSamples(&buffer[0], 0, Channels, n) == n);
+      for (i = 0; i < n; i++)
+      {
+        for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != testsample(pos + i, j));
+      }
+    }
+    CHECK(bad == 0);
+
+    // with sparse reading, inactive tracks read as silence
+    samples.EnableSparseReading();
+    samples.SetSamplePosition(0);
+    for (pos = start, bad = 0; pos < FileFrames; pos += BlockFrames)
+    {
+      uint_t n = (uint_t)std::min((uint64_t)BlockFrames, FileFrames - pos);
+
+      std::fill(buffer.begin(), buffer.end(), 1);
+      REQUIRE(samples.ReadSamples(&buffer[0], 0, Channels, n) == n);
+      for (i = 0; i < n; i++)
+      {
+        for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != (trackactive(j, pos + i) ? testsample(pos + i, j) : 0));
+      }
+    }
+    CHECK(samples.GetAbsoluteSamplePosition() == FileFrames);
+    CHECK(bad == 0);
+
+    // reading only inactive tracks outputs silence
+    samples.SetSamplePosition(0);
+    std::fill(buffer.begin(), buffer.end(), 1);
+    REQUIRE(samples.ReadSamples(&buffer[0], 0, 2, BlockFrames, 2, 2) == BlockFrames);
+    for (i = 0, bad = 0; i < (BlockFrames * 2); i++) bad += (buffer[i] != 0);
+    CHECK(bad == 0);
+
+    // mapped reads silence the slots whose (last) route is from an inactive track
+    for (pos = start, bad = 0; pos < FileFrames; pos += BlockFrames)
+    {
+      uint_t n = (uint_t)std::min((uint64_t)BlockFrames, FileFrames - pos);
+
+      samples.EnableSparseReading(false);
+      samples.SetAbsoluteSamplePosition(pos);
+      std::fill(reference.begin(), reference.end(), 9.0);
+      REQUIRE(samples.ReadSamplesMapped(&reference[0], MapChannels, n, map, NUMBEROF(map)) == n);
+
+      samples.EnableSparseReading();
+      samples.SetAbsoluteSamplePosition(pos);
+      std::fill(mapped.begin(), mapped.end(), 9.0);
+      REQUIRE(samples.ReadSamplesMapped(&mapped[0], MapChannels, n, map, NUMBEROF(map)) == n);
+
+      for (i = 0; i < n; i++)
+      {
+        bad += (mapped[i * MapChannels + 0] != (trackactive(2, pos + i) ? reference[i * MapChannels + 0] : 0.0));
+        bad += (mapped[i * MapChannels + 1] != reference[i * MapChannels + 1]);
+        bad += (mapped[i * MapChannels + 2] != 0.0);
+        bad += (mapped[i * MapChannels + 3] != 9.0);
+      }
+    }
+    CHECK(bad == 0);
+
+    file.Close();
+  }
+
+  remove(filename);
+}
@@ -0,0 +1,421 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "ADMRIFFFile.h"
+#include "RIFFChunk_Definitions.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+static const uint32_t SampleRate    = 48000;
+static const uint_t   Channels      = 2;
+static const uint_t   BytesPerFrame = Channels * 3;     // 24-bit samples
+static const uint_t   BlockFrames   = 1024;
+
+/*--------------------------------------------------------------------------------*/
+/** Return sample of test signal (exact in 24 bits)
+ */
+/*--------------------------------------------------------------------------------*/
+static sint32_t testsample(uint64_t frame, uint_t channel)
+{
+  return (sint32_t)((uint32_t)(((frame * Channels + channel) * 2654435761U) & 0xffffff) << 8);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames of test signal at the current position of file
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeframes(RIFFFile& file, uint64_t start, uint64_t nframes)
+{
+  std::vector<sint32_t> buffer(BlockFrames * Channels);
+  bool success = true;
+
+  while (success && nframes)
+  {
+    uint_t n = (uint_t)std::min(nframes, (uint64_t)BlockFrames);
+    uint_t i, j;
+
+    for (i = 0; i < n; i++)
+    {
+      for (j = 0; j < Channels; j++) buffer[i * Channels + j] = testsample(start + i, j);
+    }
+
+    success  = (file.WriteSamples(&buffer[0], 0, Channels, n) == (sint_t)n);
+    start   += n;
+    nframes -= n;
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read frames of file and return number of samples that differ from the test signal
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t checkframes(RIFFFile& file, uint64_t start, uint64_t nframes)
+{
+  std::vector<sint32_t> buffer(BlockFrames * Channels);
+  uint64_t bad = 0;
+
+  file.GetSamples()->SetSamplePosition(start);
+
+  while (nframes)
+  {
+    uint_t n = (uint_t)std::min(nframes, (uint64_t)BlockFrames);
+    uint_t i, j;
+
+    if (file.ReadSamples(&buffer[0], 0, Channels, n) != (sint_t)n) return bad + nframes * Channels;
+
+    for (i = 0; i < n; i++)
+    {
+      for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != testsample(start + i, j));
+    }
+
+    start   += n;
+    nframes -= n;
+  }
+
+  return bad;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create ADM with a single object covering all tracks
+ */
+/*--------------------------------------------------------------------------------*/
+static void createobject(ADMRIFFFile& file)
+{
+  ADMData *adm = file.GetADM();
+
+  if (adm)
+  {
+    const ADMData::TRACKLIST& tracklist = adm->GetTrackList();
+    ADMData::OBJECTNAMES names;
+    uint_t t;
+
+    names.programmeName  = "Append Test Programme";
+    names.contentName    = "Append Test Content";
+    names.objectName     = "Append Test Object";
+    names.packFormatName = "Append Test Pack";
+    names.typeLabel      = ADMObject::TypeLabel_Objects;
+
+    for (t = 0; t < tracklist.size(); t++)
+    {
+      std::string trackname;
+
+      Printf(trackname, "Track %u", t + 1);
+
+      names.trackNumber       = t;
+      names.channelFormatName = trackname;
+      names.streamFormatName  = "PCM_" + trackname;
+      names.trackFormatName   = "PCM_" + trackname;
+
+      adm->CreateObjects(names);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Set position of every channel (adding blockFormats at the current position)
+ */
+/*--------------------------------------------------------------------------------*/
+static void setpositions(ADMRIFFFile& file, double az)
+{
+  uint_t j;
+
+  for (j = 0; j < file.GetChannels(); j++)
+  {
+    AudioObjectParameters params;
+    Position pos;
+
+    pos.polar  = true;
+    pos.pos.az = az + (double)j * 30.0;
+    pos.pos.el = 0.0;
+    pos.pos.d  = 1.0;
+    params.SetPosition(pos);
+
+    file.SetObjectParameters(j, params);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create ADM BWF with a single object covering all tracks and the whole file
+ */
+/*--------------------------------------------------------------------------------*/
+static bool createadmfile(const char *filename, uint64_t nframes)
+{
+  ADMRIFFFile file;
+  bool success = false;
+
+  file.CreateADM();
+
+  if (file.Create(filename, SampleRate, Channels, SampleFormat_24bit))
+  {
+    createobject(file);
+    setpositions(file, 0.0);
+
+    success = writeframes(file, 0, nframes);
+
+    file.Close();
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return duration of the only object in ADM (or 0 if there isn't exactly one)
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t objectduration(const ADMRIFFFile& file)
+{
+  std::vector<const ADMAudioObject *> objects;
+
+  if (file.GetADM()) file.GetADM()->GetAudioObjectList(objects);
+
+  return (objects.size() == 1) ? objects[0]->GetDuration() : 0;
+}
+
+static uint32_t getle32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void setle32(uint8_t *p, uint32_t value)
+{
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+  p[2] = (uint8_t)(value >> 16);
+  p[3] = (uint8_t)(value >> 24);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Grow data chunk of a closed WAVE file to just under 4GB without writing the samples
+ *
+ * The added samples are a hole in the file (sparse on most filesystems, read as zeros)
+ * and any chunks after the data chunk are moved to after the hole
+ *
+ * @return number of frames in the data chunk or 0 on failure
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t makesparse(const char *filename)
+{
+  std::vector<uint8_t> data, trailing;
+  EnhancedFile fp;
+  uint64_t pos = 12, datapos = 0, datalen = 0, dataend, newlen;
+  bool     success = false;
+
+  if (fp.fopen(filename, "rb"))
+  {
+    fp.fseek(0, SEEK_END);
+    data.resize((size_t)fp.ftell());
+    fp.rewind();
+    success = (fp.fread(&data[0], 1, data.size()) == data.size());
+    fp.fclose();
+  }
+  if (!success) return 0;
+
+  // find data chunk
+  while ((pos + 8) <= data.size())
+  {
+    uint32_t len = getle32(&data[pos + 4]);
+
+    if (memcmp(&data[pos], "data", 4) == 0)
+    {
+      datapos = pos;
+      datalen = len;
+      break;
+    }
+
+    pos += 8 + len + (len & 1);
+  }
+  if (!datapos) return 0;
+
+  dataend = datapos + 8 + datalen + (datalen & 1);
+  trailing.assign(data.begin() + (size_t)dataend, data.end());
+
+  // leave 64KB below 4GB so that appending a second of audio takes the file beyond 4GB
+  newlen = ((0xffffffffULL - 65536 - (datapos + 8) - trailing.size()) / (2 * BytesPerFrame)) * (2 * BytesPerFrame);
+
+  setle32(&data[4], (uint32_t)(datapos + 8 + newlen + trailing.size() - 8));
+  setle32(&data[datapos + 4], (uint32_t)newlen);
+
+  if (!fp.fopen(filename, "wb")) return 0;
+
+  // header and original samples, then the last byte of the hole and the chunks that followed the samples
+  success = ((fp.fwrite(&data[0], 1, (size_t)(datapos + 8 + datalen)) == (size_t)(datapos + 8 + datalen)) &&
+             (fp.fseek((off_t)(datapos + 8 + newlen - 1), SEEK_SET) == 0) &&
+             (fp.fwrite("", 1, 1) == 1) &&
+             (trailing.empty() || (fp.fwrite(&trailing[0], 1, trailing.size()) == trailing.size())));
+  fp.fclose();
+
+  return success ? newlen / BytesPerFrame : 0;
+}
+
+TEST_CASE("riffappend")
+{
+  const char *filename = "appendtest.wav";
+  const uint64_t nframes1 = 10000, nframes2 = 7000;
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Create(filename, SampleRate, Channels, SampleFormat_24bit));
+    CHECK(writeframes(file, 0, nframes1));
+    file.Close();
+  }
+
+  {
+    RIFFFile file;
+
+    // appending continues from the end of the existing samples
+    REQUIRE(file.Append(filename));
+    CHECK(file.GetSamples()->GetSamplePosition() == nframes1);
+    CHECK(writeframes(file, nframes1, nframes2));
+    file.Close();
+  }
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetSampleLength() == (nframes1 + nframes2));
+    CHECK(checkframes(file, 0, nframes1 + nframes2) == 0);
+
+    // still small enough to be a RIFF file
+    CHECK(file.GetChunk(RIFF_ID) != NULL);
+    CHECK(file.GetChunk(RF64_ID) == NULL);
+    file.Close();
+  }
+
+  remove(filename);
+}
+
+TEST_CASE("admappend")
+{
+  const char *filename = "appendtest-adm.wav";
+  const uint64_t nframes1 = 48000, nframes2 = 24000;
+  const double   frameduration = 1.0e9 / (double)SampleRate;
+
+  REQUIRE(createadmfile(filename, nframes1));
+
+  {
+    ADMRIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK((double)objectduration(file) == Approx((double)nframes1 * frameduration).margin(frameduration));
+    file.Close();
+  }
+
+  {
+    ADMRIFFFile file;
+
+    // the object runs to the end of the file so is continued by the appended samples
+    REQUIRE(file.Append(filename));
+    REQUIRE(file.GetADM() != NULL);
+    CHECK(file.GetADM()->GetTrackList().size() == Channels);
+    setpositions(file, 90.0);
+    CHECK(writeframes(file, nframes1, nframes2));
+    file.Close();
+  }
+
+  {
+    ADMRIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetSampleLength() == (nframes1 + nframes2));
+    CHECK(checkframes(file, 0, nframes1 + nframes2) == 0);
+
+    // chna and axml are re-written (once) with the same tracks and the extended object
+    CHECK(file.GetChunk(chna_ID) != NULL);
+    CHECK(file.GetChunk(axml_ID) != NULL);
+    REQUIRE(file.GetADM() != NULL);
+    CHECK(file.GetADM()->GetTrackList().size() == Channels);
+    CHECK((double)objectduration(file) == Approx((double)(nframes1 + nframes2) * frameduration).margin(frameduration));
+    file.Close();
+  }
+
+  remove(filename);
+}
+
+TEST_CASE("riffappend_4gb")
+{
+  const char *filename = "appendtest-4gb.wav";
+  const uint64_t nframes1 = 10000, nframes2 = SampleRate;
+  uint64_t nframes;
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Create(filename, SampleRate, Channels, SampleFormat_24bit));
+    CHECK(writeframes(file, 0, nframes1));
+    file.Close();
+  }
+
+  REQUIRE((nframes = makesparse(filename)) > nframes1);
+
+  {
+    RIFFFile file;
+
+    // JUNK chunk reserved for ds64 allows the file to be promoted to RF64
+    REQUIRE(file.Append(filename));
+    CHECK(file.GetSamples()->GetSamplePosition() == nframes);
+    CHECK(writeframes(file, nframes, nframes2));
+    file.Close();
+  }
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetChunk(RF64_ID) != NULL);
+    CHECK(file.GetChunk(ds64_ID) != NULL);
+    CHECK(file.GetSampleLength() == (nframes + nframes2));
+    CHECK(checkframes(file, 0, nframes1) == 0);
+    CHECK(checkframes(file, nframes, nframes2) == 0);
+    file.Close();
+  }
+
+  remove(filename);
+}
+
+TEST_CASE("admappend_4gb")
+{
+  const char *filename = "appendtest-adm-4gb.wav";
+  const uint64_t nframes1 = 10000, nframes2 = SampleRate;
+  uint64_t nframes;
+
+  REQUIRE(createadmfile(filename, nframes1));
+  REQUIRE((nframes = makesparse(filename)) > nframes1);
+
+  {
+    ADMRIFFFile file;
+
+    REQUIRE(file.Append(filename));
+    CHECK(writeframes(file, nframes, nframes2));
+    file.Close();
+  }
+
+  {
+    ADMRIFFFile file;
+
+    // chna and axml are re-written after the samples of the RF64 file
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetChunk(RF64_ID) != NULL);
+    CHECK(file.GetChunk(ds64_ID) != NULL);
+    CHECK(file.GetChunk(chna_ID) != NULL);
+    CHECK(file.GetChunk(axml_ID) != NULL);
+    CHECK(file.GetSampleLength() == (nframes + nframes2));
+    REQUIRE(file.GetADM() != NULL);
+    CHECK(file.GetADM()->GetTrackList().size() == Channels);
+    CHECK(objectduration(file) > 0);
+    CHECK(checkframes(file, 0, nframes1) == 0);
+    CHECK(checkframes(file, nframes, nframes2) == 0);
+    file.Close();
+  }
+
+  remove(filename);
+}
@@ -0,0 +1,371 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "BackgroundWriteFile.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+static const uint_t BlockBytes = 1000;
+static const uint_t QueueBlocks = 4;       // number of blocks that fit in the queue
+
+/*--------------------------------------------------------------------------------*/
+/** Background write file whose writing thread can be held up so that the queue fills
+ */
+/*--------------------------------------------------------------------------------*/
+class GatedWriteFile : public BackgroundWriteFile
+{
+public:
+  GatedWriteFile() : BackgroundWriteFile()
+  {
+    gateopen = true;
+  }
+
+  // ensure writing has finished before the gate is destroyed
+  virtual ~GatedWriteFile() {OpenGate(); fclose();}
+
+  void OpenGate()  {gateopen = true;}
+  void CloseGate() {gateopen = false;}
+
+protected:
+  virtual bool WriteBlock(BLOCK *block)
+  {
+    uint_t i;
+
+    for (i = 0; (i < 5000) && !gateopen; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    return BackgroundWriteFile::WriteBlock(block);
+  }
+
+protected:
+  std::atomic<bool> gateopen;
+};
+
+/*--------------------------------------------------------------------------------*/
+/** Return byte of test block
+ */
+/*--------------------------------------------------------------------------------*/
+static uint8_t testbyte(uint_t block, uint_t pos)
+{
+  return (uint8_t)(block * 31 + pos + 1);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write test block
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeblock(BackgroundWriteFile& file, uint_t block)
+{
+  uint8_t data[BlockBytes];
+  uint_t  i;
+
+  for (i = 0; i < BlockBytes; i++) data[i] = testbyte(block, i);
+
+  return (file.fwrite(data, 1, BlockBytes) == BlockBytes);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Open file for background writing with a queue of QueueBlocks blocks
+ */
+/*--------------------------------------------------------------------------------*/
+static bool openfile(BackgroundWriteFile& file, const char *filename, BackgroundWriteFile::QueueFullPolicy_t policy)
+{
+  BackgroundWriteFile::CONFIG config = BackgroundWriteFile::GetDefaultConfig();
+  bool success = false;
+
+  config.buffertime = (double)QueueBlocks;
+  config.policy     = policy;
+  config.spillpath  = ".";
+
+  if (file.fopen(filename, "wb"))
+  {
+    file.SetConfig(config);
+    file.SetBytesPerSecond(BlockBytes);
+    file.EnableBackground();
+    success = file.BackgroundEnabled();
+  }
+
+  return success;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read file and check it consists of the specified test blocks (~0 for a block of zeros)
+ *
+ * @return number of bytes that differ (including missing or extra bytes)
+ */
+/*--------------------------------------------------------------------------------*/
+static uint_t checkfile(const char *filename, const std::vector<uint_t>& blocks)
+{
+  std::vector<uint8_t> data(blocks.size() * BlockBytes + 1);
+  EnhancedFile fp;
+  size_t n = 0;
+  uint_t i, j, bad = 0;
+
+  if (fp.fopen(filename, "rb"))
+  {
+    n = fp.fread(&data[0], 1, data.size());
+    fp.fclose();
+  }
+
+  if (n != (blocks.size() * BlockBytes)) return (uint_t)data.size();
+
+  for (i = 0; i < blocks.size(); i++)
+  {
+    for (j = 0; j < BlockBytes; j++) bad += (data[i * BlockBytes + j] != ((blocks[i] != ~0U) ? testbyte(blocks[i], j) : 0));
+  }
+
+  return bad;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return size of file or -1 if it does not exist
+ */
+/*--------------------------------------------------------------------------------*/
+static long filesize(const std::string& filename)
+{
+  struct stat st;
+
+  return (stat(filename.c_str(), &st) == 0) ? (long)st.st_size : -1;
+}
+
+TEST_CASE("backgroundwrite_block")
+{
+  static const char *filename = "backgroundwritetest-block.raw";
+  BackgroundWriteFile::STATS stats;
+  std::vector<uint_t> blocks;
+  std::atomic<bool> written(false);
+  uint_t i;
+
+  {
+    GatedWriteFile file;
+
+    REQUIRE(openfile(file, filename, BackgroundWriteFile::QueueFull_Block));
+
+    file.CloseGate();
+    for (i = 0; i < QueueBlocks; i++) REQUIRE(writeblock(file, i));
+
+    // queue is full so the next write waits for the writing thread
+    std::thread writer([&]() {writeblock(file, QueueBlocks); written = true;});
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(!written);
+
+    file.OpenGate();
+    writer.join();
+    CHECK(written);
+
+    file.fflush();
+    file.GetStats(stats);
+    CHECK(stats.blockedns > 0);
+    CHECK(stats.droppedblocks == 0);
+    CHECK(stats.spilledbytes == 0);
+    CHECK(stats.writtenbytes == ((QueueBlocks + 1) * BlockBytes));
+    file.fclose();
+  }
+
+  // nothing lost
+  for (i = 0; i <= QueueBlocks; i++) blocks.push_back(i);
+  CHECK(checkfile(filename, blocks) == 0);
+
+  remove(filename);
+}
+
+TEST_CASE("backgroundwrite_drop")
+{
+  static const char *filename = "backgroundwritetest-drop.raw";
+  BackgroundWriteFile::STATS stats;
+  std::vector<uint_t> blocks;
+  uint_t i;
+
+  {
+    GatedWriteFile file;
+
+    REQUIRE(openfile(file, filename, BackgroundWriteFile::QueueFull_Drop));
+
+    file.CloseGate();
+    for (i = 0; i < QueueBlocks; i++) REQUIRE(writeblock(file, i));
+
+    // queue is full so the next writes are dropped (but still succeed)
+    CHECK(writeblock(file, QueueBlocks));
+    CHECK(writeblock(file, QueueBlocks + 1));
+
+    file.GetStats(stats);
+    CHECK(stats.droppedblocks == 2);
+    CHECK(stats.droppedbytes  == (2 * BlockBytes));
+    CHECK(stats.queuedbytes   == (QueueBlocks * BlockBytes));
+
+    // once the queue has been written, writes are queued again
+    file.OpenGate();
+    file.fflush();
+    CHECK(writeblock(file, QueueBlocks + 2));
+
+    file.fflush();
+    file.GetStats(stats);
+    CHECK(stats.droppedblocks == 2);
+    CHECK(stats.writtenbytes  == ((QueueBlocks + 1) * BlockBytes));
+    file.fclose();
+  }
+
+  // dropped blocks are left as silence, the file position still advances
+  for (i = 0; i < QueueBlocks; i++) blocks.push_back(i);
+  blocks.push_back(~0U);
+  blocks.push_back(~0U);
+  blocks.push_back(QueueBlocks + 2);
+  CHECK(checkfile(filename, blocks) == 0);
+
+  remove(filename);
+}
+
+TEST_CASE("backgroundwrite_spill")
+{
+  static const char *filename = "backgroundwritetest-spill.raw";
+  const std::string spillfilename = std::string("./") + filename + ".spill";
+  BackgroundWriteFile::STATS stats;
+  std::vector<uint_t> blocks;
+  uint_t i, n = 0;
+
+  {
+    GatedWriteFile file;
+
+    REQUIRE(openfile(file, filename, BackgroundWriteFile::QueueFull_Spill));
+
+    file.CloseGate();
+    for (i = 0; i < QueueBlocks; i++) REQUIRE(writeblock(file, n++));
+
+    // queue is full so the next writes go to the spill file
+    CHECK(writeblock(file, n++));
+    CHECK(writeblock(file, n++));
+
+    file.GetStats(stats);
+    CHECK(stats.spilledbytes      == (2 * BlockBytes));
+    CHECK(stats.spillpendingbytes == (2 * BlockBytes));
+    CHECK(stats.droppedblocks     == 0);
+    CHECK(filesize(spillfilename) >= 0);
+
+    // spilled data is copied back once the writing thread catches up and the spill file emptied
+    file.OpenGate();
+    file.fflush();
+    file.GetStats(stats);
+    CHECK(stats.spillpendingbytes == 0);
+    CHECK(filesize(spillfilename) == 0);
+
+    // and spilling again re-uses it
+    file.CloseGate();
+    for (i = 0; i < QueueBlocks; i++) REQUIRE(writeblock(file, n++));
+    CHECK(writeblock(file, n++));
+
+    file.OpenGate();
+    file.fflush();
+    file.GetStats(stats);
+    CHECK(stats.spilledbytes      == (3 * BlockBytes));
+    CHECK(stats.spillpendingbytes == 0);
+    CHECK(stats.writtenbytes      == (n * BlockBytes));
+    CHECK(filesize(spillfilename) == 0);
+    file.fclose();
+  }
+
+  // nothing lost and everything in order
+  for (i = 0; i < n; i++) blocks.push_back(i);
+  CHECK(checkfile(filename, blocks) == 0);
+
+  // spill file is deleted on close
+  CHECK(filesize(spillfilename) < 0);
+
+  remove(filename);
+}
+
+#ifndef _WIN32
+/*--------------------------------------------------------------------------------*/
+/** Write test block to file and to copy of what the file should contain
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeblock(BackgroundWriteFile& file, uint_t block, std::vector<uint8_t>& expected)
+{
+  uint64_t pos = (uint64_t)file.ftell();
+  uint_t   i;
+
+  if ((pos + BlockBytes) > expected.size()) expected.resize(pos + BlockBytes);
+  for (i = 0; i < BlockBytes; i++) expected[pos + i] = testbyte(block, i);
+
+  return writeblock(file, block);
+}
+
+TEST_CASE("backgroundwrite_mapped")
+{
+  static const char *filename = "backgroundwritetest-mapped.raw";
+  const long pagesize = sysconf(_SC_PAGESIZE);
+  BackgroundWriteFile::MAPCONFIG mapconfig = BackgroundWriteFile::GetDefaultMapConfig();
+  std::vector<uint8_t> expected, data;
+  uint_t i, n = 0;
+  long   extent;
+
+  // small extents (rounded up to whole pages) so that the file is grown several times
+  mapconfig.extentbytes     = 4096;
+  mapconfig.checkpointbytes = 8192;
+  extent = ((4096 + pagesize - 1) / pagesize) * pagesize;
+
+  {
+    BackgroundWriteFile file;
+
+    REQUIRE(file.fopen(filename, "wb"));
+    REQUIRE(writeblock(file, n++, expected));
+
+    // mapping grows the file to a whole number of extents covering the data already written
+    REQUIRE(file.EnableMapping(true, mapconfig));
+    CHECK(file.MappingEnabled());
+    CHECK(filesize(filename) == extent);
+    CHECK(file.ftell() == (off_t)BlockBytes);
+
+    // writes beyond the mapping grow it (and the file) by whole extents
+    for (i = 0; i < 13; i++) REQUIRE(writeblock(file, n++, expected));
+    CHECK(file.ftell() == (off_t)expected.size());
+    CHECK((filesize(filename) % extent) == 0);
+    CHECK(filesize(filename) > (long)expected.size());
+
+    // overwrite within the data (e.g. a header) and return to the end
+    REQUIRE(file.fseek(500, SEEK_SET) == 0);
+    REQUIRE(writeblock(file, n++, expected));
+    REQUIRE(file.fseek(0, SEEK_END) == 0);
+    CHECK(file.ftell() == (off_t)expected.size());
+
+    // unmapping truncates the file to the data written and writing continues through the stream
+    REQUIRE(file.EnableMapping(false));
+    CHECK(!file.MappingEnabled());
+    CHECK(filesize(filename) == (long)expected.size());
+    REQUIRE(writeblock(file, n++, expected));
+
+    // mapping again continues from the end of the file
+    REQUIRE(file.EnableMapping(true, mapconfig));
+    for (i = 0; i < 5; i++) REQUIRE(writeblock(file, n++, expected));
+    CHECK((filesize(filename) % extent) == 0);
+
+    // closing truncates the file too
+    file.fclose();
+  }
+
+  CHECK(filesize(filename) == (long)expected.size());
+
+  {
+    EnhancedFile fp;
+
+    data.resize(expected.size());
+    REQUIRE(fp.fopen(filename, "rb"));
+    CHECK(fp.fread(&data[0], 1, data.size()) == data.size());
+    fp.fclose();
+  }
+
+  CHECK(data == expected);
+
+  remove(filename);
+}
+#endif
@@ -0,0 +1,394 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "Playlist.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+// length of each test item
+static const uint_t ItemFrames = 1000;
+
+/*--------------------------------------------------------------------------------*/
+/** Return mono float format used by all test items
+ */
+/*--------------------------------------------------------------------------------*/
+static const SoundFormat *testformat()
+{
+  static SoundFormat *format = NULL;
+
+  if (!format)
+  {
+    format = new SoundFormat;
+    format->SetSampleRate(48000);
+    format->SetChannels(1);
+    format->SetSampleFormat(SampleFormat_Float);
+  }
+
+  return format;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return value of frame of item (exact in float so that reads can be compared exactly)
+ */
+/*--------------------------------------------------------------------------------*/
+static Sample_t itemvalue(uint_t index, uint_t frame)
+{
+  return (Sample_t)(index * ItemFrames + frame) / (Sample_t)65536.0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create raw file for item and return object reading it
+ *
+ * @param value constant value of every frame or negative to use itemvalue()
+ */
+/*--------------------------------------------------------------------------------*/
+static SoundFileSamples *createitem(uint_t index, Sample_t value = -1.0)
+{
+  std::vector<float> samples(ItemFrames);
+  std::string filename;
+  SoundFileSamples *file = NULL;
+  EnhancedFile *fp;
+  uint_t i;
+
+  Printf(filename, "playlisttest-%u.raw", index);
+
+  for (i = 0; i < ItemFrames; i++) samples[i] = (value < 0.0) ? (float)itemvalue(index, i) : (float)value;
+
+  if ((fp = new EnhancedFile) != NULL)
+  {
+    if (fp->fopen(filename.c_str(), "wb"))
+    {
+      fp->fwrite(&samples[0], sizeof(samples[0]), samples.size());
+      fp->fclose();
+    }
+
+    if (fp->fopen(filename.c_str(), "rb"))
+    {
+      file = new SoundFileSamples;
+      file->SetFormat(testformat());
+      file->SetFile(RefCount<EnhancedFile>(fp), 0, samples.size() * sizeof(samples[0]));
+    }
+    else delete fp;
+  }
+
+  return file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Delete files created by createitem()
+ */
+/*--------------------------------------------------------------------------------*/
+static void removeitems(uint_t n)
+{
+  uint_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    std::string filename;
+
+    Printf(filename, "playlisttest-%u.raw", i);
+    remove(filename.c_str());
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read entire playlist in blocks
+ */
+/*--------------------------------------------------------------------------------*/
+static std::vector<Sample_t> readall(Playlist& playlist, uint_t blockframes)
+{
+  std::vector<Sample_t> output;
+  std::vector<Sample_t> block(blockframes);
+  uint_t n;
+
+  while ((n = playlist.ReadSamples(&block[0], 0, 1, blockframes)) > 0)
+  {
+    output.insert(output.end(), block.begin(), block.begin() + n);
+    if (n < blockframes) break;
+  }
+
+  return output;
+}
+
+TEST_CASE("playlist_controls")
+{
+  Playlist playlist;
+  Sample_t buffer[16];
+  uint_t i;
+
+  playlist.SetFadeSamples(0);
+  for (i = 0; i < 3; i++) playlist.AddFile(createitem(i));
+
+  REQUIRE(playlist.GetCount() == 3);
+  REQUIRE(playlist.GetPlaybackLength() == (3 * ItemFrames));
+
+  SECTION("stopped")
+  {
+    // with no ReadSamples() running, controls are actioned straight away
+    CHECK(playlist.SetPlaybackPosition(1500, true));
+    CHECK(playlist.GetPlaybackPosition() == 1500);
+    CHECK(playlist.GetPlaybackIndex() == 1);
+
+    CHECK(playlist.SetPlaybackIndex(2, true, true));
+    CHECK(playlist.GetPlaybackPosition() == (2 * ItemFrames));
+    CHECK(playlist.GetPlaybackIndex() == 2);
+
+    // position beyond end of list is invalid
+    CHECK(!playlist.SetPlaybackPosition(5 * ItemFrames, true));
+    CHECK(playlist.AtEnd());
+
+    playlist.Reset();
+    CHECK(playlist.GetPlaybackPosition() == 0);
+    CHECK(playlist.GetPlaybackIndex() == 0);
+
+    playlist.PauseAudio();
+    CHECK(playlist.IsAudioPaused());
+    playlist.PauseAudio(false);
+    CHECK(!playlist.IsAudioPaused());
+  }
+
+  SECTION("ordering")
+  {
+    // controls between reads are actioned in order
+    playlist.SetPlaybackIndex(1, true, true);
+    playlist.SetPlaybackPosition(2500, true);
+    REQUIRE(playlist.ReadSamples(buffer, 0, 1, 4) == 4);
+    for (i = 0; i < 4; i++) CHECK(buffer[i] == itemvalue(2, 500 + i));
+
+    playlist.SetPlaybackPosition(2500, true);
+    playlist.Reset();
+    REQUIRE(playlist.ReadSamples(buffer, 0, 1, 4) == 4);
+    for (i = 0; i < 4; i++) CHECK(buffer[i] == itemvalue(0, i));
+
+    // index from same place within the new item
+    playlist.SetPlaybackIndex(2, false, true);
+    CHECK(playlist.GetPlaybackPosition() == (2 * ItemFrames + 4));
+    REQUIRE(playlist.ReadSamples(buffer, 0, 1, 4) == 4);
+    for (i = 0; i < 4; i++) CHECK(buffer[i] == itemvalue(2, 4 + i));
+
+    playlist.Next();
+    CHECK(playlist.AtEnd());
+    CHECK(playlist.ReadSamples(buffer, 0, 1, 4) == 0);
+  }
+
+  SECTION("fade")
+  {
+    // without forcing, the position changes after fading down
+    playlist.SetFadeSamples(8);
+    REQUIRE(playlist.ReadSamples(buffer, 0, 1, 16) == 16);
+    CHECK(playlist.SetPlaybackPosition(2000, false));
+    CHECK(playlist.GetPlaybackPosition() == 16);
+
+    REQUIRE(playlist.ReadSamples(buffer, 0, 1, 16) == 16);
+    CHECK(buffer[0] > 0.0);
+    CHECK(buffer[0] < itemvalue(0, 16));
+    CHECK(buffer[7] < itemvalue(0, 23));
+    CHECK(buffer[8] == 0.0);
+    CHECK(buffer[15] < itemvalue(2, 7));
+    CHECK(playlist.GetPlaybackPosition() == 2008);
+  }
+
+  removeitems(3);
+}
+
+TEST_CASE("playlist_gapless")
+{
+  Playlist playlist;
+  std::vector<Sample_t> output;
+  uint_t i, bad = 0;
+
+  playlist.SetFadeSamples(0);
+  for (i = 0; i < 3; i++) playlist.AddFile(createitem(i));
+
+  SECTION("direct")
+  {
+    output = readall(playlist, 333);
+  }
+
+  SECTION("preroll")
+  {
+    playlist.SetPrerollTime(50);
+    playlist.Reset();
+
+    // wait (for a bounded time) for the next item to be pre-rolled
+    for (i = 0; (i < 2000) && !playlist.GetPrerolledItems(); i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(playlist.GetPrerolledItems() > 0);
+
+    output = readall(playlist, 333);
+
+    // the whole of (at least) the second item was played from pre-roll data
+    CHECK(playlist.GetPrerollFrames() >= ItemFrames);
+  }
+
+  SECTION("prefetch")
+  {
+    std::vector<Sample_t> block(333);
+    Playlist::PREFETCHSTATS stats;
+    uint_t n, index, j;
+
+    REQUIRE(playlist.EnablePrefetch(2, 50));
+
+    do
+    {
+      // before each block, wait (for a bounded time) for the next item's stream to be decoded ahead
+      if ((index = playlist.GetPlaybackProgress().fileindex + 1) < 3)
+      {
+        for (j = 0; (j < 2000) && !playlist.IsItemPrefetched(index); j++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        REQUIRE(playlist.IsItemPrefetched(index));
+      }
+
+      n = playlist.ReadSamples(&block[0], 0, 1, (uint_t)block.size());
+      output.insert(output.end(), block.begin(), block.begin() + n);
+    }
+    while (n == block.size());
+
+    // items after the first were played from streams that never ran dry
+    for (index = 0; index < 3; index++)
+    {
+      INFO("item " << index);
+      REQUIRE(playlist.GetPrefetchStats(index, stats));
+      CHECK(stats.underruns == 0);
+      CHECK(stats.underrunframes == 0);
+    }
+  }
+
+  // items follow on without any gap or repeated frames
+  REQUIRE(output.size() == (3 * ItemFrames));
+  for (i = 0; i < output.size(); i++) bad += (output[i] != itemvalue(i / ItemFrames, i % ItemFrames));
+  CHECK(bad == 0);
+
+  removeitems(3);
+}
+
+TEST_CASE("playlist_lazyopen")
+{
+  Playlist playlist;
+  FileHandlePool::STATS stats;
+  std::vector<Sample_t> output;
+  std::vector<Sample_t> block(100);
+  uint_t i, n, bad = 0;
+
+  playlist.SetFadeSamples(0);
+  REQUIRE(playlist.EnableLazyOpen(1, 0));
+  for (i = 0; i < 3; i++) playlist.AddFile(createitem(i));
+
+  // read in real-time sized blocks, each once the pool's maintenance thread has opened the
+  // files pinned ahead of playback (waiting for a bounded time)
+  do
+  {
+    for (i = 0; (i < 2000) && (!playlist.GetFileHandleStats(stats) || stats.pinnedclosed); i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(stats.pinnedclosed == 0);
+
+    n = playlist.ReadSamples(&block[0], 0, 1, (uint_t)block.size());
+    output.insert(output.end(), block.begin(), block.begin() + n);
+  }
+  while (n == block.size());
+
+  REQUIRE(output.size() == (3 * ItemFrames));
+  for (i = 0; i < output.size(); i++) bad += (output[i] != itemvalue(i / ItemFrames, i % ItemFrames));
+  CHECK(bad == 0);
+
+  // playback thread never opened a file itself
+  REQUIRE(playlist.GetFileHandleStats(stats));
+  CHECK(stats.silentreads == 0);
+  CHECK(stats.opens >= 3);
+
+  playlist.Clear();
+  removeitems(3);
+}
+
+TEST_CASE("playlist_crossfade")
+{
+  const uint_t fade = 100;
+  Playlist playlist;
+  std::vector<Sample_t> output;
+  uint_t i, bad = 0;
+
+  playlist.SetFadeSamples(fade);
+  playlist.EnableCrossfade();
+  playlist.AddFile(createitem(0, 0.25));
+  playlist.AddFile(createitem(1, 0.75));
+
+  output = readall(playlist, 64);
+
+  // items overlap by the length of the crossfade
+  REQUIRE(output.size() == (2 * ItemFrames - fade));
+
+  // after the initial fade up, first item until the crossfade
+  for (i = fade; i < (ItemFrames - fade); i++) bad += (output[i] != 0.25);
+  CHECK(bad == 0);
+
+  // linear crossfade rises steadily from one item to the other
+  for (i = ItemFrames - fade; i < ItemFrames; i++)
+  {
+    CHECK(output[i] >= output[i - 1]);
+    CHECK(output[i] == Approx(0.25 + 0.5 * (Sample_t)(i - (ItemFrames - fade)) / (Sample_t)fade).margin(1.0e-6));
+  }
+
+  // then second item
+  for (bad = 0; i < output.size(); i++) bad += (output[i] != 0.75);
+  CHECK(bad == 0);
+
+  removeitems(2);
+}
+
+TEST_CASE("playlist_threads")
+{
+  Playlist playlist;
+  std::atomic<bool>     quit(false);
+  std::atomic<uint64_t> frames(0);
+  uint64_t start;
+  uint_t   i;
+
+  playlist.SetFadeSamples(16);
+  playlist.EnableLoop();
+  playlist.AddFile(createitem(0));
+
+  // render continuously whilst the list is changed and controlled from this thread
+  std::thread render([&]() {
+      Sample_t buffer[64];
+
+      while (!quit) frames += playlist.ReadSamples(buffer, 0, 1, 64);
+    });
+
+  while (!frames) std::this_thread::yield();
+
+  for (i = 1; i < 4; i++)
+  {
+    playlist.AddFile(createitem(i));
+    playlist.SetPlaybackPosition(i * 700, (i & 1) != 0);
+    playlist.SetPlaybackIndex(i - 1, true, false);
+    playlist.PauseAudio((i & 1) != 0);
+    playlist.Next();
+  }
+
+  for (i = 0; i < 1000; i++) playlist.SetPlaybackPosition(i, false);
+  playlist.Reset();
+
+  // let the render thread action the remaining controls
+  start = frames;
+  while (frames < (start + 4096)) std::this_thread::yield();
+
+  quit = true;
+  render.join();
+
+  // every control has been actioned once the render thread has stopped
+  playlist.PauseAudio(false);
+  CHECK(!playlist.IsAudioPaused());
+  CHECK(playlist.SetPlaybackPosition(3500, true));
+  CHECK(playlist.GetPlaybackPosition() == 3500);
+
+  playlist.Clear();
+  CHECK(playlist.GetCount() == 0);
+  CHECK(playlist.GetPlaybackLength() == 0);
+
+  removeitems(4);
+}
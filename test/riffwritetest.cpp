@@ -0,0 +1,294 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "RIFFFile.h"
+#include "RIFFChunk_Definitions.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+static const uint32_t SampleRate    = 48000;
+static const uint_t   Channels      = 2;
+static const uint_t   BytesPerFrame = Channels * 3;     // 24-bit samples
+static const uint_t   BlockFrames   = 1000;
+
+/*--------------------------------------------------------------------------------*/
+/** Return sample of test signal (exact in 24 bits)
+ */
+/*--------------------------------------------------------------------------------*/
+static sint32_t testsample(uint64_t frame, uint_t channel)
+{
+  return (sint32_t)((uint32_t)(((frame * Channels + channel) * 2654435761U) & 0xffffff) << 8);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write a block of frames of test signal starting at frame start of the signal
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeblock(RIFFFile& file, uint64_t start)
+{
+  std::vector<sint32_t> buffer(BlockFrames * Channels);
+  uint_t i, j;
+
+  for (i = 0; i < BlockFrames; i++)
+  {
+    for (j = 0; j < Channels; j++) buffer[i * Channels + j] = testsample(start + i, j);
+  }
+
+  return (file.WriteSamples(&buffer[0], 0, Channels, BlockFrames) == (sint_t)BlockFrames);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames of test signal through a buffer lent by the file
+ *
+ * @param start first frame of test signal
+ * @param frames number of frames to request
+ * @param commit number of frames to write (no more than requested)
+ *
+ * @return number of frames written or -1 for an error
+ */
+/*--------------------------------------------------------------------------------*/
+static sint_t writelent(RIFFFile& file, uint64_t start, uint_t frames, uint_t commit)
+{
+  uint8_t *buffer;
+  uint_t  i, j;
+
+  if ((buffer = file.GetWriteBuffer(frames)) == NULL) return -1;
+
+  // file is 24-bit little-endian
+  commit = std::min(commit, frames);
+  for (i = 0; i < commit; i++)
+  {
+    for (j = 0; j < Channels; j++, buffer += 3)
+    {
+      uint32_t sample = (uint32_t)testsample(start + i, j);
+
+      buffer[0] = (uint8_t)(sample >> 8);
+      buffer[1] = (uint8_t)(sample >> 16);
+      buffer[2] = (uint8_t)(sample >> 24);
+    }
+  }
+
+  return file.CommitWriteBuffer(commit);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames of test signal through lent buffers, committing fewer frames than
+ * requested and nothing at all along the way
+ *
+ * @return number of frames written
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t writelentblocks(RIFFFile& file, uint64_t start, uint_t nblocks)
+{
+  uint64_t pos = start;
+  uint_t   i;
+
+  for (i = 0; i < nblocks; i++)
+  {
+    sint_t n;
+
+    // every third block is only partly written and is followed by an empty commit
+    if ((n = writelent(file, pos, BlockFrames, ((i % 3) == 2) ? BlockFrames / 3 : BlockFrames)) < 0) break;
+    pos += n;
+
+    if (((i % 3) == 2) && (writelent(file, pos, BlockFrames, 0) != 0)) break;
+  }
+
+  return pos - start;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read frames of file and return number of samples that differ from the test signal
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t checkframes(RIFFFile& file, uint64_t nframes)
+{
+  std::vector<sint32_t> buffer(nframes * Channels);
+  uint64_t bad = 0, i;
+  uint_t   j;
+
+  if (file.ReadSamples(&buffer[0], 0, Channels, (uint_t)nframes) != (sint_t)nframes) return nframes * Channels;
+
+  for (i = 0; i < nframes; i++)
+  {
+    for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != testsample(i, j));
+  }
+
+  return bad;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return size of file or -1 if it does not exist
+ */
+/*--------------------------------------------------------------------------------*/
+static long filesize(const char *filename)
+{
+  struct stat st;
+
+  return (stat(filename, &st) == 0) ? (long)st.st_size : -1;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return size of file according to its RIFF header
+ */
+/*--------------------------------------------------------------------------------*/
+static long riffsize(const char *filename)
+{
+  uint8_t      header[8];
+  EnhancedFile fp;
+  long         size = -1;
+
+  if (fp.fopen(filename, "rb"))
+  {
+    if ((fp.fread(header, 1, sizeof(header)) == sizeof(header)) && (memcmp(header, "RIFF", 4) == 0))
+    {
+      size = 8 + (long)((uint32_t)header[4] | ((uint32_t)header[5] << 8) | ((uint32_t)header[6] << 16) | ((uint32_t)header[7] << 24));
+    }
+    fp.fclose();
+  }
+
+  return size;
+}
+
+#ifndef _WIN32
+TEST_CASE("riffwrite_mapped")
+{
+  static const char *filename = "riffwritetest-mapped.wav";
+  BackgroundWriteFile::MAPCONFIG mapconfig = BackgroundWriteFile::GetDefaultMapConfig();
+  uint64_t pos = 0;
+  uint_t   i;
+
+  // small extents so that the file is grown several times
+  mapconfig.extentbytes     = 4096;
+  mapconfig.checkpointbytes = 8192;
+
+  {
+    RIFFFile file;
+    long     mappedsize;
+
+    file.EnableMappedWriting(true, mapconfig);
+    REQUIRE(file.Create(filename, SampleRate, Channels, SampleFormat_24bit));
+
+    for (i = 0; i < 3; i++, pos += BlockFrames) REQUIRE(writeblock(file, pos));
+
+    // file is grown in whole extents ahead of the data
+    mappedsize = filesize(filename);
+    CHECK(mappedsize > (long)(pos * BytesPerFrame));
+
+    // disabling mapping truncates the file to the data written so far
+    file.EnableMappedWriting(false, mapconfig);
+    REQUIRE(file.GetFile() != NULL);
+    CHECK(filesize(filename) == (long)file.GetFile()->ftell());
+    CHECK(filesize(filename) < mappedsize);
+
+    for (i = 0; i < 2; i++, pos += BlockFrames) REQUIRE(writeblock(file, pos));
+
+    file.EnableMappedWriting(true, mapconfig);
+    for (i = 0; i < 3; i++, pos += BlockFrames) REQUIRE(writeblock(file, pos));
+
+    file.Close();
+  }
+
+  // closing truncates the file to the end of the last chunk
+  CHECK(filesize(filename) == riffsize(filename));
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetSampleLength() == pos);
+    CHECK(checkframes(file, pos) == 0);
+    file.Close();
+  }
+
+  remove(filename);
+}
+#endif
+
+TEST_CASE("riffwrite_lent_queued")
+{
+  static const char *filename = "riffwritetest-lent-queued.wav";
+  uint64_t pos = 0;
+
+  {
+    RIFFFile file;
+    BackgroundWriteFile::STATS stats;
+
+    file.EnableBackgroundWriting(true);
+    REQUIRE(file.Create(filename, SampleRate, Channels, SampleFormat_24bit));
+    REQUIRE(dynamic_cast<BackgroundWriteFile *>(file.GetFile()) != NULL);
+    CHECK(dynamic_cast<BackgroundWriteFile *>(file.GetFile())->WriteBufferIsDirect());
+
+    // lent blocks are queued in order with copied writes
+    pos += writelentblocks(file, pos, 6);
+    REQUIRE(writeblock(file, pos)); pos += BlockFrames;
+    pos += writelentblocks(file, pos, 3);
+    CHECK(file.GetSamples()->GetSamplePosition() == pos);
+
+    CHECK(file.GetBackgroundWritingStats(stats));
+    CHECK(stats.droppedblocks == 0);
+    file.Close();
+  }
+
+  CHECK(filesize(filename) == riffsize(filename));
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetSampleLength() == pos);
+    CHECK(checkframes(file, pos) == 0);
+    file.Close();
+  }
+
+  remove(filename);
+}
+
+#ifndef _WIN32
+TEST_CASE("riffwrite_lent_mapped")
+{
+  static const char *filename = "riffwritetest-lent-mapped.wav";
+  BackgroundWriteFile::MAPCONFIG mapconfig = BackgroundWriteFile::GetDefaultMapConfig();
+  uint64_t pos = 0;
+
+  // small extents so that lent buffers cross extent boundaries
+  mapconfig.extentbytes     = 4096;
+  mapconfig.checkpointbytes = 8192;
+
+  {
+    RIFFFile file;
+
+    file.EnableMappedWriting(true, mapconfig);
+    REQUIRE(file.Create(filename, SampleRate, Channels, SampleFormat_24bit));
+    REQUIRE(dynamic_cast<BackgroundWriteFile *>(file.GetFile()) != NULL);
+    CHECK(dynamic_cast<BackgroundWriteFile *>(file.GetFile())->MappingEnabled());
+
+    // lent buffers are the mapping itself
+    pos += writelentblocks(file, pos, 6);
+    REQUIRE(writeblock(file, pos)); pos += BlockFrames;
+    pos += writelentblocks(file, pos, 3);
+    CHECK(file.GetSamples()->GetSamplePosition() == pos);
+    file.Close();
+  }
+
+  CHECK(filesize(filename) == riffsize(filename));
+
+  {
+    RIFFFile file;
+
+    REQUIRE(file.Open(filename));
+    CHECK(file.GetSampleLength() == pos);
+    CHECK(checkframes(file, pos) == 0);
+    file.Close();
+  }
+
+  remove(filename);
+}
+#endif
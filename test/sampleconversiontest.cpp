@@ -0,0 +1,544 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "SampleConversion.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+/*--------------------------------------------------------------------------------*/
+/** Fill buffer with random samples of format, including extremes (and for floats,
+ * out of range values, infinities and NaNs)
+ */
+/*--------------------------------------------------------------------------------*/
+static void randomsamples(std::vector<uint8_t>& data, SampleFormat_t format)
+{
+  uint_t i;
+
+  for (i = 0; i < data.size(); i++) data[i] = (uint8_t)rand();
+
+  if (format == SampleFormat_Float)
+  {
+    static const float specials[] =
+    {
+      0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f, 1.5f, -1.5f, 1e-20f, -1e-20f,
+      1.0f / 65536.0f, 1.0f / 16777216.0f, 1.0f - 1.0f / 16777216.0f,
+      (float)INFINITY, -(float)INFINITY, (float)NAN,
+    };
+    float *samples = (float *)&data[0];
+    uint_t n = (uint_t)(data.size() / sizeof(float));
+
+    for (i = 0; i < n; i++)
+    {
+      switch (rand() % 4)
+      {
+        case 0:
+          samples[i] = specials[rand() % NUMBEROF(specials)];
+          break;
+
+        default:
+          // mostly in range, sometimes clipping
+          samples[i] = (float)(rand() - RAND_MAX / 2) / (float)(RAND_MAX / 2) * 1.1f;
+          break;
+      }
+    }
+  }
+}
+
+TEST_CASE("sampleconversion")
+{
+  static const SampleFormat_t formats[] = {SampleFormat_16bit, SampleFormat_24bit, SampleFormat_32bit, SampleFormat_Float};
+  ConversionKernels_t original = GetConversionKernels();
+  uint_t k, test;
+
+  srand(0x5eed);
+
+  for (k = ConversionKernels_Scalar + 1; k < ConversionKernels_Count; k++)
+  {
+    ConversionKernels_t kernels = (ConversionKernels_t)k;
+
+    if (!ConversionKernelsAvailable(kernels)) continue;
+
+    INFO("kernels " << GetConversionKernelsName(kernels));
+
+    for (test = 0; test < 2000; test++)
+    {
+      // either direction between an integer/float format and float
+      SampleFormat_t format     = formats[rand() % NUMBEROF(formats)];
+      bool           toformat   = ((rand() & 1) != 0);
+      SampleFormat_t srcformat  = toformat ? SampleFormat_Float : format;
+      SampleFormat_t dstformat  = toformat ? format : SampleFormat_Float;
+      uint_t         nsrcchannels = 1 + rand() % 24;
+      uint_t         ndstchannels = 1 + rand() % 24;
+      uint_t         srcchannel = rand() % nsrcchannels;
+      uint_t         dstchannel = rand() % ndstchannels;
+      uint_t         nchannels  = (rand() % 4) ? (1 + rand() % 24) : ~0;
+      uint_t         nframes    = rand() % 300;
+
+      // sometimes transfer all channels so that contiguous runs are tested
+      if (rand() % 4 == 0)
+      {
+        ndstchannels = nsrcchannels;
+        srcchannel   = dstchannel = 0;
+        nchannels    = ~0;
+      }
+
+      std::vector<uint8_t> src(nsrcchannels * GetBytesPerSample(srcformat) * std::max(nframes, 1U));
+      std::vector<uint8_t> dst(ndstchannels * GetBytesPerSample(dstformat) * std::max(nframes, 1U));
+      std::vector<uint8_t> ref(dst.size());
+
+      INFO("test " << test << ": " << nframes << " frames of " << nchannels << " channels from " << srcchannel << "/" << nsrcchannels << " format " << (uint_t)srcformat << " to " << dstchannel << "/" << ndstchannels << " format " << (uint_t)dstformat);
+
+      randomsamples(src, srcformat);
+      randomsamples(dst, dstformat);
+      ref = dst;
+
+      REQUIRE(SetConversionKernels(ConversionKernels_Scalar));
+      ConvertSamples(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                     &ref[0], dstformat, false, dstchannel, ndstchannels,
+                     nchannels, nframes);
+
+      REQUIRE(SetConversionKernels(kernels));
+      ConvertSamples(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                     &dst[0], dstformat, false, dstchannel, ndstchannels,
+                     nchannels, nframes);
+
+      // results must be bit-identical (including untouched channels)
+      CHECK(memcmp(&dst[0], &ref[0], dst.size()) == 0);
+    }
+  }
+
+  SetConversionKernels(original);
+}
+
+TEST_CASE("planarsampleconversion")
+{
+  static const SampleFormat_t formats[] = {SampleFormat_16bit, SampleFormat_24bit, SampleFormat_32bit, SampleFormat_Float};
+  ConversionKernels_t original = GetConversionKernels();
+  uint_t k, test, i, j;
+
+  srand(0x91a4);
+
+  for (k = ConversionKernels_Scalar; k < ConversionKernels_Count; k++)
+  {
+    ConversionKernels_t kernels = (ConversionKernels_t)k;
+
+    if (!SetConversionKernels(kernels)) continue;
+
+    INFO("kernels " << GetConversionKernelsName(kernels));
+
+    for (test = 0; test < 500; test++)
+    {
+      SampleFormat_t format     = formats[rand() % NUMBEROF(formats)];
+      uint_t         nchannels  = 1 + rand() % 24;
+      uint_t         channel    = rand() % nchannels;
+      uint_t         nplanar    = 1 + rand() % nchannels;
+      uint_t         offset     = rand() % 8;
+      uint_t         nframes    = rand() % 300;
+      uint_t         bps        = GetBytesPerSample(format);
+
+      INFO("test " << test << ": " << nframes << " frames of " << nplanar << " channels from " << channel << "/" << nchannels << " format " << (uint_t)format);
+
+      std::vector<uint8_t>  interleaved(nchannels * bps * std::max(nframes, 1U));
+      std::vector<Sample_t> ref(nplanar * std::max(nframes, 1U));
+      std::vector<Sample_t> planar(nplanar * (offset + std::max(nframes, 1U)));
+      std::vector<uint8_t>  written(interleaved.size());
+      std::vector<Sample_t *> dst(nplanar);
+      std::vector<const Sample_t *> src(nplanar);
+
+      randomsamples(interleaved, format);
+      written = interleaved;
+
+      for (i = 0; i < nplanar; i++)
+      {
+        dst[i] = &planar[i * (offset + nframes)];
+        src[i] = dst[i];
+      }
+
+      // planar buffers must hold the same samples as an interleaved conversion
+      ConvertSamples(&interleaved[0], format, false, channel, nchannels,
+                     &ref[0], SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, nplanar,
+                     nplanar, nframes);
+      ConvertSamplesToPlanar(&interleaved[0], format, false, channel, nchannels,
+                             &dst[0], offset,
+                             nplanar, nframes);
+
+      uint_t nvalid = std::min(nplanar, nchannels - channel);
+      bool   same   = true;
+      for (i = 0; i < nframes; i++)
+      {
+        for (j = 0; j < nvalid; j++) same &= (memcmp(&ref[i * nplanar + j], &dst[j][offset + i], sizeof(Sample_t)) == 0);
+      }
+      CHECK(same);
+
+      // and converting back must give the same bytes as an interleaved conversion
+      ConvertSamples(&ref[0], SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, nplanar,
+                     &interleaved[0], format, false, channel, nchannels,
+                     nvalid, nframes);
+      ConvertSamplesFromPlanar(&src[0], offset,
+                               &written[0], format, false, channel, nchannels,
+                               nvalid, nframes);
+
+      CHECK(memcmp(&written[0], &interleaved[0], written.size()) == 0);
+    }
+  }
+
+  SetConversionKernels(original);
+}
+
+TEST_CASE("mappedsampleconversion")
+{
+  static const SampleFormat_t formats[] = {SampleFormat_16bit, SampleFormat_24bit, SampleFormat_32bit, SampleFormat_Float};
+  ConversionKernels_t original = GetConversionKernels();
+  uint_t k, test, i, j;
+
+  srand(0x3a9c);
+
+  for (k = ConversionKernels_Scalar; k < ConversionKernels_Count; k++)
+  {
+    ConversionKernels_t kernels = (ConversionKernels_t)k;
+
+    if (!ConversionKernelsAvailable(kernels)) continue;
+
+    INFO("kernels " << GetConversionKernelsName(kernels));
+
+    for (test = 0; test < 500; test++)
+    {
+      SampleFormat_t format       = formats[rand() % NUMBEROF(formats)];
+      uint_t         nsrcchannels = 1 + rand() % 24;
+      uint_t         ndstchannels = 1 + rand() % 24;
+      uint_t         srcchannel   = rand() % nsrcchannels;
+      uint_t         nchannels    = nsrcchannels - srcchannel;
+      uint_t         nframes      = rand() % 300;
+      uint_t         nmap         = rand() % 32;
+      bool           unity        = ((rand() & 1) != 0);
+
+      INFO("test " << test << ": " << nframes << " frames of " << nmap << " routes from " << srcchannel << "/" << nsrcchannels << " format " << (uint_t)format << " to " << ndstchannels << (unity ? " unity gain" : ""));
+
+      std::vector<uint8_t>      src(nsrcchannels * GetBytesPerSample(format) * std::max(nframes, 1U));
+      std::vector<Sample_t>     dst(ndstchannels * std::max(nframes, 1U));
+      std::vector<Sample_t>     ref(dst.size());
+      std::vector<CHANNELROUTE> map(std::max(nmap, 1U));
+
+      randomsamples(src, format);
+      for (i = 0; i < dst.size(); i++) dst[i] = (Sample_t)i;
+
+      // entries outside source or destination and repeated destinations are allowed
+      for (i = 0; i < nmap; i++)
+      {
+        map[i].channel = rand() % (nchannels + 2);
+        map[i].slot    = rand() % (ndstchannels + 2);
+        map[i].gain    = unity ? 1.0 : (Sample_t)(rand() % 2001 - 1000) / (Sample_t)500.0;
+      }
+
+      // reference: scalar conversion of each valid entry, in order, followed by gain
+      ref = dst;
+      for (i = 0; i < nmap; i++)
+      {
+        if ((map[i].channel >= nchannels) || (map[i].slot >= ndstchannels)) continue;
+
+        std::vector<Sample_t> column(std::max(nframes, 1U));
+        ConvertSamples(&src[0], format, false, srcchannel + map[i].channel, nsrcchannels,
+                       &column[0], SampleFormatOf((const Sample_t *)NULL), MACHINE_IS_BIG_ENDIAN, 0, 1,
+                       1, nframes);
+        for (j = 0; j < nframes; j++) ref[j * ndstchannels + map[i].slot] = unity ? column[j] : column[j] * map[i].gain;
+      }
+
+      REQUIRE(SetConversionKernels(kernels));
+      ConvertSamplesMapped(&src[0], format, false, srcchannel, nsrcchannels,
+                           &dst[0], ndstchannels,
+                           &map[0], nmap,
+                           nchannels, nframes);
+
+      CHECK(memcmp(&dst[0], &ref[0], dst.size() * sizeof(dst[0])) == 0);
+    }
+  }
+
+  SetConversionKernels(original);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return number of samples of format that differ between buffers (any NaN matches any other)
+ */
+/*--------------------------------------------------------------------------------*/
+static uint_t differentsamples(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, SampleFormat_t format)
+{
+  uint_t bps = GetBytesPerSample(format);
+  uint_t i, n = 0;
+
+  for (i = 0; (i + bps) <= a.size(); i += bps)
+  {
+    if (memcmp(&a[i], &b[i], bps) != 0)
+    {
+      float x, y;
+
+      if (format == SampleFormat_Float)
+      {
+        memcpy(&x, &a[i], sizeof(x));
+        memcpy(&y, &b[i], sizeof(y));
+        if (isnan(x) && isnan(y)) continue;
+      }
+
+      n++;
+    }
+  }
+
+  return n;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Fill buffer with edge case samples of format: every 16-bit value; extremes, powers of two
+ * and pseudo-random values of 24 and 32-bit samples; and for floats, a grid across (and
+ * beyond) full scale including the rounding ties of each integer format, extremes,
+ * infinities, NaNs, denormals and pseudo-random bit patterns
+ */
+/*--------------------------------------------------------------------------------*/
+static void edgesamples(std::vector<uint8_t>& samples, SampleFormat_t format)
+{
+  uint32_t seed = 0x2545f491;
+  uint_t   bps  = GetBytesPerSample(format);
+  uint_t   i, n;
+
+  samples.clear();
+
+  if (format == SampleFormat_16bit)
+  {
+    for (i = 0; i < 65536; i++)
+    {
+      samples.push_back((uint8_t)i);
+      samples.push_back((uint8_t)(i >> 8));
+    }
+  }
+  else if ((format == SampleFormat_24bit) || (format == SampleFormat_32bit))
+  {
+    std::vector<uint32_t> values;
+    uint_t bits = bps * 8;
+
+    values.push_back(0);
+    for (i = 0; i < bits; i++)
+    {
+      values.push_back(1U << i);
+      values.push_back((1U << i) - 1);
+      values.push_back(~((1U << i) - 1));
+      values.push_back(~(1U << i));
+    }
+    for (i = 0; i < 16384; i++)
+    {
+      seed = seed * 1664525 + 1013904223;
+      values.push_back(seed);
+    }
+
+    for (i = 0; i < values.size(); i++)
+    {
+      for (n = 0; n < bps; n++) samples.push_back((uint8_t)(values[i] >> (n * 8)));
+    }
+  }
+  else if (format == SampleFormat_Float)
+  {
+    static const float specials[] =
+    {
+      0.0f, -0.0f, 1.0f, -1.0f, 1.5f, -1.5f, 2.0f, -2.0f, 1e10f, -1e10f, 1e-40f, -1e-40f, 1e-20f, -1e-20f,
+      1.0f - 1.0f / 16777216.0f, -1.0f + 1.0f / 16777216.0f,
+      (float)INFINITY, -(float)INFINITY, (float)NAN, -(float)NAN,
+    };
+    static const float scales[] = {32768.0f, 8388608.0f, 2147483648.0f};
+    std::vector<float> values(specials, specials + NUMBEROF(specials));
+    uint_t s;
+
+    // either side of and on the rounding ties of each integer format, across and beyond full scale
+    for (s = 0; s < NUMBEROF(scales); s++)
+    {
+      for (i = 0; i < 8192; i++)
+      {
+        float x = ((float)i - 4096.0f) * 0.5f;
+        float y = (x + ((x < 0.0f) ? -scales[s] : scales[s]) * ((float)(i % 3) - 1.0f) * 0.5f) / scales[s];
+
+        values.push_back(x / scales[s]);
+        values.push_back(y);
+        values.push_back(nextafterf(y, 2.0f));
+        values.push_back(nextafterf(y, -2.0f));
+      }
+      values.push_back(1.0f - 0.5f / scales[s]);
+      values.push_back(-1.0f - 0.5f / scales[s]);
+    }
+
+    for (i = 0; i < 16384; i++)
+    {
+      uint32_t bits;
+      float    x;
+
+      seed = seed * 1664525 + 1013904223;
+      bits = seed;
+      memcpy(&x, &bits, sizeof(x));
+      values.push_back(x);
+
+      seed = seed * 1664525 + 1013904223;
+      values.push_back(((float)(seed >> 8) / 8388608.0f - 1.0f) * 1.25f);
+    }
+
+    samples.resize(values.size() * sizeof(float));
+    memcpy(&samples[0], &values[0], samples.size());
+  }
+}
+
+TEST_CASE("sampleconversion_transfersamples")
+{
+  static const SampleFormat_t formats[] = {SampleFormat_16bit, SampleFormat_24bit, SampleFormat_32bit, SampleFormat_Float};
+  const SampleFormat_t planarformat = SampleFormatOf((const Sample_t *)NULL);
+  ConversionKernels_t original = GetConversionKernels();
+  uint_t k, f, test, i;
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+  // ensure NEON kernels are exercised wherever they can be
+  REQUIRE(ConversionKernelsAvailable(ConversionKernels_NEON));
+#endif
+
+  srand(0x7a5f);
+
+  for (k = ConversionKernels_Scalar; k < ConversionKernels_Count; k++)
+  {
+    ConversionKernels_t kernels = (ConversionKernels_t)k;
+
+    if (!SetConversionKernels(kernels)) continue;
+
+    INFO("kernels " << GetConversionKernelsName(kernels));
+
+    // every handled format in both directions
+    for (f = 0; f < (2 * NUMBEROF(formats)); f++)
+    {
+      bool           toformat  = (f >= NUMBEROF(formats));
+      SampleFormat_t format    = formats[f % NUMBEROF(formats)];
+      SampleFormat_t srcformat = toformat ? SampleFormat_Float : format;
+      SampleFormat_t dstformat = toformat ? format : SampleFormat_Float;
+
+      // edge cases, one channel
+      {
+        std::vector<uint8_t> src, dst, ref;
+        uint_t n;
+
+        edgesamples(src, srcformat);
+        n = (uint_t)(src.size() / GetBytesPerSample(srcformat));
+
+        INFO(n << " edge case samples of format " << (uint_t)srcformat << " to format " << (uint_t)dstformat);
+
+        dst.resize(n * GetBytesPerSample(dstformat));
+        ref.resize(dst.size());
+
+        TransferSamples(&src[0], srcformat, false, 0, 1,
+                        &ref[0], dstformat, false, 0, 1,
+                        1, n);
+        ConvertSamples(&src[0], srcformat, false, 0, 1,
+                       &dst[0], dstformat, false, 0, 1,
+                       1, n);
+
+        CHECK(differentsamples(dst, ref, dstformat) == 0);
+      }
+
+      for (test = 0; test < 200; test++)
+      {
+        uint_t nsrcchannels = 1 + rand() % 24;
+        uint_t ndstchannels = 1 + rand() % 24;
+        uint_t srcchannel   = rand() % nsrcchannels;
+        uint_t dstchannel   = rand() % ndstchannels;
+        uint_t nchannels    = (rand() % 4) ? (1 + rand() % 24) : ~0;
+        uint_t nframes      = rand() % 300;
+
+        INFO("test " << test << ": " << nframes << " frames of " << nchannels << " channels from " << srcchannel << "/" << nsrcchannels << " format " << (uint_t)srcformat << " to " << dstchannel << "/" << ndstchannels << " format " << (uint_t)dstformat);
+
+        std::vector<uint8_t> src(nsrcchannels * GetBytesPerSample(srcformat) * std::max(nframes, 1U));
+        std::vector<uint8_t> dst(ndstchannels * GetBytesPerSample(dstformat) * std::max(nframes, 1U));
+        std::vector<uint8_t> ref;
+
+        randomsamples(src, srcformat);
+        randomsamples(dst, dstformat);
+        ref = dst;
+
+        // interleaved
+        TransferSamples(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                        &ref[0], dstformat, false, dstchannel, ndstchannels,
+                        nchannels, nframes);
+        ConvertSamples(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                       &dst[0], dstformat, false, dstchannel, ndstchannels,
+                       nchannels, nframes);
+
+        CHECK(differentsamples(dst, ref, dstformat) == 0);
+
+        if (planarformat != SampleFormat_Float) continue;
+
+        // planar and mapped (unity gain) to and from Sample_t buffers
+        uint_t nplanar = std::min(std::min(nchannels, nsrcchannels - srcchannel), 8U);
+        std::vector<uint8_t>    planar(nplanar * sizeof(Sample_t) * std::max(nframes, 1U));
+        std::vector<uint8_t>    planarref(planar.size());
+        std::vector<Sample_t *> channels(nplanar);
+
+        for (i = 0; i < nplanar; i++) channels[i] = (Sample_t *)&planar[i * nframes * sizeof(Sample_t)];
+
+        if (!toformat)
+        {
+          std::vector<uint8_t>      mapped(planar.size()), mappedref(planar.size());
+          std::vector<CHANNELROUTE> map(std::max(nplanar, 1U));
+
+          for (i = 0; i < nplanar; i++)
+          {
+            TransferSamples(&src[0], srcformat, false, srcchannel + i, nsrcchannels,
+                            &planarref[i * nframes * sizeof(Sample_t)], planarformat, MACHINE_IS_BIG_ENDIAN, 0, 1,
+                            1, nframes);
+          }
+          ConvertSamplesToPlanar(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                                 &channels[0], 0,
+                                 nplanar, nframes);
+
+          CHECK(differentsamples(planar, planarref, planarformat) == 0);
+
+          // reversed channel order
+          for (i = 0; i < nplanar; i++)
+          {
+            map[i].channel = i;
+            map[i].slot    = nplanar - 1 - i;
+            map[i].gain    = 1.0;
+          }
+          for (i = 0; i < nplanar; i++)
+          {
+            TransferSamples(&src[0], srcformat, false, srcchannel + i, nsrcchannels,
+                            &mappedref[0], planarformat, MACHINE_IS_BIG_ENDIAN, nplanar - 1 - i, nplanar,
+                            1, nframes);
+          }
+          ConvertSamplesMapped(&src[0], srcformat, false, srcchannel, nsrcchannels,
+                               (Sample_t *)&mapped[0], nplanar,
+                               &map[0], nplanar,
+                               nsrcchannels - srcchannel, nframes);
+
+          CHECK(differentsamples(mapped, mappedref, planarformat) == 0);
+        }
+        else
+        {
+          std::vector<const Sample_t *> srcchannels(channels.begin(), channels.end());
+          std::vector<uint8_t> out(dst.size()), outref;
+
+          randomsamples(planar, planarformat);
+          randomsamples(out, dstformat);
+          outref = out;
+
+          for (i = 0; i < nplanar; i++)
+          {
+            TransferSamples(channels[i], planarformat, MACHINE_IS_BIG_ENDIAN, 0, 1,
+                            &outref[0], dstformat, false, dstchannel + i, ndstchannels,
+                            (dstchannel + i < ndstchannels) ? 1 : 0, nframes);
+          }
+          ConvertSamplesFromPlanar(&srcchannels[0], 0,
+                                   &out[0], dstformat, false, dstchannel, ndstchannels,
+                                   nplanar, nframes);
+
+          CHECK(differentsamples(out, outref, dstformat) == 0);
+        }
+      }
+    }
+  }
+
+  SetConversionKernels(original);
+}
@@ -0,0 +1,312 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "ADMRIFFFile.h"
+#include "RIFFChunk_Definitions.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+static const uint32_t SampleRate    = 48000;
+static const uint_t   Channels      = 2;
+static const uint_t   BlockFrames   = 100;
+static const uint_t   SegmentFrames = 480;    // 10ms segments
+static const uint64_t TimeReference = 123456789;
+
+/*--------------------------------------------------------------------------------*/
+/** Return sample of test signal (exact in 24 bits)
+ */
+/*--------------------------------------------------------------------------------*/
+static sint32_t testsample(uint64_t frame, uint_t channel)
+{
+  return (sint32_t)((uint32_t)(((frame * Channels + channel) * 2654435761U) & 0xffffff) << 8);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write a block of frames of test signal starting at frame start of the signal
+ */
+/*--------------------------------------------------------------------------------*/
+static bool writeblock(ADMRIFFFile& file, uint64_t start)
+{
+  std::vector<sint32_t> buffer(BlockFrames * Channels);
+  uint_t i, j;
+
+  for (i = 0; i < BlockFrames; i++)
+  {
+    for (j = 0; j < Channels; j++) buffer[i * Channels + j] = testsample(start + i, j);
+  }
+
+  return (file.WriteSamples(&buffer[0], 0, Channels, BlockFrames) == (sint_t)BlockFrames);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Write frames of test signal through a buffer lent by the file
+ *
+ * @param start first frame of test signal
+ * @param frames number of frames to request, updated with the number that can be written
+ *
+ * @return number of frames written or -1 for an error
+ */
+/*--------------------------------------------------------------------------------*/
+static sint_t writelent(ADMRIFFFile& file, uint64_t start, uint_t& frames)
+{
+  uint8_t *buffer;
+  uint_t  i, j;
+
+  if ((buffer = file.GetWriteBuffer(frames)) == NULL) return -1;
+
+  // file is 24-bit little-endian
+  for (i = 0; i < frames; i++)
+  {
+    for (j = 0; j < Channels; j++, buffer += 3)
+    {
+      uint32_t sample = (uint32_t)testsample(start + i, j);
+
+      buffer[0] = (uint8_t)(sample >> 8);
+      buffer[1] = (uint8_t)(sample >> 16);
+      buffer[2] = (uint8_t)(sample >> 24);
+    }
+  }
+
+  return file.CommitWriteBuffer(frames);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read all frames of file and return number of samples that differ from the test signal
+ * starting at frame start of the signal
+ */
+/*--------------------------------------------------------------------------------*/
+static uint64_t checkframes(RIFFFile& file, uint64_t start, uint64_t nframes)
+{
+  std::vector<sint32_t> buffer(nframes * Channels);
+  uint64_t bad = 0, i;
+  uint_t   j;
+
+  if (file.ReadSamples(&buffer[0], 0, Channels, (uint_t)nframes) != (sint_t)nframes) return nframes * Channels;
+
+  for (i = 0; i < nframes; i++)
+  {
+    for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != testsample(start + i, j));
+  }
+
+  return bad;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Wait (for up to 2s) for the segment thread to create the next segment
+ */
+/*--------------------------------------------------------------------------------*/
+static bool waitforsegment(const ADMRIFFFile& file)
+{
+  uint_t i;
+
+  for (i = 0; (i < 2000) && !file.IsNextSegmentReady(); i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  return file.IsNextSegmentReady();
+}
+
+typedef struct
+{
+  std::string filename;
+  uint64_t    startsample;
+  uint64_t    nsamples;
+} SEGMENT;
+
+typedef struct
+{
+  ThreadLockObject     tlock;
+  std::vector<SEGMENT> segments;
+  std::atomic<bool>    blocked;       // true whilst the callback for the first segment is holding up the segment thread
+  std::atomic<bool>    release;       // set to allow the callback for the first segment to return
+} SEGMENTLIST;
+
+/*--------------------------------------------------------------------------------*/
+/** Segment callback: record segment and hold up the segment thread on the first one until
+ * released so that the next segment cannot be created in time
+ */
+/*--------------------------------------------------------------------------------*/
+static void segmentclosed(const std::string& filename, uint64_t startsample, uint64_t nsamples, void *context)
+{
+  SEGMENTLIST& list = *(SEGMENTLIST *)context;
+  SEGMENT segment = {filename, startsample, nsamples};
+  bool first;
+  uint_t i;
+
+  {
+    ThreadLock lock(list.tlock);
+    first = list.segments.empty();
+    list.segments.push_back(segment);
+  }
+
+  if (first)
+  {
+    list.blocked = true;
+    for (i = 0; (i < 5000) && !list.release; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    list.blocked = false;
+  }
+}
+
+TEST_CASE("segmentrollover")
+{
+  static const char *filenames[] = {"segmenttest.wav", "segmenttest-0001.wav", "segmenttest-0002.wav", "segmenttest-0003.wav"};
+  // expected start and length of each segment (the second is extended by the overrun until its successor is ready)
+  static const struct {uint64_t start, length;} expected[] =
+  {
+    {0,    480},
+    {480,  620},
+    {1100, 480},
+    {1580, 120},
+  };
+  ADMRIFFFile::SEGMENTCONFIG config = ADMRIFFFile::GetDefaultSegmentConfig();
+  SEGMENTLIST list;
+  uint64_t pos = 0, total = 0;
+  uint_t   i;
+
+  list.blocked = false;
+  list.release = false;
+
+  config.segmenttime      = (double)SegmentFrames / (double)SampleRate;
+  config.preparetime      = config.segmenttime * 0.5;   // next segment is requested at 240 samples into the current one
+  config.settimereference = true;
+  config.timereference    = TimeReference;
+  config.segmentcallback  = &segmentclosed;
+  config.callbackcontext  = (void *)&list;
+
+  {
+    ADMRIFFFile file;
+
+    file.EnableSegmentedRecording(config);
+    REQUIRE(file.Create(filenames[0], SampleRate, Channels, SampleFormat_24bit));
+
+    // first segment: next segment is requested by the fourth block and switched to within the fifth
+    for (; pos < 400; pos += BlockFrames) REQUIRE(writeblock(file, pos));
+    REQUIRE(waitforsegment(file));
+    REQUIRE(writeblock(file, pos)); pos += BlockFrames;
+    CHECK(file.GetSegmentIndex() == 1);
+    CHECK(file.GetSampleLength() == (pos - 480));
+
+    // wait for the segment thread to be held up closing the first segment
+    for (i = 0; (i < 2000) && !list.blocked; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(list.blocked);
+
+    // second segment: next segment cannot be created so writing continues past the boundary (at 960)
+    for (; pos < 1100; pos += BlockFrames) REQUIRE(writeblock(file, pos));
+    CHECK(file.GetSegmentIndex() == 1);
+    CHECK(file.GetSegmentOverruns() == 1);
+    CHECK(file.GetSampleLength() == (pos - 480));
+
+    // once the next segment is ready, writing switches to it at the start of the next write
+    list.release = true;
+    REQUIRE(waitforsegment(file));
+    REQUIRE(writeblock(file, pos)); pos += BlockFrames;
+    CHECK(file.GetSegmentIndex() == 2);
+    CHECK(file.GetSampleLength() == (pos - 1100));
+
+    // third segment: switched to the fourth at its boundary (at 1580)
+    for (; pos < 1500; pos += BlockFrames) REQUIRE(writeblock(file, pos));
+    REQUIRE(waitforsegment(file));
+    for (; pos < 1700; pos += BlockFrames) REQUIRE(writeblock(file, pos));
+    CHECK(file.GetSegmentIndex() == 3);
+    CHECK(file.GetSegmentOverruns() == 1);
+
+    file.Close();
+  }
+
+  // every segment is reported once, in order, with no gaps or overlaps
+  REQUIRE(list.segments.size() == NUMBEROF(expected));
+  for (i = 0; i < list.segments.size(); i++)
+  {
+    INFO("segment " << i);
+    CHECK(list.segments[i].filename    == filenames[i]);
+    CHECK(list.segments[i].startsample == expected[i].start);
+    CHECK(list.segments[i].nsamples    == expected[i].length);
+    total += list.segments[i].nsamples;
+  }
+  CHECK(total == pos);
+
+  for (i = 0; i < NUMBEROF(expected); i++)
+  {
+    RIFFFile file;
+    RIFFbextChunk *bext;
+
+    INFO("segment " << i);
+    REQUIRE(file.Open(filenames[i]));
+
+    // no samples lost or duplicated at either end of each segment
+    CHECK(file.GetSampleLength() == expected[i].length);
+    CHECK(checkframes(file, expected[i].start, expected[i].length) == 0);
+
+    // TimeReference is that of the first sample of each segment
+    REQUIRE((bext = dynamic_cast<RIFFbextChunk *>(file.GetChunk(bext_ID))) != NULL);
+    CHECK(bext->GetTimeReference() == (TimeReference + expected[i].start));
+    file.Close();
+
+    remove(filenames[i]);
+  }
+}
+
+TEST_CASE("segmentrollover_lent")
+{
+  static const char *filenames[] = {"segmenttest-lent.wav", "segmenttest-lent-0001.wav", "segmenttest-lent-0002.wav", "segmenttest-lent-0003.wav"};
+  static const uint64_t lengths[] = {480, 480, 480, 60};
+  static const uint64_t total = 1500;
+  ADMRIFFFile::SEGMENTCONFIG config = ADMRIFFFile::GetDefaultSegmentConfig();
+  uint64_t pos = 0;
+  uint_t   i;
+
+  config.segmenttime      = (double)SegmentFrames / (double)SampleRate;
+  config.preparetime      = config.segmenttime;   // next segment is requested at the start of the current one
+  config.settimereference = true;
+  config.timereference    = TimeReference;
+
+  {
+    ADMRIFFFile file;
+
+    file.EnableSegmentedRecording(config);
+    REQUIRE(file.Create(filenames[0], SampleRate, Channels, SampleFormat_24bit));
+
+    while (pos < total)
+    {
+      uint_t frames = (uint_t)std::min(total - pos, (uint64_t)300);
+      uint_t requested = frames;
+
+      // switch to the next segment without an overrun
+      if (pos && ((pos % SegmentFrames) == 0)) REQUIRE(waitforsegment(file));
+
+      // lent buffers are limited to the end of the current segment
+      REQUIRE(writelent(file, pos, frames) == (sint_t)frames);
+      CHECK(frames == std::min(requested, SegmentFrames - (uint_t)(pos % SegmentFrames)));
+      pos += frames;
+
+      CHECK(file.GetSegmentIndex() == (uint_t)((pos - 1) / SegmentFrames));
+    }
+
+    CHECK(file.GetSegmentOverruns() == 0);
+    file.Close();
+  }
+
+  for (i = 0, pos = 0; i < NUMBEROF(filenames); pos += lengths[i++])
+  {
+    RIFFFile file;
+    RIFFbextChunk *bext;
+
+    INFO("segment " << i);
+    REQUIRE(file.Open(filenames[i]));
+    CHECK(file.GetSampleLength() == lengths[i]);
+    CHECK(checkframes(file, pos, lengths[i]) == 0);
+    REQUIRE((bext = dynamic_cast<RIFFbextChunk *>(file.GetChunk(bext_ID))) != NULL);
+    CHECK(bext->GetTimeReference() == (TimeReference + pos));
+    file.Close();
+
+    remove(filenames[i]);
+  }
+  CHECK(pos == total);
+}
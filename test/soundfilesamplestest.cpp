@@ -0,0 +1,437 @@
+
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+
+#include <catch/catch.hpp>
+
+#include "SoundFileAttributes.h"
+#include "EDLSoundFileSamples.h"
+#include "MultitrackSoundFileSamples.h"
+#include "ResamplingSoundFileSamples.h"
+
+USE_BBC_AUDIOTOOLBOX
+
+// length of test file
+static const uint_t FileFrames = 1000;
+
+TEST_CASE("soundfilesamples_clip")
+{
+  static const char *filename = "soundfilesamplestest.raw";
+  std::vector<float> samples(FileFrames);
+  SoundFormat        format;
+  SoundFileSamples   file;
+  EnhancedFile       *fp;
+  Sample_t           buffer[256];
+  uint_t             i, bad = 0;
+
+  format.SetSampleRate(48000);
+  format.SetChannels(1);
+  format.SetSampleFormat(SampleFormat_Float);
+
+  // each frame holds its own position (exact in float)
+  for (i = 0; i < FileFrames; i++) samples[i] = (float)i / 65536.0f;
+
+  REQUIRE((fp = new EnhancedFile) != NULL);
+  REQUIRE(fp->fopen(filename, "wb"));
+  fp->fwrite(&samples[0], sizeof(samples[0]), samples.size());
+  fp->fclose();
+  REQUIRE(fp->fopen(filename, "rb"));
+
+  file.SetFormat(&format);
+  file.SetFile(RefCount<EnhancedFile>(fp), 0, samples.size() * sizeof(samples[0]));
+
+  SoundFileSamples::Clip_t clip =
+  {
+    100, 200,
+    0, 1,
+  };
+  file.SetClip(clip);
+
+  // positions are relative to the start of the clip
+  file.SetSamplePosition(10);
+  CHECK(file.GetAbsoluteSamplePosition() == 110);
+
+  // so reads must start at the start of the clip plus the position
+  REQUIRE(file.ReadSamples(buffer, 0, 1, 4) == 4);
+  for (i = 0; i < 4; i++) CHECK(buffer[i] == (Sample_t)(110 + i) / (Sample_t)65536.0);
+  CHECK(file.GetAbsoluteSamplePosition() == 114);
+
+  // and stop at the end of the clip
+  REQUIRE(file.ReadSamples(buffer, 0, 1, 256) == 186);
+  for (i = 0; i < 186; i++) bad += (buffer[i] != (Sample_t)(114 + i) / (Sample_t)65536.0);
+  CHECK(bad == 0);
+  CHECK(file.ReadSamples(buffer, 0, 1, 256) == 0);
+
+  remove(filename);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create raw float file of mono frames, each holding its own position, and return object to read it
+ */
+/*--------------------------------------------------------------------------------*/
+static SoundFileSamples *createrawfile(const char *filename, const SoundFormat *format, uint_t frames)
+{
+  std::vector<float> samples(frames);
+  SoundFileSamples   *file = NULL;
+  EnhancedFile       *fp;
+  uint_t i;
+
+  for (i = 0; i < frames; i++) samples[i] = (float)i / 65536.0f;
+
+  if (((fp = new EnhancedFile) != NULL) && fp->fopen(filename, "wb"))
+  {
+    fp->fwrite(&samples[0], sizeof(samples[0]), samples.size());
+    fp->fclose();
+
+    if (fp->fopen(filename, "rb") && ((file = new SoundFileSamples) != NULL))
+    {
+      file->SetFormat(format);
+      file->SetFile(RefCount<EnhancedFile>(fp), 0, samples.size() * sizeof(samples[0]));
+      fp = NULL;
+    }
+  }
+
+  delete fp;
+
+  return file;
+}
+
+TEST_CASE("soundfilesamples_edl")
+{
+  static const char *filename1 = "soundfilesamplestest1.raw";
+  static const char *filename2 = "soundfilesamplestest2.raw";
+  // source, start (in output samples) and length of each segment
+  static const struct {uint_t source, start, length;} segments[] =
+  {
+    {0, 100, 50},
+    {1, 300, 80},
+    {0, 500, 40},
+    {1, 30,  60},
+    {1, 700, 45},
+  };
+  SoundFormat       format1, format2;
+  SoundFileSamples  *ref;
+  std::vector<Sample_t> resampled, buffer;
+  uint_t            i, j, k, n, total = 0, bad = 0;
+
+  format1.SetSampleRate(48000);
+  format1.SetChannels(1);
+  format1.SetSampleFormat(SampleFormat_Float);
+  format2 = format1;
+  format2.SetSampleRate(32000);
+
+  EDLSoundFileSamples edl(1, 48000);
+  REQUIRE(edl.AddSource(createrawfile(filename1, &format1, FileFrames)) == 0);
+  REQUIRE(edl.AddSource(createrawfile(filename2, &format2, FileFrames)) == 1);
+
+  // expected output of the second source, read continuously from its start
+  REQUIRE((ref = createrawfile(filename2, &format2, FileFrames)) != NULL);
+  ResamplingSoundFileSamples resampler(ref, 48000);
+  resampled.resize(resampler.GetSampleLength());
+  REQUIRE(resampler.ReadSamples(&resampled[0], 0, 1, (uint_t)resampled.size()) == resampled.size());
+
+  // which is a ramp at 2/3 of the slope (away from the edges of the filter)
+  for (i = 100; i < (resampled.size() - 100); i++) bad += (fabs(resampled[i] - (Sample_t)i * (2.0 / 3.0) / 65536.0) > (2.0 / 65536.0));
+  CHECK(bad == 0);
+
+  for (i = 0; i < NUMBEROF(segments); i++)
+  {
+    REQUIRE(edl.AddSegment(segments[i].source, segments[i].start, segments[i].length));
+    total += segments[i].length;
+  }
+  REQUIRE(edl.GetSampleLength() == total);
+
+  // read in blocks that straddle segment boundaries
+  buffer.resize(total);
+  for (n = 0; n < total; n += k)
+  {
+    k = std::min(total - n, 37U);
+    REQUIRE(edl.ReadSamples(&buffer[n], 0, 1, k) == k);
+  }
+  CHECK(edl.ReadSamples(&buffer[0], 0, 1, 1) == 0);
+
+  // each segment must start at its own start within its source
+  for (i = n = 0; i < NUMBEROF(segments); n += segments[i++].length)
+  {
+    INFO("segment " << i);
+
+    for (j = bad = 0; j < segments[i].length; j++)
+    {
+      Sample_t expected = segments[i].source ? resampled[segments[i].start + j] : (Sample_t)(segments[i].start + j) / (Sample_t)65536.0;
+
+      bad += (fabs(buffer[n + j] - expected) > 1.0e-6);
+    }
+    CHECK(bad == 0);
+  }
+
+  // reading from within a segment
+  edl.SetSamplePosition(segments[0].length + 10);
+  REQUIRE(edl.ReadSamples(&buffer[0], 0, 1, 4) == 4);
+  for (j = 0; j < 4; j++) CHECK(fabs(buffer[j] - resampled[segments[1].start + 10 + j]) < 1.0e-6);
+
+  remove(filename1);
+  remove(filename2);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return value of frame of multichannel test file (exact in float)
+ */
+/*--------------------------------------------------------------------------------*/
+static Sample_t multichannelsample(uint_t channel, uint_t frame)
+{
+  return (Sample_t)(channel * 4096 + frame) / (Sample_t)65536.0;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Create raw float file of multichannel frames and return object to read it
+ *
+ * @param firstchannel channel number used for the first channel of the file in each sample
+ */
+/*--------------------------------------------------------------------------------*/
+static SoundFileSamples *createmultichannelfile(const char *filename, const SoundFormat *format, uint_t frames, uint_t firstchannel)
+{
+  std::vector<float> samples(frames * format->GetChannels());
+  SoundFileSamples   *file = NULL;
+  EnhancedFile       *fp;
+  uint_t i, j;
+
+  for (i = 0; i < frames; i++)
+  {
+    for (j = 0; j < format->GetChannels(); j++) samples[i * format->GetChannels() + j] = (float)multichannelsample(firstchannel + j, i);
+  }
+
+  if (((fp = new EnhancedFile) != NULL) && fp->fopen(filename, "wb"))
+  {
+    fp->fwrite(&samples[0], sizeof(samples[0]), samples.size());
+    fp->fclose();
+
+    if (fp->fopen(filename, "rb") && ((file = new SoundFileSamples) != NULL))
+    {
+      file->SetFormat(format);
+      file->SetFile(RefCount<EnhancedFile>(fp), 0, samples.size() * sizeof(samples[0]));
+      fp = NULL;
+    }
+  }
+
+  delete fp;
+
+  return file;
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Return expected value of frame of multitrack test object (the second source is
+ * silent beyond its end)
+ */
+/*--------------------------------------------------------------------------------*/
+static Sample_t multitracksample(uint_t channel, uint_t frame)
+{
+  return ((channel < 2) || (channel >= 5) || (frame < 600)) ? multichannelsample(channel, frame) : 0.0;
+}
+
+TEST_CASE("soundfilesamples_multitrack")
+{
+  static const char *filenames[] = {"multitracktest1.raw", "multitracktest2.raw", "multitracktest3.raw"};
+  // channels and length of each source (the second is shorter than the others)
+  static const struct {uint_t channels, frames;} sourcelist[] =
+  {
+    {2, FileFrames},
+    {3, 600},
+    {1, FileFrames},
+  };
+  static const uint_t Channels = 6;
+  SoundFormat           formats[NUMBEROF(sourcelist)];
+  std::vector<Sample_t> buffer(FileFrames * Channels);
+  MultitrackSoundFileSamples multitrack(48000);
+  uint_t i, j, k, n, channel = 0, bad;
+
+  for (i = 0; i < NUMBEROF(sourcelist); i++)
+  {
+    formats[i].SetSampleRate(48000);
+    formats[i].SetChannels(sourcelist[i].channels);
+    formats[i].SetSampleFormat(SampleFormat_Float);
+
+    REQUIRE(multitrack.AddSource(createmultichannelfile(filenames[i], &formats[i], sourcelist[i].frames, channel)) == channel);
+    channel += sourcelist[i].channels;
+  }
+  REQUIRE(multitrack.GetChannels() == Channels);
+  REQUIRE(multitrack.GetSampleLength() == FileFrames);
+
+  // all channels, in blocks that straddle the end of the shorter source
+  for (n = 0; n < FileFrames; n += k)
+  {
+    k = std::min(FileFrames - n, 37U);
+    REQUIRE(multitrack.ReadSamples(&buffer[n * Channels], 0, Channels, k) == k);
+  }
+  CHECK(multitrack.ReadSamples(&buffer[0], 0, Channels, 1) == 0);
+
+  for (i = bad = 0; i < FileFrames; i++)
+  {
+    for (j = 0; j < Channels; j++) bad += (buffer[i * Channels + j] != multitracksample(j, i));
+  }
+  CHECK(bad == 0);
+
+  // channels spanning the first two sources, over the end of the second
+  multitrack.SetSamplePosition(580);
+  REQUIRE(multitrack.ReadSamples(&buffer[0], 0, 3, 40, 1, 3) == 40);
+  for (i = bad = 0; i < 40; i++)
+  {
+    for (j = 0; j < 3; j++) bad += (buffer[i * 3 + j] != multitracksample(1 + j, 580 + i));
+  }
+  CHECK(bad == 0);
+
+  // planar, skipping a channel
+  {
+    std::vector<Sample_t> planar[Channels];
+    Sample_t *dst[Channels];
+
+    for (j = 0; j < Channels; j++)
+    {
+      planar[j].assign(20, 9.0);
+      dst[j] = (j != 2) ? &planar[j][0] : NULL;
+    }
+
+    multitrack.SetSamplePosition(590);
+    REQUIRE(multitrack.ReadSamplesPlanar(dst, 0, 20) == 20);
+    for (j = bad = 0; j < Channels; j++)
+    {
+      for (i = 0; i < 20; i++) bad += (planar[j][i] != ((j != 2) ? multitracksample(j, 590 + i) : 9.0));
+    }
+    CHECK(bad == 0);
+  }
+
+  // mapped, with two entries for each of the first two slots (the last entry for a slot wins)
+  {
+    static const CHANNELROUTE map[] =
+    {
+      {3, 0, 1.0},
+      {0, 0, 2.0},
+      {4, 1, 1.0},
+      {5, 1, 0.5},
+    };
+
+    std::fill(buffer.begin(), buffer.begin() + 30, 9.0);
+    multitrack.SetSamplePosition(100);
+    REQUIRE(multitrack.ReadSamplesMapped(&buffer[0], 3, 10, map, NUMBEROF(map)) == 10);
+    for (i = bad = 0; i < 10; i++)
+    {
+      bad += (buffer[i * 3 + 0] != (Sample_t)2.0 * multitracksample(0, 100 + i));
+      bad += (buffer[i * 3 + 1] != (Sample_t)0.5 * multitracksample(5, 100 + i));
+      bad += (buffer[i * 3 + 2] != 9.0);
+    }
+    CHECK(bad == 0);
+  }
+
+  for (i = 0; i < NUMBEROF(filenames); i++) remove(filenames[i]);
+}
+
+/*--------------------------------------------------------------------------------*/
+/** Read frames of a channel from transposed cache and return number of samples that
+ * differ from those of the multichannel test file
+ */
+/*--------------------------------------------------------------------------------*/
+static uint_t checkcachedchannel(TransposedCache& cache, uint_t channel, uint_t firstchannel, uint_t frame, uint_t nframes)
+{
+  std::vector<float> samples(nframes);
+  uint_t i, bad = 0;
+
+  if (!cache.ReadChannel(channel, frame, nframes, (uint8_t *)&samples[0])) return nframes;
+
+  for (i = 0; i < nframes; i++) bad += (samples[i] != (float)multichannelsample(firstchannel + channel, frame + i));
+
+  return bad;
+}
+
+TEST_CASE("soundfilesamples_transposedcache")
+{
+  static const char *filename = "transposedcachetest.raw";
+  static const uint_t Channels = 16;
+  std::vector<Sample_t> buffer(FileFrames * Channels);
+  std::string      cachefilename;
+  SoundFormat      format;
+  SoundFileSamples *file;
+  EnhancedFile     fp;
+  uint_t           i, j, bad;
+
+  format.SetSampleRate(48000);
+  format.SetChannels(Channels);
+  format.SetSampleFormat(SampleFormat_Float);
+
+  // blocks of 300 frames, so the last block is short (100 frames)
+  TransposedCache cache(300);
+  cache.SetAutoBuild(false);
+
+  REQUIRE((file = createmultichannelfile(filename, &format, FileFrames, 0)) != NULL);
+  REQUIRE(file->UseTransposedCache(&cache));
+  CHECK(cache.GetState() == TransposedCache::State_Missing);
+  cachefilename = cache.GetCacheFilename();
+  CHECK(cachefilename == TransposedCache::GetDefaultCacheFilename(filename));
+
+  // not used until built
+  CHECK(!cache.UseFor(1));
+  CHECK(cache.GetState() == TransposedCache::State_Missing);
+
+  REQUIRE(cache.Build());
+  CHECK(cache.IsReady());
+
+  // only used for reads of up to 1/8 of the channels by default
+  CHECK(!cache.UseFor(0));
+  CHECK(cache.UseFor(1));
+  CHECK(cache.UseFor(2));
+  CHECK(!cache.UseFor(3));
+  cache.SetChannelFraction(.5);
+  CHECK(cache.UseFor(8));
+  CHECK(!cache.UseFor(9));
+  // and never for reads of every channel
+  cache.SetChannelFraction(1.0);
+  CHECK(cache.UseFor(Channels - 1));
+  CHECK(!cache.UseFor(Channels));
+  cache.SetChannelFraction(.125);
+
+  // reads within a block, across blocks and into the short last block
+  CHECK(checkcachedchannel(cache, 0, 0, 10, 100) == 0);
+  CHECK(checkcachedchannel(cache, 5, 0, 250, FileFrames - 250) == 0);
+  CHECK(checkcachedchannel(cache, Channels - 1, 0, 900, 100) == 0);
+  CHECK(checkcachedchannel(cache, Channels - 1, 0, 950, 50) == 0);
+
+  // reads beyond the end fail
+  {
+    std::vector<float> samples(20);
+    CHECK(!cache.ReadChannel(0, FileFrames - 10, 20, (uint8_t *)&samples[0]));
+    CHECK(!cache.ReadChannel(Channels, 0, 20, (uint8_t *)&samples[0]));
+  }
+
+  // reads of a few channels through the sound file object, into the short last block
+  file->SetSamplePosition(850);
+  REQUIRE(file->ReadSamples(&buffer[0], 0, 2, 150, 3, 2) == 150);
+  for (i = bad = 0; i < 150; i++)
+  {
+    for (j = 0; j < 2; j++) bad += (buffer[i * 2 + j] != multichannelsample(3 + j, 850 + i));
+  }
+  CHECK(bad == 0);
+
+  cache.Close();
+  delete file;
+
+  // change the sound file (different samples and trailing data after them)
+  REQUIRE((file = createmultichannelfile(filename, &format, FileFrames, 100)) != NULL);
+  REQUIRE(fp.fopen(filename, "ab"));
+  fp.fwrite("junk", 1, 4);
+  fp.fclose();
+
+  // the existing sidecar no longer matches and is ignored
+  REQUIRE(file->UseTransposedCache(&cache));
+  CHECK(cache.GetState() == TransposedCache::State_Missing);
+  CHECK(!cache.UseFor(1));
+
+  // until rebuilt from the new samples
+  REQUIRE(cache.Build());
+  CHECK(checkcachedchannel(cache, 5, 100, 0, FileFrames) == 0);
+
+  cache.Close();
+  delete file;
+
+  remove(filename);
+  remove(cachefilename.c_str());
+}